@@ -0,0 +1,585 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Parallel batch scanner and the index format, see batch.h
+ *
+ * Binary index layout, all integers little endian:
+ *  header: "SNSYINDX" u32 version
+ *  region: 'R' u32 name_sz, name, u64 base, u64 size, u32 window,
+ *          u8 truncated, u64 n_entropy, n_entropy bytes,
+ *          u64 n_hits, n_hits * (u64 ofs, u32 len, u16 id, u8 kind)
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "ptnmatch.h"
+#include "detect.h"
+#include "batch.h"
+
+#define BATCH_MAGIC "SNSYINDX"
+#define BATCH_VERSION 1
+
+/* below this many windows per worker the thread setup costs more than the
+ * work itself, so small inputs end up on fewer threads */
+#define BATCH_MINWINDOWS 64
+
+/* sanity limits for loading */
+#define BATCH_MAXNAME 4096
+#define BATCH_HITSZ 15
+
+struct batch_job {
+	struct batch_opts* opts;
+	const uint8_t* buf;
+	size_t lo, hi, end, window;
+	uint64_t base;
+
+	const double* lut;
+	uint8_t* entropy;
+
+	struct batch_hit* hits;
+	size_t n_hits, cap, limit;
+	bool truncated, failed;
+	pthread_t pth;
+};
+
+bool batch_addpattern(struct batch_opts* opts, const char* hexlist)
+{
+	size_t count = 1;
+	for (const char* c = hexlist; *c; c++)
+		count += *c == ',';
+
+	uint8_t* ptn = malloc(count);
+	if (!ptn)
+		return false;
+
+	const char* cur = hexlist;
+	for (size_t i = 0; i < count; i++){
+		char* end;
+		unsigned long v = strtoul(cur, &end, 16);
+		if (end == cur || v > 0xff || (*end != ',' && *end != '\0')){
+			free(ptn);
+			return false;
+		}
+		ptn[i] = v;
+		cur = end + 1;
+	}
+
+	uint8_t** ptns = realloc(opts->ptns, sizeof(uint8_t*) * (opts->n_ptns + 1));
+	if (!ptns){
+		free(ptn);
+		return false;
+	}
+	opts->ptns = ptns;
+
+	size_t* ptn_sz = realloc(opts->ptn_sz, sizeof(size_t) * (opts->n_ptns + 1));
+	if (!ptn_sz){
+		free(ptn);
+		return false;
+	}
+	opts->ptn_sz = ptn_sz;
+
+	opts->ptns[opts->n_ptns] = ptn;
+	opts->ptn_sz[opts->n_ptns++] = count;
+	ptn_match_free(&opts->matcher);
+	return true;
+}
+
+bool batch_prepare(struct batch_opts* opts)
+{
+	if (!opts->window)
+		opts->window = BATCH_DEFWINDOW;
+	if (opts->window > BATCH_MAXWINDOW)
+		opts->window = BATCH_MAXWINDOW;
+	if (!opts->hit_limit)
+		opts->hit_limit = BATCH_DEFHITS;
+
+	if (opts->matcher)
+		return true;
+
+	size_t n = opts->n_ptns + (opts->no_detect ? 0 : detect_sigs_n);
+	opts->overlap = 0;
+	if (!n)
+		return true;
+
+	uint8_t* bufs[n];
+	size_t sizes[n];
+	for (size_t i = 0; i < opts->n_ptns; i++){
+		bufs[i] = opts->ptns[i];
+		sizes[i] = opts->ptn_sz[i];
+	}
+	for (size_t i = opts->n_ptns; i < n; i++){
+		bufs[i] = (uint8_t*) detect_sigs[i - opts->n_ptns].buf;
+		sizes[i] = detect_sigs[i - opts->n_ptns].used;
+	}
+
+	opts->matcher = ptn_match_build(bufs, sizes, n);
+	if (!opts->matcher)
+		return false;
+
+	opts->overlap = ptn_match_maxlen(opts->matcher);
+	if (!opts->no_detect && opts->overlap < detect_lookahead)
+		opts->overlap = detect_lookahead;
+
+	return true;
+}
+
+void batch_region_init(struct batch_region* dst,
+	const char* name, uint64_t base, size_t window)
+{
+	if (!window)
+		window = BATCH_DEFWINDOW;
+
+	*dst = (struct batch_region){
+		.name = strdup(name ? name : ""),
+		.base = base,
+		.window = window > BATCH_MAXWINDOW ? BATCH_MAXWINDOW : window
+	};
+}
+
+static bool add_hit(struct batch_job* job, struct batch_hit hit)
+{
+	if (job->n_hits >= job->limit){
+		job->truncated = true;
+		return false;
+	}
+
+	if (job->n_hits == job->cap){
+		size_t ncap = job->cap ? job->cap * 2 : 256;
+		struct batch_hit* hits = realloc(job->hits, sizeof(struct batch_hit) * ncap);
+		if (!hits){
+			job->failed = true;
+			return false;
+		}
+		job->hits = hits;
+		job->cap = ncap;
+	}
+
+	job->hits[job->n_hits++] = hit;
+	return true;
+}
+
+/* [end] is relative to job->lo, where the scan for the job starts */
+static void job_hit(void* tag, size_t ind, size_t end)
+{
+	struct batch_job* job = tag;
+	struct batch_opts* opts = job->opts;
+	bool is_ptn = ind < opts->n_ptns;
+	size_t len = is_ptn ?
+		opts->ptn_sz[ind] : detect_sigs[ind - opts->n_ptns].used;
+	size_t ofs = job->lo + end + 1 - len;
+
+/* matches that start in the overlap belong to the next job */
+	if (ofs >= job->hi)
+		return;
+
+	if (!is_ptn){
+		const struct detect_sig* sig = &detect_sigs[ind - opts->n_ptns];
+		if (sig->valid && !sig->valid(&job->buf[ofs], job->end - ofs))
+			return;
+		ind -= opts->n_ptns;
+	}
+
+	add_hit(job, (struct batch_hit){
+		.ofs = job->base + ofs,
+		.len = len,
+		.id = ind,
+		.kind = is_ptn ? BATCH_PATTERN : BATCH_DETECT
+	});
+}
+
+static void* job_run(void* arg)
+{
+	struct batch_job* job = arg;
+	size_t window = job->window;
+	uint32_t hgram[256];
+
+/* entropy for each window that starts in [lo, hi) */
+	for (size_t i = job->lo, j = 0; i < job->hi; i += window, j++){
+		size_t n = job->hi - i > window ? window : job->hi - i;
+		double sum = 0;
+		memset(hgram, '\0', sizeof(hgram));
+
+		for (size_t k = 0; k < n; k++)
+			hgram[job->buf[i + k]]++;
+
+		for (size_t k = 0; k < 256; k++)
+			sum += job->lut[hgram[k]];
+
+		double ent = log2((double)n) - sum / (double)n;
+		ent = ent < 0.0 ? 0.0 : (ent > 8.0 ? 8.0 : ent);
+		job->entropy[j] = (uint8_t)(255.0 * ent / 8.0);
+	}
+
+	if (job->opts->matcher){
+		size_t lim = job->hi + ptn_match_maxlen(job->opts->matcher) - 1;
+		if (lim > job->end)
+			lim = job->end;
+
+		uint32_t state = 0;
+		ptn_match_scan(job->opts->matcher, &state,
+			&job->buf[job->lo], lim - job->lo, job_hit, job);
+	}
+
+	return NULL;
+}
+
+static unsigned job_count(struct batch_opts* opts, size_t n_windows)
+{
+	long nt = opts->threads;
+	if (!nt)
+		nt = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nt <= 0)
+		nt = 1;
+
+	size_t lim = n_windows / BATCH_MINWINDOWS;
+	if ((size_t)nt > lim)
+		nt = lim ? lim : 1;
+
+	return nt;
+}
+
+bool batch_scan(struct batch_opts* opts, struct batch_region* dst,
+	const uint8_t* buf, size_t sz, size_t tail)
+{
+	if (!sz)
+		return true;
+
+	if (!batch_prepare(opts))
+		return false;
+
+	size_t window = dst->window;
+	size_t n_windows = (sz + window - 1) / window;
+	uint8_t* entropy = realloc(dst->entropy, dst->n_entropy + n_windows);
+	if (!entropy)
+		return false;
+	dst->entropy = entropy;
+
+	double* lut = malloc(sizeof(double) * (window + 1));
+	if (!lut)
+		return false;
+	for (size_t i = 0; i <= window; i++)
+		lut[i] = i ? (double)i * log2((double)i) : 0.0;
+
+	unsigned nt = job_count(opts, n_windows);
+	struct batch_job jobs[nt];
+	size_t per_job = (n_windows + nt - 1) / nt;
+	size_t left = opts->hit_limit > dst->n_hits ? opts->hit_limit - dst->n_hits : 0;
+
+	for (size_t i = 0; i < nt; i++){
+		size_t lo = i * per_job * window;
+		size_t hi = lo + per_job * window;
+		jobs[i] = (struct batch_job){
+			.opts = opts,
+			.buf = buf,
+			.lo = lo > sz ? sz : lo,
+			.hi = hi > sz ? sz : hi,
+			.end = sz + tail,
+			.window = window,
+			.base = dst->base + dst->size,
+			.lut = lut,
+			.entropy = &dst->entropy[dst->n_entropy + i * per_job],
+			.limit = left
+		};
+	}
+
+/* the calling thread takes the first job */
+	size_t started = 1;
+	for (; started < nt; started++)
+		if (0 != pthread_create(&jobs[started].pth, NULL, job_run, &jobs[started]))
+			break;
+
+	job_run(&jobs[0]);
+	for (size_t i = started; i < nt; i++)
+		job_run(&jobs[i]);
+	for (size_t i = 1; i < started; i++)
+		pthread_join(jobs[i].pth, NULL);
+
+	free(lut);
+	dst->n_entropy += n_windows;
+	dst->size += sz;
+
+/* jobs cover consecutive ranges, so merging in job order keeps the hits
+ * sorted the same way a single pass would */
+	bool ok = true;
+	for (size_t i = 0; i < nt; i++){
+		struct batch_job* job = &jobs[i];
+		ok = ok && !job->failed;
+		dst->truncated |= job->truncated;
+
+		size_t n = job->n_hits;
+		if (n > left){
+			n = left;
+			dst->truncated = true;
+		}
+
+		if (n && ok){
+			if (dst->n_hits + n > dst->hit_cap){
+				size_t ncap = dst->n_hits + n;
+				struct batch_hit* hits = realloc(dst->hits, sizeof(struct batch_hit) * ncap);
+				if (hits){
+					dst->hits = hits;
+					dst->hit_cap = ncap;
+				}
+				else
+					ok = false;
+			}
+			if (ok){
+				memcpy(&dst->hits[dst->n_hits], job->hits, sizeof(struct batch_hit) * n);
+				dst->n_hits += n;
+				left -= n;
+			}
+		}
+		free(job->hits);
+	}
+
+	return ok;
+}
+
+const char* batch_hit_name(struct batch_opts* opts, const struct batch_hit* hit)
+{
+	if (hit->kind == BATCH_DETECT && hit->id < detect_sigs_n)
+		return detect_sigs[hit->id].ident;
+
+	return "pattern";
+}
+
+static bool wr_le(FILE* fout, uint64_t v, size_t n)
+{
+	uint8_t buf[8];
+	for (size_t i = 0; i < n; i++, v >>= 8)
+		buf[i] = v & 0xff;
+	return fwrite(buf, n, 1, fout) == 1;
+}
+
+static bool rd_le(FILE* fin, uint64_t* v, size_t n)
+{
+	uint8_t buf[8];
+	if (fread(buf, n, 1, fin) != 1)
+		return false;
+
+	*v = 0;
+	for (size_t i = n; i > 0; i--)
+		*v = (*v << 8) | buf[i-1];
+	return true;
+}
+
+static void json_str(FILE* fout, const char* str)
+{
+	fputc('"', fout);
+	for (; *str; str++){
+		unsigned char c = *str;
+		if (c == '"' || c == '\\')
+			fprintf(fout, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fout, "\\u%04x", c);
+		else
+			fputc(c, fout);
+	}
+	fputc('"', fout);
+}
+
+bool batch_write_header(FILE* fout, enum batch_fmt fmt)
+{
+	if (fmt == BATCH_JSONL)
+		return true;
+
+	return fwrite(BATCH_MAGIC, 8, 1, fout) == 1 && wr_le(fout, BATCH_VERSION, 4);
+}
+
+/* entropy values per line, keeps lines reasonable for large regions */
+#define JSON_ENTLINE 4096
+
+static bool write_jsonl(FILE* fout,
+	struct batch_opts* opts, const struct batch_region* reg)
+{
+	fputs("{\"region\":", fout);
+	json_str(fout, reg->name);
+	fprintf(fout, ",\"base\":%"PRIu64",\"size\":%"PRIu64",\"window\":%zu,"
+		"\"hits\":%zu,\"truncated\":%s}\n", reg->base, reg->size, reg->window,
+		reg->n_hits, reg->truncated ? "true" : "false");
+
+	for (size_t i = 0; i < reg->n_entropy; i += JSON_ENTLINE){
+		fprintf(fout, "{\"entropy\":%"PRIu64",\"values\":[",
+			reg->base + (uint64_t) i * reg->window);
+		size_t n = reg->n_entropy - i > JSON_ENTLINE ? JSON_ENTLINE : reg->n_entropy - i;
+		for (size_t j = 0; j < n; j++)
+			fprintf(fout, j ? ",%d" : "%d", reg->entropy[i + j]);
+		fputs("]}\n", fout);
+	}
+
+	for (size_t i = 0; i < reg->n_hits; i++){
+		const struct batch_hit* hit = &reg->hits[i];
+		fprintf(fout, "{\"hit\":%"PRIu64",\"len\":%"PRIu32",\"kind\":\"%s\","
+			"\"id\":%d,\"name\":\"%s\"}\n", hit->ofs, hit->len,
+			hit->kind == BATCH_DETECT ? "detect" : "pattern",
+			(int) hit->id, batch_hit_name(opts, hit));
+	}
+
+	return !ferror(fout);
+}
+
+bool batch_write(FILE* fout, enum batch_fmt fmt,
+	struct batch_opts* opts, const struct batch_region* reg)
+{
+	if (fmt == BATCH_JSONL)
+		return write_jsonl(fout, opts, reg);
+
+	size_t name_sz = strlen(reg->name);
+	bool ok = fputc('R', fout) != EOF &&
+		wr_le(fout, name_sz, 4) &&
+		fwrite(reg->name, 1, name_sz, fout) == name_sz &&
+		wr_le(fout, reg->base, 8) &&
+		wr_le(fout, reg->size, 8) &&
+		wr_le(fout, reg->window, 4) &&
+		wr_le(fout, reg->truncated, 1) &&
+		wr_le(fout, reg->n_entropy, 8) &&
+		fwrite(reg->entropy, 1, reg->n_entropy, fout) == reg->n_entropy &&
+		wr_le(fout, reg->n_hits, 8);
+
+	for (size_t i = 0; i < reg->n_hits && ok; i++){
+		ok = wr_le(fout, reg->hits[i].ofs, 8) &&
+			wr_le(fout, reg->hits[i].len, 4) &&
+			wr_le(fout, reg->hits[i].id, 2) &&
+			wr_le(fout, reg->hits[i].kind, 1);
+	}
+
+	return ok;
+}
+
+static bool load_region(FILE* fin, struct batch_region* dst, size_t left)
+{
+	uint64_t name_sz, window, trunc, n;
+	*dst = (struct batch_region){0};
+
+	if (!rd_le(fin, &name_sz, 4) || name_sz > BATCH_MAXNAME)
+		return false;
+
+	dst->name = malloc(name_sz + 1);
+	if (!dst->name || (name_sz && fread(dst->name, name_sz, 1, fin) != 1))
+		return false;
+	dst->name[name_sz] = '\0';
+
+	if (!rd_le(fin, &dst->base, 8) || !rd_le(fin, &dst->size, 8) ||
+		!rd_le(fin, &window, 4) || !rd_le(fin, &trunc, 1) || !window)
+		return false;
+	dst->window = window;
+	dst->truncated = trunc != 0;
+
+/* the counts have to match the header and fit in what is left of the file */
+	if (!rd_le(fin, &n, 8) || n != (dst->size + window - 1) / window || n > left)
+		return false;
+
+	dst->entropy = malloc(n ? n : 1);
+	if (!dst->entropy || (n && fread(dst->entropy, n, 1, fin) != 1))
+		return false;
+	dst->n_entropy = n;
+
+	if (!rd_le(fin, &n, 8) || n > left / BATCH_HITSZ)
+		return false;
+
+	dst->hits = malloc(sizeof(struct batch_hit) * (n ? n : 1));
+	if (!dst->hits)
+		return false;
+
+	for (size_t i = 0; i < n; i++){
+		uint64_t ofs, len, id, kind;
+		if (!rd_le(fin, &ofs, 8) || !rd_le(fin, &len, 4) ||
+			!rd_le(fin, &id, 2) || !rd_le(fin, &kind, 1))
+			return false;
+
+		dst->hits[i] = (struct batch_hit){
+			.ofs = ofs, .len = len, .id = id, .kind = kind
+		};
+	}
+	dst->n_hits = dst->hit_cap = n;
+
+	return true;
+}
+
+struct batch_region* batch_load(const char* path, size_t* n_regions)
+{
+	FILE* fin = fopen(path, "r");
+	if (!fin)
+		return NULL;
+
+	char magic[8];
+	uint64_t version;
+	if (fread(magic, 8, 1, fin) != 1 || memcmp(magic, BATCH_MAGIC, 8) != 0 ||
+		!rd_le(fin, &version, 4) || version != BATCH_VERSION){
+		fclose(fin);
+		return NULL;
+	}
+
+	fseek(fin, 0, SEEK_END);
+	long fsz = ftell(fin);
+	fseek(fin, 12, SEEK_SET);
+
+	struct batch_region* res = NULL;
+	size_t count = 0;
+	int tag;
+
+	while ((tag = fgetc(fin)) == 'R'){
+		struct batch_region* nr = realloc(res, sizeof(struct batch_region) * (count + 1));
+		if (!nr)
+			break;
+		res = nr;
+
+		long pos = ftell(fin);
+		if (!load_region(fin, &res[count], fsz > pos ? fsz - pos : 0)){
+			batch_region_free(&res[count]);
+			break;
+		}
+		count++;
+	}
+
+/* anything but a clean end means the index is damaged */
+	bool ok = tag == EOF && !ferror(fin);
+	fclose(fin);
+
+	if (!ok){
+		for (size_t i = 0; i < count; i++)
+			batch_region_free(&res[i]);
+		free(res);
+		return NULL;
+	}
+
+/* an index without regions is still valid */
+	*n_regions = count;
+	return res ? res : calloc(1, sizeof(struct batch_region));
+}
+
+struct batch_region* batch_find(
+	struct batch_region* set, size_t n_regions, const char* name)
+{
+	for (size_t i = 0; i < n_regions; i++)
+		if (strcmp(set[i].name, name) == 0)
+			return &set[i];
+
+	return NULL;
+}
+
+void batch_region_free(struct batch_region* reg)
+{
+	free(reg->name);
+	free(reg->entropy);
+	free(reg->hits);
+	*reg = (struct batch_region){0};
+}
+
+void batch_opts_free(struct batch_opts* opts)
+{
+	for (size_t i = 0; i < opts->n_ptns; i++)
+		free(opts->ptns[i]);
+	free(opts->ptns);
+	free(opts->ptn_sz);
+	ptn_match_free(&opts->matcher);
+	*opts = (struct batch_opts){0};
+}
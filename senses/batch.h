@@ -0,0 +1,121 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Headless batch analysis. A sensor that runs without an arcan
+ * connection sweeps its input with batch_scan, which splits the buffer over
+ * all cores and computes per-window entropy (same scale as the rwstat
+ * entropy alpha), matches a set of patterns and runs the detect.h signature
+ * validators. The results are kept per region (a file or a mapping) and can
+ * be written as a compact binary index or as JSON lines, and the binary
+ * index can be loaded again so that an interactive session starts with the
+ * analysis already done.
+ */
+
+#ifndef HAVE_BATCH
+#define HAVE_BATCH
+
+enum batch_fmt {
+	BATCH_BINARY = 0,
+	BATCH_JSONL = 1
+};
+
+enum batch_kind {
+	BATCH_PATTERN = 0, /* id is the index in batch_opts patterns */
+	BATCH_DETECT = 1   /* id is the index in detect_sigs         */
+};
+
+struct batch_hit {
+	uint64_t ofs; /* absolute, region base included */
+	uint32_t len;
+	uint16_t id;
+	uint8_t kind;
+};
+
+struct batch_region {
+	char* name;
+	uint64_t base, size;
+	size_t window;
+
+/* one value per window, 255 * shannon entropy / 8 */
+	uint8_t* entropy;
+	size_t n_entropy;
+
+/* in the order the signatures end, truncated is set if hit_limit was hit */
+	struct batch_hit* hits;
+	size_t n_hits, hit_cap;
+	bool truncated;
+};
+
+struct batch_opts {
+	size_t window;     /* bytes per entropy value, 0: BATCH_DEFWINDOW,
+	                      clamped to BATCH_MAXWINDOW */
+	unsigned threads;  /* 0: one per online core */
+	size_t hit_limit;  /* per region, 0: BATCH_DEFHITS */
+	bool no_detect;
+
+	uint8_t** ptns;
+	size_t* ptn_sz;
+	size_t n_ptns;
+
+/* built on the first scan, covers both the patterns and detect_sigs */
+	struct ptn_match* matcher;
+	size_t overlap;
+};
+
+#define BATCH_DEFWINDOW 1024
+#define BATCH_MAXWINDOW (1024 * 1024)
+#define BATCH_DEFHITS (1024 * 1024)
+
+/*
+ * Add a pattern in the same format as the rwstat "val" argument, comma
+ * separated hex byte values (e.g. 4d,5a,90). Returns false on a malformed
+ * sequence.
+ */
+bool batch_addpattern(struct batch_opts*, const char* hexlist);
+
+/*
+ * Prepare [dst] for a source called [name] that starts at [base].
+ */
+void batch_region_init(struct batch_region* dst,
+	const char* name, uint64_t base, size_t window);
+
+/*
+ * Scan [sz] bytes that follow what has already been scanned into [dst].
+ * [tail] bytes past [sz] must be readable and are only used to complete
+ * matches that start inside [sz], so a large source can be fed in chunks
+ * that overlap with opts->overlap bytes (available after the first call
+ * or batch_prepare). [sz] has to be a multiple of the window size for
+ * every chunk but the last. Returns false on allocation failure.
+ */
+bool batch_scan(struct batch_opts*, struct batch_region* dst,
+	const uint8_t* buf, size_t sz, size_t tail);
+
+/* build the matcher ahead of the first scan, sets opts->overlap */
+bool batch_prepare(struct batch_opts*);
+
+/* name of the pattern or signature behind [hit] */
+const char* batch_hit_name(struct batch_opts*, const struct batch_hit* hit);
+
+/*
+ * Write the index header (binary only, call once before the regions) and
+ * then one region at a time.
+ */
+bool batch_write_header(FILE*, enum batch_fmt);
+bool batch_write(FILE*, enum batch_fmt,
+	struct batch_opts*, const struct batch_region*);
+
+/*
+ * Load every region from a binary index, returns NULL if the file could not
+ * be read or isn't an index.
+ */
+struct batch_region* batch_load(const char* path, size_t* n_regions);
+
+/* region by name, NULL if it isn't in the set */
+struct batch_region* batch_find(
+	struct batch_region* set, size_t n_regions, const char* name);
+
+void batch_region_free(struct batch_region*);
+void batch_opts_free(struct batch_opts*);
+
+#endif
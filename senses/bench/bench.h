@@ -0,0 +1,57 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Shared parts of the senseye_bench harness. The benchmarks run
+ * against a headless, in-memory shmif segment (bench_shmif.c) so that no arcan
+ * instance is needed, and report one JSON object per case on stdout.
+ */
+
+struct bench_input {
+	const char* name;
+	uint8_t* buf;
+	size_t sz;
+};
+
+/* collected per-frame times for one case, in microseconds */
+struct bench_stat {
+	double* samples;
+	size_t count, limit;
+	uint64_t bytes;
+	double total;
+};
+
+/* monotonic time in seconds */
+double bench_now();
+
+/* add the time since [start], returns false if the sample couldn't be kept */
+bool bench_sample(struct bench_stat*, double start, size_t bytes);
+
+/*
+ * print the case as one line of JSON: throughput, frame time percentiles
+ * and [extra] (already formatted "key":value pairs, or NULL). Resets [st].
+ */
+void bench_report(struct bench_stat* st,
+	const char* bench, const char* kase, const char* input, const char* extra);
+
+/*
+ * Headless segment, vidp is w*h and pitch is w. Signal and enqueue only
+ * count, the counters are reset on bench_segment.
+ */
+struct arcan_shmif_cont bench_segment(size_t w, size_t h);
+void bench_segment_free(struct arcan_shmif_cont*);
+size_t bench_signals();
+size_t bench_events();
+
+/* xlt_supp and sense_mfile internals, see bench_xlt.c and bench_mfile.c */
+void bench_unpack(uint8_t* outb, const shmif_pixel* px, size_t n, size_t pack);
+
+struct ent;
+struct ent* bench_mfile_ents(struct bench_input* in, size_t n);
+void bench_mfile_setup();
+void bench_mfile_tiles(struct arcan_shmif_cont*,
+	struct ent*, size_t n, size_t base, int pack, size_t pos);
+void bench_mfile_diff(struct arcan_shmif_cont*,
+	struct ent*, size_t n, size_t base, int pack, size_t pos);
+size_t bench_mfile_packsz(int pack);
+extern const char* bench_mfile_packs[];
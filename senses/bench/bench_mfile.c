@@ -0,0 +1,59 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Pulls in sense_mfile (minus its main) so that the bench can
+ * render tiles and comparison tiles from in-memory inputs.
+ */
+#define main mfile_main
+#include "sense_mfile.c"
+#undef main
+
+#include "bench.h"
+
+const char* bench_mfile_packs[] = {
+	"intens",
+	"tight",
+	"tnoalpha",
+	NULL
+};
+
+struct ent* bench_mfile_ents(struct bench_input* in, size_t n)
+{
+	struct ent* res = malloc(sizeof(struct ent) * n);
+	if (!res)
+		return NULL;
+
+	memset(res, '\0', sizeof(struct ent) * n);
+	for (size_t i = 0; i < n; i++){
+		res[i].map = in[i].buf;
+		res[i].map_sz = in[i].sz;
+		res[i].fd = -1;
+		res[i].arg = in[i].name;
+	}
+
+	return res;
+}
+
+void bench_mfile_setup()
+{
+	setup_kernels();
+	pool_setup();
+}
+
+size_t bench_mfile_packsz(int pack)
+{
+	return pack_szlut[pack];
+}
+
+void bench_mfile_tiles(struct arcan_shmif_cont* dst,
+	struct ent* ents, size_t n, size_t base, int pack, size_t pos)
+{
+	refresh_data(dst, ents, n, base, pack, pos, 1);
+}
+
+void bench_mfile_diff(struct arcan_shmif_cont* dst,
+	struct ent* ents, size_t n, size_t base, int pack, size_t pos)
+{
+	refresh_diff(dst, ents, n, base, pack, pos);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Headless stand-in for the parts of arcan_shmif that the
+ * benchmarked paths use. A segment is just a page and a pixel buffer in
+ * memory, signalling and event queueing are counted and otherwise ignored,
+ * nothing can connect. The bench is linked against this instead of the real
+ * shmif library.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <arcan_shmif.h>
+
+#include "bench.h"
+
+static size_t n_signals;
+static size_t n_events;
+
+struct arcan_shmif_cont bench_segment(size_t w, size_t h)
+{
+	struct arcan_shmif_cont res = {0};
+	res.addr = malloc(sizeof(struct arcan_shmif_page));
+	if (!res.addr || !arcan_shmif_resize(&res, w, h)){
+		free(res.addr);
+		return (struct arcan_shmif_cont){0};
+	}
+
+	memset(res.addr, '\0', sizeof(struct arcan_shmif_page));
+	res.addr->w = w;
+	res.addr->h = h;
+	res.epipe = -1;
+
+	n_signals = n_events = 0;
+	return res;
+}
+
+void bench_segment_free(struct arcan_shmif_cont* cont)
+{
+	free(cont->vidp);
+	free(cont->addr);
+	*cont = (struct arcan_shmif_cont){0};
+}
+
+size_t bench_signals()
+{
+	return n_signals;
+}
+
+size_t bench_events()
+{
+	return n_events;
+}
+
+bool arcan_shmif_resize(struct arcan_shmif_cont* cont,
+	unsigned width, unsigned height)
+{
+	if (!width || !height ||
+		width > PP_SHMPAGE_MAXW || height > PP_SHMPAGE_MAXH)
+		return false;
+
+	shmif_pixel* vidp = realloc(cont->vidp,
+		(size_t) width * height * sizeof(shmif_pixel));
+	if (!vidp)
+		return false;
+
+	memset(vidp, '\0', (size_t) width * height * sizeof(shmif_pixel));
+	cont->vidp = vidp;
+	cont->w = width;
+	cont->h = height;
+	cont->pitch = width;
+	cont->stride = width * sizeof(shmif_pixel);
+	return true;
+}
+
+unsigned arcan_shmif_signal(
+	struct arcan_shmif_cont* cont, enum arcan_shmif_sigmask mask)
+{
+	n_signals++;
+	return 0;
+}
+
+int arcan_shmif_enqueue(
+	struct arcan_shmif_cont* cont, const struct arcan_event* const ev)
+{
+	n_events++;
+	return 1;
+}
+
+int arcan_shmif_poll(struct arcan_shmif_cont* cont, struct arcan_event* dst)
+{
+	return 0;
+}
+
+int arcan_shmif_wait(struct arcan_shmif_cont* cont, struct arcan_event* dst)
+{
+	return 0;
+}
+
+struct arcan_shmif_cont arcan_shmif_open(
+	enum ARCAN_SEGID type, enum ARCAN_FLAGS flags, struct arg_arr** args)
+{
+	if (args)
+		*args = NULL;
+	return (struct arcan_shmif_cont){0};
+}
+
+struct arcan_shmif_cont arcan_shmif_acquire(struct arcan_shmif_cont* parent,
+	const char* shmkey, int type, int flags)
+{
+	return (struct arcan_shmif_cont){0};
+}
+
+void arcan_shmif_drop(struct arcan_shmif_cont* cont)
+{
+	bench_segment_free(cont);
+}
+
+bool arg_lookup(struct arg_arr* arr,
+	const char* val, unsigned short ind, const char** found)
+{
+	return false;
+}
@@ -0,0 +1,14 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Pulls in xlt_supp so that the bench can reach the unpacking
+ * stage that translators run on every new frame.
+ */
+#include "xlt_supp.c"
+#include "bench.h"
+
+void bench_unpack(uint8_t* outb, const shmif_pixel* px, size_t n, size_t pack)
+{
+	unpack_pixels(outb, px, n, pack);
+}
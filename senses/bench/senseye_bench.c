@@ -0,0 +1,567 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Throughput benchmarks for the hot paths, runnable without an
+ * arcan instance. Covers rwstat (every clock, mapping, packing and alpha
+ * mode, base size and pattern count), xlt_supp unpacking, memif copies and
+ * sense_mfile tile rendering, over the tests/ corpora and a synthetic input.
+ * Every case is printed as one JSON object per line so that results can be
+ * collected and compared between releases.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <limits.h>
+
+#include <arcan_shmif.h>
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "rwstat.h"
+#ifndef BENCH_NO_MEMIF
+#include "memif.h"
+#endif
+#include "bench.h"
+
+#ifndef BENCH_CORPUS
+#define BENCH_CORPUS "tests"
+#endif
+
+#define COUNT_OF(X) (sizeof(X)/sizeof(X[0]))
+#define MAX_INPUTS 16
+
+static struct {
+	size_t case_bytes;
+	size_t min_frames;
+	size_t synth_sz;
+	const char* filter;
+	struct bench_input inputs[MAX_INPUTS];
+	size_t n_inputs;
+} opts = {
+	.case_bytes = 1 * 1024 * 1024,
+	.min_frames = 4,
+	.synth_sz = 64 * 1024 * 1024
+};
+
+static const char* clk_names[] = {"block", "slide"};
+static const char* map_names[] = {"wrap", "tuple", "tuple_acc", "hilbert"};
+static const char* pack_names[] = {"tight", "tnoalpha", "intens"};
+static const char* alpha_names[] = {"full", "ptn", "delta", "entbase"};
+static const size_t bases[] = {32, 64, 128, 256, 512, 1024};
+static const size_t ptn_counts[] = {0, 1, 16, 256};
+
+/* fixed seed, the same synthetic input and patterns on every run */
+static uint64_t prng_state = 0x5e45e7e5e45e7e5eULL;
+static uint64_t prng()
+{
+	uint64_t x = prng_state;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return (prng_state = x);
+}
+
+double bench_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1000000000.0;
+}
+
+bool bench_sample(struct bench_stat* st, double start, size_t bytes)
+{
+	double dt = bench_now() - start;
+	st->total += dt;
+	st->bytes += bytes;
+
+	if (st->count == st->limit){
+		size_t nl = st->limit ? st->limit * 2 : 1024;
+		double* ns = realloc(st->samples, nl * sizeof(double));
+		if (!ns)
+			return false;
+		st->samples = ns;
+		st->limit = nl;
+	}
+
+	st->samples[st->count++] = dt * 1000000.0;
+	return true;
+}
+
+static int cmp_sample(const void* a, const void* b)
+{
+	double da = *(const double*) a, db = *(const double*) b;
+	return da < db ? -1 : da > db;
+}
+
+/* nearest-rank */
+static double pct(struct bench_stat* st, double p)
+{
+	if (!st->count)
+		return 0;
+
+	size_t ind = (size_t)(p * (double)st->count + 0.999999);
+	ind = ind ? ind - 1 : 0;
+	return st->samples[ind < st->count ? ind : st->count - 1];
+}
+
+void bench_report(struct bench_stat* st,
+	const char* bench, const char* kase, const char* input, const char* extra)
+{
+	qsort(st->samples, st->count, sizeof(double), cmp_sample);
+	double mbs = st->total > 0 ? (double)st->bytes / st->total / 1000000.0 : 0;
+
+	printf("{\"bench\":\"%s\",\"case\":\"%s\",\"input\":\"%s\","
+		"\"bytes\":%"PRIu64",\"seconds\":%.6f,\"mb_s\":%.2f,\"frames\":%zu,"
+		"\"p50_us\":%.2f,\"p90_us\":%.2f,\"p99_us\":%.2f,\"max_us\":%.2f%s%s}\n",
+		bench, kase, input, st->bytes, st->total, mbs, st->count,
+		pct(st, 0.5), pct(st, 0.9), pct(st, 0.99), pct(st, 1.0),
+		extra ? "," : "", extra ? extra : ""
+	);
+	fflush(stdout);
+
+	st->count = 0;
+	st->bytes = 0;
+	st->total = 0;
+}
+
+static bool selected(const char* bench, const char* kase)
+{
+	if (!opts.filter)
+		return true;
+
+	char buf[256];
+	snprintf(buf, sizeof(buf), "%s %s", bench, kase);
+	return strstr(buf, opts.filter) != NULL;
+}
+
+/* amount of input to push through a case with frames of [frame] bytes */
+static size_t case_budget(size_t frame)
+{
+	size_t min = frame * opts.min_frames;
+	return opts.case_bytes > min ? opts.case_bytes : min;
+}
+
+/* patterns are picked from the input itself so that they actually match */
+static void add_patterns(struct rwstat_ch* ch, struct bench_input* in, size_t n)
+{
+	for (size_t i = 0; i < n; i++){
+		size_t len = 4 + prng() % 5;
+		if (in->sz < len)
+			return;
+
+		uint8_t* buf = malloc(len);
+		if (!buf)
+			return;
+
+		memcpy(buf, &in->buf[prng() % (in->sz - len + 1)], len);
+		ch->add_pattern(ch, 0x80 + i % 0x80, i, FLAG_EVENT, buf, len);
+	}
+}
+
+/*
+ * One sample per data() call. In block clock that is a frame worth of input,
+ * in slide clock it is a row, as the slide sensors step by a row at a time
+ * and every row results in a frame.
+ */
+static void bench_rwstat(struct bench_input* in, struct bench_stat* st)
+{
+	for (size_t clk = 0; clk < COUNT_OF(clk_names); clk++)
+	for (size_t map = 0; map < COUNT_OF(map_names); map++)
+	for (size_t pack = 0; pack < COUNT_OF(pack_names); pack++)
+	for (size_t alpha = 0; alpha < COUNT_OF(alpha_names); alpha++)
+	for (size_t bi = 0; bi < COUNT_OF(bases); bi++)
+	for (size_t pi = 0; pi < COUNT_OF(ptn_counts); pi++){
+		char kase[128];
+		snprintf(kase, sizeof(kase),
+			"clock=%s map=%s pack=%s alpha=%s base=%zu patterns=%zu",
+			clk_names[clk], map_names[map], pack_names[pack],
+			alpha_names[alpha], bases[bi], ptn_counts[pi]);
+
+		if (!selected("rwstat", kase))
+			continue;
+
+		struct arcan_shmif_cont seg = bench_segment(bases[bi], bases[bi]);
+		if (!seg.addr){
+			fprintf(stderr, "rwstat: couldn't allocate %zu segment\n", bases[bi]);
+			continue;
+		}
+
+		struct rwstat_ch* ch = rwstat_addch(clk, map, pack, bases[bi], &seg);
+		if (!ch){
+			bench_segment_free(&seg);
+			continue;
+		}
+
+		ch->switch_mapping(ch, map);
+		ch->switch_packing(ch, pack);
+		ch->switch_alpha(ch, alpha);
+		add_patterns(ch, in, ptn_counts[pi]);
+
+		size_t row = ch->row_size(ch);
+		size_t frame = row * ch->base(ch);
+		size_t step = clk == RW_CLK_SLIDE ? row : frame;
+		size_t pos = 0, left = case_budget(step);
+		size_t base_signals = bench_signals(), base_events = bench_events();
+
+		while (left){
+			size_t n = step < left ? step : left;
+			if (n > in->sz - pos)
+				n = in->sz - pos;
+
+			int fs = 0;
+			double start = bench_now();
+			size_t nw = ch->data(ch, &in->buf[pos], n, &fs);
+			bench_sample(st, start, nw);
+
+			if (!nw)
+				break;
+
+			left -= nw;
+			pos = pos + nw == in->sz ? 0 : pos + nw;
+		}
+
+		char extra[64];
+		snprintf(extra, sizeof(extra), "\"signals\":%zu,\"events\":%zu",
+			bench_signals() - base_signals, bench_events() - base_events);
+		bench_report(st, "rwstat", kase, in->name, extra);
+
+		ch->free(&ch);
+		bench_segment_free(&seg);
+	}
+}
+
+/* the translator side, a frame of packed pixels back into bytes */
+static void bench_xlt(struct bench_input* in, struct bench_stat* st)
+{
+	static const size_t packs[] = {1, 3};
+
+	for (size_t bi = 0; bi < COUNT_OF(bases); bi++)
+	for (size_t pi = 0; pi < COUNT_OF(packs); pi++){
+		char kase[64];
+		snprintf(kase, sizeof(kase), "unpack base=%zu pack_sz=%zu",
+			bases[bi], packs[pi]);
+
+		if (!selected("xlt_supp", kase) || in->sz < 4)
+			continue;
+
+		size_t npx = bases[bi] * bases[bi];
+		shmif_pixel* px = malloc(npx * sizeof(shmif_pixel));
+		uint8_t* outb = malloc(npx * 3);
+		if (!px || !outb){
+			free(px);
+			free(outb);
+			continue;
+		}
+
+		for (size_t i = 0; i < npx; i++){
+			const uint8_t* src = &in->buf[(i * 4) % (in->sz - in->sz % 4)];
+			px[i] = SHMIF_RGBA(src[0], src[1], src[2], 0xff);
+		}
+
+		size_t frame = npx * packs[pi];
+		for (size_t left = case_budget(frame); left > 0;){
+			double start = bench_now();
+			bench_unpack(outb, px, npx, packs[pi]);
+			bench_sample(st, start, frame);
+			left = left > frame ? left - frame : 0;
+		}
+
+		bench_report(st, "xlt_supp", kase, in->name, NULL);
+		free(px);
+		free(outb);
+	}
+}
+
+#ifndef BENCH_NO_MEMIF
+#define MEMIF_BATCH 8
+
+/* reads from our own heap, through the same interface sense_mem uses */
+static void bench_memif(struct bench_input* in, struct bench_stat* st)
+{
+	static const size_t windows[] = {4096, 65536, 1024 * 1024};
+
+	struct map_descr ent = {
+		.addr = (uintptr_t) in->buf,
+		.endaddr = (uintptr_t) in->buf + in->sz,
+		.sz = in->sz,
+		.perm = "rw-p"
+	};
+
+	struct map_ctx* maps[MEMIF_BATCH] = {NULL};
+	for (size_t i = 0; i < MEMIF_BATCH; i++)
+		if (!(maps[i] = memif_openmapping(getpid(), &ent))){
+			fprintf(stderr, "memif: couldn't open own mapping\n");
+			goto out;
+		}
+
+	for (size_t wi = 0; wi < COUNT_OF(windows); wi++)
+	for (size_t batch = 1; batch <= MEMIF_BATCH; batch *= MEMIF_BATCH){
+		char kase[64];
+		snprintf(kase, sizeof(kase), "%s window=%zu",
+			batch > 1 ? "copyv" : "copy", windows[wi]);
+
+		size_t win = windows[wi] < in->sz ? windows[wi] : in->sz;
+		if (!selected("memif", kase) || !win)
+			continue;
+
+		uint8_t* bufs[MEMIF_BATCH];
+		size_t sizes[MEMIF_BATCH];
+		uint8_t* store = malloc(win * batch);
+		if (!store)
+			continue;
+
+		for (size_t i = 0; i < batch; i++){
+			bufs[i] = &store[i * win];
+			memif_reset(maps[i]);
+		}
+
+		for (size_t left = case_budget(win * batch); left > 0;){
+			for (size_t i = 0; i < batch; i++){
+				sizes[i] = win;
+				if (memif_seek(maps[i], 0, SEEK_CUR) + win > in->sz)
+					memif_reset(maps[i]);
+			}
+
+			double start = bench_now();
+			size_t nr = batch > 1 ?
+				memif_copyv(maps, bufs, sizes, batch) :
+				memif_copy(maps[0], bufs[0], win);
+			bench_sample(st, start, nr);
+
+			if (!nr)
+				break;
+			left = left > nr ? left - nr : 0;
+		}
+
+		bench_report(st, "memif", kase, in->name, NULL);
+		free(store);
+	}
+
+out:
+	for (size_t i = 0; i < MEMIF_BATCH; i++)
+		memif_closemapping(maps[i]);
+}
+#endif
+
+/* one frame of side-by-side tiles over every input, then the diff tile */
+static void bench_mfile(struct bench_stat* st)
+{
+	static const size_t mbases[] = {64, 128, 256, 512};
+
+	struct ent* ents = bench_mfile_ents(opts.inputs, opts.n_inputs);
+	if (!ents)
+		return;
+
+	size_t min_sz = SIZE_MAX;
+	for (size_t i = 0; i < opts.n_inputs; i++)
+		if (opts.inputs[i].sz < min_sz)
+			min_sz = opts.inputs[i].sz;
+
+	bench_mfile_setup();
+
+	for (size_t diff = 0; diff < 2; diff++)
+	for (size_t bi = 0; bi < COUNT_OF(mbases); bi++)
+	for (size_t pack = 0; bench_mfile_packs[pack]; pack++){
+		char kase[64];
+		size_t base = mbases[bi];
+		snprintf(kase, sizeof(kase), "%s base=%zu pack=%s tiles=%zu",
+			diff ? "diff" : "tiles", base, bench_mfile_packs[pack], opts.n_inputs);
+
+		if (!selected("mfile", kase))
+			continue;
+
+		struct arcan_shmif_cont seg = diff ?
+			bench_segment(base, base) :
+			bench_segment((base + 1) * opts.n_inputs, base + 1);
+		if (!seg.addr)
+			continue;
+
+		size_t frame = base * base * bench_mfile_packsz(pack);
+		size_t pos = 0;
+
+		for (size_t left = case_budget(frame * opts.n_inputs); left > 0;){
+			double start = bench_now();
+			if (diff)
+				bench_mfile_diff(&seg, ents, opts.n_inputs, base, pack, pos);
+			else
+				bench_mfile_tiles(&seg, ents, opts.n_inputs, base, pack, pos);
+			bench_sample(st, start, frame * opts.n_inputs);
+
+			left = left > frame * opts.n_inputs ? left - frame * opts.n_inputs : 0;
+			pos = pos + frame >= min_sz ? 0 : pos + frame;
+		}
+
+		bench_report(st, "mfile", kase, "all", NULL);
+		bench_segment_free(&seg);
+	}
+
+	free(ents);
+}
+
+static bool add_input(const char* name, uint8_t* buf, size_t sz)
+{
+	if (opts.n_inputs == MAX_INPUTS || !sz){
+		free(buf);
+		return false;
+	}
+
+	opts.inputs[opts.n_inputs++] = (struct bench_input){
+		.name = name,
+		.buf = buf,
+		.sz = sz
+	};
+	return true;
+}
+
+static bool load_file(const char* dir, const char* name)
+{
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+	int fd = open(path, O_RDONLY);
+	struct stat fs;
+	if (-1 == fd || -1 == fstat(fd, &fs) || !S_ISREG(fs.st_mode)){
+		fprintf(stderr, "couldn't open %s\n", path);
+		if (fd != -1)
+			close(fd);
+		return false;
+	}
+
+	uint8_t* buf = malloc(fs.st_size);
+	size_t ofs = 0;
+	while (buf && ofs < fs.st_size){
+		ssize_t nr = read(fd, &buf[ofs], fs.st_size - ofs);
+		if (nr <= 0 && errno != EINTR)
+			break;
+		ofs += nr > 0 ? nr : 0;
+	}
+
+	close(fd);
+	return add_input(strdup(name), buf, ofs);
+}
+
+static int cmp_name(const void* a, const void* b)
+{
+	return strcmp(*(char* const*) a, *(char* const*) b);
+}
+
+/* every .bin in the corpus directory, in name order */
+static void load_corpus(const char* path)
+{
+	DIR* dir = opendir(path);
+	if (!dir){
+		fprintf(stderr, "couldn't open corpus %s, %s\n", path, strerror(errno));
+		return;
+	}
+
+	char* names[MAX_INPUTS];
+	size_t count = 0;
+	struct dirent* dent;
+	while (count < MAX_INPUTS - 1 && (dent = readdir(dir))){
+		size_t len = strlen(dent->d_name);
+		if (len > 4 && strcmp(&dent->d_name[len - 4], ".bin") == 0)
+			names[count++] = strdup(dent->d_name);
+	}
+	closedir(dir);
+
+	qsort(names, count, sizeof(char*), cmp_name);
+	for (size_t i = 0; i < count; i++){
+		load_file(path, names[i]);
+		free(names[i]);
+	}
+}
+
+/* alternating noise and low-entropy runs, closer to real data than either */
+static void add_synthetic(size_t sz)
+{
+	uint8_t* buf = malloc(sz);
+	if (!buf)
+		return;
+
+	for (size_t ofs = 0; ofs < sz; ofs += 8){
+		uint64_t v = prng();
+		if ((ofs >> 16) & 1)
+			v &= 0x0f0f0f0f0f0f0f0fULL;
+		memcpy(&buf[ofs], &v, sz - ofs < 8 ? sz - ofs : 8);
+	}
+
+	add_input("synthetic", buf, sz);
+}
+
+static int usage()
+{
+	const char* const argp[] = {
+		"-c dir", "corpus directory, default: " BENCH_CORPUS,
+		"-s mb", "synthetic input size (0 to disable), default: 64",
+		"-b kb", "input per case, at least 4 frames, default: 1024",
+		"-f str", "only run cases where 'bench case' contains str",
+		"-?", "this text"
+	};
+
+	printf("Usage: senseye_bench [options]\n");
+	for (size_t i = 0; i < COUNT_OF(argp); i+=2)
+		printf("%-15s %s\n", argp[i], argp[i+1]);
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* corpus = BENCH_CORPUS;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "c:s:b:f:?")) >= 0)
+	switch(ch){
+	case 'c':
+		corpus = optarg;
+	break;
+	case 's':
+		opts.synth_sz = strtoul(optarg, NULL, 10) * 1024 * 1024;
+	break;
+	case 'b':
+		opts.case_bytes = strtoul(optarg, NULL, 10) * 1024;
+	break;
+	case 'f':
+		opts.filter = optarg;
+	break;
+	default:
+		return usage();
+	}
+
+	load_corpus(corpus);
+	if (opts.synth_sz)
+		add_synthetic(opts.synth_sz);
+
+	if (!opts.n_inputs){
+		fprintf(stderr, "no inputs, see -c and -s\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("{\"bench\":\"meta\",\"ncpu\":%ld,\"case_bytes\":%zu,"
+		"\"min_frames\":%zu,\"inputs\":%zu}\n", sysconf(_SC_NPROCESSORS_ONLN),
+		opts.case_bytes, opts.min_frames, opts.n_inputs);
+
+	struct bench_stat st = {0};
+	for (size_t i = 0; i < opts.n_inputs; i++){
+		bench_rwstat(&opts.inputs[i], &st);
+		bench_xlt(&opts.inputs[i], &st);
+#ifndef BENCH_NO_MEMIF
+		bench_memif(&opts.inputs[i], &st);
+#endif
+	}
+	bench_mfile(&st);
+
+	free(st.samples);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,152 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Signature validators, see detect.h
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "detect.h"
+
+static inline uint32_t rd_le16(const uint8_t* buf)
+{
+	return buf[0] | (buf[1] << 8);
+}
+
+static inline uint32_t rd_le32(const uint8_t* buf)
+{
+	return rd_le16(buf) | (rd_le16(&buf[2]) << 16);
+}
+
+static inline uint32_t rd_be32(const uint8_t* buf)
+{
+	return ((uint32_t)buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+}
+
+/* logical screen descriptor, both dimensions present */
+bool detect_gif(const uint8_t* buf, size_t buf_sz)
+{
+	return buf_sz >= 13 && rd_le16(&buf[6]) && rd_le16(&buf[8]);
+}
+
+/* the first chunk has to be a well-formed IHDR */
+bool detect_png(const uint8_t* buf, size_t buf_sz)
+{
+	if (buf_sz < 29 || rd_be32(&buf[8]) != 13 || memcmp(&buf[12], "IHDR", 4))
+		return false;
+
+	uint32_t w = rd_be32(&buf[16]);
+	uint32_t h = rd_be32(&buf[20]);
+	uint8_t depth = buf[24];
+	uint8_t type = buf[25];
+
+	return w && h && w <= INT32_MAX && h <= INT32_MAX &&
+		(depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16) &&
+		(type == 0 || type == 2 || type == 3 || type == 4 || type == 6) &&
+		buf[26] == 0 && buf[27] == 0 && buf[28] <= 1;
+}
+
+/* SOI has to be followed by a marker that can start a stream, with a length */
+bool detect_jpeg(const uint8_t* buf, size_t buf_sz)
+{
+	if (buf_sz < 6 || buf[2] != 0xff)
+		return false;
+
+	uint8_t m = buf[3];
+	bool marker = (m >= 0xe0 && m <= 0xef) || m == 0xdb || m == 0xc4 ||
+		m == 0xdd || m == 0xfe || (m >= 0xc0 && m <= 0xcf && m != 0xc8 && m != 0xcc);
+
+	return marker && ((buf[4] << 8) | buf[5]) >= 2;
+}
+
+/* known DIB header sizes and a pixel offset past the headers */
+bool detect_bmp(const uint8_t* buf, size_t buf_sz)
+{
+	if (buf_sz < 26)
+		return false;
+
+	uint32_t hsz = rd_le32(&buf[14]);
+	if (hsz != 12 && hsz != 40 && hsz != 52 &&
+		hsz != 56 && hsz != 108 && hsz != 124)
+		return false;
+
+	return rd_le32(&buf[10]) >= 14 + hsz && rd_le32(&buf[2]) >= 14 + hsz;
+}
+
+/*
+ * DOS header is 64 bytes with e_lfanew at 0x3c, the COFF header that it
+ * points to is 24 bytes including the signature and is directly followed
+ * by the optional header magic
+ */
+#define PE_DOSHDR 64
+#define PE_COFFHDR 24
+
+bool detect_pe(const uint8_t* buf, size_t buf_sz)
+{
+	if (buf_sz < PE_DOSHDR)
+		return false;
+
+	size_t lfanew = rd_le32(&buf[0x3c]);
+	if (lfanew < PE_DOSHDR || lfanew > buf_sz ||
+		buf_sz - lfanew < PE_COFFHDR + 2)
+		return false;
+
+	if (memcmp(&buf[lfanew], "PE\0\0", 4) != 0)
+		return false;
+
+	uint32_t magic = rd_le16(&buf[lfanew + PE_COFFHDR]);
+	return magic == 0x10b || magic == 0x20b;
+}
+
+const struct detect_sig detect_sigs[] = {
+	{
+		.ident = "GIF87",
+		.kind = DETECT_IMAGE,
+		.buf = {0x47, 0x49, 0x46, 0x38, 0x37, 0x61},
+		.used = 6,
+		.valid = detect_gif
+	},
+	{
+		.ident = "GIF89",
+		.kind = DETECT_IMAGE,
+		.buf = {0x47, 0x49, 0x46, 0x38, 0x39, 0x61},
+		.used = 6,
+		.valid = detect_gif
+	},
+	{
+		.ident = "PNG",
+		.kind = DETECT_IMAGE,
+		.buf = {0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a},
+		.used = 8,
+		.valid = detect_png
+	},
+	{
+		.ident = "JPEG",
+		.kind = DETECT_IMAGE,
+		.buf = {0xff, 0xd8},
+		.used = 2,
+		.valid = detect_jpeg
+	},
+	{
+		.ident = "BMP",
+		.kind = DETECT_IMAGE,
+		.buf = {0x42, 0x4d},
+		.used = 2,
+		.valid = detect_bmp
+	},
+	{
+		.ident = "PE",
+		.kind = DETECT_EXECUTABLE,
+		.buf = {0x4d, 0x5a},
+		.used = 2,
+		.valid = detect_pe
+	}
+};
+
+const size_t detect_sigs_n = sizeof(detect_sigs) / sizeof(detect_sigs[0]);
+
+/* e_lfanew is rarely past the first page */
+const size_t detect_lookahead = 4096;
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Signature validators shared between the translators and the
+ * batch scanner. Each takes the buffer from the first byte of the signature
+ * onwards and returns true if the header that should follow makes sense.
+ */
+
+#ifndef HAVE_DETECT
+#define HAVE_DETECT
+
+bool detect_gif(const uint8_t* buf, size_t buf_sz);
+bool detect_png(const uint8_t* buf, size_t buf_sz);
+bool detect_jpeg(const uint8_t* buf, size_t buf_sz);
+bool detect_bmp(const uint8_t* buf, size_t buf_sz);
+
+/*
+ * 'MZ' followed by a DOS header where e_lfanew points to a 'PE\0\0' COFF
+ * header with a PE32 or PE32+ optional header, the same checks xlt_pefile
+ * does before it starts on the section table.
+ */
+bool detect_pe(const uint8_t* buf, size_t buf_sz);
+
+enum detect_kind {
+	DETECT_IMAGE = 0,
+	DETECT_EXECUTABLE = 1
+};
+
+struct detect_sig {
+	const char* ident;
+	enum detect_kind kind;
+	uint8_t buf[8];
+	size_t used;
+	bool (*valid)(const uint8_t* buf, size_t buf_sz);
+};
+
+/*
+ * Every signature the validators above cover, [detect_lookahead] is the
+ * number of bytes from the start of a signature that the validators may
+ * need to see in order to accept it.
+ */
+extern const struct detect_sig detect_sigs[];
+extern const size_t detect_sigs_n;
+extern const size_t detect_lookahead;
+
+#endif
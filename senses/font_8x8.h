@@ -179,6 +179,48 @@ static bool draw_box(struct arcan_shmif_cont* c, uint16_t x, uint16_t y,
 	return true;
 }
 
+/*
+ * copy a prerendered [w] * [h] block of packed rows to [x, y], used for
+ * cells that repeat (glyph atlases), clipped to the surface like draw_box
+ */
+static inline void draw_block(struct arcan_shmif_cont* c, uint16_t x,
+	uint16_t y, uint16_t w, uint16_t h, const shmif_pixel* src)
+{
+	if (x >= c->w || y >= c->h)
+		return;
+
+	size_t uw = x + w > c->w ? c->w - x : w;
+	size_t uh = y + h > c->h ? c->h - y : h;
+
+	for (size_t cy = 0; cy < uh; cy++)
+		memcpy(&c->vidp[(y + cy) * c->pitch + x],
+			&src[cy * w], uw * sizeof(shmif_pixel));
+}
+
+/*
+ * grow the dirty region of [c] to cover [x, y, w, h], clipped to the
+ * surface, for partial redraws with SHMIF_RHINT_SUBREGION. Start from an
+ * inverted region (x1 > x2) that gets filled in as cells are drawn.
+ */
+static inline void dirty_box(struct arcan_shmif_cont* c,
+	size_t x, size_t y, size_t w, size_t h)
+{
+	size_t x2 = x + w > c->w ? c->w : x + w;
+	size_t y2 = y + h > c->h ? c->h : y + h;
+
+	if (x >= x2 || y >= y2)
+		return;
+
+	if (x < c->dirty.x1)
+		c->dirty.x1 = x;
+	if (y < c->dirty.y1)
+		c->dirty.y1 = y;
+	if (x2 > c->dirty.x2)
+		c->dirty.x2 = x2;
+	if (y2 > c->dirty.y2)
+		c->dirty.y2 = y2;
+}
+
 static inline void draw_char(struct arcan_shmif_cont* c, uint8_t ch,
 	uint16_t x, uint16_t y, shmif_pixel txcol)
 {
@@ -62,8 +62,20 @@ struct senseye_ch {
 /* Return the number of bytes currently consumed in the window */
 	size_t (*size)(struct senseye_ch*);
 
+/* Sampling policy for data, at frame granularity: forward one frame in
+ * every [nth], at most [fps] frames per second and, with [burst] set, the
+ * frame a pattern matched in along with the [burst]-1 that follow. 0 turns
+ * the respective part off, with all three off (default) every byte is
+ * forwarded. Frames that are not forwarded never wait for the UI but still
+ * count towards the stream offset. */
+	void (*sample)(struct senseye_ch*, unsigned nth, float fps, unsigned burst);
+
+/* Skip [n] bytes of the stream that will never be provided, the frame in
+ * progress is finished with cleared bytes and later frames are offset past
+ * the skipped part. Returns the new stream offset or -1. */
+	off_t (*seek)(struct senseye_ch*, long long n);
+
 /* little need to manipulate these manually, but provided for advanced use */
-	off_t (*seek)(struct senseye_ch*, long long);
 	void (*queue)(struct senseye_ch*, struct arcan_event*);
 	struct rwstat_ch* in;
 	struct senseye_priv* in_pr;
@@ -125,6 +137,30 @@ struct senseye_ch* senseye_open(
 struct senseye_ch* senseye_update_identity(
 	struct senseye_cont* cont, const char* const ident);
 
+/*
+ * Instead of a thread blocking on every data window, a channel can be
+ * handed to a small pool of threads shared by all channels in the process.
+ * [step] is invoked whenever the event handle of the channel (in_handle) or
+ * [fd] (may be -1) is readable, and once right away. It should handle what
+ * is pending without waiting for more and return false when the channel is
+ * finished, [done] is then called (from the same thread) to release it.
+ * A channel is never stepped from two threads at the same time.
+ */
+typedef bool (*senseye_step)(struct senseye_ch*, void* tag);
+typedef void (*senseye_done)(struct senseye_ch*, void* tag);
+
+bool senseye_schedule(struct senseye_ch*,
+	int fd, senseye_step step, senseye_done done, void* tag);
+
+/*
+ * Sample buffers for channels, taken from a shared pool of power-of-two
+ * size classes so that windows that come and go (or get resized) reuse
+ * each others memory. [sz] is rounded up to the usable size. Contents are
+ * undefined. Release with the size that was returned.
+ */
+uint8_t* senseye_buffer(size_t* sz);
+void senseye_buffer_release(uint8_t* buf, size_t sz);
+
 /*
  * Indicate that the primary connection accepts a certain specialized input
  * See shmif_tuisym for list of valid symbols. Note that it's an arcan
@@ -181,7 +217,11 @@ typedef bool (*xlt_input)(struct arcan_shmif_cont* out, arcan_event* ev);
 enum xlt_flags {
 	XLT_NONE = 0,
 	XLT_DYNSIZE = 1,
-	XLT_FORKABLE = 2
+	XLT_FORKABLE = 2,
+
+/* populate / overlay never modify [buf], with 4 byte packing it can then
+ * point into the input segment instead of a private copy of the frame */
+	XLT_INPLACE = 4
 };
 
 /*
@@ -213,6 +253,22 @@ void xlt_config(struct xlt_context*,
 void xlt_ofs_coord(struct xlt_session* sess,
 	size_t ofs, size_t* x, size_t* y);
 
+/*
+ * Request a new populate pass for the session that [out] (the segment
+ * handed to populate) belongs to. Safe to call from other threads, meant
+ * for translators that finish work asynchronously. Repeated calls before
+ * the session gets to it collapse into one pass.
+ */
+void xlt_wake(struct arcan_shmif_cont* out);
+
+/*
+ * Hash [sz] bytes from [buf] for translators that cache parsed or decoded
+ * results by content. Only meant as a cache key, a word at a time with a
+ * final mix is enough and keeps the lookup cheap compared to the work it
+ * replaces.
+ */
+uint64_t xlt_hash(const uint8_t* buf, size_t sz);
+
 /*
  * pump the context event loop manually, will flush and then
  * return true as soon as possible. Returns false on a dead or
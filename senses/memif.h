@@ -14,6 +14,9 @@ struct map_descr {
 	size_t sz;
 	char perm[6];
  	char device[16];
+
+/* set if the entry passed the FILTER_READ probe */
+	bool readable;
 };
 
 enum memif_filter {
@@ -32,6 +35,16 @@ enum memif_filter {
 struct map_descr* memif_mapdescr(PROCESS_ID pid,
 	size_t min_sz, enum memif_filter filt, size_t* count);
 
+/*
+ * refresh a mapping table previously returned from memif_mapdescr (or NULL)
+ * in place. Entries that are unchanged since the last refresh are kept, as is
+ * their probe result, so only new or changed ones are tested for >filter<.
+ * [*cache] may be reallocated. Returns true if the table changed, on failure
+ * the table is released and *cache set to NULL.
+ */
+bool memif_mapupdate(PROCESS_ID pid, size_t min_sz,
+	enum memif_filter filt, struct map_descr** cache, size_t* count);
+
 /*
  * allocate a control context for a specific mapping (ent), return NULL on
  * access violation or dated/incorrect mapping.
@@ -50,6 +63,37 @@ void memif_closemapping(struct map_ctx*);
  */
 size_t memif_copy(struct map_ctx*, uint8_t* buf, size_t buf_sz);
 
+/*
+ * batched version of memif_copy, fill [n] windows where bufs[i] (up to
+ * buf_sz[i] bytes) is read from the current position of maps[i]. buf_sz is
+ * updated with the number of bytes copied into each window, pages that could
+ * not be read inside the mapping are zero-filled rather than ending the copy.
+ * Returns the total number of bytes copied.
+ */
+size_t memif_copyv(struct map_ctx** maps,
+	uint8_t** bufs, size_t* buf_sz, size_t n);
+
+/*
+ * copy [n] ranges starting at the ABSOLUTE addresses addr[i] into bufs[i],
+ * without moving the current position. Ranges are clamped to the mapping and
+ * buf_sz is used the same way as in memif_copyv. Returns the total number of
+ * bytes copied.
+ */
+size_t memif_copyat(struct map_ctx*, const uint64_t* addr,
+	uint8_t** bufs, size_t* buf_sz, size_t n);
+
+/*
+ * track writes to the window of [sz] bytes at the current position. mask is
+ * set to one byte per page (first entry is the page the window starts in)
+ * that is non-zero if the page may have been written to since the previous
+ * call for the same window. Calling with a new window (position or size)
+ * marks every page. Returns the number of entries set, 0 if tracking is not
+ * supported or mask_sz is too small, then the caller has to assume that
+ * everything changed.
+ */
+size_t memif_dirty(struct map_ctx*,
+	size_t sz, uint8_t* mask, size_t mask_sz, size_t* pg_sz);
+
 /*
  * return true if it is possible to write to the underlying mapping
  */
@@ -5,6 +5,9 @@
  */
 #define _LARGEFILE64_SOURCE
 
+/* process_vm_readv */
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -15,8 +18,10 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <limits.h>
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -48,74 +53,231 @@ static bool seek64(int fd, uint64_t addr)
 		return -1 != lseek64(fd, addr, SEEK_SET);
 }
 
-struct map_descr* memif_mapdescr(PROCESS_ID pid,
-	size_t min_sz, enum memif_filter filter, size_t* count)
+/*
+ * /proc/pid/maps is read in one go into a buffer that is kept between calls
+ * and parsed in a single pass. Processes with JITs can have tens of thousands
+ * of mappings, stdio and a separate counting pass made that noticeably slow.
+ */
+static struct {
+	pthread_mutex_t lock;
+	char* buf;
+	size_t buf_sz;
+	struct map_descr* scratch;
+	size_t scratch_sz;
+} maps = {
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static ssize_t read_maps(pid_t pid)
 {
-	int mdescr = -1;
 	char wbuf[sizeof("/proc//maps") + 20];
 	snprintf(wbuf, sizeof(wbuf), "/proc/%d/maps", (int) pid);
-	FILE* fpek = fopen(wbuf, "r");
+	int fd = open(wbuf, O_RDONLY);
+	if (-1 == fd)
+		return -1;
+
+	size_t len = 0;
+	for(;;){
+		if (len + 1 >= maps.buf_sz){
+			size_t nsz = maps.buf_sz ? maps.buf_sz * 2 : 65536;
+			char* nb = realloc(maps.buf, nsz);
+			if (!nb){
+				close(fd);
+				return -1;
+			}
+			maps.buf = nb;
+			maps.buf_sz = nsz;
+		}
 
-	if (filter != FILTER_NONE){
-		snprintf(wbuf, sizeof(wbuf), "/proc/%d/mem", (int) pid);
-		mdescr = open(wbuf, O_MASK);
+		ssize_t nr = read(fd, &maps.buf[len], maps.buf_sz - len - 1);
+		if (-1 == nr){
+			if (errno == EINTR)
+				continue;
+			close(fd);
+			return -1;
+		}
+		if (0 == nr)
+			break;
+		len += nr;
 	}
 
-/* populate list of entries, first get limit */
-	for (*count = 0; !feof(fpek); (*count)++)
-		while(fgetc(fpek) != '\n' && !feof(fpek))
-			;
-	fseek(fpek, 0, SEEK_SET);
+	close(fd);
+	maps.buf[len] = '\0';
+	return len;
+}
 
-/* note there is a time-of-check-time-of-use-risk here */
-	size_t pcache_sz = *count * sizeof(struct map_descr);
-	struct map_descr* pcache = malloc(pcache_sz);
-	if (!pcache)
-		return NULL;
-	memset(pcache, '\0', pcache_sz);
+static const char* scan_hex(const char* p, uint64_t* out)
+{
+	uint64_t v = 0;
+	for (;; p++){
+		if (*p >= '0' && *p <= '9')
+			v = (v << 4) | (*p - '0');
+		else if (*p >= 'a' && *p <= 'f')
+			v = (v << 4) | (*p - 'a' + 10);
+		else
+			break;
+	}
+	*out = v;
+	return p;
+}
 
-	size_t ofs = 0;
-	while(!feof(fpek) && ofs < *count){
-		unsigned long long int dadr[4];
-		int ret = fscanf(fpek, "%llx-%llx %5s %llx %5s %llx", &dadr[0],
-			&dadr[1], pcache[ofs].perm, &dadr[2], pcache[ofs].device, &dadr[3]);
+/* copy one whitespace separated field, truncating to fit */
+static const char* scan_field(const char* p, char* dst, size_t lim)
+{
+	while (*p == ' ')
+		p++;
+
+	size_t i = 0;
+	for (; *p && *p != ' ' && *p != '\n'; p++)
+		if (i < lim - 1)
+			dst[i++] = *p;
+	dst[i] = '\0';
+	return p;
+}
 
-		if (0 == ret){
-				while (fgetc(fpek) != '\n' && !feof(fpek))
-					;
-			continue;
-		}
+/*
+ * one line is: start-end perm offset device inode [path], returns the start
+ * of the next line, [ent] is only valid if [ok] is set
+ */
+static const char* parse_line(
+	const char* p, struct map_descr* ent, uint64_t* inode, bool* ok)
+{
+	uint64_t ofs;
+	char tmp[24];
+	*ok = false;
+
+	p = scan_hex(p, &ent->addr);
+	if (*p == '-'){
+		p = scan_hex(p + 1, &ent->endaddr);
+		p = scan_field(p, ent->perm, sizeof(ent->perm));
+		while (*p == ' ')
+			p++;
+		p = scan_hex(p, &ofs);
+		p = scan_field(p, ent->device, sizeof(ent->device));
+		p = scan_field(p, tmp, sizeof(tmp));
+		*inode = strtoull(tmp, NULL, 10);
+		*ok = tmp[0] != '\0';
+	}
+
+	while (*p && *p != '\n')
+		p++;
+	return *p ? p + 1 : p;
+}
+
+bool memif_mapupdate(PROCESS_ID pid, size_t min_sz,
+	enum memif_filter filter, struct map_descr** cache, size_t* count)
+{
+	pthread_mutex_lock(&maps.lock);
+
+	struct map_descr* old = *cache;
+	size_t n_old = old ? *count : 0;
+
+	if (-1 == read_maps(pid)){
+		free(*cache);
+		*cache = NULL;
+		*count = 0;
+		pthread_mutex_unlock(&maps.lock);
+		return n_old > 0;
+	}
+
+	int mdescr = -1;
+	size_t n = 0, oi = 0;
+	const char* p = maps.buf;
+
+	while (*p){
+		struct map_descr ent;
+		uint64_t inode;
+		bool ok;
+		memset(&ent, '\0', sizeof(ent));
+		p = parse_line(p, &ent, &inode, &ok);
 
 /* usually the file- mapped pages aren't that interesting in this context,
  * so only process entries that have the matching inode set to 0 */
-		if (dadr[3] == 0 && dadr[1] > dadr[0] && dadr[1] - dadr[0] > 0){
-			if (filter){
-				char junk[4096];
-				if (!seek64(mdescr, dadr[0]))
-					continue;
-
-				if (-1 == read(mdescr, junk, 4096))
-					continue;
+		if (!ok || inode != 0 || ent.endaddr <= ent.addr)
+			continue;
+
+		ent.sz = ent.endaddr - ent.addr;
+		if (ent.sz <= min_sz)
+			continue;
+
+		if (n == maps.scratch_sz){
+			size_t nsz = maps.scratch_sz ? maps.scratch_sz * 2 : 1024;
+			struct map_descr* ns =
+				realloc(maps.scratch, nsz * sizeof(struct map_descr));
+			if (!ns)
+				break;
+			maps.scratch = ns;
+			maps.scratch_sz = nsz;
+		}
+
+/* both tables are sorted on address, an entry that still looks the same
+ * keeps its probe result */
+		while (oi < n_old && old[oi].addr < ent.addr)
+			oi++;
+
+		if (oi < n_old && old[oi].addr == ent.addr &&
+			old[oi].endaddr == ent.endaddr &&
+			strcmp(old[oi].perm, ent.perm) == 0 &&
+			strcmp(old[oi].device, ent.device) == 0 &&
+			(filter == FILTER_NONE || old[oi].readable)){
+			memcpy(&maps.scratch[n++], &old[oi], sizeof(struct map_descr));
+			continue;
+		}
+
+		if (filter != FILTER_NONE){
+			char junk[4096];
+			if (-1 == mdescr){
+				char wbuf[sizeof("/proc//mem") + 20];
+				snprintf(wbuf, sizeof(wbuf), "/proc/%d/mem", (int) pid);
+				mdescr = open(wbuf, O_MASK);
 			}
-			pcache[ofs].addr = dadr[0];
-			pcache[ofs].endaddr = dadr[1];
-			pcache[ofs].sz = dadr[1] - dadr[0];
-			if (pcache[ofs].sz > min_sz)
-				ofs++;
+
+			if (!seek64(mdescr, ent.addr) || -1 == read(mdescr, junk, 4096))
+				continue;
+			ent.readable = true;
 		}
+
+		memcpy(&maps.scratch[n++], &ent, sizeof(struct map_descr));
 	}
 
 	if (-1 != mdescr)
 		close(mdescr);
 
-	if (ofs <= 1){
-		free(pcache);
-		*count = 0;
-		return NULL;
+	bool changed = n != n_old ||
+		(n && memcmp(maps.scratch, old, n * sizeof(struct map_descr)) != 0);
+
+	if (!n){
+		free(*cache);
+		*cache = NULL;
+	}
+	else if (changed){
+		struct map_descr* ns = old;
+		if (n != n_old)
+			ns = realloc(old, n * sizeof(struct map_descr));
+
+		if (ns){
+			memcpy(ns, maps.scratch, n * sizeof(struct map_descr));
+			*cache = ns;
+		}
+		else {
+			free(old);
+			*cache = NULL;
+			n = 0;
+		}
 	}
 
-	*count = ofs-1;
-	return pcache;
+	*count = n;
+	pthread_mutex_unlock(&maps.lock);
+	return changed;
+}
+
+struct map_descr* memif_mapdescr(PROCESS_ID pid,
+	size_t min_sz, enum memif_filter filter, size_t* count)
+{
+	struct map_descr* res = NULL;
+	*count = 0;
+	memif_mapupdate(pid, min_sz, filter, &res, count);
+	return res;
 }
 
 struct map_ctx {
@@ -124,8 +286,21 @@ struct map_ctx {
 	uint64_t ofs;
 	size_t sz;
 	int fd;
+	pid_t pid;
+
+/* soft-dirty tracking state, see memif_dirty */
+	bool trk_on;
+	uint64_t trk_ofs;
+	size_t trk_sz, trk_npg;
+	uint8_t* trk_mask;
+	struct map_ctx* trk_next;
 };
 
+/* set when process_vm_readv turns out to be missing or not permitted,
+ * everything from then on goes through /proc/pid/mem. Only a hint that can
+ * be read from any thread, so the __atomic builtins without ordering */
+static bool no_vmread;
+
 struct map_ctx* memif_openmapping(PROCESS_ID pid, struct map_descr* ent)
 {
 	char wbuf[sizeof("/proc//mem") + 8];
@@ -147,19 +322,31 @@ struct map_ctx* memif_openmapping(PROCESS_ID pid, struct map_descr* ent)
 	fprintf(stderr, "launch_addr(%" PRIx64 ")+%zx seek, %s\n",
 		ent->addr, ent->endaddr - ent->addr, strerror(errno));
 	struct map_ctx* mctx = malloc(sizeof(struct map_ctx));
-	mctx->fd = fd;
-	mctx->address = ent->addr;
-	mctx->sz = ent->sz;
+	if (!mctx){
+		close(fd);
+		return NULL;
+	}
+
+	*mctx = (struct map_ctx){
+		.fd = fd,
+		.pid = pid,
+		.address = ent->addr,
+		.sz = ent->sz
+	};
 	return mctx;
 }
 
+static void trk_remove(struct map_ctx*);
+
 void memif_closemapping(struct map_ctx* map)
 {
 	if (!map)
 		return;
 
+	trk_remove(map);
 	close(map->fd);
 	memset(map, '\0', sizeof(struct map_ctx));
+	free(map);
 }
 
 bool memif_reset(struct map_ctx* map)
@@ -171,17 +358,399 @@ bool memif_reset(struct map_ctx* map)
 	return true;
 }
 
+static size_t page_size()
+{
+	long sz = sysconf(_SC_PAGESIZE);
+	return sz > 0 ? sz : 4096;
+}
+
+/* zero-fill from the faulting address up to the next page boundary */
+static size_t skip_page(uint8_t* buf, uint64_t addr, size_t left)
+{
+	size_t pg = page_size();
+	size_t step = pg - addr % pg;
+	if (step > left)
+		step = left;
+	memset(buf, '\0', step);
+	return step;
+}
+
+static void iov_advance(struct iovec* loc, struct iovec* rem, size_t n)
+{
+	loc->iov_base = (uint8_t*) loc->iov_base + n;
+	loc->iov_len -= n;
+	rem->iov_base = (uint8_t*) rem->iov_base + n;
+	rem->iov_len -= n;
+}
+
+/*
+ * Fill every loc[i] from rem[i] (same lengths) with as few calls as possible.
+ * A fault stops the transfer at that point. Depending on kernel version that
+ * can be inside an iovec element or at its start, so an element that made no
+ * progress is retried for a single page, which is zero-filled if that fails
+ * too, then the rest of the batch is resumed. Returns false if the syscall
+ * can't be used at all, and errno is left for the caller.
+ */
+static bool vm_readv(pid_t pid, struct iovec* loc, struct iovec* rem, size_t n)
+{
+	size_t i = 0;
+	while (i < n){
+		if (!loc[i].iov_len){
+			i++;
+			continue;
+		}
+
+		size_t cnt = n - i > IOV_MAX ? IOV_MAX : n - i;
+		size_t req = 0;
+		for (size_t j = 0; j < cnt; j++)
+			req += loc[i+j].iov_len;
+
+		ssize_t nr = process_vm_readv(pid, &loc[i], cnt, &rem[i], cnt, 0);
+		if (-1 == nr){
+			if (errno != EFAULT)
+				return false;
+			nr = 0;
+		}
+
+		if (nr == req){
+			i += cnt;
+			continue;
+		}
+
+		for (; nr && nr >= loc[i].iov_len; i++)
+			nr -= loc[i].iov_len;
+		if (nr){
+			iov_advance(&loc[i], &rem[i], nr);
+			continue;
+		}
+
+/* stopped at the start of [i], is it the first page that is the problem */
+		uint64_t addr = (uintptr_t) rem[i].iov_base;
+		size_t pg = page_size() - addr % page_size();
+		struct iovec l1 = {
+			.iov_base = loc[i].iov_base,
+			.iov_len = pg < loc[i].iov_len ? pg : loc[i].iov_len
+		};
+		struct iovec r1 = {.iov_base = rem[i].iov_base, .iov_len = l1.iov_len};
+
+		nr = process_vm_readv(pid, &l1, 1, &r1, 1, 0);
+		if (-1 == nr && errno != EFAULT)
+			return false;
+
+		if (nr > 0)
+			iov_advance(&loc[i], &rem[i], nr);
+		else
+			iov_advance(&loc[i], &rem[i],
+				skip_page(loc[i].iov_base, addr, loc[i].iov_len));
+	}
+	return true;
+}
+
+/* the /proc/pid/mem version, unreadable pages give EIO */
+static size_t fd_read(
+	struct map_ctx* map, uint64_t addr, uint8_t* buf, size_t buf_sz)
+{
+	if (!seek64(map->fd, addr))
+		return 0;
+
+	size_t tot = 0;
+	while (tot < buf_sz){
+		ssize_t nr = read(map->fd, &buf[tot], buf_sz - tot);
+		if (-1 == nr){
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (errno != EIO && errno != EFAULT)
+				break;
+			nr = skip_page(&buf[tot], addr + tot, buf_sz - tot);
+			if (!seek64(map->fd, addr + tot + nr))
+				break;
+		}
+		else if (0 == nr)
+			break;
+		tot += nr;
+	}
+
+	return tot;
+}
+
+/*
+ * windows that belong to the same process go in one process_vm_readv
+ * batch (the mm lock is taken once rather than per window), and the
+ * per-mapping fd is only used as the fallback.
+ */
+size_t memif_copyv(struct map_ctx** maps,
+	uint8_t** bufs, size_t* buf_sz, size_t n)
+{
+	size_t tot = 0;
+	struct iovec* loc = malloc(sizeof(struct iovec) * n * 2);
+	struct iovec* rem = &loc[n];
+
+	for (size_t i = 0; i < n;){
+		size_t j = i;
+		for (; j < n && maps[j] && bufs[j] && maps[j]->pid == maps[i]->pid; j++){
+			uint64_t left = maps[j]->sz - maps[j]->ofs;
+			if (buf_sz[j] > left)
+				buf_sz[j] = left;
+			if (!loc)
+				continue;
+			loc[j] = (struct iovec){.iov_base = bufs[j], .iov_len = buf_sz[j]};
+			rem[j] = (struct iovec){
+				.iov_base = (void*)(uintptr_t)(maps[j]->address + maps[j]->ofs),
+				.iov_len = buf_sz[j]
+			};
+		}
+
+/* invalid entry, skip */
+		if (j == i){
+			buf_sz[i++] = 0;
+			continue;
+		}
+
+		bool done = false;
+		if (loc && !__atomic_load_n(&no_vmread, __ATOMIC_RELAXED)){
+			done = vm_readv(maps[i]->pid, &loc[i], &rem[i], j - i);
+			if (!done && errno == ESRCH){
+				for (; i < j; i++)
+					buf_sz[i] = 0;
+				continue;
+			}
+			if (!done && (errno == ENOSYS || errno == EPERM))
+				__atomic_store_n(&no_vmread, true, __ATOMIC_RELAXED);
+		}
+
+		for (; i < j; i++){
+			if (!done)
+				buf_sz[i] = fd_read(maps[i],
+					maps[i]->address + maps[i]->ofs, bufs[i], buf_sz[i]);
+			maps[i]->ofs += buf_sz[i];
+			tot += buf_sz[i];
+		}
+	}
+
+	free(loc);
+	return tot;
+}
+
+size_t memif_copyat(struct map_ctx* map, const uint64_t* addr,
+	uint8_t** bufs, size_t* buf_sz, size_t n)
+{
+	if (!map || !n)
+		return 0;
+
+	struct iovec* loc = malloc(sizeof(struct iovec) * n * 2);
+	struct iovec* rem = &loc[n];
+	for (size_t i = 0; i < n; i++){
+		uint64_t ofs = addr[i] - map->address;
+		uint64_t left = 0;
+		if (addr[i] >= map->address && ofs < map->sz)
+			left = map->sz - ofs;
+		if (buf_sz[i] > left || !bufs[i])
+			buf_sz[i] = bufs[i] ? left : 0;
+		if (!loc)
+			continue;
+		loc[i] = (struct iovec){.iov_base = bufs[i], .iov_len = buf_sz[i]};
+		rem[i] = (struct iovec){
+			.iov_base = (void*)(uintptr_t) addr[i],
+			.iov_len = buf_sz[i]
+		};
+	}
+
+	bool done = false;
+	if (loc && !__atomic_load_n(&no_vmread, __ATOMIC_RELAXED)){
+		done = vm_readv(map->pid, loc, rem, n);
+		if (!done && errno == ESRCH){
+			free(loc);
+			memset(buf_sz, '\0', sizeof(size_t) * n);
+			return 0;
+		}
+		if (!done && (errno == ENOSYS || errno == EPERM))
+			__atomic_store_n(&no_vmread, true, __ATOMIC_RELAXED);
+	}
+	free(loc);
+
+	size_t tot = 0;
+	for (size_t i = 0; i < n; i++){
+		if (!done)
+			buf_sz[i] = fd_read(map, addr[i], bufs[i], buf_sz[i]);
+		tot += buf_sz[i];
+	}
+	return tot;
+}
+
+/*
+ * Soft-dirty bits are per process and clear_refs resets all of them, so
+ * every tracked window of a process is harvested into its own mask before
+ * the bits are cleared, otherwise one channel sampling would hide changes
+ * from the others. Sampling is not atomic with regards to the target, a
+ * write landing between reading pagemap and clearing is only seen on the
+ * next write to that page.
+ */
+#define PM_SOFT_DIRTY (1ull << 55)
+
+static struct {
+	pthread_mutex_t lock;
+	struct map_ctx* first;
+	pid_t pid;
+	int pagemap, clear_refs;
+	bool checked, supported;
+} trk = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.pagemap = -1,
+	.clear_refs = -1
+};
+
+static bool trk_open(pid_t pid)
+{
+	if (trk.pid == pid && -1 != trk.pagemap && -1 != trk.clear_refs)
+		return true;
+
+	if (-1 != trk.pagemap)
+		close(trk.pagemap);
+	if (-1 != trk.clear_refs)
+		close(trk.clear_refs);
+
+	char wbuf[sizeof("/proc//clear_refs") + 20];
+	snprintf(wbuf, sizeof(wbuf), "/proc/%d/pagemap", (int) pid);
+	trk.pagemap = open(wbuf, O_RDONLY);
+	snprintf(wbuf, sizeof(wbuf), "/proc/%d/clear_refs", (int) pid);
+	trk.clear_refs = open(wbuf, O_WRONLY);
+	trk.pid = pid;
+
+	return -1 != trk.pagemap && -1 != trk.clear_refs;
+}
+
+static void trk_remove(struct map_ctx* map)
+{
+	pthread_mutex_lock(&trk.lock);
+	for (struct map_ctx** cur = &trk.first; *cur; cur = &(*cur)->trk_next)
+		if (*cur == map){
+			*cur = map->trk_next;
+			break;
+		}
+	pthread_mutex_unlock(&trk.lock);
+
+	free(map->trk_mask);
+	map->trk_mask = NULL;
+	map->trk_on = false;
+}
+
+/*
+ * without soft-dirty support the bit is simply never set, which would look
+ * like nothing ever changes. A freshly faulted page is always soft-dirty, so
+ * check that on one of our own.
+ */
+static bool trk_selftest()
+{
+	if (trk.checked)
+		return trk.supported;
+
+	trk.checked = true;
+	size_t pg = page_size();
+	volatile uint8_t* probe = mmap(NULL, pg,
+		PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == probe)
+		return false;
+	probe[0] = 1;
+
+	uint64_t ent = 0;
+	int fd = open("/proc/self/pagemap", O_RDONLY);
+	if (-1 != fd){
+		if (8 != pread(fd, &ent, 8, (uintptr_t) probe / pg * 8))
+			ent = 0;
+		close(fd);
+	}
+	munmap((void*) probe, pg);
+
+	trk.supported = !!(ent & PM_SOFT_DIRTY);
+	return trk.supported;
+}
+
+static bool trk_harvest(pid_t pid)
+{
+	uint64_t ent[512];
+	size_t pg = page_size();
+
+	for (struct map_ctx* cur = trk.first; cur; cur = cur->trk_next){
+		if (cur->pid != pid || !cur->trk_mask)
+			continue;
+
+		uint64_t first = (cur->address + cur->trk_ofs) / pg;
+		for (size_t i = 0; i < cur->trk_npg;){
+			size_t n = cur->trk_npg - i > 512 ? 512 : cur->trk_npg - i;
+			ssize_t nr = pread(trk.pagemap, ent, n * 8, (first + i) * 8);
+			if (nr <= 0)
+				return false;
+
+			n = nr / 8;
+			for (size_t j = 0; j < n; j++)
+				if (ent[j] & PM_SOFT_DIRTY)
+					cur->trk_mask[i + j] = 1;
+			i += n;
+		}
+	}
+
+	return 1 == write(trk.clear_refs, "4", 1);
+}
+
+size_t memif_dirty(struct map_ctx* map,
+	size_t sz, uint8_t* mask, size_t mask_sz, size_t* pg_sz)
+{
+	if (!map || !mask)
+		return 0;
+
+	size_t pg = page_size();
+	uint64_t left = map->sz - map->ofs;
+	if (sz > left)
+		sz = left;
+
+	uint64_t addr = map->address + map->ofs;
+	size_t npg = sz ? (addr + sz - 1) / pg - addr / pg + 1 : 0;
+	if (npg > mask_sz)
+		return 0;
+	*pg_sz = pg;
+
+	pthread_mutex_lock(&trk.lock);
+	if (!map->trk_on){
+		map->trk_on = true;
+		map->trk_next = trk.first;
+		trk.first = map;
+	}
+
+	if (!trk_selftest() || !trk_open(map->pid) || !trk_harvest(map->pid)){
+		pthread_mutex_unlock(&trk.lock);
+		return 0;
+	}
+
+/* new window, the bits just cleared are from now on relevant */
+	if (!map->trk_mask || map->trk_ofs != map->ofs || map->trk_sz != sz){
+		uint8_t* nm = realloc(map->trk_mask, npg ? npg : 1);
+		if (!nm){
+			pthread_mutex_unlock(&trk.lock);
+			return 0;
+		}
+		memset(nm, '\0', npg);
+		map->trk_mask = nm;
+		map->trk_ofs = map->ofs;
+		map->trk_sz = sz;
+		map->trk_npg = npg;
+		memset(mask, 1, npg);
+	}
+	else {
+		memcpy(mask, map->trk_mask, npg);
+		memset(map->trk_mask, '\0', npg);
+	}
+
+	pthread_mutex_unlock(&trk.lock);
+	return npg;
+}
+
 size_t memif_copy(struct map_ctx* map, uint8_t* buf, size_t buf_sz)
 {
 	if (!map || !buf)
 		return 0;
 
-	ssize_t nr = read(map->fd, buf, buf_sz);
-	if (nr >= 0){
-		map->ofs += nr;
-		return nr;
-	}
-	return 0;
+	memif_copyv(&map, &buf, &buf_sz, 1);
+	return buf_sz;
 }
 
 bool memif_canwrite(struct map_ctx* ctx)
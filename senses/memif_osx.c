@@ -138,6 +138,7 @@ struct map_descr* memif_mapdescr(PROCESS_ID pid,
 		pcache[ofs].perm[1] = info.protection & VM_PROT_WRITE ? 'w' : ' ';
 		pcache[ofs].perm[2] = info.protection & VM_PROT_EXECUTE ? 'x' : ' ';
 		pcache[ofs].device[0] = '\0';
+		pcache[ofs].readable = filter != FILTER_NONE;
 
 		address += size;
 		ofs++;
@@ -151,6 +152,16 @@ step:
 	return pcache;
 }
 
+/* vm_region is walked per entry anyway, so there is nothing to gain
+ * from diffing against the previous table */
+bool memif_mapupdate(PROCESS_ID pid, size_t min_sz,
+	enum memif_filter filter, struct map_descr** cache, size_t* count)
+{
+	free(*cache);
+	*cache = memif_mapdescr(pid, min_sz, filter, count);
+	return true;
+}
+
 bool memif_canwrite(struct map_ctx* ctx)
 {
 	return false;
@@ -228,6 +239,40 @@ size_t memif_copy(struct map_ctx* ctx, uint8_t* buffer, size_t size)
 	return have_read;
 }
 
+size_t memif_copyv(struct map_ctx** maps,
+	uint8_t** bufs, size_t* buf_sz, size_t n)
+{
+	size_t tot = 0;
+	for (size_t i = 0; i < n; i++){
+		buf_sz[i] = memif_copy(maps[i], bufs[i], buf_sz[i]);
+		tot += buf_sz[i];
+	}
+	return tot;
+}
+
+size_t memif_copyat(struct map_ctx* ctx, const uint64_t* addr,
+	uint8_t** bufs, size_t* buf_sz, size_t n)
+{
+	uint64_t cur = ctx->ofs;
+	size_t tot = 0;
+	for (size_t i = 0; i < n; i++){
+		bool inside = addr[i] >= ctx->address && addr[i] - ctx->address < ctx->sz;
+		ctx->ofs = addr[i] - ctx->address;
+		buf_sz[i] = inside ? memif_copy(ctx, bufs[i], buf_sz[i]) : 0;
+		tot += buf_sz[i];
+	}
+	ctx->ofs = cur;
+	return tot;
+}
+
+/* vm_region only gives per-region dirty page counts that can't be reset,
+ * not enough to tell which pages changed since the last sample */
+size_t memif_dirty(struct map_ctx* ctx,
+	size_t sz, uint8_t* mask, size_t mask_sz, size_t* pg_sz)
+{
+	return 0;
+}
+
 bool memif_reset(struct map_ctx* ent)
 {
 	if (ent->ofs){
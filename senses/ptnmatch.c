@@ -0,0 +1,231 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Aho-Corasick automaton with a dense transition table over
+ * byte classes. Only bytes that occur in at least one pattern get their own
+ * class, everything else collapses into class 0 that always leads back to
+ * the root, which keeps the table small for typical signature sets.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "ptnmatch.h"
+
+#define STATE_NONE UINT32_MAX
+
+/* set on transitions into states that terminate at least one pattern,
+ * lets the scan loop skip the output lookup for the common case */
+#define STATE_OUT 0x80000000
+
+struct ptn_out {
+	uint32_t ind;
+	uint32_t next;
+};
+
+struct ptn_match {
+/* 16 bits, with every byte value in use there are 257 classes */
+	uint16_t cls[256];
+	size_t n_cls;
+	size_t n_states;
+	size_t maxlen;
+
+/* n_states * n_cls, next state for each (state, class) */
+	uint32_t* delta;
+
+/* first entry in [outs] for patterns ending in that exact state */
+	uint32_t* own;
+
+/* nearest state along the failure chain that has an output of its own */
+	uint32_t* dict;
+
+	struct ptn_out* outs;
+};
+
+void ptn_match_free(struct ptn_match** m)
+{
+	if (!m || !*m)
+		return;
+
+	free((*m)->delta);
+	free((*m)->own);
+	free((*m)->dict);
+	free((*m)->outs);
+	free(*m);
+	*m = NULL;
+}
+
+size_t ptn_match_maxlen(struct ptn_match* m)
+{
+	return m ? m->maxlen : 0;
+}
+
+struct ptn_match* ptn_match_build(
+	uint8_t* const* ptns, const size_t* sizes, size_t n)
+{
+	size_t max_states = 1;
+	size_t n_used = 0;
+
+	struct ptn_match* res = malloc(sizeof(struct ptn_match));
+	if (!res)
+		return NULL;
+	memset(res, '\0', sizeof(struct ptn_match));
+
+/* class assignment, 0 is reserved for 'not in any pattern' */
+	for (size_t i = 0; i < n; i++){
+		if (!ptns[i] || !sizes[i])
+			continue;
+
+		n_used++;
+		max_states += sizes[i];
+		if (sizes[i] > res->maxlen)
+			res->maxlen = sizes[i];
+
+		for (size_t j = 0; j < sizes[i]; j++)
+			res->cls[ptns[i][j]] = 1;
+	}
+
+	if (!n_used || max_states >= STATE_OUT){
+		free(res);
+		return NULL;
+	}
+
+	res->n_cls = 1;
+	for (size_t i = 0; i < 256; i++)
+		if (res->cls[i])
+			res->cls[i] = res->n_cls++;
+
+	size_t ncls = res->n_cls;
+	res->delta = malloc(sizeof(uint32_t) * max_states * ncls);
+	res->own = malloc(sizeof(uint32_t) * max_states);
+	res->dict = malloc(sizeof(uint32_t) * max_states);
+	res->outs = malloc(sizeof(struct ptn_out) * n_used);
+	uint32_t* fail = malloc(sizeof(uint32_t) * max_states);
+	uint32_t* queue = malloc(sizeof(uint32_t) * max_states);
+
+	if (!res->delta || !res->own || !res->dict || !res->outs || !fail || !queue){
+		free(fail);
+		free(queue);
+		ptn_match_free(&res);
+		return NULL;
+	}
+
+	memset(res->delta, 0xff, sizeof(uint32_t) * max_states * ncls);
+	memset(res->own, 0xff, sizeof(uint32_t) * max_states);
+	memset(res->dict, 0xff, sizeof(uint32_t) * max_states);
+	res->n_states = 1;
+
+/* build the trie, insert in reverse so that each output list
+ * ends up in ascending pattern index order */
+	size_t n_outs = 0;
+	for (size_t i = n; i > 0; i--){
+		uint8_t* ptn = ptns[i-1];
+		size_t sz = sizes[i-1];
+		if (!ptn || !sz)
+			continue;
+
+		uint32_t s = 0;
+		for (size_t j = 0; j < sz; j++){
+			uint32_t* next = &res->delta[s * ncls + res->cls[ptn[j]]];
+			if (*next == STATE_NONE)
+				*next = res->n_states++;
+			s = *next;
+		}
+
+		res->outs[n_outs] = (struct ptn_out){
+			.ind = i-1,
+			.next = res->own[s]
+		};
+		res->own[s] = n_outs++;
+	}
+
+/* class 0 never continues a match */
+	for (size_t s = 0; s < res->n_states; s++)
+		res->delta[s * ncls] = 0;
+
+/* breadth first, fill in failure transitions so the table is complete,
+ * rows for shallower states are always finished before they are used */
+	size_t q_head = 0, q_tail = 0;
+	for (size_t c = 1; c < ncls; c++){
+		uint32_t u = res->delta[c];
+		if (u == STATE_NONE)
+			res->delta[c] = 0;
+		else {
+			fail[u] = 0;
+			queue[q_tail++] = u;
+		}
+	}
+
+	while (q_head < q_tail){
+		uint32_t s = queue[q_head++];
+		uint32_t* row = &res->delta[s * ncls];
+		uint32_t* frow = &res->delta[fail[s] * ncls];
+
+		for (size_t c = 1; c < ncls; c++){
+			uint32_t u = row[c];
+			if (u == STATE_NONE){
+				row[c] = frow[c];
+				continue;
+			}
+
+			uint32_t f = frow[c];
+			fail[u] = f;
+			res->dict[u] = res->own[f] != STATE_NONE ? f : res->dict[f];
+			queue[q_tail++] = u;
+		}
+	}
+
+	free(fail);
+	free(queue);
+
+/* tag transitions into output states */
+	size_t tbl_sz = res->n_states * ncls;
+	for (size_t i = 0; i < tbl_sz; i++){
+		uint32_t u = res->delta[i];
+		if (res->own[u] != STATE_NONE || res->dict[u] != STATE_NONE)
+			res->delta[i] |= STATE_OUT;
+	}
+
+/* shrink to what was actually used */
+	void* tmp = realloc(res->delta, sizeof(uint32_t) * tbl_sz);
+	if (tmp)
+		res->delta = tmp;
+
+	return res;
+}
+
+size_t ptn_match_scan(struct ptn_match* m, uint32_t* state,
+	const uint8_t* buf, size_t buf_sz, ptn_match_hit hit, void* tag)
+{
+	if (!m || !buf)
+		return 0;
+
+	const uint32_t* delta = m->delta;
+	const uint16_t* cls = m->cls;
+	size_t ncls = m->n_cls;
+	uint32_t s = *state & ~STATE_OUT;
+	size_t rc = 0;
+
+	if (s >= m->n_states)
+		s = 0;
+
+	for (size_t i = 0; i < buf_sz; i++){
+		s = delta[s * ncls + cls[buf[i]]];
+		if (!(s & STATE_OUT))
+			continue;
+
+		s &= ~STATE_OUT;
+		uint32_t t = m->own[s] != STATE_NONE ? s : m->dict[s];
+		for (; t != STATE_NONE; t = m->dict[t])
+			for (uint32_t o = m->own[t]; o != STATE_NONE; o = m->outs[o].next){
+				rc++;
+				if (hit)
+					hit(tag, m->outs[o].ind, i);
+			}
+	}
+
+	*state = s;
+	return rc;
+}
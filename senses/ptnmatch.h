@@ -0,0 +1,48 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Compiled multi-pattern matcher (Aho-Corasick) shared between
+ * the rwstat pattern alpha and translators that need to find a set of byte
+ * signatures in a buffer. Scanning cost is O(buf_sz + matches) regardless of
+ * the number of patterns, and overlapping matches are all reported.
+ */
+
+#ifndef HAVE_PTNMATCH
+#define HAVE_PTNMATCH
+
+struct ptn_match;
+
+/*
+ * Invoked for every match, [ind] is the index of the pattern in the set that
+ * was used to build the matcher and [end] is the offset of the last matching
+ * byte relative to the start of the scanned buffer.
+ */
+typedef void (*ptn_match_hit)(void* tag, size_t ind, size_t end);
+
+/*
+ * Compile [n] patterns into a matcher. The pattern buffers are not retained
+ * and can be released after the call. Zero-length patterns are ignored.
+ * Returns NULL on allocation failure or if there are no usable patterns.
+ */
+struct ptn_match* ptn_match_build(
+	uint8_t* const* ptns, const size_t* sizes, size_t n);
+
+/*
+ * Scan [buf_sz] bytes, [state] carries the automaton state between calls so
+ * a stream can be fed in chunks. Set *state to 0 to start from scratch. The
+ * [end] offsets passed to [hit] are relative to [buf]. Returns the number of
+ * matches.
+ */
+size_t ptn_match_scan(struct ptn_match*, uint32_t* state,
+	const uint8_t* buf, size_t buf_sz, ptn_match_hit hit, void* tag);
+
+/*
+ * Length of the longest pattern in the set, useful for determining how much
+ * overlap is needed when splitting a scan into independent chunks.
+ */
+size_t ptn_match_maxlen(struct ptn_match*);
+
+void ptn_match_free(struct ptn_match**);
+
+#endif
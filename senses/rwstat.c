@@ -8,16 +8,26 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 
 #include <arcan_shmif.h>
 #include <arcan_tuisym.h>
 
 #include "libsenseye.h"
 #include "rwstat.h"
+#include "ptnmatch.h"
+#include "stagetime.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 enum step_sz {
 	STEP_NONE = 0,
@@ -30,7 +40,6 @@ enum step_sz {
 struct pattern {
 	uint8_t* buf;
 	size_t buf_sz;
-	size_t buf_pos;
 	int evc;
 	uint8_t alpha;
 	uint32_t id;
@@ -45,6 +54,39 @@ static int pack_sizes[] = {
 	1
 };
 
+/*
+ * MAP_HILBERT is drawn in aligned tiles of HILBERT_TILE * HILBERT_TILE
+ * pixels, the curve covers each such tile with one contiguous range of
+ * offsets, as a rotated / mirrored copy of the curve at that size.
+ */
+#define HILBERT_TILE 16
+
+struct hilbert_tile {
+	uint16_t x, y;
+	uint8_t orient;
+};
+
+/* tile order for one base, shared between all channels and kept for the
+ * lifetime of the process as there are only a handful of distinct bases */
+struct hilbert_tiles {
+	size_t base;
+	size_t tile;
+	struct hilbert_tile* tiles;
+	struct hilbert_tiles* next;
+};
+
+static struct hilbert_tiles* hilbert_cache;
+static pthread_mutex_t hilbert_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct rwstat_ch_priv;
+
+/* pattern hits forwarded in the statistics stream per frame */
+#define STATS_HITLIM 64
+
+/* pack [n] pixels worth of [buf] into the output, starting at pixel [ofs] */
+typedef void (*pack_row_fn)(
+	struct rwstat_ch_priv*, const uint8_t* buf, size_t ofs, size_t n);
+
 struct rwstat_ch_priv {
 	enum rwstat_clock clock;
 	enum rwstat_pack pack;
@@ -53,43 +95,99 @@ struct rwstat_ch_priv {
 /* mapping etc. has changed but we havn't told our parent */
 	bool status_dirty;
 
-/* scaling factors used for some mapping modes */
-	float sf_x, sf_y;
+/* byte to coordinate scaling for the tuple mapping modes */
+	uint16_t tuple_lut[256];
 	uint8_t pack_sz;
+
+/* selected from [row_kernels] whenever map, pack or alpha changes */
+	pack_row_fn pack_row;
 	uint16_t* cmap;
 
-/* scales O(n) */
+/* MAP_HILBERT without [cmap], pixel offsets within a tile for each of the
+ * 8 tile orientations given the current pitch */
+	struct hilbert_tiles* hb_tiles;
+	int32_t* hb_ofs;
+
+/* patterns are compiled into [ptn_match] lazily on the next step after
+ * one has been added, matching is O(buf_sz + hits) in the pattern count */
 	struct pattern* patterns;
 	size_t n_patterns;
 	size_t patterns_sz;
+	struct ptn_match* ptn_match;
+	bool ptn_dirty;
+
+/* bumped whenever a pattern is added, see rwstat_patterns */
+	unsigned ptn_gen;
+
+/* pattern alpha fill state, pixel offset and current 'stateful' alpha */
+	size_t ptn_px;
+	uint8_t ptn_av;
 
 /* statistics for the data connection as such */
 	size_t cnt_total;
 	size_t cnt_local;
 	size_t buf_ofs;
 
-/* histogram used for estimating entropy etc. */
+/* histogram used for estimating entropy etc. in CLK_SLIDE it covers
+ * the current window, otherwise it accumulates over the transfer */
 	uint32_t hgram[256];
 
+/* streaming entropy state for RW_ALPHA_ENTBASE, one histogram and one
+ * running sum(n*log2(n)) per ent_base block, [ent_lut] holds n*log2(n)
+ * for every count a block can reach. [ent_hgram] is only allocated when
+ * the per-block state fits RWSTAT_ENT_STATELIM, and [ent_valid] tracks
+ * if it reflects the contents of [buf]. */
+	float* ent_lut;
+	size_t ent_lut_sz;
+	uint16_t* ent_hgram;
+	float* ent_sum;
+	size_t ent_blocks;
+	size_t ent_slid;
+	bool ent_valid;
+
 /* we need a local intermediary buffer that we flush in
  * order to support switching modes of packing etc. */
 	size_t base, ent_base;
 	uint8_t* buf;
 	size_t buf_sz;
 
+/* [buf] is a window into [ring] that holds every byte twice, at [i] and
+ * [i + buf_sz], so a CLK_SLIDE write only moves [head] forward and the
+ * window [ring + head, ring + head + buf_sz) is always contiguous. The
+ * mirror half is only kept current while in CLK_SLIDE. */
+	uint8_t* ring;
+	size_t head;
+
 /* alpha buffer matches base * base and is sampled
  * by the packing function based on the amode of the ch */
 	uint8_t* alpha;
 
 /* output segment */
 	struct arcan_shmif_cont* cont;
+
+/* per-stage costs, exported along with FRAMESTATUS */
+	struct stage_timer stages;
+
+/* statistics side stream (see send_stats), [stat_hits] holds up to
+ * STATS_HITLIM pattern hits of the current frame as id + offset. The set
+ * for the newest frame waits in [stat_buf] ([stat_ready]) until the
+ * consumer asks for one ([stat_want]) */
+	bool stats, stat_want, stat_ready;
+	uint8_t* stat_buf;
+	size_t stat_buf_sz;
+	uint8_t stat_hits[STATS_HITLIM * 8];
+	size_t n_stat_hits;
+	struct {
+		size_t frame, total, rows, n_blocks, block_sz;
+		uint32_t max;
+	} stat_set;
 };
 
 /*
  * hilbert curve functions
  * [plucked straight from wikipedia]
  * could traverse the curve in more efficient ways but since
- * it is only used to generate the LUT on resize, don't bother.
+ * it is only used to generate the tile tables, don't bother.
  */
 static void hilbert_rot(int n, int *x, int *y, int rx, int ry)
 {
@@ -105,14 +203,14 @@ static void hilbert_rot(int n, int *x, int *y, int rx, int ry)
 	}
 }
 
-static void hilbert_d2xy(int n, int d, int* x, int* y)
+/* continue the d2xy walk at level [s0] for the (x, y) of the levels below */
+static void hilbert_walk(int n, int s0, int t, int* x, int* y)
 {
-	int rx, ry, t=d;
-	*x = *y = 0;
+	int rx, ry;
 
-	for (int s = 1; s < n; s *= 2){
-   	rx = 1 & (t / 2);
-   	ry = 1 & (t ^ rx);
+	for (int s = s0; s < n; s *= 2){
+		rx = 1 & (t / 2);
+		ry = 1 & (t ^ rx);
 		hilbert_rot(s, x, y, rx, ry);
 		*x += s * rx;
 		*y += s * ry;
@@ -120,6 +218,104 @@ static void hilbert_d2xy(int n, int d, int* x, int* y)
 	}
 }
 
+static void hilbert_d2xy(int n, int d, int* x, int* y)
+{
+	*x = *y = 0;
+	hilbert_walk(n, 1, d, x, y);
+}
+
+/* the 8 symmetries of a tile, as the direction of local +x and local +y */
+static const int hilbert_dirs[4][2] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+
+static int hilbert_dir(int dx, int dy)
+{
+	for (int i = 0; i < 4; i++)
+		if (hilbert_dirs[i][0] == dx && hilbert_dirs[i][1] == dy)
+			return i;
+	return 0;
+}
+
+/*
+ * the levels above the tile only mirror, swap and translate, so probing
+ * where the local (0, 0), (1, 0) and (0, 1) of tile [k] end up gives the
+ * tile origin and orientation
+ */
+static struct hilbert_tile hilbert_probe(int n, int tile, int k)
+{
+	int ox = 0, oy = 0, ax = 1, ay = 0, bx = 0, by = 1;
+	hilbert_walk(n, tile, k, &ox, &oy);
+	hilbert_walk(n, tile, k, &ax, &ay);
+	hilbert_walk(n, tile, k, &bx, &by);
+
+	int ex = hilbert_dir(ax - ox, ay - oy);
+	int ey = hilbert_dir(bx - ox, by - oy);
+
+	return (struct hilbert_tile){
+		.x = ox,
+		.y = oy,
+		.orient = ex * 2 + (ey != (ex + 1) % 4)
+	};
+}
+
+static struct hilbert_tiles* hilbert_tiles(size_t base)
+{
+	struct hilbert_tiles* res;
+	pthread_mutex_lock(&hilbert_lock);
+
+	for (res = hilbert_cache; res; res = res->next)
+		if (res->base == base)
+			goto out;
+
+	size_t tile = base < HILBERT_TILE ? base : HILBERT_TILE;
+	size_t n_tiles = (base / tile) * (base / tile);
+
+	res = malloc(sizeof(struct hilbert_tiles));
+	if (!res)
+		goto out;
+
+	res->tiles = malloc(sizeof(struct hilbert_tile) * n_tiles);
+	if (!res->tiles){
+		free(res);
+		res = NULL;
+		goto out;
+	}
+
+	for (size_t i = 0; i < n_tiles; i++)
+		res->tiles[i] = hilbert_probe(base, tile, i);
+
+	res->base = base;
+	res->tile = tile;
+	res->next = hilbert_cache;
+	hilbert_cache = res;
+
+out:
+	pthread_mutex_unlock(&hilbert_lock);
+	return res;
+}
+
+static int32_t* hilbert_offsets(size_t tile, size_t pitch)
+{
+	size_t tt = tile * tile;
+	int32_t* res = malloc(sizeof(int32_t) * 8 * tt);
+	if (!res)
+		return NULL;
+
+	for (size_t j = 0; j < tt; j++){
+		int x, y;
+		hilbert_d2xy(tile, j, &x, &y);
+
+		for (size_t o = 0; o < 8; o++){
+			int ex = o / 2;
+			int ey = o % 2 ? (ex + 3) % 4 : (ex + 1) % 4;
+			int px = hilbert_dirs[ex][0] * x + hilbert_dirs[ey][0] * y;
+			int py = hilbert_dirs[ex][1] * x + hilbert_dirs[ey][1] * y;
+			res[o * tt + j] = py * (int32_t) pitch + px;
+		}
+	}
+
+	return res;
+}
+
 static const char* rwstat_lut[] = {
 	"wrap",
 	"tuple",
@@ -133,40 +329,91 @@ static const char* pack_lut[] = {
 	"mono",
 };
 
+/* upper bound (bytes) for the per-block entropy histograms, past this
+ * (tiny ent_base on a large base) each block is recomputed every step */
+#define RWSTAT_ENT_STATELIM (32 * 1024 * 1024)
+
 static inline void rebuild_hgram(struct rwstat_ch_priv* chp)
 {
+	memset(chp->hgram, '\0', sizeof(chp->hgram));
 	for (size_t i = 0; i < chp->buf_sz; i++)
 		chp->hgram[ chp->buf[ i ] ]++;
 }
 
 /*
- * calculate shannon entropy with a previously supplied histogram
+ * append [n] (<= buf_sz) bytes to the sliding window, dropping the [n]
+ * oldest ones. The new bytes replace the oldest ones in both halves of
+ * the ring and the window is advanced, [buf] == NULL writes zeroes.
  */
-static inline float shent_h(uint8_t* buf, size_t bufsz, uint32_t hgram[256])
+static void ring_write(struct rwstat_ch_priv* chp, uint8_t* buf, size_t n)
 {
-	float ent = 0.0f;
-	for (size_t i = 0; i < bufsz; i++){
-		float pr = (float)hgram[buf[i]] / (float) bufsz;
-		ent -= pr * log2f(pr);
+	size_t pos = chp->head;
+	size_t ntw = chp->buf_sz - pos < n ? chp->buf_sz - pos : n;
+
+	if (buf){
+		for (size_t i = 0; i < n; i++)
+			chp->hgram[ buf[i] ]++;
+
+		memcpy(&chp->ring[pos], buf, ntw);
+		memcpy(&chp->ring[pos + chp->buf_sz], buf, ntw);
+		memcpy(chp->ring, &buf[ntw], n - ntw);
+		memcpy(&chp->ring[chp->buf_sz], &buf[ntw], n - ntw);
+	}
+	else {
+		chp->hgram[0] += n;
+		memset(&chp->ring[pos], '\0', ntw);
+		memset(&chp->ring[pos + chp->buf_sz], '\0', ntw);
+		memset(chp->ring, '\0', n - ntw);
+		memset(&chp->ring[chp->buf_sz], '\0', n - ntw);
 	}
 
-	return ent;
+	chp->head = (pos + n) % chp->buf_sz;
+	chp->buf = &chp->ring[chp->head];
 }
 
 /*
- * calculate shannon entropy without a previous histogram
+ * move the window back to the start of the ring and refresh the mirror
+ * half, needed when switching clock as only CLK_SLIDE uses the ring.
  */
-static inline float shent(uint8_t* buf, size_t bufsz)
+static void ring_align(struct rwstat_ch_priv* chp)
 {
-	uint32_t hgram[256] = {0};
-	for (size_t i = 0; i < bufsz; i++)
-		hgram[ buf[i] ]++;
+	if (chp->head){
+		memmove(chp->ring, chp->buf, chp->buf_sz);
+		chp->head = 0;
+		chp->buf = chp->ring;
+	}
+	memcpy(&chp->ring[chp->buf_sz], chp->ring, chp->buf_sz);
+}
+
+/*
+ * shannon entropy (bits) of a block of [n] bytes given the sum of
+ * count*log2(count) over its histogram: log2(n) - sum / n
+ */
+static inline float shent_sum(float sum, size_t n)
+{
+	float ent = log2f((float)n) - sum / (float)n;
+	return ent < 0.0f ? 0.0f : (ent > 8.0f ? 8.0f : ent);
+}
+
+/*
+ * calculate shannon entropy without a previous histogram, [lut] covers
+ * n*log2(n) for 0..bufsz
+ */
+static inline float shent(const float* lut, uint8_t* buf, size_t bufsz)
+{
+	uint16_t hgram[256] = {0};
+	float sum = 0.0f;
 
-	return shent_h(buf, bufsz, hgram);
+	for (size_t i = 0; i < bufsz; i++){
+		uint16_t c = hgram[buf[i]]++;
+		sum += lut[c+1] - lut[c];
+	}
+
+	return shent_sum(sum, bufsz);
 }
 
 static inline void pack_bytes(
-	struct rwstat_ch_priv* chp, uint8_t* buf, size_t ofs)
+	struct rwstat_ch_priv* chp, const uint8_t* buf, size_t ofs)
 {
 	int x = 0, y = 0;
 	shmif_pixel val = 0;
@@ -179,14 +426,14 @@ static inline void pack_bytes(
 	break;
 
 	case MAP_TUPLE:
-		x = (float)buf[0] * chp->sf_x;
-		y = (float)buf[1] * chp->sf_y;
+		x = chp->tuple_lut[buf[0]];
+		y = chp->tuple_lut[buf[1]];
 		buf += 2;
 	break;
 	case MAP_TUPLE_ACC:
 	{
-		x = (float)buf[0] * chp->sf_x;
-		y = (float)buf[1] * chp->sf_y;
+		x = chp->tuple_lut[buf[0]];
+		y = chp->tuple_lut[buf[1]];
 		buf += 2;
 		shmif_pixel ov = chp->cont->vidp[ y * chp->cont->pitch + x];
 		uint8_t	v = (ov & 0x000000ff);
@@ -228,6 +475,359 @@ postpack:
 	chp->cont->vidp[ y * chp->cont->pitch + x ] = val;
 }
 
+/*
+ * row kernels, the generic one covers every combination through
+ * pack_bytes, the others are for MAP_WRAP where a row of input maps to
+ * a row of output and only the packing needs to be considered.
+ */
+static void row_generic(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n)
+{
+	for (size_t i = 0; i < n; i++, buf += chp->pack_sz)
+		pack_bytes(chp, buf, ofs + i);
+}
+
+static inline shmif_pixel* wrap_row(struct rwstat_ch_priv* chp, size_t ofs)
+{
+	return &chp->cont->vidp[
+		(ofs / chp->base) * chp->cont->pitch + ofs % chp->base];
+}
+
+static void row_wrap_tight(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n)
+{
+	shmif_pixel* dst = wrap_row(chp, ofs);
+	for (size_t i = 0; i < n; i++, buf += 4)
+		dst[i] = SHMIF_RGBA(buf[0], buf[1], buf[2], buf[3]);
+}
+
+static void row_wrap_tnoalpha(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n)
+{
+	shmif_pixel* dst = wrap_row(chp, ofs);
+	const uint8_t* alpha = &chp->alpha[ofs];
+	for (size_t i = 0; i < n; i++, buf += 3)
+		dst[i] = SHMIF_RGBA(buf[0], buf[1], buf[2], alpha[i]);
+}
+
+static void row_wrap_intens(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n)
+{
+	shmif_pixel* dst = wrap_row(chp, ofs);
+	const uint8_t* alpha = &chp->alpha[ofs];
+	for (size_t i = 0; i < n; i++)
+		dst[i] = SHMIF_RGBA(buf[i], buf[i], buf[i], alpha[i]);
+}
+
+/*
+ * vector versions, these assume that shmif_pixel is stored B, G, R, A in
+ * memory (the default SHMIF_RGBA on little endian) which is checked for in
+ * select_kernel, and fall back to the scalar loop for the tail.
+ */
+#if defined(__SSE2__) || defined(__ARM_NEON)
+#define ROW_SIMD
+
+static void row_wrap_tight_simd(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n)
+{
+	shmif_pixel* dst = wrap_row(chp, ofs);
+	size_t i = 0;
+
+#ifdef __SSE2__
+/* R G B A -> B G R A, swap the low and high byte of each 16-bit half */
+	const __m128i m_ga = _mm_set1_epi32(0xff00ff00);
+	const __m128i m_b = _mm_set1_epi32(0x000000ff);
+	const __m128i m_r = _mm_set1_epi32(0x00ff0000);
+
+	for (; i + 4 <= n; i += 4){
+		__m128i v = _mm_loadu_si128((const __m128i*) &buf[i * 4]);
+		__m128i r = _mm_or_si128(_mm_and_si128(v, m_ga),
+			_mm_or_si128(
+				_mm_and_si128(_mm_srli_epi32(v, 16), m_b),
+				_mm_and_si128(_mm_slli_epi32(v, 16), m_r)
+			)
+		);
+		_mm_storeu_si128((__m128i*) &dst[i], r);
+	}
+#else
+	for (; i + 16 <= n; i += 16){
+		uint8x16x4_t v = vld4q_u8(&buf[i * 4]);
+		uint8x16_t t = v.val[0];
+		v.val[0] = v.val[2];
+		v.val[2] = t;
+		vst4q_u8((uint8_t*) &dst[i], v);
+	}
+#endif
+
+	for (buf += i * 4; i < n; i++, buf += 4)
+		dst[i] = SHMIF_RGBA(buf[0], buf[1], buf[2], buf[3]);
+}
+
+static void row_wrap_intens_simd(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n)
+{
+	shmif_pixel* dst = wrap_row(chp, ofs);
+	const uint8_t* alpha = &chp->alpha[ofs];
+	size_t i = 0;
+
+#ifdef __SSE2__
+/* interleave to (v, v) and (v, a) byte pairs, then those pairs to pixels */
+	for (; i + 16 <= n; i += 16){
+		__m128i v = _mm_loadu_si128((const __m128i*) &buf[i]);
+		__m128i a = _mm_loadu_si128((const __m128i*) &alpha[i]);
+		__m128i vv_lo = _mm_unpacklo_epi8(v, v);
+		__m128i vv_hi = _mm_unpackhi_epi8(v, v);
+		__m128i va_lo = _mm_unpacklo_epi8(v, a);
+		__m128i va_hi = _mm_unpackhi_epi8(v, a);
+		__m128i* out = (__m128i*) &dst[i];
+		_mm_storeu_si128(&out[0], _mm_unpacklo_epi16(vv_lo, va_lo));
+		_mm_storeu_si128(&out[1], _mm_unpackhi_epi16(vv_lo, va_lo));
+		_mm_storeu_si128(&out[2], _mm_unpacklo_epi16(vv_hi, va_hi));
+		_mm_storeu_si128(&out[3], _mm_unpackhi_epi16(vv_hi, va_hi));
+	}
+#else
+	for (; i + 16 <= n; i += 16){
+		uint8x16x4_t px;
+		px.val[0] = px.val[1] = px.val[2] = vld1q_u8(&buf[i]);
+		px.val[3] = vld1q_u8(&alpha[i]);
+		vst4q_u8((uint8_t*) &dst[i], px);
+	}
+#endif
+
+	for (; i < n; i++)
+		dst[i] = SHMIF_RGBA(buf[i], buf[i], buf[i], alpha[i]);
+}
+#endif
+
+/*
+ * MAP_HILBERT, walk [ofs, ofs + n) one tile at a time so the writes stay
+ * within HILBERT_TILE rows, [pack] and [delta] are constant per wrapper.
+ */
+static inline void hilbert_span(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n, enum rwstat_pack pack, bool delta)
+{
+	size_t tt = chp->hb_tiles->tile * chp->hb_tiles->tile;
+	size_t pitch = chp->cont->pitch;
+	size_t step = pack_sizes[pack];
+	const uint8_t* alpha = chp->alpha;
+	size_t end = ofs + n;
+
+	while (ofs < end){
+		const struct hilbert_tile* tile = &chp->hb_tiles->tiles[ofs / tt];
+		size_t j = ofs % tt;
+		size_t lim = tt - j < end - ofs ? tt - j : end - ofs;
+		shmif_pixel* dst = &chp->cont->vidp[tile->y * pitch + tile->x];
+		const int32_t* tofs = &chp->hb_ofs[tile->orient * tt + j];
+
+		for (size_t i = 0; i < lim; i++, buf += step){
+			shmif_pixel val;
+			uint8_t av;
+
+			if (pack == PACK_TIGHT){
+				val = SHMIF_RGBA(buf[0], buf[1], buf[2], 0x00);
+				av = buf[3];
+			}
+			else if (pack == PACK_TNOALPHA){
+				val = SHMIF_RGBA(buf[0], buf[1], buf[2], 0x00);
+				av = alpha[ofs + i];
+			}
+			else {
+				val = SHMIF_RGBA(buf[0], buf[0], buf[0], 0x00);
+				av = alpha[ofs + i];
+			}
+
+			if (delta)
+				av = 0xff * ((dst[tofs[i]] & 0x00ffffff) != val);
+
+			dst[tofs[i]] = val | SHMIF_RGBA(0, 0, 0, av);
+		}
+
+		ofs += lim;
+	}
+}
+
+static void row_hilbert_tight(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n)
+{
+	hilbert_span(chp, buf, ofs, n, PACK_TIGHT, false);
+}
+
+static void row_hilbert_tnoalpha(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n)
+{
+	hilbert_span(chp, buf, ofs, n, PACK_TNOALPHA, false);
+}
+
+static void row_hilbert_intens(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n)
+{
+	hilbert_span(chp, buf, ofs, n, PACK_INTENS, false);
+}
+
+static void row_hilbert_tight_delta(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n)
+{
+	hilbert_span(chp, buf, ofs, n, PACK_TIGHT, true);
+}
+
+static void row_hilbert_tnoalpha_delta(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n)
+{
+	hilbert_span(chp, buf, ofs, n, PACK_TNOALPHA, true);
+}
+
+static void row_hilbert_intens_delta(struct rwstat_ch_priv* chp,
+	const uint8_t* buf, size_t ofs, size_t n)
+{
+	hilbert_span(chp, buf, ofs, n, PACK_INTENS, true);
+}
+
+/*
+ * [map][pack][alpha is RW_ALPHA_DELTA], NULL entries use row_generic.
+ * DELTA needs to read back the previous frame so it is left to pack_bytes.
+ */
+static const pack_row_fn row_kernels[4][3][2] = {
+	[MAP_WRAP] = {
+		[PACK_TIGHT] = {row_wrap_tight, NULL},
+		[PACK_TNOALPHA] = {row_wrap_tnoalpha, NULL},
+		[PACK_INTENS] = {row_wrap_intens, NULL}
+	},
+	[MAP_HILBERT] = {
+		[PACK_TIGHT] = {row_hilbert_tight, row_hilbert_tight_delta},
+		[PACK_TNOALPHA] = {row_hilbert_tnoalpha, row_hilbert_tnoalpha_delta},
+		[PACK_INTENS] = {row_hilbert_intens, row_hilbert_intens_delta}
+	}
+};
+
+static void select_kernel(struct rwstat_ch_priv* chp)
+{
+	pack_row_fn fn = row_kernels
+		[chp->map][chp->pack][chp->amode == RW_ALPHA_DELTA];
+
+/* tile tables missing, [cmap] is used instead */
+	if (chp->map == MAP_HILBERT && !chp->hb_ofs)
+		fn = NULL;
+
+#ifdef ROW_SIMD
+	shmif_pixel px = SHMIF_RGBA(0x01, 0x02, 0x03, 0x04);
+	uint8_t* pb = (uint8_t*) &px;
+
+	if (pb[0] == 0x03 && pb[1] == 0x02 && pb[2] == 0x01 && pb[3] == 0x04){
+		if (fn == row_wrap_tight)
+			fn = row_wrap_tight_simd;
+		else if (fn == row_wrap_intens)
+			fn = row_wrap_intens_simd;
+	}
+#endif
+
+	chp->pack_row = fn ? fn : row_generic;
+}
+
+/*
+ * (re-)allocate the entropy tables to match the current base, ent_base
+ * and packing size, invalidates any streaming state.
+ */
+static void ent_setup(struct rwstat_ch_priv* chp)
+{
+	if (!chp->ent_base || chp->ent_base > chp->base ||
+		chp->base % chp->ent_base != 0)
+		chp->ent_base = chp->base;
+
+	size_t bb = chp->ent_base * chp->pack_sz;
+	size_t nb = (chp->base * chp->base) / chp->ent_base;
+	chp->ent_valid = false;
+	chp->ent_slid = 0;
+
+	if (chp->ent_lut_sz != bb + 1){
+		free(chp->ent_lut);
+		chp->ent_lut = malloc(sizeof(float) * (bb + 1));
+		chp->ent_lut_sz = chp->ent_lut ? bb + 1 : 0;
+		for (size_t i = 0; i < chp->ent_lut_sz; i++)
+			chp->ent_lut[i] = i ? (float)i * log2f((float)i) : 0.0f;
+	}
+
+	if (chp->ent_blocks == nb && chp->ent_hgram)
+		return;
+
+	free(chp->ent_hgram);
+	free(chp->ent_sum);
+	chp->ent_hgram = NULL;
+	chp->ent_sum = NULL;
+	chp->ent_blocks = nb;
+
+	if (nb * 256 * sizeof(uint16_t) > RWSTAT_ENT_STATELIM)
+		return;
+
+	chp->ent_hgram = malloc(nb * 256 * sizeof(uint16_t));
+	chp->ent_sum = malloc(nb * sizeof(float));
+	if (!chp->ent_hgram || !chp->ent_sum){
+		free(chp->ent_hgram);
+		free(chp->ent_sum);
+		chp->ent_hgram = NULL;
+		chp->ent_sum = NULL;
+	}
+}
+
+/*
+ * rebuild the per-block histograms and sums from the current buffer
+ */
+static void ent_rebuild(struct rwstat_ch_priv* chp)
+{
+	size_t bb = chp->ent_base * chp->pack_sz;
+	const float* lut = chp->ent_lut;
+
+	memset(chp->ent_hgram, '\0', chp->ent_blocks * 256 * sizeof(uint16_t));
+
+	for (size_t k = 0; k < chp->ent_blocks; k++){
+		uint16_t* h = &chp->ent_hgram[k * 256];
+		uint8_t* buf = &chp->buf[k * bb];
+		float sum = 0.0f;
+
+		for (size_t i = 0; i < bb; i++){
+			uint16_t c = h[buf[i]]++;
+			sum += lut[c+1] - lut[c];
+		}
+		chp->ent_sum[k] = sum;
+	}
+
+	chp->ent_valid = true;
+	chp->ent_slid = 0;
+}
+
+/*
+ * The window is about to slide [ntw] bytes with [inbuf] (NULL for zeros)
+ * entering at the end. Each block loses its first [ntw] bytes and gains
+ * the first [ntw] of the next block (or the new data for the last one),
+ * so only those bytes touch the histograms. Must be called before the
+ * buffer is moved.
+ */
+static void ent_slide(struct rwstat_ch_priv* chp,
+	const uint8_t* inbuf, size_t ntw)
+{
+	size_t bb = chp->ent_base * chp->pack_sz;
+	const float* lut = chp->ent_lut;
+
+	for (size_t k = 0; k < chp->ent_blocks; k++){
+		uint16_t* h = &chp->ent_hgram[k * 256];
+		const uint8_t* out = &chp->buf[k * bb];
+		const uint8_t* in = k + 1 < chp->ent_blocks ? out + bb : inbuf;
+		float sum = chp->ent_sum[k];
+
+		for (size_t i = 0; i < ntw; i++){
+			uint16_t c = h[out[i]]--;
+			sum += lut[c-1] - lut[c];
+			c = h[in ? in[i] : 0]++;
+			sum += lut[c+1] - lut[c];
+		}
+		chp->ent_sum[k] = sum;
+	}
+
+/* floating point drift, amortize a full rebuild over one window */
+	chp->ent_slid += ntw;
+	if (chp->ent_slid >= chp->buf_sz)
+		chp->ent_valid = false;
+}
+
 /*
  * build alphamap with shannon entropy based on a specific blocksize,
  * bsz should always be % chp->buf_sz otherwise
@@ -235,53 +835,126 @@ postpack:
 static void update_entalpha(struct rwstat_ch_priv* chp, size_t bsz)
 {
 	size_t bsqr = chp->base * chp->base;
+	size_t bb = bsz * chp->pack_sz;
+
+	if (chp->ent_lut_sz != bb + 1)
+		ent_setup(chp);
+
+	if (!chp->ent_lut){
+		memset(chp->alpha, 0xff, bsqr);
+		return;
+	}
+
+	if (chp->ent_hgram){
+		if (!chp->ent_valid)
+			ent_rebuild(chp);
+
+		for (size_t k = 0; k < chp->ent_blocks; k++){
+			uint8_t entalpha = (uint8_t) (255.0f *
+				(shent_sum(chp->ent_sum[k], bb) / 8.0f));
+			memset(&chp->alpha[k * bsz], entalpha, bsz);
+		}
+		return;
+	}
 
 	for (size_t i = 0; i < bsqr; i += bsz){
 		uint8_t entalpha = (uint8_t) (255.0f *
-			(shent(&chp->buf[i*chp->pack_sz], bsz * chp->pack_sz) / 8.0f));
+			(shent(chp->ent_lut, &chp->buf[i*chp->pack_sz], bb) / 8.0f));
 
 		memset(&chp->alpha[i], entalpha, bsz);
 	}
 }
 
+static void rebuild_ptnmatch(struct rwstat_ch_priv* chp)
+{
+	ptn_match_free(&chp->ptn_match);
+	chp->ptn_dirty = false;
+
+	uint8_t* bufs[chp->n_patterns];
+	size_t sizes[chp->n_patterns];
+	for (size_t i = 0; i < chp->n_patterns; i++){
+		bufs[i] = chp->patterns[i].buf;
+		sizes[i] = chp->patterns[i].buf_sz;
+	}
+
+	chp->ptn_match = ptn_match_build(bufs, sizes, chp->n_patterns);
+}
+
+/* record the hit for the statistics stream, big endian id and offset */
+static void stats_hit(void* tag, size_t ind, size_t end)
+{
+	struct rwstat_ch_priv* chp = tag;
+	if (chp->n_stat_hits == STATS_HITLIM)
+		return;
+
+	uint32_t id = chp->patterns[ind].id;
+	size_t ofs = end + 1 - chp->patterns[ind].buf_sz;
+	uint8_t* dst = &chp->stat_hits[chp->n_stat_hits++ * 8];
+	dst[0] = id >> 24;
+	dst[1] = id >> 16;
+	dst[2] = id >> 8;
+	dst[3] = id;
+	dst[4] = ofs >> 24;
+	dst[5] = ofs >> 16;
+	dst[6] = ofs >> 8;
+	dst[7] = ofs;
+}
+
+/*
+ * Invoked by the matcher in buffer order, [end] is the byte offset of the
+ * last byte in the match. Pixels up to and including the one [end] maps to
+ * are filled with the current 'stateful' alpha before the match itself is
+ * painted, so a state pattern only affects the bytes that follow it.
+ */
+static void ptn_hit(void* tag, size_t ind, size_t end)
+{
+	struct rwstat_ch_priv* chp = tag;
+	struct pattern* ptn = &chp->patterns[ind];
+	size_t end_px = end / chp->pack_sz;
+
+	if (end_px >= chp->ptn_px){
+		memset(&chp->alpha[chp->ptn_px], chp->ptn_av, end_px - chp->ptn_px + 1);
+		chp->ptn_px = end_px + 1;
+	}
+
+	size_t start_px = (end + 1 - ptn->buf_sz) / chp->pack_sz;
+	memset(&chp->alpha[start_px], ptn->alpha, end_px - start_px + 1);
+
+	if ((ptn->flags & FLAG_STATE))
+		chp->ptn_av = ptn->alpha;
+	if ((ptn->flags & FLAG_EVENT))
+		ptn->evc++;
+	if (chp->stats)
+		stats_hit(chp, ind, end);
+}
+
 /*
  * Use the current set of patterns to populate the alpha buffer
  * that is then sampled when building the final output.
  */
 static void update_ptnalpha(struct rwstat_ch_priv* chp)
 {
-	uint8_t av = 0xff;
-	if (chp->n_patterns == 0){
-		memset(chp->alpha, av, chp->base * chp->base);
+	size_t bsqr = chp->base * chp->base;
+
+	if (chp->ptn_dirty)
+		rebuild_ptnmatch(chp);
+
+	if (chp->n_patterns == 0 || !chp->ptn_match){
+		memset(chp->alpha, 0xff, bsqr);
 		return;
 	}
 
-/* reset patterns */
-	for (size_t i = 0; i < chp->n_patterns; i++){
-		chp->patterns[i].buf_pos = 0;
+/* reset patterns, matching state is constrained to each synched buffer */
+	for (size_t i = 0; i < chp->n_patterns; i++)
 		chp->patterns[i].evc = 0;
-	}
-
-/* If ptn-match ever becomes a performance choke,
- * here is a good spot for adding parallelization. */
-	for (size_t i = 0; i < chp->buf_sz; i++){
-		chp->alpha[i] = av;
-
-		for (size_t j = 0; j < chp->n_patterns; j++){
-			struct pattern* ptn = &chp->patterns[j];
-			if (ptn->buf[ptn->buf_pos] == chp->buf[i])
-			 	if (++(ptn->buf_pos) == ptn->buf_sz){
-					chp->patterns[j].buf_pos = 0;
-					memset(&chp->alpha[i - ptn->buf_sz], ptn->alpha, ptn->buf_sz);
-					if ((ptn->flags & FLAG_STATE))
-						av = ptn->alpha;
-					if ((ptn->flags & FLAG_EVENT))
-						ptn->evc++;
-				}
-			}
 
-	}
+	uint32_t state = 0;
+	chp->ptn_px = 0;
+	chp->ptn_av = 0xff;
+	ptn_match_scan(chp->ptn_match, &state, chp->buf, chp->buf_sz, ptn_hit, chp);
 
+	if (chp->ptn_px < bsqr)
+		memset(&chp->alpha[chp->ptn_px], chp->ptn_av, bsqr - chp->ptn_px);
 
 /* Check matched patterns and fire an event with the matching
  * identifier, and the number of times each event was matched
@@ -299,6 +972,161 @@ static void update_ptnalpha(struct rwstat_ch_priv* chp)
 		}
 }
 
+/*
+ * Header message followed by multipart messages with two hex digits per
+ * byte in [buf], the same framing sense_mem uses for the dirty mask.
+ */
+static void send_hex(struct arcan_shmif_cont* cont,
+	const char* hdr, const uint8_t* buf, size_t n)
+{
+	static const char hex[] = "0123456789abcdef";
+	arcan_event ev = {
+		.category = EVENT_EXTERNAL,
+		.ext.kind = ARCAN_EVENT(MESSAGE)
+	};
+	size_t lim = sizeof(ev.ext.message.data) - 1;
+	snprintf((char*)ev.ext.message.data, lim + 1, "%s", hdr);
+	ev.ext.message.multipart = n > 0;
+	arcan_shmif_enqueue(cont, &ev);
+
+	size_t ofs = 0;
+	for (size_t i = 0; i < n; i++){
+		ev.ext.message.data[ofs++] = hex[buf[i] >> 4];
+		ev.ext.message.data[ofs++] = hex[buf[i] & 0x0f];
+		if (ofs + 2 > lim || i == n - 1){
+			ev.ext.message.data[ofs] = '\0';
+			ev.ext.message.multipart = i < n - 1;
+			arcan_shmif_enqueue(cont, &ev);
+			ofs = 0;
+		}
+	}
+}
+
+/*
+ * Statistics side stream so that the UI doesn't have to read back and
+ * process the frame itself, collected for each frame while enabled. A set
+ * of the four messages below is a few hundred events at large bases, so
+ * it is paced by the consumer: each STATS_ON asks for one set, which is
+ * sent right away if a frame is waiting and otherwise after the next one.
+ * Frames in between only replace the waiting set. [frame] is the
+ * FRAMESTATUS pts of the frame the statistics belong to.
+ *
+ * stats_hgram:frame:max:total - 256 bins scaled to 255 * count / max
+ * stats_ent:frame:blocks:block_sz - 255 * entropy / 8 per ent_base block
+ * stats_rows:frame:rows - min, max byte value for each row
+ * stats_ptn:frame:hits - 32-bit big endian pattern id and byte offset
+ */
+static void send_stats(struct rwstat_ch_priv* chp)
+{
+	if (!chp->stat_want || !chp->stat_ready)
+		return;
+
+	size_t n_blocks = chp->stat_set.n_blocks;
+	size_t n_rows = chp->stat_set.rows;
+	uint8_t* ent = chp->stat_buf;
+	uint8_t* rows = &ent[n_blocks];
+	uint8_t* bins = &rows[2 * n_rows];
+
+	char hdr[64];
+	size_t frame = chp->stat_set.frame;
+	snprintf(hdr, sizeof(hdr), "stats_hgram:%zu:%"PRIu32":%zu",
+		frame, chp->stat_set.max, chp->stat_set.total);
+	send_hex(chp->cont, hdr, bins, 256);
+
+	snprintf(hdr, sizeof(hdr), "stats_ent:%zu:%zu:%zu",
+		frame, n_blocks, chp->stat_set.block_sz);
+	send_hex(chp->cont, hdr, ent, n_blocks);
+
+	snprintf(hdr, sizeof(hdr), "stats_rows:%zu:%zu", frame, n_rows);
+	send_hex(chp->cont, hdr, rows, 2 * n_rows);
+
+	snprintf(hdr, sizeof(hdr), "stats_ptn:%zu:%zu", frame, chp->n_stat_hits);
+	send_hex(chp->cont, hdr, chp->stat_hits, chp->n_stat_hits * 8);
+
+	chp->stat_want = chp->stat_ready = false;
+}
+
+/* fill [stat_buf] and [stat_set] from the frame in [buf], see send_stats */
+static void collect_stats(struct rwstat_ch_priv* chp)
+{
+/* ent_base is only valid after the first setup */
+	if (!chp->ent_base || chp->ent_lut_sz != chp->ent_base * chp->pack_sz + 1)
+		ent_setup(chp);
+
+	size_t bb = chp->ent_base * chp->pack_sz;
+	size_t row_sz = chp->base * chp->pack_sz;
+	size_t n_blocks = chp->buf_sz / bb;
+	size_t need = n_blocks + 2 * chp->base + 256;
+
+	if (chp->stat_buf_sz < need){
+		uint8_t* buf = realloc(chp->stat_buf, need);
+		chp->stat_ready = false;
+		if (!buf)
+			return;
+		chp->stat_buf = buf;
+		chp->stat_buf_sz = need;
+	}
+
+	uint8_t* ent = chp->stat_buf;
+	uint8_t* rows = &ent[n_blocks];
+	uint8_t* bins = &rows[2 * chp->base];
+	uint32_t hgram[256] = {0};
+	uint16_t bh[256];
+
+/* blocks nest in rows as ent_base always divides base */
+	for (size_t y = 0, k = 0; y < chp->base; y++){
+		const uint8_t* row = &chp->buf[y * row_sz];
+		uint8_t lo = 0xff, hi = 0x00;
+
+		for (size_t b = 0; b < row_sz; b += bb, k++){
+			float sum = 0.0f;
+			memset(bh, '\0', sizeof(bh));
+
+			for (size_t i = b; i < b + bb; i++){
+				uint8_t v = row[i];
+				hgram[v]++;
+				lo = v < lo ? v : lo;
+				hi = v > hi ? v : hi;
+				if (chp->ent_lut){
+					uint16_t c = bh[v]++;
+					sum += chp->ent_lut[c+1] - chp->ent_lut[c];
+				}
+			}
+
+			ent[k] = chp->ent_lut ?
+				(uint8_t)(255.0f * (shent_sum(sum, bb) / 8.0f)) : 0xff;
+		}
+
+		rows[y * 2 + 0] = lo;
+		rows[y * 2 + 1] = hi;
+	}
+
+	uint32_t max = 1;
+	for (size_t i = 0; i < 256; i++)
+		max = hgram[i] > max ? hgram[i] : max;
+	for (size_t i = 0; i < 256; i++)
+		bins[i] = (uint64_t) hgram[i] * 255 / max;
+
+/* outside of the pattern alpha, the hits have to be collected separately */
+	if (chp->amode != RW_ALPHA_PTN && chp->n_patterns){
+		if (chp->ptn_dirty)
+			rebuild_ptnmatch(chp);
+
+		uint32_t state = 0;
+		chp->n_stat_hits = 0;
+		ptn_match_scan(chp->ptn_match, &state,
+			chp->buf, chp->buf_sz, stats_hit, chp);
+	}
+
+	chp->stat_set.frame = chp->cnt_total;
+	chp->stat_set.total = chp->buf_sz;
+	chp->stat_set.rows = chp->base;
+	chp->stat_set.n_blocks = n_blocks;
+	chp->stat_set.block_sz = bb;
+	chp->stat_set.max = max;
+	chp->stat_ready = true;
+}
+
 /*
  * Build the output buffer and push/synch to an external recipient,
  * taking mapping function, alpha population functions, and timing-
@@ -317,6 +1145,7 @@ static void ch_step(struct rwstat_ch* ch)
 
 	size_t ntw = chp->base * chp->base;
 	ch->event(ch, &outev);
+	stage_export(&chp->stages, chp->cont);
 
 /*
  * Notify about the packing mode active for this frame. This is
@@ -342,22 +1171,37 @@ static void ch_step(struct rwstat_ch* ch)
 		ch->event(ch, &outev);
 	}
 
-	if ( 1 == (chp->clock & (RW_CLK_SLIDE)) )
-		rebuild_hgram(chp);
+/* hits from the pattern alpha pass go to the statistics of this frame */
+	chp->n_stat_hits = 0;
 
-	if (chp->amode == RW_ALPHA_ENTBASE)
+	uint64_t ts = stage_begin(&chp->stages);
+	if (chp->amode == RW_ALPHA_ENTBASE){
 		update_entalpha(chp, chp->ent_base);
+		stage_end(&chp->stages, STAGE_ENT, ts);
+	}
 
-	else if (chp->amode == RW_ALPHA_PTN)
+	else if (chp->amode == RW_ALPHA_PTN){
 		update_ptnalpha(chp);
+		stage_end(&chp->stages, STAGE_PTN, ts);
+	}
 
-	for (size_t i = 0; i < chp->buf_sz; i += chp->pack_sz)
-		pack_bytes(chp, &chp->buf[i], i / chp->pack_sz);
+	ts = stage_begin(&chp->stages);
+	size_t row_sz = chp->base * chp->pack_sz;
+	for (size_t y = 0; y < chp->base; y++)
+		chp->pack_row(chp, &chp->buf[y * row_sz], y * chp->base, chp->base);
+	stage_end(&chp->stages, STAGE_PACK, ts);
 
+	ts = stage_begin(&chp->stages);
 	chp->cont->addr->vpts = ch->priv->cnt_total;
 	arcan_shmif_signal(chp->cont, SHMIF_SIGVID);
+	stage_end(&chp->stages, STAGE_SIGNAL, ts);
 	chp->cnt_local = chp->cnt_total;
 
+	if (chp->stats){
+		collect_stats(chp);
+		send_stats(chp);
+	}
+
 /* non-sparse mappings require an output flush */
 	if (chp->map == MAP_TUPLE || chp->map == MAP_TUPLE_ACC){
 		shmif_pixel val = SHMIF_RGBA(0x00, 0x00, 0x00, 0xff);
@@ -375,6 +1219,7 @@ static size_t ch_data(struct rwstat_ch* ch,
 	uint8_t* buf, size_t buf_sz, int* step)
 {
 	struct rwstat_ch_priv* chp = ch->priv;
+	uint64_t ts = stage_begin(&chp->stages);
 	size_t ntw;
 
 /* larger write chunks are equivalent to a block slide,
@@ -382,29 +1227,52 @@ static size_t ch_data(struct rwstat_ch* ch,
 	if (ch->priv->clock == RW_CLK_SLIDE){
 		if (buf_sz < chp->buf_sz){
 			ntw = buf_sz;
-			chp->buf_ofs = chp->buf_sz - ntw;
-			memmove(chp->buf, chp->buf + ntw, chp->buf_ofs);
+
+/* small slides can update the entropy blocks in place, otherwise it is
+ * cheaper to just rebuild them on the next step */
+			if (chp->amode == RW_ALPHA_ENTBASE && chp->ent_hgram &&
+				chp->ent_valid && ntw * 2 < chp->ent_base * chp->pack_sz)
+				ent_slide(chp, buf, ntw);
+			else
+				chp->ent_valid = false;
+
+/* window histogram, the incoming bytes are added in ring_write */
+			for (size_t i = 0; i < ntw; i++)
+				chp->hgram[ chp->buf[i] ]--;
 		}
-		else
+		else {
 			ntw = chp->buf_sz;
+			chp->ent_valid = false;
+			memset(chp->hgram, '\0', sizeof(chp->hgram));
+		}
+
+		ring_write(chp, buf, ntw);
+		chp->buf_ofs = chp->buf_sz;
 	}
-	else
+	else {
 		ntw = buf_sz < (chp->buf_sz - chp->buf_ofs) ?
 			buf_sz : chp->buf_sz - chp->buf_ofs;
+		chp->ent_valid = false;
 
-/* add to remap buffer and histogram,
- * histogram need to be rebuilt for CLK_SLIDE but add > branch */
-	if (buf)
-	for (size_t i = 0; i < ntw; i++){
-		chp->hgram[ buf[i] ]++;
-		chp->buf[ chp->buf_ofs++ ] = buf[i];
-	}
-	else {
-		chp->hgram[0] += ntw;
-		memset(&chp->buf[ chp->buf_ofs ], '\0', ntw);
-		chp->buf_ofs += ntw;
+/* blocks are written through [buf], keep it at the start of the ring */
+		if (chp->head)
+			ring_align(chp);
+
+/* add to remap buffer and histogram, accumulates over the transfer */
+		if (buf)
+		for (size_t i = 0; i < ntw; i++){
+			chp->hgram[ buf[i] ]++;
+			chp->buf[ chp->buf_ofs++ ] = buf[i];
+		}
+		else {
+			chp->hgram[0] += ntw;
+			memset(&chp->buf[ chp->buf_ofs ], '\0', ntw);
+			chp->buf_ofs += ntw;
+		}
 	}
 
+	stage_end(&chp->stages, STAGE_DATA, ts);
+
 	if (chp->buf_ofs == chp->buf_sz){
 		chp->buf_ofs = 0;
 		*step = 1;
@@ -441,10 +1309,25 @@ static bool ch_pattern(struct rwstat_ch* ch,
 	newp->alpha = alpha;
 	newp->id = id;
 	newp->flags = fl;
+	chp->ptn_dirty = true;
+	chp->ptn_gen++;
 
 	return true;
 }
 
+static size_t ch_scan(struct rwstat_ch* ch,
+	const uint8_t* buf, size_t buf_sz, uint32_t* state)
+{
+	struct rwstat_ch_priv* chp = ch->priv;
+
+	if (chp->ptn_dirty){
+		rebuild_ptnmatch(chp);
+		*state = 0;
+	}
+
+	return ptn_match_scan(chp->ptn_match, state, buf, buf_sz, NULL, NULL);
+}
+
 static void ch_tick(struct rwstat_ch* ch)
 {
 	ch_step(ch);
@@ -473,6 +1356,8 @@ static void ch_pack(struct rwstat_ch* ch, enum rwstat_pack pack)
 	case MAP_HILBERT: break; /* can use the buf_ofs value for this */
 	}
 
+	select_kernel(chp);
+
 /* since packing size might have changed, we need to do a sanity check */
 	if (chp->buf_sz != (chp->base * chp->base) * chp->pack_sz)
 		ch->resize(ch, chp->base);
@@ -490,11 +1375,21 @@ static void ch_map(struct rwstat_ch* ch, enum rwstat_mapping map)
 		chp->cmap = NULL;
 	}
 
+	free(chp->hb_ofs);
+	chp->hb_ofs = NULL;
+	chp->hb_tiles = NULL;
+
 	size_t hsz = ch->priv->base * ch->priv->base;
 
-/* some mapping modes need a LUT for the ofs = F(X,Y) */
+/* some mapping modes need a LUT for the ofs = F(X,Y), the tiled hilbert
+ * walk needs the curve to subdivide evenly, base is a power of two */
 	if (map == MAP_WRAP || map == MAP_TUPLE || map == MAP_TUPLE_ACC)
 		;
+	else if (map == MAP_HILBERT && chp->base > 1 &&
+		(chp->base & (chp->base - 1)) == 0 &&
+		(chp->hb_tiles = hilbert_tiles(chp->base)) &&
+		(chp->hb_ofs = hilbert_offsets(chp->hb_tiles->tile, chp->cont->pitch)))
+		;
 	else if (map == MAP_HILBERT){
 		uint16_t* cmap = malloc( 2 * 2 * hsz );
 		for (size_t i = 0; i < hsz; i++){
@@ -506,6 +1401,8 @@ static void ch_map(struct rwstat_ch* ch, enum rwstat_mapping map)
 		chp->cmap = cmap;
 	}
 
+	select_kernel(chp);
+
 /* changing mapping mode may require different packing dimensions reset the
  * buffer to reflect change in mapping mode, this doesn't matter in CLK_BYTES
  * but for other modes */
@@ -541,8 +1438,11 @@ static void ch_alpha(struct rwstat_ch* ch, enum rwstat_alpha amode)
 			if (amode == 0 || chp->ent_base > chp->base ||
 				chp->base % chp->ent_base != 0)
 				chp->ent_base = chp->base;
+
+			ent_setup(chp);
 		}
 
+		select_kernel(chp);
 		chp->status_dirty = true;
 		ch_step(ch);
 	}
@@ -557,6 +1457,11 @@ static void ch_reclock(struct rwstat_ch* ch, enum rwstat_clock clock)
 {
 /*	ch_step(ch); - somewhat uncertain if there is any valid point
  *	in enforcing a step on the change of clocking function */
+	if (clock == RW_CLK_SLIDE && ch->priv->clock != RW_CLK_SLIDE){
+		ring_align(ch->priv);
+		rebuild_hgram(ch->priv);
+	}
+
 	ch->priv->clock = clock;
 }
 
@@ -568,13 +1473,22 @@ static size_t ch_rowsz(struct rwstat_ch* ch)
 static void ch_free(struct rwstat_ch** ch)
 {
 	struct rwstat_ch_priv* chp = (*ch)->priv;
+	stage_summary(&chp->stages, stderr, "rwstat");
+
 	for (size_t i = 0; i < chp->patterns_sz; i++){
 		free(chp->patterns[i].buf);
 	}
 	free(chp->patterns);
-
-	if (chp->buf){
-		free(chp->buf);
+	ptn_match_free(&chp->ptn_match);
+	free(chp->cmap);
+	free(chp->hb_ofs);
+	free(chp->ent_lut);
+	free(chp->ent_hgram);
+	free(chp->ent_sum);
+	free(chp->stat_buf);
+
+	if (chp->ring){
+		free(chp->ring);
 		free(chp->alpha);
 	}
 
@@ -607,8 +1521,8 @@ static void ch_resize(struct rwstat_ch* ch, size_t base)
 	if (ch->priv->buf_sz == bsqr * ch->priv->pack_sz)
 		goto done;
 
-	if (ch->priv->buf){
-		free(ch->priv->buf);
+	if (ch->priv->ring){
+		free(ch->priv->ring);
 		free(ch->priv->alpha);
 	}
 	ch->priv->buf_sz = bsqr * ch->priv->pack_sz;
@@ -617,15 +1531,24 @@ static void ch_resize(struct rwstat_ch* ch, size_t base)
 /* we allocate some guard_bytes here to avoid the nasty combination
  * of switching packing+map modes that require more bytes than we can
  * currently deliver but don't want to wait for a full-step immediately */
-	ch->priv->buf = malloc(ch->priv->buf_sz + base);
-	memset(ch->priv->buf + ch->priv->buf_sz, '\0', base);
+	ch->priv->ring = malloc(2 * ch->priv->buf_sz + base);
+	memset(ch->priv->ring, '\0', 2 * ch->priv->buf_sz + base);
+	ch->priv->buf = ch->priv->ring;
+	ch->priv->head = 0;
 	ch->priv->alpha = malloc(bsqr);
 
-	memset(ch->priv->buf, '\0', ch->priv->buf_sz);
 	memset(ch->priv->alpha, 0xff, bsqr);
 	ch->priv->base = base;
-	ch->priv->sf_x = (float) (base-1) / 255.0f;
-	ch->priv->sf_y = (float) (base-1) / 255.0f;
+
+	float sf = (float) (base-1) / 255.0f;
+	for (size_t i = 0; i < 256; i++)
+		ch->priv->tuple_lut[i] = (float)i * sf;
+
+	if (ch->priv->clock == RW_CLK_SLIDE)
+		rebuild_hgram(ch->priv);
+
+	if (ch->priv->amode == RW_ALPHA_ENTBASE)
+		ent_setup(ch->priv);
 
 done:
 	ch_map(ch, ch->priv->map);
@@ -740,6 +1663,21 @@ static bool alpha_ent(struct rwstat_ch* ch, arcan_event* ev)
 	return true;
 }
 
+static bool stats_on(struct rwstat_ch* ch, arcan_event* ev)
+{
+	ch->priv->stats = true;
+	ch->priv->stat_want = true;
+	send_stats(ch->priv);
+	return true;
+}
+
+static bool stats_off(struct rwstat_ch* ch, arcan_event* ev)
+{
+	ch->priv->stats = false;
+	ch->priv->stat_want = ch->priv->stat_ready = false;
+	return true;
+}
+
 static bool step_fwd(struct rwstat_ch* ch, arcan_event* ev)
 {
 	*ev = (struct arcan_event){
@@ -846,6 +1784,16 @@ static struct {
 		.sym = TUIK_F,
 		.handler = alpha_full,
 	},
+	{
+		.label = "STATS_ON",
+		.descr = "Send histogram / entropy / row / pattern statistics, one set per request",
+		.handler = stats_on
+	},
+	{
+		.label = "STATS_OFF",
+		.descr = "Stop sending per frame statistics",
+		.handler = stats_off
+	},
 	{
 		.label = "STEP_FWD",
 		.descr = "Tell the sensor to incrementally sample new data",
@@ -1044,6 +1992,7 @@ struct rwstat_ch* rwstat_addch(
 	res->wind_ofs = ch_wind;
 	res->resize = ch_resize;
 	res->add_pattern = ch_pattern;
+	res->scan = ch_scan;
 	res->left = ch_left;
 	res->base = ch_base;
 	res->row_size = ch_rowsz;
@@ -1053,7 +2002,27 @@ struct rwstat_ch* rwstat_addch(
 	res->priv->amode = RW_ALPHA_FULL;
 	res->switch_packing(res, PACK_INTENS);
 	res->priv->status_dirty = true;
+	stage_init(&res->priv->stages);
 
 	register_data_inputs(c);
 	return res;
 }
+
+struct stage_timer* rwstat_timer(struct rwstat_ch* ch)
+{
+	return &ch->priv->stages;
+}
+
+size_t rwstat_patterns(struct rwstat_ch* ch,
+	uint8_t** bufs, size_t* sizes, size_t lim, unsigned* gen)
+{
+	struct rwstat_ch_priv* chp = ch->priv;
+	for (size_t i = 0; i < chp->n_patterns && i < lim; i++){
+		bufs[i] = chp->patterns[i].buf;
+		sizes[i] = chp->patterns[i].buf_sz;
+	}
+
+	if (gen)
+		*gen = chp->ptn_gen;
+	return chp->n_patterns;
+}
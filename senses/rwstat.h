@@ -111,6 +111,15 @@ struct rwstat_ch {
 	bool (*add_pattern)(struct rwstat_ch*, uint8_t alpha, uint32_t id,
 		enum ptn_flags, void* buf, size_t sz);
 
+/*
+ * Run the current set of patterns over [buf] without touching the channel
+ * buffers or output, [state] carries partial matches between calls and is
+ * reset if the set has changed. Returns the number of matches, lets a feeder
+ * look for triggers in data it doesn't forward.
+ */
+	size_t (*scan)(struct rwstat_ch*,
+		const uint8_t* buf, size_t buf_sz, uint32_t* state);
+
 /* change the offset counter that is propagated in parent communication */
 	void (*wind_ofs)(struct rwstat_ch*, off_t val);
 
@@ -149,3 +158,19 @@ bool rwstat_consume_event(struct rwstat_ch*, struct arcan_event*);
  * rwstat channel.
  */
 void rwstat_addpatterns(struct rwstat_ch*, struct arg_arr*);
+
+/*
+ * Stage timing for the channel (see stagetime.h), lets the sensor add the
+ * cost of reading from its source.
+ */
+struct stage_timer;
+struct stage_timer* rwstat_timer(struct rwstat_ch*);
+
+/*
+ * Reference up to [lim] of the patterns in the current set, the buffers
+ * belong to the channel. [gen] is set to a counter that changes whenever a
+ * pattern is added, so a feeder can tell when to refresh anything it built
+ * from the set. Returns the number of patterns in the set.
+ */
+size_t rwstat_patterns(struct rwstat_ch*,
+	uint8_t** bufs, size_t* sizes, size_t lim, unsigned* gen);
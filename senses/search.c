@@ -0,0 +1,601 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Background search index, see search.h
+ *
+ * The ranges are cut into chunks that never cross a range boundary. Each
+ * pattern set gets a 'run' that the workers claim chunks from, starting with
+ * the chunk the viewer was in when the set changed. A restart cancels the
+ * run and the results are dropped, workers still busy with a chunk of the
+ * old run see that when they come back to commit and leave.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "ptnmatch.h"
+#include "search.h"
+
+/* unit of work for the workers and for scanning on demand */
+#define SEARCH_CHUNK (1024 * 1024)
+
+/* past this many hits a chunk only keeps the count, a pattern like a single
+ * zero byte would otherwise cost several times the size of the source, and
+ * lookups in such a chunk scan it again instead */
+#define SEARCH_CHUNKHITS 65536
+
+/* upper bound on how much search_next scans itself before giving up */
+#define SEARCH_SYNCLIM (16 * SEARCH_CHUNK)
+
+struct search_chunk {
+	uint64_t lo, hi;
+	size_t range;
+
+/* sorted start offsets, NULL with n_hits set if the chunk was too dense */
+	uint64_t* hits;
+	size_t n_hits;
+	bool done;
+};
+
+/* one per pattern set, shared between the index and the workers for it */
+struct search_run {
+	struct search_index* idx;
+	struct ptn_match* match;
+	size_t* sizes;
+	size_t overlap;
+
+/* chunks are claimed in order from [first], wrapping around */
+	size_t first, next;
+	bool cancel;
+	unsigned refs;
+};
+
+struct search_index {
+	pthread_mutex_t lock;
+	pthread_cond_t idle;
+
+	const uint8_t* map;
+	search_read read;
+	struct search_range* ranges;
+	size_t n_ranges;
+
+	struct search_chunk* chunks;
+	size_t n_chunks, n_done;
+
+/* the fixed set from search_create */
+	uint8_t** ptns;
+	size_t* sizes;
+	size_t n_ptns;
+
+	struct search_run* run;
+	unsigned gen, workers;
+};
+
+/* hits from scanning one chunk, [bound] is the chunk size */
+struct search_hits {
+	struct search_run* run;
+	size_t limit, bound;
+	uint64_t base;
+
+	uint64_t* hits;
+	size_t n_hits, cap, count;
+	bool dense;
+};
+
+static int cmp_ofs(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*) a;
+	uint64_t y = *(const uint64_t*) b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void hits_dense(struct search_hits* hs)
+{
+	free(hs->hits);
+	hs->hits = NULL;
+	hs->n_hits = hs->cap = 0;
+	hs->dense = true;
+}
+
+static void collect_hit(void* tag, size_t ind, size_t end)
+{
+	struct search_hits* hs = tag;
+	size_t start = end + 1 - hs->run->sizes[ind];
+
+/* matches that start in the overlap belong to the next chunk */
+	if (start >= hs->bound)
+		return;
+
+	hs->count++;
+	if (hs->dense)
+		return;
+
+	if (hs->n_hits == hs->limit){
+		hits_dense(hs);
+		return;
+	}
+
+	if (hs->n_hits == hs->cap){
+		size_t ncap = hs->cap ? hs->cap * 2 : 256;
+		uint64_t* hits = realloc(hs->hits, sizeof(uint64_t) * ncap);
+		if (!hits){
+			hits_dense(hs);
+			return;
+		}
+		hs->hits = hits;
+		hs->cap = ncap;
+	}
+
+	hs->hits[hs->n_hits++] = hs->base + start;
+}
+
+/*
+ * Chunk boundaries and ranges never change after search_create, so this
+ * runs without holding the lock. Returns false if the chunk couldn't be
+ * read, [hs] is always initialized.
+ */
+static bool scan_chunk(struct search_index* idx,
+	struct search_run* run, size_t ci, size_t limit, struct search_hits* hs)
+{
+	struct search_chunk* c = &idx->chunks[ci];
+	struct search_range* r = &idx->ranges[c->range];
+	size_t sz = c->hi - c->lo;
+	size_t tail = run->overlap ? run->overlap - 1 : 0;
+	if (tail > r->hi - c->hi)
+		tail = r->hi - c->hi;
+
+	*hs = (struct search_hits){
+		.run = run,
+		.limit = limit,
+		.bound = sz,
+		.base = c->lo
+	};
+
+	const uint8_t* buf = idx->map ? &idx->map[c->lo] : NULL;
+	uint8_t* tmp = NULL;
+	size_t nb = sz + tail;
+	if (!buf){
+		tmp = malloc(nb);
+		if (!tmp)
+			return false;
+		nb = idx->read(r->tag, c->lo, tmp, nb);
+		buf = tmp;
+	}
+
+	uint32_t state = 0;
+	ptn_match_scan(run->match, &state, buf, nb, collect_hit, hs);
+	free(tmp);
+
+/* several patterns can start at the same offset */
+	if (hs->n_hits > 1){
+		qsort(hs->hits, hs->n_hits, sizeof(uint64_t), cmp_ofs);
+		size_t n = 1;
+		for (size_t i = 1; i < hs->n_hits; i++)
+			if (hs->hits[i] != hs->hits[n-1])
+				hs->hits[n++] = hs->hits[i];
+		hs->n_hits = n;
+	}
+
+	if (!hs->dense)
+		hs->count = hs->n_hits;
+
+	return true;
+}
+
+/* takes over the hits unless there are too many to keep */
+static void commit_chunk(
+	struct search_index* idx, size_t ci, struct search_hits* hs)
+{
+	struct search_chunk* c = &idx->chunks[ci];
+	c->n_hits = hs->count;
+	c->done = true;
+	idx->n_done++;
+
+	if (!hs->dense && hs->n_hits <= SEARCH_CHUNKHITS){
+		c->hits = hs->hits;
+		hs->hits = NULL;
+	}
+}
+
+static void run_release(struct search_run* run)
+{
+	if (--run->refs)
+		return;
+
+	ptn_match_free(&run->match);
+	free(run->sizes);
+	free(run);
+}
+
+static void* search_worker(void* arg)
+{
+	struct search_run* run = arg;
+	struct search_index* idx = run->idx;
+
+	pthread_mutex_lock(&idx->lock);
+	while (!run->cancel && run->next < idx->n_chunks){
+		size_t ci = (run->first + run->next++) % idx->n_chunks;
+		if (idx->chunks[ci].done)
+			continue;
+
+		pthread_mutex_unlock(&idx->lock);
+		struct search_hits hs;
+		bool ok = scan_chunk(idx, run, ci, SEARCH_CHUNKHITS, &hs);
+		pthread_mutex_lock(&idx->lock);
+
+		if (ok && !run->cancel && !idx->chunks[ci].done)
+			commit_chunk(idx, ci, &hs);
+		free(hs.hits);
+	}
+
+	run_release(run);
+	idx->workers--;
+	pthread_cond_broadcast(&idx->idle);
+	pthread_mutex_unlock(&idx->lock);
+	return NULL;
+}
+
+/* first chunk that ends after [ofs] */
+static size_t find_chunk(struct search_index* idx, uint64_t ofs)
+{
+	size_t lo = 0, hi = idx->n_chunks;
+	while (lo < hi){
+		size_t mid = lo + (hi - lo) / 2;
+		if (idx->chunks[mid].hi <= ofs)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* first hit at or past [ofs], n if there is none */
+static size_t first_from(const uint64_t* hits, size_t n, uint64_t ofs)
+{
+	size_t lo = 0, hi = n;
+	while (lo < hi){
+		size_t mid = lo + (hi - lo) / 2;
+		if (hits[mid] < ofs)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/* dense chunks only have a count, spread it evenly over the chunk */
+static size_t dense_share(
+	const struct search_chunk* c, uint64_t lo, uint64_t hi)
+{
+	uint64_t a = lo > c->lo ? lo : c->lo;
+	uint64_t b = hi < c->hi ? hi : c->hi;
+	if (b <= a)
+		return 0;
+
+	return (double) c->n_hits * (double)(b - a) / (double)(c->hi - c->lo);
+}
+
+static void stop_run(struct search_index* idx)
+{
+	if (!idx->run)
+		return;
+
+	idx->run->cancel = true;
+	run_release(idx->run);
+	idx->run = NULL;
+}
+
+/* leave a core for the feeder and the preview */
+static unsigned worker_count(size_t n_chunks)
+{
+	long nt = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if (nt <= 0)
+		nt = 1;
+	if ((size_t) nt > n_chunks)
+		nt = n_chunks;
+	return nt;
+}
+
+bool search_restart(struct search_index* idx,
+	uint8_t* const* ptns, const size_t* sizes, size_t n, uint64_t from)
+{
+	pthread_mutex_lock(&idx->lock);
+	stop_run(idx);
+	for (size_t i = 0; i < idx->n_chunks; i++){
+		free(idx->chunks[i].hits);
+		idx->chunks[i].hits = NULL;
+		idx->chunks[i].n_hits = 0;
+		idx->chunks[i].done = false;
+	}
+	idx->n_done = 0;
+	idx->gen++;
+
+	size_t total = idx->n_ptns + n;
+	if (!total || !idx->n_chunks){
+		pthread_mutex_unlock(&idx->lock);
+		return true;
+	}
+
+	struct search_run* run = malloc(sizeof(struct search_run));
+	uint8_t** bufs = malloc(sizeof(uint8_t*) * total);
+	size_t* run_sizes = malloc(sizeof(size_t) * total);
+	if (!run || !bufs || !run_sizes){
+		free(run);
+		free(bufs);
+		free(run_sizes);
+		pthread_mutex_unlock(&idx->lock);
+		return false;
+	}
+
+	for (size_t i = 0; i < idx->n_ptns; i++){
+		bufs[i] = idx->ptns[i];
+		run_sizes[i] = idx->sizes[i];
+	}
+	for (size_t i = 0; i < n; i++){
+		bufs[idx->n_ptns + i] = ptns[i];
+		run_sizes[idx->n_ptns + i] = sizes[i];
+	}
+
+	*run = (struct search_run){
+		.idx = idx,
+		.match = ptn_match_build(bufs, run_sizes, total),
+		.sizes = run_sizes,
+		.first = find_chunk(idx, from),
+		.refs = 1
+	};
+	free(bufs);
+
+	if (!run->match){
+		run_release(run);
+		pthread_mutex_unlock(&idx->lock);
+		return false;
+	}
+
+	run->overlap = ptn_match_maxlen(run->match);
+	if (run->first >= idx->n_chunks)
+		run->first = 0;
+	idx->run = run;
+
+/* if no worker could be started, search_next still scans on demand */
+	unsigned nt = worker_count(idx->n_chunks);
+	for (size_t i = 0; i < nt; i++){
+		pthread_t pth;
+		run->refs++;
+		idx->workers++;
+		if (0 != pthread_create(&pth, NULL, search_worker, run)){
+			run->refs--;
+			idx->workers--;
+			break;
+		}
+		pthread_detach(pth);
+	}
+
+	pthread_mutex_unlock(&idx->lock);
+	return true;
+}
+
+struct search_index* search_create(const uint8_t* map, search_read read,
+	const struct search_range* ranges, size_t n_ranges,
+	uint8_t* const* ptns, const size_t* sizes, size_t n_ptns)
+{
+	if (!map && !read)
+		return NULL;
+
+	struct search_index* idx = malloc(sizeof(struct search_index));
+	if (!idx)
+		return NULL;
+
+	*idx = (struct search_index){
+		.map = map,
+		.read = read
+	};
+	pthread_mutex_init(&idx->lock, NULL);
+	pthread_cond_init(&idx->idle, NULL);
+
+	size_t n_chunks = 0;
+	for (size_t i = 0; i < n_ranges; i++)
+		if (ranges[i].hi > ranges[i].lo)
+			n_chunks += (ranges[i].hi - ranges[i].lo + SEARCH_CHUNK - 1) / SEARCH_CHUNK;
+
+	idx->ranges = malloc(sizeof(struct search_range) * (n_ranges ? n_ranges : 1));
+	idx->chunks = malloc(sizeof(struct search_chunk) * (n_chunks ? n_chunks : 1));
+	idx->ptns = malloc(sizeof(uint8_t*) * (n_ptns ? n_ptns : 1));
+	idx->sizes = malloc(sizeof(size_t) * (n_ptns ? n_ptns : 1));
+	if (!idx->ranges || !idx->chunks || !idx->ptns || !idx->sizes){
+		search_free(idx);
+		return NULL;
+	}
+
+	memcpy(idx->ranges, ranges, sizeof(struct search_range) * n_ranges);
+	idx->n_ranges = n_ranges;
+
+	for (size_t i = 0; i < n_ranges; i++)
+		for (uint64_t lo = ranges[i].lo; lo < ranges[i].hi; lo += SEARCH_CHUNK){
+			uint64_t hi = ranges[i].hi - lo > SEARCH_CHUNK ?
+				lo + SEARCH_CHUNK : ranges[i].hi;
+			idx->chunks[idx->n_chunks++] = (struct search_chunk){
+				.lo = lo,
+				.hi = hi,
+				.range = i
+			};
+		}
+
+	for (size_t i = 0; i < n_ptns; i++){
+		uint8_t* buf = malloc(sizes[i] ? sizes[i] : 1);
+		if (!buf){
+			search_free(idx);
+			return NULL;
+		}
+		memcpy(buf, ptns[i], sizes[i]);
+		idx->ptns[i] = buf;
+		idx->sizes[i] = sizes[i];
+		idx->n_ptns++;
+	}
+
+	if (n_ptns)
+		search_restart(idx, NULL, NULL, 0, 0);
+
+	return idx;
+}
+
+enum search_status search_next(struct search_index* idx,
+	uint64_t ofs, bool fwd, uint64_t* hit)
+{
+	pthread_mutex_lock(&idx->lock);
+	struct search_run* run = idx->run;
+	if (!run){
+		pthread_mutex_unlock(&idx->lock);
+		return SEARCH_NONE;
+	}
+	run->refs++;
+
+/* the chunk [ofs] is in, or the closest one in the search direction */
+	ssize_t cur = find_chunk(idx, ofs);
+	if (!fwd && ((size_t) cur == idx->n_chunks || idx->chunks[cur].lo > ofs))
+		cur--;
+
+	enum search_status rv = SEARCH_NONE;
+	size_t synced = 0;
+
+	for (; cur >= 0 && (size_t) cur < idx->n_chunks; cur += fwd ? 1 : -1){
+		struct search_chunk* c = &idx->chunks[cur];
+		struct search_hits hs = {0};
+		const uint64_t* hits = c->hits;
+		size_t n = c->n_hits;
+
+/* not reached yet or too dense to keep, look for ourselves */
+		if (!c->done || (!c->hits && c->n_hits)){
+			if (synced >= SEARCH_SYNCLIM){
+				rv = SEARCH_PENDING;
+				break;
+			}
+			synced += c->hi - c->lo;
+
+			pthread_mutex_unlock(&idx->lock);
+			bool ok = scan_chunk(idx, run, cur, SIZE_MAX, &hs);
+			pthread_mutex_lock(&idx->lock);
+
+			if (!ok || run->cancel){
+				free(hs.hits);
+				rv = SEARCH_PENDING;
+				break;
+			}
+
+			hits = hs.hits;
+			n = hs.n_hits;
+			if (!c->done)
+				commit_chunk(idx, cur, &hs);
+		}
+
+		size_t i = first_from(hits, n, ofs);
+		if (fwd && i < n && hits[i] == ofs)
+			i++;
+
+		bool found = fwd ? i < n : i > 0;
+		if (found)
+			*hit = fwd ? hits[i] : hits[i-1];
+
+		free(hs.hits);
+		if (found){
+			rv = SEARCH_FOUND;
+			break;
+		}
+	}
+
+	run_release(run);
+	pthread_mutex_unlock(&idx->lock);
+	return rv;
+}
+
+size_t search_count(struct search_index* idx, uint64_t lo, uint64_t hi)
+{
+	size_t res = 0;
+
+	pthread_mutex_lock(&idx->lock);
+	for (size_t i = find_chunk(idx, lo);
+		i < idx->n_chunks && idx->chunks[i].lo < hi; i++){
+		struct search_chunk* c = &idx->chunks[i];
+		if (!c->done)
+			continue;
+
+		if (c->hits)
+			res += first_from(c->hits, c->n_hits, hi) -
+				first_from(c->hits, c->n_hits, lo);
+		else
+			res += dense_share(c, lo, hi);
+	}
+	pthread_mutex_unlock(&idx->lock);
+
+	return res;
+}
+
+void search_density(struct search_index* idx,
+	uint64_t lo, size_t step, uint32_t* bins, size_t n_bins)
+{
+	if (!step || !n_bins)
+		return;
+
+	uint64_t hi = lo + (uint64_t) step * n_bins;
+
+	pthread_mutex_lock(&idx->lock);
+	for (size_t i = find_chunk(idx, lo);
+		i < idx->n_chunks && idx->chunks[i].lo < hi; i++){
+		struct search_chunk* c = &idx->chunks[i];
+		if (!c->done || !c->n_hits)
+			continue;
+
+		if (c->hits){
+			for (size_t j = first_from(c->hits, c->n_hits, lo);
+				j < c->n_hits && c->hits[j] < hi; j++)
+				bins[(c->hits[j] - lo) / step]++;
+			continue;
+		}
+
+		uint64_t a = c->lo > lo ? c->lo : lo;
+		uint64_t b = c->hi < hi ? c->hi : hi;
+		for (size_t bin = (a - lo) / step; bin < n_bins && lo + bin * step < b; bin++)
+			bins[bin] += dense_share(c, lo + bin * step, lo + (bin + 1) * step);
+	}
+	pthread_mutex_unlock(&idx->lock);
+}
+
+unsigned search_progress(struct search_index* idx, size_t* done, size_t* total)
+{
+	pthread_mutex_lock(&idx->lock);
+	*done = idx->n_done;
+	*total = idx->n_chunks;
+	unsigned gen = idx->gen;
+	pthread_mutex_unlock(&idx->lock);
+
+	return gen;
+}
+
+void search_free(struct search_index* idx)
+{
+	if (!idx)
+		return;
+
+	pthread_mutex_lock(&idx->lock);
+	stop_run(idx);
+	while (idx->workers)
+		pthread_cond_wait(&idx->idle, &idx->lock);
+	pthread_mutex_unlock(&idx->lock);
+
+	for (size_t i = 0; i < idx->n_chunks; i++)
+		free(idx->chunks[i].hits);
+	for (size_t i = 0; i < idx->n_ptns; i++)
+		free(idx->ptns[i]);
+
+	free(idx->chunks);
+	free(idx->ranges);
+	free(idx->ptns);
+	free(idx->sizes);
+	pthread_cond_destroy(&idx->idle);
+	pthread_mutex_destroy(&idx->lock);
+	free(idx);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Background "find next" index. A set of patterns is matched
+ * over an entire source (a file mapping or a set of process memory ranges)
+ * by a pool of worker threads, one chunk at a time starting from where the
+ * viewer is. The start offset of every hit is kept sorted per chunk so that
+ * a data window can jump to the next or previous hit without stepping a
+ * window at a time through the source, and a preview can show where the hits
+ * are while the index is being built.
+ */
+
+#ifndef HAVE_SEARCH
+#define HAVE_SEARCH
+
+struct search_index;
+
+/* [lo, hi) in source offsets, [tag] is passed to the reader */
+struct search_range {
+	uint64_t lo, hi;
+	void* tag;
+};
+
+/*
+ * Copy [sz] bytes at [ofs] from the range with [tag] into [dst], returns the
+ * number of bytes that could be read.
+ */
+typedef size_t (*search_read)(void* tag, uint64_t ofs, uint8_t* dst, size_t sz);
+
+enum search_status {
+	SEARCH_FOUND = 0,
+	SEARCH_NONE = 1,   /* no hit in that direction                 */
+	SEARCH_PENDING = 2 /* not indexed far enough to tell, try again */
+};
+
+/*
+ * Setup an index over [n_ranges] sorted, non-overlapping ranges. If [map] is
+ * set, the offsets are relative to it and it is read directly, otherwise the
+ * ranges go through [read]. [ptns] is a fixed set that is always searched for
+ * in addition to what is given to search_restart. It is copied, and if it is
+ * non-empty the workers start right away. Returns NULL on failure.
+ */
+struct search_index* search_create(const uint8_t* map, search_read read,
+	const struct search_range* ranges, size_t n_ranges,
+	uint8_t* const* ptns, const size_t* sizes, size_t n_ptns);
+
+/*
+ * Drop the current results and search for the fixed set and [ptns] instead,
+ * the chunks from [from] and onwards are searched first. The buffers are not
+ * retained. Returns false if the new set couldn't be compiled, the index is
+ * empty until the next restart.
+ */
+bool search_restart(struct search_index*,
+	uint8_t* const* ptns, const size_t* sizes, size_t n, uint64_t from);
+
+/*
+ * Start offset of the first hit after [ofs], or the last one before it if
+ * [fwd] isn't set. Chunks that the workers haven't reached yet are scanned
+ * by the caller, up to SEARCH_SYNCLIM bytes, before giving up with
+ * SEARCH_PENDING.
+ */
+enum search_status search_next(struct search_index*,
+	uint64_t ofs, bool fwd, uint64_t* hit);
+
+/* number of indexed hits that start in [lo, hi) */
+size_t search_count(struct search_index*, uint64_t lo, uint64_t hi);
+
+/*
+ * Add the indexed hits that start in [lo, lo + step * n_bins) to [bins],
+ * one bin per [step] bytes.
+ */
+void search_density(struct search_index*,
+	uint64_t lo, size_t step, uint32_t* bins, size_t n_bins);
+
+/*
+ * Number of chunks that have been indexed out of [total], the returned
+ * value changes with every restart so a consumer can tell when its view of
+ * the index is stale.
+ */
+unsigned search_progress(struct search_index*, size_t* done, size_t* total);
+
+/* waits for the workers to finish their current chunk */
+void search_free(struct search_index*);
+
+#endif
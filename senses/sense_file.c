@@ -10,6 +10,10 @@
  * [ ] draw position on update
  * [ ] update identity
  */
+
+/* madvise() for the data window prefetcher is outside of plain POSIX */
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -21,7 +25,6 @@
 #include <errno.h>
 #include <math.h>
 #include <getopt.h>
-#include <stdatomic.h>
 
 #include <arcan_shmif.h>
 #include <poll.h>
@@ -34,13 +37,16 @@
 
 #include "libsenseye.h"
 #include "rwstat.h"
+#include "batch.h"
+#include "detect.h"
+#include "search.h"
 #include "sense_file_ch.c"
+#include "sense_file_pyr.c"
 
 #define EPSILON 0.0000001f
 
 struct data_window {
 	struct senseye_ch* ch;
-	pthread_t pth;
 	int id;
 
 /* ipc with the thread */
@@ -52,6 +58,11 @@ struct data_window {
 	size_t last_pos_sz;
 	size_t last_count_px;
 	size_t last_coord[2];
+
+/* shared with the thread, and the index state the density was drawn at */
+	struct search_index* search;
+	unsigned search_gen;
+	size_t search_done;
 };
 
 static struct {
@@ -67,6 +78,21 @@ static struct {
 	bool wrap, detailed, in_rebuild;
 	uint32_t alloc;
 
+/* bumped on every rebuild so that an interrupted one can tell, and the
+ * number of pyramid leaves the edge markers were last drawn with */
+	unsigned preview_gen;
+	size_t edge_leaves;
+
+/* prebuilt batch index for the file, if one was provided */
+	struct batch_region* index;
+	size_t index_n;
+	struct batch_region* report;
+
+/* hit density from the search index, one value per preview pixel (pitch
+ * layout) so that the position overlay can restore it */
+	uint8_t* density;
+	size_t density_sz, density_n;
+
 /* preparation to be able to handle multiple sample points for the same file */
 	struct data_window windows[1];
 	size_t n_windows;
@@ -88,7 +114,18 @@ static int usage()
 		"\t-p x,--pcomp=x \thistogram row-row comparison in preview\n"
 		"\t               \targ. val (0.0 - 1.0) sets cutoff level\n"
 		"\t-d,--pdetail \tuse entire data range for pcomparison\n"
+		"\t-i x,--index=x \tcache preview data in index file x\n"
+		"\t-r x,--report=x \tpreload a batch report made with -b\n"
+		"\t-P x,--pattern=x \tlook for x (hex bytes, e.g. 4d,5a), repeatable,\n"
+		"\t                 \tseeds the find next index or the batch report\n"
 		"\t-?,--help \tthis text\n"
+		"\nBatch mode, no connection, every remaining argument is an input:\n"
+		"\t-b x,--batch=x \twrite the report to x (- for stdout)\n"
+		"\t-j,--jsonl \twrite JSON lines instead of a binary index\n"
+		"\t-B n,--block=n \tbytes per entropy value (default: %d)\n"
+		"\t-D,--nodetect \tdon't run the image / executable detectors\n"
+		"\t-t n,--threads=n \tnumber of workers (default: one per core)\n",
+		BATCH_DEFWINDOW
 	);
 
 	return EXIT_SUCCESS;
@@ -100,105 +137,345 @@ static const struct option longopts[] = {
 	{"height", required_argument, NULL, 'h'},
 	{"pcomp",  required_argument, NULL, 'p'},
 	{"pdetail",no_argument,       NULL, 'd'},
+	{"index",  required_argument, NULL, 'i'},
+	{"report", required_argument, NULL, 'r'},
+	{"batch",  required_argument, NULL, 'b'},
+	{"jsonl",  no_argument,       NULL, 'j'},
+	{"block",  required_argument, NULL, 'B'},
+	{"pattern",required_argument, NULL, 'P'},
+	{"nodetect",no_argument,      NULL, 'D'},
+	{"threads",required_argument, NULL, 't'},
 	{"help",   required_argument, NULL, '?'},
 	{NULL, no_argument, NULL, 0}
 };
 
-static float cmp_histo(int32_t* a, int32_t* b, float roww)
+/*
+ * per-bin square root of the normalized histogram, the Bhattacharyya
+ * coefficient between two rows is then the dot product of their vectors
+ */
+static void histo_sqrt(const uint64_t* h, uint64_t total, float* out)
 {
-	float bcf = 0, sum_1 = 0, sum_2 = 0;
-	for (size_t i = 0; i < 256; i++){
-		float na = ((float)a[i]+EPSILON) / roww;
-		float nb = ((float)b[i]+EPSILON) / roww;
-		bcf += sqrt(na * nb);
-		sum_1 += na;
-		sum_2 += nb;
-	}
-	float rnd = floor(sum_1 + 0.5);
-	bcf = bcf > rnd ? rnd : bcf;
-	return 1.0 - sqrtf(rnd - bcf);
+	float fn = (float)total;
+	for (size_t i = 0; i < 256; i++)
+		out[i] = sqrtf(((float)h[i] + EPSILON) / fn);
 }
 
-static bool rebuild_preview(struct senseye_cont* cont,
-	uint8_t* map, size_t map_sz, float cutoff, bool detailed)
+static float cmp_histo(const float* a, const float* b)
 {
-/* update preview, try to retain a ~60 fps synch- rate */
-	struct arcan_shmif_cont* c = cont->context(cont);
-	size_t step_sz = map_sz / (c->w * c->h);
-	fsense.in_rebuild = false;
+	float bcf = 0;
+	for (size_t i = 0; i < 256; i++)
+		bcf += a[i] * b[i];
 
-	if (step_sz == 0)
-		step_sz = 1;
+	bcf = bcf > 1.0f ? 1.0f : bcf;
+	return 1.0f - sqrtf(1.0f - bcf);
+}
 
+/*
+ * mark rows where the histogram differs from the previous row, detailed
+ * uses the entire byte range of each row (through the pyramid) otherwise
+ * only the bytes that were sampled for the preview.
+ */
+static void draw_edges(struct arcan_shmif_cont* c,
+	size_t step_sz, float cutoff, bool detailed)
+{
 	size_t bytes_perline = step_sz * c->w;
-	size_t pos = 0;
-	size_t row = 0;
+	shmif_pixel red = SHMIF_RGBA(0xff, 0x00, 0x00, 0x00);
+	uint64_t hist[256];
+	float cur[256], prev[256];
+	bool have_prev = false;
+
+	for (size_t row = 0; row < c->h; row++){
+		size_t lo = row * bytes_perline;
+		uint64_t total = 0;
+
+		if (lo < fsense.map_sz && detailed)
+			total = pyr_range(lo, lo + bytes_perline, hist);
+		else if (lo < fsense.map_sz){
+			memset(hist, '\0', sizeof(hist));
+			for (size_t i = 0; i < c->w && lo < fsense.map_sz; i++, lo += step_sz){
+				hist[fsense.map[lo]]++;
+				total++;
+			}
+		}
 
-/* clear before generating preview */
-	for (size_t i = 0; i < c->w * c->h; i++)
-		c->vidp[i] = SHMIF_RGBA(0x00, 0x00, 0x00, 0xff);
+		bool edge = false;
+		if (total){
+			histo_sqrt(hist, total, cur);
+			edge = have_prev && cmp_histo(cur, prev) < cutoff;
+			memcpy(prev, cur, sizeof(cur));
+		}
+		have_prev = total > 0;
 
-	unsigned long long last = arcan_timemillis();
+		shmif_pixel* dst = &c->vidp[row * c->pitch];
+		for (size_t i = 0; i < c->w; i++)
+			dst[i] = edge ? (dst[i] | red) : (dst[i] & ~red);
+	}
+}
 
-/* using histograms in preview to try and find edges between datatypes */
-	int32_t dr[256];
-	int32_t cr[256];
-	bool dirty = false;
+/*
+ * The entropy from a preloaded report goes into the preview alpha channel,
+ * the same way that the data channel presents it with the entropy alpha.
+ * Each pixel takes the value of the window its first byte falls in.
+ */
+static void draw_report(struct arcan_shmif_cont* c, size_t step_sz)
+{
+	struct batch_region* rep = fsense.report;
+	shmif_pixel amask = SHMIF_RGBA(0x00, 0x00, 0x00, 0xff);
+
+	for (size_t row = 0; row < c->h; row++){
+		shmif_pixel* dst = &c->vidp[row * c->pitch];
+		for (size_t x = 0; x < c->w; x++){
+			size_t ind = ((row * c->w + x) * step_sz) / rep->window;
+			if (ind >= rep->n_entropy)
+				return;
+			dst[x] = (dst[x] & ~amask) | SHMIF_RGBA(0, 0, 0, rep->entropy[ind]);
+		}
+	}
+}
 
-	while (pos + step_sz < map_sz && row < c->h){
-		size_t cpos = pos;
-		dirty = true;
+/*
+ * Hits from the search index go into the blue channel, brighter the more
+ * hits there are in the bytes a pixel covers compared to the densest pixel.
+ * Only repaints if the index has changed since the last time unless [force]
+ * is set, returns true if anything was drawn.
+ */
+static bool draw_density(struct arcan_shmif_cont* c,
+	struct data_window* wnd, size_t step_sz, bool force)
+{
+	if (!wnd->search)
+		return false;
 
-		for (size_t i = 0; i < c->w && pos < map_sz; i++){
-			c->vidp[row * c->w + i] = SHMIF_RGBA(0x00, map[pos], 0x00, 0xff);
+	size_t done, total;
+	unsigned gen = search_progress(wnd->search, &done, &total);
+	if (!force && gen == wnd->search_gen && done == wnd->search_done)
+		return false;
 
-			if (!(isnan(cutoff))){
-				if (detailed)
-					for (size_t j = 0; j < step_sz && pos < map_sz; j++)
-						dr[map[pos+j]]++;
-				else
-					dr[map[pos]]++;
-			}
+	wnd->search_gen = gen;
+	wnd->search_done = done;
+
+	size_t np = c->w * c->h;
+	size_t dn = c->pitch * c->h;
+	if (dn > fsense.density_sz){
+		uint8_t* dens = realloc(fsense.density, dn);
+		if (!dens)
+			return false;
+		fsense.density = dens;
+		fsense.density_sz = dn;
+	}
+
+	uint32_t* bins = calloc(np, sizeof(uint32_t));
+	if (!bins)
+		return false;
+
+	search_density(wnd->search, 0, step_sz, bins, np);
+	uint32_t max = 0;
+	for (size_t i = 0; i < np; i++)
+		max = bins[i] > max ? bins[i] : max;
+
+	shmif_pixel blue = SHMIF_RGBA(0x00, 0x00, 0xff, 0x00);
+	for (size_t row = 0; row < c->h; row++){
+		shmif_pixel* dst = &c->vidp[row * c->pitch];
+		uint8_t* dd = &fsense.density[row * c->pitch];
+		for (size_t x = 0; x < c->w; x++){
+			uint32_t n = bins[row * c->w + x];
+			dd[x] = n ? 0x40 + (uint64_t) 0xbf * n / max : 0;
+			dst[x] = (dst[x] & ~blue) | SHMIF_RGBA(0x00, 0x00, dd[x], 0x00);
+		}
+	}
+	fsense.density_n = dn;
+
+	free(bins);
+	return true;
+}
+
+/* what the density left in the blue channel of pixel [ind] */
+static shmif_pixel density_px(size_t ind)
+{
+	if (ind >= fsense.density_n)
+		return 0;
+
+	return SHMIF_RGBA(0x00, 0x00, fsense.density[ind], 0x00);
+}
+
+/* upper bound on the number of hits that are announced on connection */
+#define REPORT_MSGLIM 64
+
+/*
+ * Forward the hits in the report as senseye_hit:name:offset:length messages,
+ * followed by senseye_report:hits:windows:window_size
+ */
+static void send_report(struct arcan_shmif_cont* c)
+{
+	struct batch_region* rep = fsense.report;
+	arcan_event ev = {
+		.category = EVENT_EXTERNAL,
+		.ext.kind = ARCAN_EVENT(MESSAGE)
+	};
+	size_t lim = COUNT_OF(ev.ext.message.data);
+
+	for (size_t i = 0; i < rep->n_hits && i < REPORT_MSGLIM; i++){
+		snprintf((char*)ev.ext.message.data, lim,
+			"senseye_hit:%s:%"PRIu64":%"PRIu32, batch_hit_name(NULL, &rep->hits[i]),
+			rep->hits[i].ofs, rep->hits[i].len);
+		arcan_shmif_enqueue(c, &ev);
+	}
+
+	snprintf((char*)ev.ext.message.data, lim, "senseye_report:%zu:%zu:%zu",
+		rep->n_hits, rep->n_entropy, rep->window);
+	arcan_shmif_enqueue(c, &ev);
+}
+
+/*
+ * Pick the report entry for [name] (any entry if there is only one) and
+ * only use it if it was made from something of the same size.
+ */
+static bool load_report(const char* path, const char* name, size_t sz)
+{
+	fsense.index = batch_load(path, &fsense.index_n);
+	if (!fsense.index){
+		fprintf(stderr, "couldn't load report (%s)\n", path);
+		return false;
+	}
+
+	struct batch_region* rep = fsense.index_n == 1 ?
+		fsense.index : batch_find(fsense.index, fsense.index_n, name);
+
+	if (!rep || rep->size != sz){
+		fprintf(stderr, "report (%s) doesn't cover %s\n", path, name);
+		return false;
+	}
+
+	fsense.report = rep;
+	return true;
+}
+
+/*
+ * Headless sweep over [files], one region in the report per file, named by
+ * the path as it was given. Returns the exit status.
+ */
+static int run_batch(struct batch_opts* opts,
+	const char* dst, enum batch_fmt fmt, char** files, int n_files)
+{
+	bool use_stdout = strcmp(dst, "-") == 0;
+	FILE* fout = use_stdout ? stdout : fopen(dst, "w");
+	if (!fout){
+		fprintf(stderr, "couldn't open report (%s) for writing\n", dst);
+		return EXIT_FAILURE;
+	}
 
-			pos += step_sz;
+	if (!batch_prepare(opts) || !batch_write_header(fout, fmt)){
+		fprintf(stderr, "couldn't setup batch scanning\n");
+		if (!use_stdout)
+			fclose(fout);
+		return EXIT_FAILURE;
+	}
+
+	int rc = EXIT_SUCCESS;
+	for (int i = 0; i < n_files; i++){
+		struct stat fs;
+		int fd = open(files[i], O_RDONLY);
+		if (-1 == fd || -1 == fstat(fd, &fs) || !S_ISREG(fs.st_mode)){
+			fprintf(stderr, "skipping %s, not a readable regular file\n", files[i]);
+			if (-1 != fd)
+				close(fd);
+			rc = EXIT_FAILURE;
+			continue;
 		}
-/* can do this on the preview sample scale or detailed */
-		if (!isnan(cutoff)){
-			float val = cmp_histo(dr, cr, detailed ? step_sz * c->w : c->w);
-			memcpy(cr, dr, sizeof(dr));
-			memset(dr, '\0', sizeof(dr));
-			if (val < cutoff)
-				for(size_t i = 0; i < c->w; i++)
-					c->vidp[row * c->w + i] |= SHMIF_RGBA(0xff, 0x00, 0x00, 0x00);
+
+		uint8_t* map = NULL;
+		if (fs.st_size > 0){
+			map = mmap(NULL, fs.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (MAP_FAILED == map){
+				fprintf(stderr, "skipping %s, couldn't mmap\n", files[i]);
+				close(fd);
+				rc = EXIT_FAILURE;
+				continue;
+			}
+/* the workers each start at a different part of the file */
+			madvise(map, fs.st_size, MADV_WILLNEED);
 		}
+		close(fd);
 
-/* update events to maintain interactivity, may exit */
-		if (!senseye_pump(cont, false)){
-			fsense.in_rebuild = false;
-			return false;
+		struct batch_region reg;
+		batch_region_init(&reg, files[i], 0, opts->window);
+		bool ok = !map || batch_scan(opts, &reg, map, fs.st_size, 0);
+		if (map)
+			munmap(map, fs.st_size);
+
+		if (!ok || !batch_write(fout, fmt, opts, &reg)){
+			fprintf(stderr, "couldn't scan or write report for %s\n", files[i]);
+			rc = EXIT_FAILURE;
 		}
+		batch_region_free(&reg);
+	}
+
+	if (use_stdout)
+		fflush(fout);
+	else if (0 != fclose(fout))
+		rc = EXIT_FAILURE;
+
+	batch_opts_free(opts);
+	return rc;
+}
 
-/* draw preview- processing "edge" */
-		if (arcan_timemillis() - last > 14){
-			for (size_t i = 0; i < c->w && row < c->h; i++)
-				c->vidp[(row+1) * c->w + i] = SHMIF_RGBA(0xff, 0x00, 0x00, 0xff);
+static bool rebuild_preview(struct senseye_cont* cont,
+	uint8_t* map, size_t map_sz, float cutoff, bool detailed)
+{
+	struct arcan_shmif_cont* c = cont->context(cont);
+	size_t step_sz = map_sz / (c->w * c->h);
+	unsigned gen = ++fsense.preview_gen;
+
+	if (step_sz == 0)
+		step_sz = 1;
+
+/* clear before generating preview */
+	pyr_preview_stop();
+	fsense.density_n = 0;
+	for (size_t y = 0; y < c->h; y++)
+		for (size_t x = 0; x < c->w; x++)
+			c->vidp[y * c->pitch + x] = SHMIF_RGBA(0x00, 0x00, 0x00, 0xff);
+
+/* the workers fill in the passes, we try to retain a ~60 fps synch- rate
+ * and keep processing events, any of which may start a new rebuild */
+	bool cached = pyr_preview_load(c, step_sz);
+
+	for (size_t s = PYR_BASESTRIDE; s > 0 && !cached; s /= 2){
+		pyr_preview_pass(c, step_sz, s);
+
+		while (!pyr_preview_wait(14)){
 			arcan_shmif_signal(c, SHMIF_SIGVID);
-			last = arcan_timemillis();
-			dirty = false;
+			if (!senseye_pump(cont, false))
+				return false;
+			if (gen != fsense.preview_gen)
+				return true;
 		}
 
-		row++;
+		arcan_shmif_signal(c, SHMIF_SIGVID);
+		if (!senseye_pump(cont, false))
+			return false;
+		if (gen != fsense.preview_gen)
+			return true;
 	}
 
-	fsense.in_rebuild = false;
+	if (!cached)
+		pyr_preview_save(c, step_sz);
 
-	if (dirty){
-		uint64_t pos = fsense.windows[0].last_pos;
-		fsense.windows[0].last_pos = (uint64_t)-1;
-		update_region(c, &fsense.windows[0], pos);
-		arcan_shmif_signal(c, SHMIF_SIGVID);
-		last = arcan_timemillis();
+	if (fsense.report)
+		draw_report(c, step_sz);
+
+	if (!isnan(cutoff)){
+		fsense.edge_leaves =
+			__atomic_load_n(&pyr.leaves_done, __ATOMIC_SEQ_CST);
+		draw_edges(c, step_sz, cutoff, detailed);
 	}
+
+	draw_density(c, &fsense.windows[0], step_sz, true);
+
+	uint64_t pos = fsense.windows[0].last_pos;
+	fsense.windows[0].last_pos = (uint64_t)-1;
+	update_region(c, &fsense.windows[0], pos);
+	arcan_shmif_signal(c, SHMIF_SIGVID);
+
 	return true;
 }
 
@@ -214,6 +491,9 @@ void control_event(struct senseye_cont* cont, arcan_event* ev)
 			(abs((int)ev->tgt.ioevs[0].iv - (int)c->w) > 0 ||
 			abs((int)ev->tgt.ioevs[1].iv - (int)c->h) > 0);
 
+			if (dev)
+				pyr_preview_stop();
+
 			if (dev && senseye_resize(cont, ev->tgt.ioevs[0].iv, ev->tgt.ioevs[1].iv)){
 				rebuild_preview(cont,
 					fsense.map, fsense.map_sz, fsense.cutoff, fsense.detailed);
@@ -243,7 +523,8 @@ void control_event(struct senseye_cont* cont, arcan_event* ev)
 		&& ev->io.input.digital.active){
 		arcan_shmif_mousestate(c, fsense.mstate, NULL, &x, &y);
 		uint64_t ofs = y * bytes_perline + x * step_sz;
-		write(fsense.windows[0].pipe_out, &ofs, sizeof(ofs));
+		if (-1 != fsense.windows[0].pipe_out)
+			write(fsense.windows[0].pipe_out, &ofs, sizeof(ofs));
 	}
 }
 
@@ -266,7 +547,8 @@ static void update_region(
 			wnd->last_coord[1] * cont->pitch + wnd->last_coord[0]];
 		size_t np = wnd->last_count_px;
 		while(np-- && dst < endm){
-			*dst++ &= mask;
+			*dst = (*dst & mask) | density_px(dst - cont->vidp);
+			dst++;
 		}
 	}
 
@@ -297,14 +579,25 @@ static void update_region(
 	}
 }
 
-static bool spawn_ch(
-	size_t ofs, const char* name, size_t base, bool wrap, struct data_window* dst)
+/* the thread side has finished, stop the index workers and drop our end */
+static void window_closed(struct data_window* wnd)
+{
+	search_free(wnd->search);
+	wnd->search = NULL;
+	close(wnd->pipe_in);
+	close(wnd->pipe_out);
+	wnd->pipe_in = wnd->pipe_out = -1;
+}
+
+static bool spawn_ch(size_t ofs, const char* name, size_t base,
+	bool wrap, const struct batch_opts* seed, struct data_window* dst)
 {
 	struct senseye_ch* chan = senseye_open(&fsense.cont, name, base);
 	struct fsense_thdata* thd = malloc(sizeof(struct fsense_thdata));
 	static int chind = 1;
 	if (!chan || !thd){
 		fprintf(stderr, "couldn't map data channel, parent rejected.\n");
+		free(thd);
 		return false;
 	}
 /* use a pipe to signal / wake to split polling events on shared memory
@@ -315,6 +608,14 @@ static bool spawn_ch(
 	pipe(&pipes[2]);
 	for (size_t i = 0; i < 4; i++)
 		fcntl(pipes[i], F_SETFL, O_NONBLOCK);
+
+/* without an index the find bindings just report that nothing was found */
+	struct search_range whole = {.lo = 0, .hi = fsense.map_sz};
+	struct search_index* search = search_create(fsense.map, NULL,
+		&whole, 1, seed->ptns, seed->ptn_sz, seed->n_ptns);
+	if (!search)
+		fprintf(stderr, "couldn't setup search index.\n");
+
 	*thd = (struct fsense_thdata){
 		.ch = chan,
 		.fmap = fsense.map,
@@ -322,16 +623,24 @@ static bool spawn_ch(
 		.wrap = wrap,
 		.ind = chind,
 		.pipe_in = pipes[0],
-		.pipe_out = pipes[3]
+		.pipe_out = pipes[3],
+		.search = search
 	};
-	pthread_t pth;
-	pthread_create(&pth, NULL, data_window_loop, thd);
+	if (!senseye_schedule(chan,
+		pipes[0], data_window_step, data_window_done, thd)){
+		fprintf(stderr, "couldn't schedule data channel.\n");
+		search_free(search);
+		for (size_t i = 0; i < 4; i++)
+			close(pipes[i]);
+		free(thd);
+		return false;
+	}
 	*dst = (struct data_window){
 		.ch = chan,
-		.pth = pth,
 		.id = chind++,
 		.pipe_out = pipes[1],
-		.pipe_in = pipes[2]
+		.pipe_in = pipes[2],
+		.search = search
 	};
 	return true;
 }
@@ -344,10 +653,16 @@ int main(int argc, char* argv[])
 	size_t p_w = 128;
 	size_t p_h = 512;
 	bool detailed = false, wrap = false;
+	const char* index = NULL;
+	const char* report = NULL;
+	const char* batch = NULL;
+	enum batch_fmt batch_fmt = BATCH_BINARY;
+	struct batch_opts bopts = {0};
 	int ch;
 	fsense.cutoff = NAN;
 
-	while((ch = getopt_long(argc, argv, "Ww:h:p:d?", longopts, NULL)) >= 0)
+	while((ch =
+		getopt_long(argc, argv, "Ww:h:p:di:r:b:jB:P:Dt:?", longopts, NULL)) >= 0)
 	switch(ch){
 	case '?' :
 		return usage();
@@ -361,6 +676,37 @@ int main(int argc, char* argv[])
 	break;
 	case 'd' : detailed = true;
 	break;
+	case 'i' :
+		index = optarg;
+	break;
+	case 'r' :
+		report = optarg;
+	break;
+	case 'b' :
+		batch = optarg;
+	break;
+	case 'j' :
+		batch_fmt = BATCH_JSONL;
+	break;
+	case 'B' :
+		bopts.window = strtoul(optarg, NULL, 10);
+		if (bopts.window == 0 || bopts.window > BATCH_MAXWINDOW){
+			printf("invalid -B,--block argument, expected 1..%d\n", BATCH_MAXWINDOW);
+			return EXIT_FAILURE;
+		}
+	break;
+	case 'P' :
+		if (!batch_addpattern(&bopts, optarg)){
+			printf("invalid -P,--pattern argument (%s)\n", optarg);
+			return EXIT_FAILURE;
+		}
+	break;
+	case 'D' :
+		bopts.no_detect = true;
+	break;
+	case 't' :
+		bopts.threads = strtoul(optarg, NULL, 10);
+	break;
 	case 'W' :
 		wrap = true;
 	break;
@@ -387,6 +733,9 @@ int main(int argc, char* argv[])
 		return usage();
 	}
 
+	if (batch)
+		return run_batch(&bopts, batch, batch_fmt, &argv[optind], argc - optind);
+
 	int fd = open(argv[optind], O_RDONLY);
 	struct stat buf;
 	if (-1 == fstat(fd, &buf)){
@@ -411,13 +760,25 @@ int main(int argc, char* argv[])
 		return EXIT_FAILURE;
 	}
 
+	if (!pyr_setup(fsense.map, fsense.map_sz, index, &buf)){
+		fprintf(stderr, "couldn't spawn preview workers.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (report && !load_report(report, argv[optind], fsense.map_sz))
+		return EXIT_FAILURE;
+
 	if (!senseye_connect(NULL, stderr, &fsense.cont, &aarr, connectfl))
 		return EXIT_FAILURE;
 
+	if (fsense.report)
+		send_report(fsense.cont.context(&fsense.cont));
+
 	if (!arcan_shmif_resize(fsense.cont.context(&fsense.cont), p_w, p_h))
 		return EXIT_FAILURE;
 
 	fsense.cont.dispatch = control_event;
+	fsense.detailed = detailed;
 
 /* run an automatic refresh clock as trigger to update file preview position */
 	arcan_shmif_enqueue(fsense.cont.context(&fsense.cont), &(struct arcan_event){
@@ -427,8 +788,11 @@ int main(int argc, char* argv[])
 		.ext.clock.id = 0xabcdef00,
 	});
 
-	if (spawn_ch(0, argv[1], base, wrap, &fsense.windows[0]) &&
-		rebuild_preview(
+/* -P patterns seed the search index, it keeps its own copy */
+	bool spawned = spawn_ch(0, argv[1], base, wrap, &bopts, &fsense.windows[0]);
+	batch_opts_free(&bopts);
+
+	if (spawned && rebuild_preview(
 			&fsense.cont, fsense.map, fsense.map_sz, fsense.cutoff, detailed)){
 		while (senseye_pump(&fsense.cont, true)){
 			uint64_t pos;
@@ -436,17 +800,44 @@ int main(int argc, char* argv[])
 
 			for (size_t i = 0; i < fsense.n_windows; i++){
 				int val = read(fsense.windows[i].pipe_in, &pos, sizeof(pos));
+				if (0 == val){
+					window_closed(&fsense.windows[i]);
+					continue;
+				}
 				if (-1 == val || val != sizeof(pos))
 					continue;
 
 /* flush so we get the latest in case this has been blocked on resize / rebuild */
-				while (-1 != read(fsense.windows[i].pipe_in, &pos, sizeof(pos))){}
+				while (sizeof(pos) == read(fsense.windows[i].pipe_in, &pos, sizeof(pos))){}
 
 				update_region(
 					fsense.cont.context(&fsense.cont), &fsense.windows[i], pos);
 				dirty = true;
 			}
 
+/* refine the edge markers as more of the pyramid becomes available */
+			struct arcan_shmif_cont* c = fsense.cont.context(&fsense.cont);
+			size_t step_sz = fsense.map_sz / (c->w * c->h);
+			size_t leaves = __atomic_load_n(&pyr.leaves_done, __ATOMIC_SEQ_CST);
+			if (!isnan(fsense.cutoff) && fsense.detailed &&
+				leaves != fsense.edge_leaves){
+				fsense.edge_leaves = leaves;
+				draw_edges(c, step_sz ? step_sz : 1, fsense.cutoff, true);
+
+				pos = fsense.windows[0].last_pos;
+				fsense.windows[0].last_pos = (uint64_t)-1;
+				update_region(c, &fsense.windows[0], pos);
+				dirty = true;
+			}
+
+/* and the hit density as the search index fills in */
+			if (draw_density(c, &fsense.windows[0], step_sz ? step_sz : 1, false)){
+				pos = fsense.windows[0].last_pos;
+				fsense.windows[0].last_pos = (uint64_t)-1;
+				update_region(c, &fsense.windows[0], pos);
+				dirty = true;
+			}
+
 			if (dirty){
 				arcan_shmif_signal(fsense.cont.context(&fsense.cont), SHMIF_SIGVID);
 			}
@@ -5,6 +5,34 @@
  */
 #include <arcan_tuisym.h>
 
+/*
+ * Prefetching: the range that is most likely to be needed next is predicted
+ * from the last step (direction and size) and handed to a helper thread that
+ * issues MADV_WILLNEED, so the kernel can read ahead while the current window
+ * is being fed to the channel. Pages that fall far enough behind are dropped
+ * from the mapping again (the page cache is left to the kernel) so that RSS
+ * stays bounded when stepping through an entire image.
+ */
+#define PF_AHEAD 2
+#define PF_BEHIND 8
+
+struct fsense_prefetch {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool pending, alive, fwd;
+	size_t last_pos;
+
+/* current request, [pos, pos+window), predicted and retained ranges */
+	size_t cur_lo, cur_hi;
+	size_t want_lo, want_hi;
+	size_t keep_lo, keep_hi;
+
+/* only touched by the helper, the range that has been advised */
+	size_t res_lo, res_hi;
+	size_t page_sz;
+	uint8_t* map;
+};
+
 struct fsense_thdata {
 	struct senseye_ch* ch;
 	uint8_t* fmap;
@@ -19,8 +47,206 @@ struct fsense_thdata {
 
 	int pipe_in;
 	int pipe_out;
+	bool started;
+
+	struct fsense_prefetch* pf;
+
+/* hit index over the whole map, follows the channel pattern set */
+	struct search_index* search;
+	unsigned ptn_gen;
 };
 
+static void pf_advise(
+	struct fsense_prefetch* pf, size_t lo, size_t hi, int advice)
+{
+	size_t pg = pf->page_sz;
+	lo -= lo % pg;
+	hi = (hi + pg - 1) / pg * pg;
+	if (hi > lo)
+		madvise(pf->map + lo, hi - lo, advice);
+}
+
+static void pf_run(struct fsense_prefetch* pf,
+	size_t cur_lo, size_t cur_hi, size_t lo, size_t hi,
+	size_t keep_lo, size_t keep_hi)
+{
+	bool have = pf->res_hi > pf->res_lo;
+
+/* only advise what isn't already covered from the previous steps */
+	if (have && lo < pf->res_hi && hi > pf->res_lo){
+		if (lo >= pf->res_lo)
+			lo = pf->res_hi;
+		if (hi <= pf->res_hi)
+			hi = pf->res_lo;
+	}
+	if (hi > lo)
+		pf_advise(pf, lo, hi, MADV_WILLNEED);
+
+/* drop everything outside of the retained range, on a seek that is all of it,
+ * rounding outwards so that no page is left straddling the boundary */
+	if (have){
+		size_t pg = pf->page_sz;
+		size_t klo = keep_lo - keep_lo % pg;
+		size_t khi = (keep_hi + pg - 1) / pg * pg;
+
+		if (pf->res_hi <= keep_lo || pf->res_lo >= keep_hi){
+			if (pf->res_hi <= keep_lo)
+				pf_advise(pf, pf->res_lo, pf->res_hi < klo ? pf->res_hi : klo,
+					MADV_DONTNEED);
+			else
+				pf_advise(pf, pf->res_lo > khi ? pf->res_lo : khi,
+					pf->res_hi, MADV_DONTNEED);
+			have = false;
+		}
+		else {
+			if (pf->res_lo < klo)
+				pf_advise(pf, pf->res_lo, klo, MADV_DONTNEED);
+			if (pf->res_hi > khi)
+				pf_advise(pf, khi, pf->res_hi, MADV_DONTNEED);
+			if (pf->res_lo < keep_lo)
+				pf->res_lo = keep_lo;
+			if (pf->res_hi > keep_hi)
+				pf->res_hi = keep_hi;
+		}
+	}
+
+/* both the window and the prediction are inside the retained range */
+	size_t nlo = cur_lo < lo ? cur_lo : lo;
+	size_t nhi = cur_hi > hi ? cur_hi : hi;
+	if (!have){
+		pf->res_lo = nlo;
+		pf->res_hi = nhi;
+	}
+	else {
+		if (nlo < pf->res_lo)
+			pf->res_lo = nlo;
+		if (nhi > pf->res_hi)
+			pf->res_hi = nhi;
+	}
+}
+
+static void* prefetch_thread(void* arg)
+{
+	struct fsense_prefetch* pf = arg;
+
+	pthread_mutex_lock(&pf->lock);
+	while (pf->alive){
+		if (!pf->pending){
+			pthread_cond_wait(&pf->wake, &pf->lock);
+			continue;
+		}
+
+		size_t cur_lo = pf->cur_lo, cur_hi = pf->cur_hi;
+		size_t lo = pf->want_lo, hi = pf->want_hi;
+		size_t keep_lo = pf->keep_lo, keep_hi = pf->keep_hi;
+		pf->pending = false;
+		pthread_mutex_unlock(&pf->lock);
+
+		pf_run(pf, cur_lo, cur_hi, lo, hi, keep_lo, keep_hi);
+
+		pthread_mutex_lock(&pf->lock);
+	}
+	pthread_mutex_unlock(&pf->lock);
+
+	pthread_cond_destroy(&pf->wake);
+	pthread_mutex_destroy(&pf->lock);
+	free(pf);
+	return NULL;
+}
+
+/* failure here just means no prefetching */
+static void prefetch_setup(struct fsense_thdata* th)
+{
+	struct fsense_prefetch* pf = malloc(sizeof(struct fsense_prefetch));
+	if (!pf)
+		return;
+
+	long pg = sysconf(_SC_PAGESIZE);
+	*pf = (struct fsense_prefetch){
+		.alive = true,
+		.fwd = true,
+		.last_pos = th->ofs,
+		.page_sz = pg > 0 ? pg : 4096,
+		.map = th->fmap
+	};
+	pthread_mutex_init(&pf->lock, NULL);
+	pthread_cond_init(&pf->wake, NULL);
+	th->pf = pf;
+
+	pthread_t pth;
+	if (0 != pthread_create(&pth, NULL, prefetch_thread, pf)){
+		pthread_cond_destroy(&pf->wake);
+		pthread_mutex_destroy(&pf->lock);
+		free(pf);
+		th->pf = NULL;
+		return;
+	}
+	pthread_detach(pth);
+}
+
+/* the helper owns and releases the state once it has seen this */
+static void prefetch_stop(struct fsense_thdata* th)
+{
+	struct fsense_prefetch* pf = th->pf;
+	if (!pf)
+		return;
+
+	th->pf = NULL;
+	pthread_mutex_lock(&pf->lock);
+	pf->alive = false;
+	pthread_cond_signal(&pf->wake);
+	pthread_mutex_unlock(&pf->lock);
+}
+
+/*
+ * Only steps up to a window in size say something about where the user is
+ * heading, anything larger is a seek and keeps the last known direction.
+ * The lookahead is a few steps, but never less than a window so that single
+ * row steps still get reasonably sized reads.
+ */
+static void prefetch_predict(struct fsense_thdata* th, size_t pos, size_t ntw)
+{
+	struct fsense_prefetch* pf = th->pf;
+	if (!pf)
+		return;
+
+	size_t step = pos >= pf->last_pos ? pos - pf->last_pos : pf->last_pos - pos;
+	if (step > 0 && step <= ntw)
+		pf->fwd = pos > pf->last_pos;
+	else
+		step = 0;
+	pf->last_pos = pos;
+
+	size_t ahead = step * PF_AHEAD > ntw ? step * PF_AHEAD : ntw;
+	size_t end = pos + ntw > th->sz ? th->sz : pos + ntw;
+	size_t lo, hi;
+	if (pf->fwd){
+		lo = end;
+		hi = th->sz - end > ahead ? end + ahead : th->sz;
+	}
+	else {
+		lo = pos > ahead ? pos - ahead : 0;
+		hi = pos;
+	}
+
+	size_t behind = ntw * PF_BEHIND;
+	size_t keep_lo = lo < pos ? lo : pos;
+	size_t keep_hi = hi > end ? hi : end;
+	keep_lo = keep_lo > behind ? keep_lo - behind : 0;
+	keep_hi = th->sz - keep_hi > behind ? keep_hi + behind : th->sz;
+
+	pthread_mutex_lock(&pf->lock);
+	pf->cur_lo = pos;
+	pf->cur_hi = end;
+	pf->want_lo = lo;
+	pf->want_hi = hi;
+	pf->keep_lo = keep_lo;
+	pf->keep_hi = keep_hi;
+	pf->pending = true;
+	pthread_cond_signal(&pf->wake);
+	pthread_mutex_unlock(&pf->lock);
+}
+
 /* repopulate the channel */
 static void refresh_data(struct fsense_thdata* th, size_t pos)
 {
@@ -35,6 +261,9 @@ static void refresh_data(struct fsense_thdata* th, size_t pos)
 /* tell the channel about our new position */
 	ch->wind_ofs(ch, pos);
 
+/* get the next window on its way before we fault in this one */
+	prefetch_predict(th, pos, ntw);
+
 /* and populate / feed it to the channel */
 	int ign;
 	size_t left = th->sz - pos;
@@ -95,6 +324,67 @@ static void step_page(struct fsense_thdata* th, struct rwstat_ch* ch)
 	th->large_step = 0;
 }
 
+/* restart the search index if the channel pattern set has changed */
+static void sync_search(struct fsense_thdata* th)
+{
+	struct rwstat_ch* ch = th->ch->in;
+	unsigned gen;
+	size_t n = rwstat_patterns(ch, NULL, NULL, 0, &gen);
+	if (!th->search || gen == th->ptn_gen)
+		return;
+
+	uint8_t* bufs[n ? n : 1];
+	size_t sizes[n ? n : 1];
+	rwstat_patterns(ch, bufs, sizes, n, NULL);
+	search_restart(th->search, bufs, sizes, n, th->ofs);
+	th->ptn_gen = gen;
+}
+
+/*
+ * Jump to the closest hit from the search index and tell the UI with a
+ * search:found:offset, search:pending:chunks done:chunks or search:none
+ * message
+ */
+static void find_hit(struct fsense_thdata* th, struct rwstat_ch* ch, bool fwd)
+{
+	uint64_t hit = 0;
+	sync_search(th);
+	enum search_status st = th->search ?
+		search_next(th->search, th->ofs, fwd, &hit) : SEARCH_NONE;
+
+	arcan_event ev = {
+		.category = EVENT_EXTERNAL,
+		.ext.kind = ARCAN_EVENT(MESSAGE)
+	};
+	char* msg = (char*)ev.ext.message.data;
+	size_t lim = COUNT_OF(ev.ext.message.data);
+
+	if (st == SEARCH_FOUND){
+		th->ofs = hit;
+		refresh_data(th, th->ofs);
+		snprintf(msg, lim, "search:found:%"PRIu64, hit);
+	}
+	else if (st == SEARCH_PENDING){
+		size_t done, total;
+		search_progress(th->search, &done, &total);
+		snprintf(msg, lim, "search:pending:%zu:%zu", done, total);
+	}
+	else
+		snprintf(msg, lim, "search:none");
+
+	ch->event(ch, &ev);
+}
+
+static void find_next(struct fsense_thdata* th, struct rwstat_ch* ch)
+{
+	find_hit(th, ch, true);
+}
+
+static void find_prev(struct fsense_thdata* th, struct rwstat_ch* ch)
+{
+	find_hit(th, ch, false);
+}
+
 static struct {
 	const char* label;
 	const char* descr;
@@ -132,6 +422,18 @@ static struct {
 		.sym = TUIK_5,
 		.handler = step_page
 	},
+	{
+		.label = "FIND_NEXT",
+		.descr = "Jump to the next pattern match in the file",
+		.sym = TUIK_N,
+		.handler = find_next
+	},
+	{
+		.label = "FIND_PREV",
+		.descr = "Jump to the previous pattern match in the file",
+		.sym = TUIK_B,
+		.handler = find_prev
+	},
 };
 
 static void register_bindings(struct arcan_shmif_cont* cont)
@@ -152,6 +454,12 @@ static void process_label(
 	if (!ev->io.label[0])
 		return;
 
+/* only act on press, the find bindings would otherwise jump twice */
+	bool active = ev->io.datatype == EVENT_IDATATYPE_DIGITAL ?
+		ev->io.input.digital.active : ev->io.input.translated.active;
+	if (!active)
+		return;
+
 /* if it is tagged with the input intention */
 	for (size_t i = 0; i < COUNT_OF(lbl_tbl); i++){
 		if (strcmp(lbl_tbl[i].label, ev->io.label) == 0){
@@ -222,61 +530,75 @@ static bool process_cmd(
 	return true;
 }
 
-/* may be run in a new thread or a new process, don't know, don't care */
-void* data_window_loop(void* th_data)
+/*
+ * Stepped from the shared channel scheduler whenever the parent pipe or the
+ * segment event queue has something, the setup is done on the first step.
+ */
+static bool data_window_step(struct senseye_ch* sch, void* tag)
 {
 /* we ignore the senseye- abstraction here and works
  * directly with the rwstat and shmif context */
-	struct fsense_thdata* thd = th_data;
+	struct fsense_thdata* thd = tag;
 	struct rwstat_ch* ch = thd->ch->in;
 	struct arcan_shmif_cont* cont = ch->context(ch);
 
-	arcan_event ev = {
-		.category = EVENT_EXTERNAL,
-		.ext.kind = ARCAN_EVENT(IDENT),
-		.ext.message.data = "fsense"
-	};
-	ch->event(ch, &ev);
-
-	register_bindings(cont);
-	short pollev = POLLIN | POLLERR | POLLHUP | POLLNVAL;
-	ch->switch_clock(ch, RW_CLK_BLOCK);
-	thd->small_step = ch->row_size(ch);
-	refresh_data(thd, thd->ofs);
-
-	int evstat = 0;
-	while (evstat != -1){
-		struct pollfd fds[2] = {
-			{	.fd = thd->pipe_in, .events = pollev },
-			{ .fd = cont->epipe, .events = pollev }
+	if (!thd->started){
+		arcan_event ev = {
+			.category = EVENT_EXTERNAL,
+			.ext.kind = ARCAN_EVENT(IDENT),
+			.ext.message.data = "fsense"
 		};
+		ch->event(ch, &ev);
 
-		int sv = poll(fds, 2, -1);
+		register_bindings(cont);
+		ch->switch_clock(ch, RW_CLK_BLOCK);
+		thd->small_step = ch->row_size(ch);
+		prefetch_setup(thd);
+		refresh_data(thd, thd->ofs);
+		thd->started = true;
+	}
 
-/* parent controlled offset */
-		if ( (fds[0].revents & POLLIN) ){
-			size_t lofs;
-			if (sizeof(lofs) == read(fds[0].fd, &lofs, sizeof(lofs))){
-				thd->ofs = FIXOFS(lofs);
-				refresh_data(thd, thd->ofs);
-			}
-		}
+/* parent controlled offset, only the latest one matters */
+	size_t lofs;
+	bool moved = false;
+	while (sizeof(lofs) == read(thd->pipe_in, &lofs, sizeof(lofs))){
+		thd->ofs = FIXOFS(lofs);
+		moved = true;
+	}
+	if (moved)
+		refresh_data(thd, thd->ofs);
 
 /* flush data window event queue */
-		arcan_event ev;
-		while ( (evstat = arcan_shmif_poll(cont, &ev)) > 0){
+	arcan_event ev;
+	int evstat;
+	while ( (evstat = arcan_shmif_poll(cont, &ev)) > 0){
 
 /* shared rwstat handler? */
-			if (rwstat_consume_event(ch, &ev))
-				continue;
+		if (rwstat_consume_event(ch, &ev))
+			continue;
 
-			if (ev.category == EVENT_IO)
-				process_label(thd, ch, &ev);
+		if (ev.category == EVENT_IO)
+			process_label(thd, ch, &ev);
 
-			if (ev.category == EVENT_TARGET)
-				process_cmd(thd, ch, &ev.tgt);
-		}
+		if (ev.category == EVENT_TARGET)
+			process_cmd(thd, ch, &ev.tgt);
 	}
 
-	return NULL;
+/* any pattern added through the events above */
+	sync_search(thd);
+
+	return evstat != -1;
+}
+
+/*
+ * The main side owns the search index, closing our end of the pipes is what
+ * tells it that the window is gone and the index can be released.
+ */
+static void data_window_done(struct senseye_ch* sch, void* tag)
+{
+	struct fsense_thdata* thd = tag;
+	prefetch_stop(thd);
+	close(thd->pipe_in);
+	close(thd->pipe_out);
+	free(thd);
 }
@@ -0,0 +1,502 @@
+/*
+ * Background summary of the mapped file used by the preview window. A pool
+ * of workers does two things:
+ *
+ *  1. preview sampling, one byte per preview pixel. This is done in passes
+ *     of decreasing stride (8, 4, 2, 1) where each sample covers the cell it
+ *     is responsible for, so a coarse version of the preview is visible
+ *     almost immediately and then refines.
+ *
+ *  2. a histogram pyramid, a complete binary tree over fixed size blocks
+ *     of the file where every node holds the byte histogram of its range.
+ *     Leaves are processed in bit-reversed order so that partial results are
+ *     spread evenly over the file, and a node is summed from its children as
+ *     soon as both are ready. Any byte range can then be approximated from
+ *     O(log n) nodes, which is what the histogram edge detection uses so that
+ *     a resize of the preview does not need to touch the file again.
+ *
+ * Sampling jobs are preferred over pyramid leaves as they are what the user
+ * is waiting for.
+ *
+ * Optionally, the pyramid and the last preview samples live in an index file
+ * so that reopening the same file skips both. The index is keyed on size,
+ * mtime and a hash of a few sampled blocks (hashing everything would mean
+ * reading the entire file, which is what the index is there to avoid). The
+ * pyramid nodes are mapped straight from it, leaves are persisted as they
+ * complete and an interrupted build continues where it stopped.
+ */
+
+#define PYR_MAXLEAF 4096
+#define PYR_MINBLK 4096
+#define PYR_MAXWORKERS 8
+#define PYR_BASESTRIDE 8
+
+#define PYR_IDXMAGIC "SNSYIDX1"
+#define PYR_IDXHDR 4096
+#define PYR_IDXSAMPLES 16
+
+struct pyr_index_hdr {
+	char magic[8];
+	uint64_t file_sz;
+	int64_t mtime;
+	uint64_t hash;
+	uint64_t blk_sz;
+	uint64_t n_leaf;
+
+/* preview samples, one byte per pixel, stored after the ready flags */
+	uint64_t pv_w, pv_h, pv_step;
+};
+
+struct pyr_job {
+	struct arcan_shmif_cont* c;
+	size_t step_sz;
+	size_t stride;
+
+/* rows handed out / finished for the current pass */
+	size_t row, rows, done;
+	size_t active;
+};
+
+static struct {
+	uint8_t* map;
+	size_t map_sz;
+
+/* heap layout, root at 1 and the leaves at [n_leaf, 2 * n_leaf) */
+	size_t blk_sz;
+	size_t n_leaf, leaf_bits;
+	uint64_t (*nodes)[256];
+
+/* shared with the workers, accessed through the __atomic builtins */
+	uint8_t* ready;
+	unsigned* pending;
+	size_t leaves_done;
+	size_t next_leaf;
+
+/* set if [nodes] and [ready] are mapped from an index file */
+	struct pyr_index_hdr* idx;
+	int idx_fd;
+	size_t idx_pvofs;
+
+	struct pyr_job job;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	pthread_cond_t progress;
+	size_t n_workers;
+} pyr = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.work = PTHREAD_COND_INITIALIZER,
+	.progress = PTHREAD_COND_INITIALIZER
+};
+
+static size_t bit_reverse(size_t v, size_t bits)
+{
+	size_t res = 0;
+	for (size_t i = 0; i < bits; i++, v >>= 1)
+		res = (res << 1) | (v & 1);
+	return res;
+}
+
+static void pyr_leaf(size_t leaf)
+{
+	size_t node = pyr.n_leaf + leaf;
+	uint64_t* hist = pyr.nodes[node];
+	size_t start = leaf * pyr.blk_sz;
+
+	if (start < pyr.map_sz){
+		size_t end = start + pyr.blk_sz;
+		if (end > pyr.map_sz)
+			end = pyr.map_sz;
+
+		uint32_t tmp[256] = {0};
+		for (size_t i = start; i < end; i++)
+			tmp[pyr.map[i]]++;
+
+		for (size_t i = 0; i < 256; i++)
+			hist[i] = tmp[i];
+	}
+
+/* the last child to become ready sums the parent, repeated upwards */
+	__atomic_store_n(&pyr.ready[node], 1, __ATOMIC_SEQ_CST);
+	__atomic_fetch_add(&pyr.leaves_done, 1, __ATOMIC_SEQ_CST);
+
+	while (node > 1){
+		node >>= 1;
+		if (__atomic_fetch_add(&pyr.pending[node], 1, __ATOMIC_SEQ_CST) != 1)
+			break;
+
+		uint64_t* l = pyr.nodes[node * 2];
+		uint64_t* r = pyr.nodes[node * 2 + 1];
+		for (size_t i = 0; i < 256; i++)
+			pyr.nodes[node][i] = l[i] + r[i];
+		__atomic_store_n(&pyr.ready[node], 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+/*
+ * sample the [stride] spaced pixels of row [y] that were not covered by an
+ * earlier pass, and fill the stride * stride cell each of them covers
+ */
+static void pyr_sample_row(struct pyr_job* job, size_t y)
+{
+	struct arcan_shmif_cont* c = job->c;
+	size_t s = job->stride;
+	size_t bytes_perline = job->step_sz * c->w;
+	bool first = s == PYR_BASESTRIDE;
+
+	for (size_t x = 0; x < c->w; x += s){
+		if (!first && x % (2 * s) == 0 && y % (2 * s) == 0)
+			continue;
+
+		size_t pos = y * bytes_perline + x * job->step_sz;
+		shmif_pixel px = SHMIF_RGBA(0x00,
+			pos < pyr.map_sz ? pyr.map[pos] : 0x00, 0x00, 0xff);
+
+		for (size_t cy = y; cy < y + s && cy < c->h; cy++)
+			for (size_t cx = x; cx < x + s && cx < c->w; cx++)
+				c->vidp[cy * c->pitch + cx] = px;
+	}
+}
+
+static void* pyr_worker(void* arg)
+{
+	pthread_mutex_lock(&pyr.lock);
+
+	for(;;){
+		struct pyr_job* job = &pyr.job;
+
+		if (job->row < job->rows){
+			size_t y = job->row++ * job->stride;
+			job->active++;
+			pthread_mutex_unlock(&pyr.lock);
+
+			pyr_sample_row(job, y);
+
+			pthread_mutex_lock(&pyr.lock);
+			job->active--;
+			job->done++;
+			pthread_cond_broadcast(&pyr.progress);
+			continue;
+		}
+
+		if (pyr.next_leaf < pyr.n_leaf){
+			size_t leaf = bit_reverse(pyr.next_leaf++, pyr.leaf_bits);
+			if (__atomic_load_n(&pyr.ready[pyr.n_leaf + leaf], __ATOMIC_SEQ_CST))
+				continue;
+			pthread_mutex_unlock(&pyr.lock);
+
+			pyr_leaf(leaf);
+
+			pthread_mutex_lock(&pyr.lock);
+			pthread_cond_broadcast(&pyr.progress);
+			continue;
+		}
+
+		pthread_cond_wait(&pyr.work, &pyr.lock);
+	}
+
+	return NULL;
+}
+
+static uint64_t pyr_hash(uint8_t* map, size_t map_sz)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t blk = 4096;
+
+	for (size_t i = 0; i <= PYR_IDXSAMPLES; i++){
+		size_t ofs = map_sz > blk ? (map_sz - blk) / PYR_IDXSAMPLES * i : 0;
+		size_t end = ofs + blk < map_sz ? ofs + blk : map_sz;
+		for (; ofs < end; ofs++)
+			hash = (hash ^ map[ofs]) * 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+/*
+ * map the nodes / ready flags from [path], reset the contents if the
+ * index does not match the current file. Returns false if the index can't
+ * be used at all.
+ */
+static bool pyr_index(const char* path, const struct stat* st, size_t n_nodes)
+{
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (-1 == fd){
+		fprintf(stderr, "couldn't open index (%s): %s\n", path, strerror(errno));
+		return false;
+	}
+
+	struct pyr_index_hdr key = {
+		.file_sz = pyr.map_sz,
+		.mtime = st->st_mtime,
+		.hash = pyr_hash(pyr.map, pyr.map_sz),
+		.blk_sz = pyr.blk_sz,
+		.n_leaf = pyr.n_leaf
+	};
+	memcpy(key.magic, PYR_IDXMAGIC, sizeof(key.magic));
+
+	size_t nodes_ofs = PYR_IDXHDR;
+	size_t ready_ofs = nodes_ofs + n_nodes * sizeof(uint64_t[256]);
+	size_t total = ready_ofs + n_nodes * sizeof(uint8_t);
+
+	struct pyr_index_hdr cur;
+	struct stat ist;
+	bool valid = pread(fd, &cur, sizeof(cur), 0) == sizeof(cur) &&
+		memcmp(cur.magic, key.magic, sizeof(key.magic)) == 0 &&
+		cur.file_sz == key.file_sz && cur.mtime == key.mtime &&
+		cur.hash == key.hash && cur.blk_sz == key.blk_sz &&
+		cur.n_leaf == key.n_leaf &&
+		0 == fstat(fd, &ist) && ist.st_size >= total;
+
+	if (!valid){
+		if (-1 == ftruncate(fd, 0) || -1 == ftruncate(fd, total)){
+			close(fd);
+			return false;
+		}
+	}
+
+	uint8_t* base = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (MAP_FAILED == base){
+		close(fd);
+		return false;
+	}
+
+	pyr.idx = (struct pyr_index_hdr*) base;
+	pyr.idx_fd = fd;
+	pyr.idx_pvofs = total;
+	pyr.nodes = (uint64_t (*)[256]) &base[nodes_ofs];
+	pyr.ready = (uint8_t*) &base[ready_ofs];
+
+/* the header goes last so a partially reset index is never trusted */
+	if (!valid)
+		*pyr.idx = key;
+
+	return true;
+}
+
+static bool pyr_setup(uint8_t* map, size_t map_sz,
+	const char* index, const struct stat* st)
+{
+	pyr.map = map;
+	pyr.map_sz = map_sz;
+
+	pyr.blk_sz = PYR_MINBLK;
+	while (map_sz / pyr.blk_sz >= PYR_MAXLEAF)
+		pyr.blk_sz *= 2;
+
+	size_t n_blk = (map_sz + pyr.blk_sz - 1) / pyr.blk_sz;
+	pyr.n_leaf = 1;
+	pyr.leaf_bits = 0;
+	while (pyr.n_leaf < n_blk){
+		pyr.n_leaf *= 2;
+		pyr.leaf_bits++;
+	}
+
+	size_t n_nodes = 2 * pyr.n_leaf;
+	pyr.pending = malloc(n_nodes * sizeof(unsigned));
+	pyr.leaves_done = 0;
+
+	if (pyr.pending && (!index || !pyr_index(index, st, n_nodes))){
+		pyr.nodes = malloc(n_nodes * sizeof(uint64_t[256]));
+		pyr.ready = malloc(n_nodes * sizeof(uint8_t));
+		if (pyr.nodes && pyr.ready){
+			memset(pyr.nodes, '\0', n_nodes * sizeof(uint64_t[256]));
+			for (size_t i = 0; i < n_nodes; i++)
+				pyr.ready[i] = 0;
+		}
+	}
+
+/* without the pyramid, edge detection falls back to reading the file */
+	if (!pyr.pending || !pyr.nodes || !pyr.ready){
+		free(pyr.pending);
+		if (!pyr.idx){
+			free(pyr.nodes);
+			free(pyr.ready);
+		}
+		pyr.nodes = NULL;
+		pyr.n_leaf = 0;
+	}
+
+/* finish parents an interrupted build did not get to, then derive the
+ * child counters from what is ready */
+	for (size_t node = pyr.n_leaf - 1; pyr.n_leaf && node > 0; node--){
+		unsigned nr = __atomic_load_n(&pyr.ready[node * 2], __ATOMIC_SEQ_CST) +
+			__atomic_load_n(&pyr.ready[node * 2 + 1], __ATOMIC_SEQ_CST);
+		pyr.pending[node] = nr;
+
+		if (nr == 2 && !__atomic_load_n(&pyr.ready[node], __ATOMIC_SEQ_CST)){
+			for (size_t i = 0; i < 256; i++)
+				pyr.nodes[node][i] = pyr.nodes[node * 2][i] + pyr.nodes[node * 2 + 1][i];
+			__atomic_store_n(&pyr.ready[node], 1, __ATOMIC_SEQ_CST);
+		}
+	}
+
+	for (size_t i = 0; i < pyr.n_leaf; i++)
+		if (__atomic_load_n(&pyr.ready[pyr.n_leaf + i], __ATOMIC_SEQ_CST))
+			__atomic_fetch_add(&pyr.leaves_done, 1, __ATOMIC_SEQ_CST);
+
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	pyr.n_workers = ncpu < 1 ? 1 : (ncpu > PYR_MAXWORKERS ? PYR_MAXWORKERS : ncpu);
+
+	for (size_t i = 0; i < pyr.n_workers; i++){
+		pthread_t pth;
+		if (0 != pthread_create(&pth, NULL, pyr_worker, NULL)){
+			if (i == 0)
+				return false;
+			pyr.n_workers = i;
+			break;
+		}
+		pthread_detach(pth);
+	}
+
+	return true;
+}
+
+/*
+ * cancel any ongoing sampling and wait for the rows in flight, needs to be
+ * done before the preview segment is resized or cleared
+ */
+static void pyr_preview_stop()
+{
+	pthread_mutex_lock(&pyr.lock);
+	pyr.job.rows = pyr.job.row;
+	while (pyr.job.active)
+		pthread_cond_wait(&pyr.progress, &pyr.lock);
+	pthread_mutex_unlock(&pyr.lock);
+}
+
+static void pyr_preview_pass(
+	struct arcan_shmif_cont* c, size_t step_sz, size_t stride)
+{
+	pthread_mutex_lock(&pyr.lock);
+	pyr.job = (struct pyr_job){
+		.c = c,
+		.step_sz = step_sz,
+		.stride = stride,
+		.rows = (c->h + stride - 1) / stride
+	};
+	pthread_cond_broadcast(&pyr.work);
+	pthread_mutex_unlock(&pyr.lock);
+}
+
+/*
+ * wait at most [ms] for the current pass to finish,
+ * returns true if there are no more rows to process
+ */
+static bool pyr_preview_wait(unsigned ms)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += (long)ms * 1000000;
+	ts.tv_sec += ts.tv_nsec / 1000000000;
+	ts.tv_nsec %= 1000000000;
+
+	pthread_mutex_lock(&pyr.lock);
+	bool done;
+	while (!(done = pyr.job.done >= pyr.job.rows) &&
+		pthread_cond_timedwait(&pyr.progress, &pyr.lock, &ts) != ETIMEDOUT){}
+	pthread_mutex_unlock(&pyr.lock);
+
+	return done;
+}
+
+/*
+ * draw the preview from the samples in the index if they were taken with
+ * the same dimensions, the preview segment is assumed to be idle
+ */
+static bool pyr_preview_load(struct arcan_shmif_cont* c, size_t step_sz)
+{
+	if (!pyr.idx || pyr.idx->pv_w != c->w ||
+		pyr.idx->pv_h != c->h || pyr.idx->pv_step != step_sz)
+		return false;
+
+	uint8_t* row = malloc(c->w);
+	if (!row)
+		return false;
+
+	bool ok = true;
+	for (size_t y = 0; y < c->h && ok; y++){
+		ok = pread(pyr.idx_fd, row, c->w, pyr.idx_pvofs + y * c->w) == c->w;
+		for (size_t x = 0; x < c->w && ok; x++)
+			c->vidp[y * c->pitch + x] = SHMIF_RGBA(0x00, row[x], 0x00, 0xff);
+	}
+
+	free(row);
+	return ok;
+}
+
+static void pyr_preview_save(struct arcan_shmif_cont* c, size_t step_sz)
+{
+	if (!pyr.idx)
+		return;
+
+	size_t bytes_perline = step_sz * c->w;
+	uint8_t* row = malloc(c->w);
+	if (!row)
+		return;
+
+/* invalidate first so an interrupted write is not picked up */
+	pyr.idx->pv_w = pyr.idx->pv_h = 0;
+
+	bool ok = true;
+	for (size_t y = 0; y < c->h && ok; y++){
+		for (size_t x = 0; x < c->w; x++){
+			size_t pos = y * bytes_perline + x * step_sz;
+			row[x] = pos < pyr.map_sz ? pyr.map[pos] : 0x00;
+		}
+		ok = pwrite(pyr.idx_fd, row, c->w, pyr.idx_pvofs + y * c->w) == c->w;
+	}
+
+	if (ok){
+		pyr.idx->pv_step = step_sz;
+		pyr.idx->pv_w = c->w;
+		pyr.idx->pv_h = c->h;
+	}
+
+	free(row);
+}
+
+/*
+ * accumulate the histogram for the leaves starting inside [lo, hi) from
+ * whatever nodes are ready, returns the number of bytes it covers
+ */
+static uint64_t pyr_query(size_t node, size_t n_lo, size_t n_hi,
+	size_t lo, size_t hi, uint64_t* out)
+{
+	if (hi <= n_lo || lo >= n_hi)
+		return 0;
+
+	if (lo <= n_lo && n_hi <= hi &&
+		__atomic_load_n(&pyr.ready[node], __ATOMIC_SEQ_CST)){
+		uint64_t sum = 0;
+		for (size_t i = 0; i < 256; i++){
+			out[i] += pyr.nodes[node][i];
+			sum += pyr.nodes[node][i];
+		}
+		return sum;
+	}
+
+	if (node >= pyr.n_leaf)
+		return 0;
+
+	size_t mid = n_lo + (n_hi - n_lo) / 2;
+	return pyr_query(node * 2, n_lo, mid, lo, hi, out) +
+		pyr_query(node * 2 + 1, mid, n_hi, lo, hi, out);
+}
+
+static uint64_t pyr_range(size_t lo, size_t hi, uint64_t* out)
+{
+	memset(out, '\0', sizeof(uint64_t) * 256);
+
+/* too short to be represented by the leaves, go to the source */
+	if (hi - lo < 4 * pyr.blk_sz || !pyr.nodes){
+		if (hi > pyr.map_sz)
+			hi = pyr.map_sz;
+		for (size_t i = lo; i < hi; i++)
+			out[pyr.map[i]]++;
+		return lo < hi ? hi - lo : 0;
+	}
+
+	size_t l_lo = (lo + pyr.blk_sz - 1) / pyr.blk_sz;
+	size_t l_hi = (hi + pyr.blk_sz - 1) / pyr.blk_sz;
+	return pyr_query(1, 0, pyr.n_leaf, l_lo, l_hi, out);
+}
@@ -20,6 +20,7 @@
 #include <math.h>
 
 #include <arcan_shmif.h>
+#include <arcan_tuisym.h>
 #include <poll.h>
 
 #include <sys/types.h>
@@ -32,15 +33,64 @@
 #include "libsenseye.h"
 #include "font_8x8.h"
 #include "rwstat.h"
+#include "stagetime.h"
+#include "batch.h"
+#include "search.h"
 #include "memif.h"
 
 #define RGBA(r, g, b, a) SHMIF_RGBA(r, g, b, a)
 
+/* every n:th refresh in dirty mode copies everything to catch writes that
+ * raced the soft-dirty sampling */
+#define DIRTY_FULL 64
+
+/* capture history granularity and default number of snapshots */
+#define HIST_PAGE 4096
+#define HIST_DEPTH 32
+
+struct hist_page {
+	unsigned refs;
+	uint8_t data[];
+};
+
+struct hist_snap {
+	uint64_t addr;
+	size_t sz, npg;
+	struct hist_page** pages;
+	uint8_t* delta;
+};
+
 struct page_ch {
 	struct senseye_ch* channel;
 	struct map_ctx* mctx;
 	uintptr_t base;
+	uint64_t addr;
 	size_t size;
+
+/* pattern set generation last given to the search index */
+	unsigned ptn_gen;
+
+/* changed-only refresh, [buf_addr] + [buf_len] is the window that a
+ * previous dirty refresh left in [buf], only valid while [buf_ok] */
+	bool dirty;
+	unsigned since_full;
+	uint8_t* mask;
+	size_t mask_sz;
+	bool buf_ok;
+	uint64_t buf_addr;
+	size_t buf_len;
+
+/* capture ring, newest at [hist_head], hist_pos is -1 for live or the
+ * number of snapshots back from the newest that is being shown */
+	bool capture;
+	struct hist_snap* hist;
+	size_t hist_depth, hist_count, hist_head;
+	ssize_t hist_pos;
+
+/* window staging buffer, from the shared buffer pool */
+	bool started;
+	uint8_t* buf;
+	size_t buf_sz;
 };
 
 struct {
@@ -54,18 +104,122 @@ struct {
 	size_t sel_lim, sel_page;
 	uintptr_t sel_base;
 	size_t sel_size;
-	bool skip_inode, write_enable;
+	bool skip_inode, write_enable, dirty_only;
+	size_t hist_depth;
+
+/* find next index over every readable mapping, and the index state the
+ * preview was last drawn at. Created on the first pattern (search_get),
+ * [search] is read without [search_lock] through __atomic loads */
+	struct search_index* search;
+	pthread_mutex_t search_lock;
+	bool search_failed;
+	unsigned search_gen;
+	size_t search_done;
 
 /* external connections */
 	struct senseye_cont* cont;
 	size_t last_chbase;
 } msense = {
  .skip_inode = true,
- .last_chbase = 256
+ .last_chbase = 256,
+ .search_lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+/*
+ * Search index source, a single context from the first to the last readable
+ * mapping that is read at absolute addresses. The /proc/pid/mem fallback in
+ * memif_copyat seeks, so the workers take turns.
+ */
+static struct {
+	struct map_ctx* map;
+	pthread_mutex_t lock;
+} mem_src = {
+	.lock = PTHREAD_MUTEX_INITIALIZER
 };
 
+static struct search_index* search_get(bool create);
+
 static void update_preview(shmif_pixel ccol);
-void* data_loop(void*);
+static bool data_step(struct senseye_ch*, void*);
+static void data_done(struct senseye_ch*, void*);
+
+/*
+ * Data channels are stepped from the shared scheduler pool, but the steps
+ * tend to arrive at the same time (clock driven from the UI). Copy requests
+ * are therefore queued and whichever worker finds the queue idle reads all
+ * pending windows in one memif_copyv call, the others just wait for their
+ * request to be completed.
+ */
+#define COPYQ_LIMIT 64
+
+struct copy_req {
+	struct map_ctx* map;
+	uint8_t* buf;
+	size_t sz;
+	bool done;
+	struct copy_req* next;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	struct copy_req* first;
+	struct copy_req** last;
+	bool busy;
+} copyq = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+	.last = &copyq.first
+};
+
+static size_t batch_copy(struct map_ctx* map, uint8_t* buf, size_t sz)
+{
+	struct copy_req req = {.map = map, .buf = buf, .sz = sz};
+
+	pthread_mutex_lock(&copyq.lock);
+	*copyq.last = &req;
+	copyq.last = &req.next;
+
+	while (!req.done){
+		if (copyq.busy){
+			pthread_cond_wait(&copyq.done, &copyq.lock);
+			continue;
+		}
+
+/* detach up to a batch worth of requests and run them unlocked */
+		struct map_ctx* maps[COPYQ_LIMIT];
+		uint8_t* bufs[COPYQ_LIMIT];
+		size_t sizes[COPYQ_LIMIT];
+		struct copy_req* batch[COPYQ_LIMIT];
+		size_t n = 0;
+
+		for (; copyq.first && n < COPYQ_LIMIT; n++){
+			batch[n] = copyq.first;
+			maps[n] = batch[n]->map;
+			bufs[n] = batch[n]->buf;
+			sizes[n] = batch[n]->sz;
+			copyq.first = copyq.first->next;
+		}
+		if (!copyq.first)
+			copyq.last = &copyq.first;
+
+		copyq.busy = true;
+		pthread_mutex_unlock(&copyq.lock);
+
+		memif_copyv(maps, bufs, sizes, n);
+
+		pthread_mutex_lock(&copyq.lock);
+		for (size_t i = 0; i < n; i++){
+			batch[i]->sz = sizes[i];
+			batch[i]->done = true;
+		}
+		copyq.busy = false;
+		pthread_cond_broadcast(&copyq.done);
+	}
+
+	pthread_mutex_unlock(&copyq.lock);
+	return req.sz;
+}
 
 /*
  * try to acquire a handle into the memory of the process at a specific base
@@ -89,7 +243,6 @@ static void launch_addr(PROCESS_ID pid, struct map_descr* ent, size_t base)
 		return;
 	}
 
-	pthread_t pth;
 	struct page_ch* pch = malloc(sizeof(struct page_ch));
 	if (NULL == pch){
 		fprintf(stderr, "launch_addr(%" PRIxPTR ")+%zx "
@@ -98,14 +251,19 @@ static void launch_addr(PROCESS_ID pid, struct map_descr* ent, size_t base)
 		return;
 	}
 
-	pch->channel = ch;
-	pch->mctx = mctx;
-	pch->base = base;
-	pch->size = size;
+	*pch = (struct page_ch){
+		.channel = ch,
+		.mctx = mctx,
+		.base = base,
+		.addr = ent->addr,
+		.size = size,
+		.dirty = msense.dirty_only,
+		.hist_pos = -1
+	};
 
-	if (-1 == pthread_create(&pth, NULL, data_loop, pch)){
+	if (!senseye_schedule(ch, -1, data_step, data_done, pch)){
 		fprintf(stderr, "launch_addr(%" PRIxPTR ")+%zx "
-			"couldn't spawn processing thread\n", base, size);
+			"couldn't schedule processing\n", base, size);
 		ch->close(ch, NULL);
 		free(pch);
 		memif_closemapping(mctx);
@@ -147,12 +305,10 @@ static void control_event(struct senseye_cont* cont, arcan_event* ev)
 			launch_addr(msense.pid, &msense.mcache[msense.sel], msense.last_chbase);
 		}
 		else if (strcmp(ev->io.label, "r") == 0 || strcmp(ev->io.label, "f") == 0){
-			free(msense.mcache);
-			msense.mcache = memif_mapdescr(msense.pid, 0,
-				strcmp(ev->io.label, "f") == 0 ?
-				FILTER_READ : FILTER_NONE, &msense.mcache_sz
+			refresh = memif_mapupdate(msense.pid, 0,
+				strcmp(ev->io.label, "f") == 0 ? FILTER_READ : FILTER_NONE,
+				&msense.mcache, &msense.mcache_sz
 			);
-			refresh = true;
 		}
 	}
 	if (ev->category == EVENT_TARGET &&
@@ -168,16 +324,301 @@ static void control_event(struct senseye_cont* cont, arcan_event* ev)
 		update_preview(SHMIF_RGBA(0x00, 0xff, 0x00, 0xff));
 }
 
-static void push_data(struct rwstat_ch* ch,
-	struct map_ctx* map, uint8_t* buf, bool repos)
+/*
+ * The dirty mask is forwarded to the UI as a header message,
+ * dirty:[first page address, hex]:[page size]:[pages]
+ * followed by multipart messages with one hex digit per four pages, the
+ * least significant bit is the first page of the four.
+ */
+static void send_mask(struct arcan_shmif_cont* cont,
+	uint64_t addr, size_t pg, const uint8_t* mask, size_t npg)
+{
+	arcan_event ev = {
+		.category = EVENT_EXTERNAL,
+		.ext.kind = ARCAN_EVENT(MESSAGE)
+	};
+	size_t lim = sizeof(ev.ext.message.data) - 1;
+	snprintf((char*)ev.ext.message.data, lim + 1,
+		"dirty:%"PRIx64":%zu:%zu", addr, pg, npg);
+	ev.ext.message.multipart = npg > 0;
+	arcan_shmif_enqueue(cont, &ev);
+
+	size_t ofs = 0;
+	for (size_t i = 0; i < npg; i += 4){
+		uint8_t v = 0;
+		for (size_t j = 0; j < 4 && i + j < npg; j++)
+			v |= (!!mask[i + j]) << j;
+
+		ev.ext.message.data[ofs++] = "0123456789abcdef"[v];
+		if (ofs == lim || i + 4 >= npg){
+			ev.ext.message.data[ofs] = '\0';
+			ev.ext.message.multipart = i + 4 < npg;
+			arcan_shmif_enqueue(cont, &ev);
+			ofs = 0;
+		}
+	}
+}
+
+/*
+ * Capture history, each refresh of the window is kept as a snapshot in a
+ * ring of hist_depth entries. Snapshots are split into HIST_PAGE sized pages
+ * and pages that didn't change from the previous snapshot of the same window
+ * are shared (refcounted) rather than copied, so a mostly static window costs
+ * little more than its changing pages. Each snapshot also keeps which pages
+ * differ from the previous one, this is what is sent as the dirty mask when
+ * scrubbing through the history.
+ */
+static void hist_drop(struct hist_snap* s)
+{
+	for (size_t i = 0; i < s->npg; i++)
+		if (s->pages[i] && 0 == --s->pages[i]->refs)
+			free(s->pages[i]);
+
+	free(s->pages);
+	free(s->delta);
+	memset(s, '\0', sizeof(struct hist_snap));
+}
+
+static void hist_free(struct page_ch* pch)
+{
+	for (size_t i = 0; i < pch->hist_depth && pch->hist; i++)
+		hist_drop(&pch->hist[i]);
+
+	free(pch->hist);
+	pch->hist = NULL;
+	pch->hist_count = pch->hist_head = 0;
+	pch->hist_pos = -1;
+}
+
+static struct hist_snap* hist_get(struct page_ch* pch, size_t back)
+{
+	if (back >= pch->hist_count)
+		return NULL;
+
+	return &pch->hist[
+		(pch->hist_head + pch->hist_depth - back) % pch->hist_depth];
+}
+
+/* returns false if nothing changed since the last snapshot or on failure */
+static bool hist_capture(
+	struct page_ch* pch, uint64_t addr, const uint8_t* buf, size_t sz)
+{
+	size_t npg = (sz + HIST_PAGE - 1) / HIST_PAGE;
+	struct hist_snap* prev = hist_get(pch, 0);
+	if (prev && (prev->addr != addr || prev->sz != sz))
+		prev = NULL;
+
+	struct hist_snap snap = {
+		.addr = addr,
+		.sz = sz,
+		.npg = npg,
+		.pages = malloc(npg * sizeof(struct hist_page*)),
+		.delta = malloc(npg)
+	};
+	if (!snap.pages || !snap.delta){
+		free(snap.pages);
+		free(snap.delta);
+		return false;
+	}
+	memset(snap.pages, '\0', npg * sizeof(struct hist_page*));
+
+	size_t changed = 0;
+	for (size_t i = 0; i < npg; i++){
+		size_t len = sz - i * HIST_PAGE;
+		len = len > HIST_PAGE ? HIST_PAGE : len;
+
+		if (prev && memcmp(prev->pages[i]->data, &buf[i * HIST_PAGE], len) == 0){
+			snap.pages[i] = prev->pages[i];
+			snap.pages[i]->refs++;
+			snap.delta[i] = 0;
+			continue;
+		}
+
+		struct hist_page* pg = malloc(sizeof(struct hist_page) + HIST_PAGE);
+		if (!pg){
+			hist_drop(&snap);
+			return false;
+		}
+		pg->refs = 1;
+		memcpy(pg->data, &buf[i * HIST_PAGE], len);
+		memset(&pg->data[len], '\0', HIST_PAGE - len);
+		snap.pages[i] = pg;
+		snap.delta[i] = 1;
+		changed++;
+	}
+
+	if (prev && !changed){
+		hist_drop(&snap);
+		return false;
+	}
+
+	pch->hist_head = (pch->hist_head + 1) % pch->hist_depth;
+	if (pch->hist_count == pch->hist_depth)
+		hist_drop(&pch->hist[pch->hist_head]);
+	else
+		pch->hist_count++;
+
+	pch->hist[pch->hist_head] = snap;
+	return true;
+}
+
+/* repaint from a stored snapshot, the process is left alone */
+static void hist_show(struct page_ch* pch, uint8_t* buf)
 {
+	struct rwstat_ch* ch = pch->channel->in;
+	struct hist_snap* s = hist_get(pch, pch->hist_pos);
+	if (!s)
+		return;
+
 	size_t left = ch->left(ch);
+	size_t nb = s->sz > left ? left : s->sz;
+	pch->buf_ok = false;
+	for (size_t ofs = 0; ofs < nb; ofs += HIST_PAGE)
+		memcpy(&buf[ofs], s->pages[ofs / HIST_PAGE]->data,
+			nb - ofs > HIST_PAGE ? HIST_PAGE : nb - ofs);
+	if (nb < left)
+		memset(&buf[nb], '\0', left - nb);
+
+	arcan_event ev = {
+		.category = EVENT_EXTERNAL,
+		.ext.kind = ARCAN_EVENT(MESSAGE)
+	};
+	snprintf((char*)ev.ext.message.data, sizeof(ev.ext.message.data),
+		"history:%zu:%zu", (size_t) pch->hist_pos, pch->hist_count);
+	arcan_shmif_enqueue(ch->context(ch), &ev);
+	send_mask(ch->context(ch), s->addr, HIST_PAGE, s->delta, s->npg);
+
+	int ign;
 	ch->switch_clock(ch, RW_CLK_BLOCK);
-	ch->wind_ofs(ch, memif_addr(map));
-	uint64_t nc = memif_copy(map, buf, left);
+	ch->wind_ofs(ch, s->addr);
+	ch->data(ch, buf, left, &ign);
+}
+
+/*
+ * re-read only the pages written to since the last sample of the same
+ * window, [buf] still holds the rest. Returns false if the caller should
+ * fall back to a full copy.
+ */
+static bool push_dirty(struct page_ch* pch, uint8_t* buf, size_t left)
+{
+	struct rwstat_ch* ch = pch->channel->in;
+	struct map_ctx* map = pch->mctx;
+
+/* no page is smaller than 4k where soft-dirty exists */
+	size_t need = left / 4096 + 2;
+	if (pch->mask_sz < need){
+		uint8_t* mask = realloc(pch->mask, need);
+		if (!mask)
+			return false;
+		pch->mask = mask;
+		pch->mask_sz = need;
+	}
+
+	size_t pg;
+	uint64_t addr = memif_addr(map);
+	size_t npg = memif_dirty(map, left, pch->mask, pch->mask_sz, &pg);
+	if (!npg)
+		return false;
+
+/* the mask is relative to the window, not to what [buf] holds */
+	if (++pch->since_full >= DIRTY_FULL ||
+		!pch->buf_ok || pch->buf_addr != addr || pch->buf_len != left){
+		pch->since_full = 0;
+		memset(pch->mask, 1, npg);
+	}
+
+	send_mask(ch->context(ch), addr - addr % pg, pg, pch->mask, npg);
+
+/* coalesce into runs of dirty pages, clipped to the window */
+	uint64_t* runs = malloc(npg * (sizeof(uint64_t) +
+		sizeof(uint8_t*) + sizeof(size_t)));
+	if (!runs)
+		return false;
+	uint8_t** bufs = (uint8_t**) &runs[npg];
+	size_t* sizes = (size_t*) &bufs[npg];
+
+	size_t n = 0;
+	uint64_t first = addr - addr % pg;
+	size_t valid = npg * pg - addr % pg;
+	if (valid > left)
+		valid = left;
+
+	for (size_t i = 0; i < npg; i++){
+		if (!pch->mask[i])
+			continue;
+
+		uint64_t lo = first + i * pg;
+		uint64_t hi = lo + pg;
+		lo = lo < addr ? addr : lo;
+		hi = hi > addr + valid ? addr + valid : hi;
+
+		if (n && runs[n-1] + sizes[n-1] == lo)
+			sizes[n-1] += hi - lo;
+		else {
+			runs[n] = lo;
+			bufs[n] = &buf[lo - addr];
+			sizes[n++] = hi - lo;
+		}
+	}
+
+	pch->buf_ok = true;
+	pch->buf_addr = addr;
+	pch->buf_len = left;
+
+/* nothing changed, nothing to repack */
+	if (!n){
+		free(runs);
+		return true;
+	}
+
+	struct stage_timer* st = rwstat_timer(ch);
+	uint64_t ts = stage_begin(st);
+	memif_copyat(map, runs, bufs, sizes, n);
+	stage_end(st, STAGE_COPY, ts);
+	free(runs);
+
+	if (valid < left)
+		memset(&buf[valid], '\0', left - valid);
+
+	if (pch->capture)
+		hist_capture(pch, addr, buf, left);
+
+	int ign;
+	ch->switch_clock(ch, RW_CLK_BLOCK);
+	ch->wind_ofs(ch, addr);
+	ch->data(ch, buf, left, &ign);
+	return true;
+}
+
+static void push_data(struct page_ch* pch, uint8_t* buf, bool repos)
+{
+	struct rwstat_ch* ch = pch->channel->in;
+	struct map_ctx* map = pch->mctx;
+	size_t left = ch->left(ch);
+
+	if (pch->hist_pos >= 0){
+		hist_show(pch, buf);
+		return;
+	}
+
+	if (pch->dirty && repos && push_dirty(pch, buf, left))
+		return;
+
+/* anything but a dirty refresh leaves [buf] out of step with the mask */
+	pch->buf_ok = false;
+
+	uint64_t addr = memif_addr(map);
+	ch->switch_clock(ch, RW_CLK_BLOCK);
+	ch->wind_ofs(ch, addr);
+
+	struct stage_timer* st = rwstat_timer(ch);
+	uint64_t ts = stage_begin(st);
+	uint64_t nc = batch_copy(map, buf, left);
+	stage_end(st, STAGE_COPY, ts);
 	if (0 == nc){
 		memif_reset(map);
-		nc = memif_copy(map, buf, left);
+		addr = memif_addr(map);
+		nc = batch_copy(map, buf, left);
 		if (0 == nc)
 			return;
 	}
@@ -189,6 +630,9 @@ static void push_data(struct rwstat_ch* ch,
 			memset(buf + nc, '\0', left - nc);
 	}
 
+	if (pch->capture)
+		hist_capture(pch, addr, buf, left);
+
 	int ign;
 	ch->data(ch, buf, left, &ign);
 }
@@ -242,17 +686,218 @@ static void damage_mem(struct rwstat_ch* ch, uint8_t mode,
 	arcan_shmif_enqueue(cont, &ev);
 }
 
-void* data_loop(void* th_data)
+static bool toggle_dirty(struct page_ch* pch)
+{
+	pch->dirty = !pch->dirty;
+	pch->buf_ok = false;
+	return false;
+}
+
+static bool toggle_capture(struct page_ch* pch)
+{
+	if (pch->capture){
+		bool repaint = pch->hist_pos >= 0;
+		pch->capture = false;
+		hist_free(pch);
+		return repaint;
+	}
+
+	pch->hist_depth = msense.hist_depth ? msense.hist_depth : HIST_DEPTH;
+	pch->hist = malloc(pch->hist_depth * sizeof(struct hist_snap));
+	if (!pch->hist)
+		return false;
+
+	memset(pch->hist, '\0', pch->hist_depth * sizeof(struct hist_snap));
+	pch->capture = true;
+	return false;
+}
+
+static bool hist_older(struct page_ch* pch)
+{
+	if (!pch->hist_count || pch->hist_pos + 1 >= (ssize_t) pch->hist_count)
+		return false;
+	pch->hist_pos++;
+	return true;
+}
+
+static bool hist_newer(struct page_ch* pch)
+{
+	if (pch->hist_pos < 0)
+		return false;
+	pch->hist_pos--;
+	return true;
+}
+
+static bool hist_live(struct page_ch* pch)
+{
+	if (pch->hist_pos < 0)
+		return false;
+	pch->hist_pos = -1;
+	return true;
+}
+
+/*
+ * The index is shared between all windows and follows the pattern set of
+ * whichever window had a pattern added last, searching from where it is.
+ */
+static void sync_search(struct page_ch* pch)
+{
+	struct rwstat_ch* ch = pch->channel->in;
+	unsigned gen;
+	size_t n = rwstat_patterns(ch, NULL, NULL, 0, &gen);
+	if (gen == pch->ptn_gen)
+		return;
+
+	struct search_index* idx = search_get(n > 0);
+	if (!idx)
+		return;
+
+	uint8_t* bufs[n ? n : 1];
+	size_t sizes[n ? n : 1];
+	rwstat_patterns(ch, bufs, sizes, n, NULL);
+	search_restart(idx, bufs, sizes, n, memif_addr(pch->mctx));
+	pch->ptn_gen = gen;
+}
+
+/*
+ * Move to the closest hit inside the mapping of the window, the UI gets the
+ * same search:found:address, search:pending:chunks done:chunks or
+ * search:none message as from sense_file
+ */
+static bool find_hit(struct page_ch* pch, bool fwd)
+{
+	struct rwstat_ch* ch = pch->channel->in;
+	uint64_t hit = 0;
+	sync_search(pch);
+	struct search_index* idx = search_get(false);
+	enum search_status st = idx ?
+		search_next(idx, memif_addr(pch->mctx), fwd, &hit) : SEARCH_NONE;
+
+/* the index is sorted, so past the mapping there is nothing for us */
+	if (st == SEARCH_FOUND && (hit < pch->addr || hit - pch->addr >= pch->size))
+		st = SEARCH_NONE;
+
+	arcan_event ev = {
+		.category = EVENT_EXTERNAL,
+		.ext.kind = ARCAN_EVENT(MESSAGE)
+	};
+	char* msg = (char*)ev.ext.message.data;
+	size_t lim = COUNT_OF(ev.ext.message.data);
+
+	if (st == SEARCH_FOUND){
+		memif_seek(pch->mctx, hit - pch->addr, SEEK_SET);
+		snprintf(msg, lim, "search:found:%"PRIu64, hit);
+	}
+	else if (st == SEARCH_PENDING){
+		size_t done, total;
+		search_progress(idx, &done, &total);
+		snprintf(msg, lim, "search:pending:%zu:%zu", done, total);
+	}
+	else
+		snprintf(msg, lim, "search:none");
+
+	ch->event(ch, &ev);
+	return st == SEARCH_FOUND;
+}
+
+static bool find_next(struct page_ch* pch)
+{
+	return find_hit(pch, true);
+}
+
+static bool find_prev(struct page_ch* pch)
+{
+	return find_hit(pch, false);
+}
+
+static struct {
+	const char* label;
+	const char* descr;
+	uint16_t sym;
+	bool (*handler)(struct page_ch*);
+} lbl_tbl[] = {
+	{
+		.label = "DIRTY_PAGES",
+		.descr = "Toggle refreshing only pages that changed",
+		.sym = TUIK_D,
+		.handler = toggle_dirty
+	},
+	{
+		.label = "CAPTURE",
+		.descr = "Toggle keeping a history of snapshots for this window",
+		.sym = TUIK_C,
+		.handler = toggle_capture
+	},
+	{
+		.label = "HISTORY_OLDER",
+		.descr = "Show the previous snapshot in the capture history",
+		.sym = TUIK_COMMA,
+		.handler = hist_older
+	},
+	{
+		.label = "HISTORY_NEWER",
+		.descr = "Show the next snapshot in the capture history",
+		.sym = TUIK_PERIOD,
+		.handler = hist_newer
+	},
+	{
+		.label = "HISTORY_LIVE",
+		.descr = "Return from the capture history to the live process",
+		.sym = TUIK_L,
+		.handler = hist_live
+	},
+	{
+		.label = "FIND_NEXT",
+		.descr = "Jump to the next pattern match in the mapping",
+		.sym = TUIK_N,
+		.handler = find_next
+	},
+	{
+		.label = "FIND_PREV",
+		.descr = "Jump to the previous pattern match in the mapping",
+		.sym = TUIK_B,
+		.handler = find_prev
+	}
+};
+
+/*
+ * labelled or default symbol, same as the rwstat bindings. Returns true if
+ * the event was consumed, [repaint] is set if the window needs a refresh.
+ */
+static bool process_label(struct page_ch* pch, arcan_event* ev, bool* repaint)
+{
+	*repaint = false;
+	bool active = ev->io.datatype == EVENT_IDATATYPE_DIGITAL ?
+		ev->io.input.digital.active : ev->io.input.translated.active;
+
+	if (ev->io.datatype != EVENT_IDATATYPE_DIGITAL &&
+		ev->io.datatype != EVENT_IDATATYPE_TRANSLATED)
+		return false;
+
+	for (size_t i = 0; i < COUNT_OF(lbl_tbl); i++){
+		bool match = ev->io.label[0] ?
+			strcmp(ev->io.label, lbl_tbl[i].label) == 0 :
+			ev->io.datatype == EVENT_IDATATYPE_TRANSLATED &&
+				ev->io.input.translated.keysym == lbl_tbl[i].sym &&
+				ev->io.input.translated.modifiers == 0;
+
+		if (match){
+			if (active)
+				*repaint = lbl_tbl[i].handler(pch);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static void data_setup(struct page_ch* pch)
 {
-/* map convenience aliases and work directly with the stats channel
- * rather than going through the sense_ abstraction */
-	struct page_ch* pch = (struct page_ch*)th_data;
 	struct rwstat_ch* ch = pch->channel->in;
 	struct arcan_shmif_cont* cont = ch->context(ch);
-	struct map_ctx* memmap = pch->mctx;
 
-	size_t buf_sz = ch->left(ch);
-	uint8_t* buf = malloc(buf_sz);
+	pch->buf_sz = ch->left(ch);
+	pch->buf = senseye_buffer(&pch->buf_sz);
 
 	arcan_event ev = {
 		.category = EVENT_EXTERNAL,
@@ -261,31 +906,64 @@ void* data_loop(void* th_data)
 	};
 
 	ch->event(ch, &ev);
-	push_data(ch, memmap, buf, true);
+	for (size_t i = 0; i < COUNT_OF(lbl_tbl); i++)
+		senseye_register_input(cont,
+			lbl_tbl[i].label, lbl_tbl[i].descr, lbl_tbl[i].sym, 0);
 
-	uint64_t cofs = 0;
+	if (msense.hist_depth)
+		toggle_capture(pch);
+	if (pch->buf)
+		push_data(pch, pch->buf, true);
 
-	if (memif_canwrite(memmap) && msense.write_enable){
+	if (memif_canwrite(pch->mctx) && msense.write_enable){
 		ch->damage = damage_mem;
 		ch->damage_tag = pch;
 	}
 
-	while (buf && arcan_shmif_wait(cont, &ev) != 0){
+	pch->started = true;
+}
+
+/* stepped from the shared channel scheduler on segment events */
+static bool data_step(struct senseye_ch* sch, void* tag)
+{
+/* map convenience aliases and work directly with the stats channel
+ * rather than going through the sense_ abstraction */
+	struct page_ch* pch = tag;
+	struct rwstat_ch* ch = pch->channel->in;
+	struct arcan_shmif_cont* cont = ch->context(ch);
+	struct map_ctx* memmap = pch->mctx;
+	arcan_event ev;
+	int evstat = 0;
+
+	if (!pch->started)
+		data_setup(pch);
+
+	while (pch->buf && (evstat = arcan_shmif_poll(cont, &ev)) > 0){
 		if (rwstat_consume_event(ch, &ev)){
 			continue;
 		}
 
+		bool repaint;
+		if (ev.category == EVENT_IO && process_label(pch, &ev, &repaint)){
+			if (repaint)
+				push_data(pch, pch->buf, true);
+			continue;
+		}
+
 /* might have been resized during consume */
-		if (ch->left(ch) > buf_sz){
-			free(buf);
-			buf_sz = ch->left(ch);
-			buf = malloc(buf_sz);
+		if (ch->left(ch) > pch->buf_sz){
+			senseye_buffer_release(pch->buf, pch->buf_sz);
+			pch->buf_sz = ch->left(ch);
+			pch->buf = senseye_buffer(&pch->buf_sz);
+			pch->buf_ok = false;
+			if (!pch->buf)
+				return false;
 		}
 
 		if (ev.category == EVENT_TARGET)
 		switch(ev.tgt.kind){
 		case TARGET_COMMAND_EXIT:
-			return NULL;
+			return false;
 		break;
 
 		case TARGET_COMMAND_DISPLAYHINT:{
@@ -299,16 +977,28 @@ void* data_loop(void* th_data)
 			if (ev.tgt.ioevs[0].iv == -1){
 				memif_seek(memmap, -2 * ch->left(ch), SEEK_CUR);
 			}
-			push_data(ch, memmap, buf, ev.tgt.ioevs[0].iv == 0);
+			push_data(pch, pch->buf, ev.tgt.ioevs[0].iv == 0);
 		}
 		default:
 		break;
 		}
 	}
 
+/* any pattern added through the events above */
+	sync_search(pch);
+
+	return pch->buf && evstat != -1;
+}
+
+static void data_done(struct senseye_ch* sch, void* tag)
+{
+	struct page_ch* pch = tag;
 	pch->channel->close(pch->channel, NULL);
-	free(th_data);
-	return NULL;
+	hist_free(pch);
+	free(pch->mask);
+	senseye_buffer_release(pch->buf, pch->buf_sz);
+	memif_closemapping(pch->mctx);
+	free(pch);
 }
 
 /*
@@ -360,6 +1050,14 @@ static void update_preview(shmif_pixel ccol)
 	int cc = msense.sel % nl;
 	size_t start = y;
 
+/* hit density column, relative to the busiest visible mapping */
+	size_t hmax = 0;
+	struct search_index* idx = search_get(false);
+	for (size_t i = ofs; idx && i < ofs + nl && i < count; i++){
+		size_t n = search_count(idx, mcache[i].addr, mcache[i].endaddr);
+		hmax = n > hmax ? n : hmax;
+	}
+
 	while (y < c->addr->h && ofs < count){
 		uint8_t r = mcache[ofs].perm[0] == 'r' ? 0xff : 0x55;
 		uint8_t g = mcache[ofs].perm[1] == 'w' ? 0xff : 0x55;
@@ -380,6 +1078,13 @@ static void update_preview(shmif_pixel ccol)
 			(int)((mcache[ofs].endaddr - mcache[ofs].addr) / 1024));
 
 		draw_text(c, wbuf, fontw + 1, y, col);
+
+		size_t hits = hmax ? search_count(
+			idx, mcache[ofs].addr, mcache[ofs].endaddr) : 0;
+		if (hits)
+			draw_box(c, c->w - fontw, y, fontw, fonth,
+				RGBA(0x00, 0x00, 0x40 + 0xbf * hits / hmax, 0xff));
+
 		y += rowsz;
 		ofs++;
 	}
@@ -389,37 +1094,247 @@ static void update_preview(shmif_pixel ccol)
 	arcan_shmif_signal(c, SHMIF_SIGVID);
 }
 
+static size_t mem_read(void* tag, uint64_t ofs, uint8_t* dst, size_t sz)
+{
+	pthread_mutex_lock(&mem_src.lock);
+	size_t nb = memif_copyat(mem_src.map, &ofs, &dst, &sz, 1);
+	pthread_mutex_unlock(&mem_src.lock);
+	return nb;
+}
+
+/*
+ * Index every readable mapping as it looks at setup time, mappings that
+ * come later are not covered. Failure just means no find next. Called with
+ * search_lock held or before there are any other threads.
+ */
+static void search_setup(struct batch_opts* seed)
+{
+	size_t n = msense.mcache_sz ? msense.mcache_sz : 1;
+	struct search_range* ranges = malloc(sizeof(struct search_range) * n);
+	if (!ranges)
+		return;
+
+	n = 0;
+	struct map_descr span = {.addr = UINT64_MAX};
+	for (size_t i = 0; i < msense.mcache_sz; i++){
+		struct map_descr* ent = &msense.mcache[i];
+
+/* [vsyscall] and the like sit above what /proc/pid/mem can seek to */
+		if (ent->perm[0] != 'r' || ent->endaddr > INT64_MAX)
+			continue;
+
+		span.addr = ent->addr < span.addr ? ent->addr : span.addr;
+		span.endaddr = ent->endaddr > span.endaddr ? ent->endaddr : span.endaddr;
+		ranges[n++] = (struct search_range){
+			.lo = ent->addr,
+			.hi = ent->endaddr
+		};
+	}
+
+	span.sz = span.endaddr - span.addr;
+	if (!n || !(mem_src.map = memif_openmapping(msense.pid, &span))){
+		free(ranges);
+		return;
+	}
+
+	struct search_index* idx = search_create(NULL, mem_read,
+		ranges, n, seed->ptns, seed->ptn_sz, seed->n_ptns);
+	free(ranges);
+
+	if (!idx){
+		fprintf(stderr, "couldn't setup search index\n");
+		memif_closemapping(mem_src.map);
+		mem_src.map = NULL;
+		return;
+	}
+
+	__atomic_store_n(&msense.search, idx, __ATOMIC_RELEASE);
+}
+
+/* the search index, if [create] it is set up on first use */
+static struct search_index* search_get(bool create)
+{
+	struct search_index* idx = __atomic_load_n(&msense.search, __ATOMIC_ACQUIRE);
+	if (idx || !create)
+		return idx;
+
+	pthread_mutex_lock(&msense.search_lock);
+	if (!msense.search && !msense.search_failed){
+		struct batch_opts none = {0};
+		search_setup(&none);
+		msense.search_failed = !msense.search;
+	}
+	idx = msense.search;
+	pthread_mutex_unlock(&msense.search_lock);
+
+	return idx;
+}
+
+/* bytes per read in batch mode, the report is built in steps of this */
+#define BATCH_CHUNK (16 * 1024 * 1024)
+
+/*
+ * Headless sweep over every readable mapping in the process, one report
+ * region per mapping named pid@address with the mapping address as base.
+ * Mappings are read in chunks with opts->overlap bytes of lookahead so that
+ * hits that cross a chunk boundary are still found. Returns the exit status.
+ */
+static int run_batch(struct batch_opts* opts, const char* dst, enum batch_fmt fmt)
+{
+	bool use_stdout = strcmp(dst, "-") == 0;
+	FILE* fout = use_stdout ? stdout : fopen(dst, "w");
+	if (!fout){
+		fprintf(stderr, "couldn't open report (%s) for writing\n", dst);
+		return EXIT_FAILURE;
+	}
+
+	size_t buf_sz = 0;
+	uint8_t* buf = NULL;
+	if (batch_prepare(opts) && batch_write_header(fout, fmt)){
+		buf_sz = BATCH_CHUNK + opts->overlap;
+		buf = senseye_buffer(&buf_sz);
+	}
+
+	if (!buf){
+		fprintf(stderr, "couldn't setup batch scanning\n");
+		if (!use_stdout)
+			fclose(fout);
+		return EXIT_FAILURE;
+	}
+
+	int rc = EXIT_SUCCESS;
+	for (size_t i = 0; i < msense.mcache_sz; i++){
+		struct map_descr* ent = &msense.mcache[i];
+		if (ent->perm[0] != 'r')
+			continue;
+
+		struct map_ctx* map = memif_openmapping(msense.pid, ent);
+		if (!map)
+			continue;
+
+		char name[64];
+		snprintf(name, sizeof(name), "%d@%"PRIx64, (int)msense.pid, ent->addr);
+		struct batch_region reg;
+		batch_region_init(&reg, name, ent->addr, opts->window);
+
+/* every chunk but the last has to cover whole entropy windows */
+		size_t step = BATCH_CHUNK - BATCH_CHUNK % opts->window;
+		bool ok = true;
+
+		for (uint64_t ofs = 0; ofs < ent->sz && ok; ofs += step){
+			uint64_t addr = ent->addr + ofs;
+			size_t nb = ent->sz - ofs;
+			if (nb > step + opts->overlap)
+				nb = step + opts->overlap;
+
+			size_t want = nb;
+			memif_copyat(map, &addr, &buf, &nb, 1);
+			size_t chunk = nb > step ? step : nb;
+			ok = batch_scan(opts, &reg, buf, chunk, nb - chunk);
+
+/* short read, the mapping shrunk while we were at it */
+			if (nb < want)
+				break;
+		}
+		memif_closemapping(map);
+
+		if (!ok || !batch_write(fout, fmt, opts, &reg)){
+			fprintf(stderr, "couldn't scan or write report for %s\n", name);
+			rc = EXIT_FAILURE;
+		}
+		batch_region_free(&reg);
+	}
+
+	senseye_buffer_release(buf, buf_sz);
+	if (use_stdout)
+		fflush(fout);
+	else if (0 != fclose(fout))
+		rc = EXIT_FAILURE;
+
+	batch_opts_free(opts);
+	return rc;
+}
+
 int main(int argc, char* argv[])
 {
 	struct senseye_cont cont;
 	struct arg_arr* aarr;
 	enum ARCAN_FLAGS connectfl = SHMIF_CONNECT_LOOP;
+	struct batch_opts bopts = {0};
+	enum batch_fmt batch_fmt = BATCH_BINARY;
+	const char* batch = NULL;
 
-	if (2 != argc && 3 != argc){
-		printf("usage: sense_mem [-w] process_id\n");
-		return EXIT_FAILURE;
-	}
-
-	if (argc == 3){
-		if (strcmp(argv[1], "-w") == 0){
+	int argi = 1;
+	for (; argi < argc - 1 && argv[argi][0] == '-'; argi++){
+		if (strcmp(argv[argi], "-w") == 0){
 			fprintf(stderr, "Write support enabled\n");
 			msense.write_enable = true;
 		}
+		else if (strcmp(argv[argi], "-d") == 0)
+			msense.dirty_only = true;
+		else if (strcmp(argv[argi], "-c") == 0 && argi + 1 < argc - 1){
+			msense.hist_depth = strtoul(argv[++argi], NULL, 10);
+		}
+		else if (strcmp(argv[argi], "-b") == 0 && argi + 1 < argc - 1)
+			batch = argv[++argi];
+		else if (strcmp(argv[argi], "-j") == 0)
+			batch_fmt = BATCH_JSONL;
+		else if (strcmp(argv[argi], "-D") == 0)
+			bopts.no_detect = true;
+		else if (strcmp(argv[argi], "-B") == 0 && argi + 1 < argc - 1)
+			bopts.window = strtoul(argv[++argi], NULL, 10);
+		else if (strcmp(argv[argi], "-t") == 0 && argi + 1 < argc - 1)
+			bopts.threads = strtoul(argv[++argi], NULL, 10);
+		else if (strcmp(argv[argi], "-P") == 0 && argi + 1 < argc - 1){
+			if (!batch_addpattern(&bopts, argv[++argi])){
+				fprintf(stderr, "invalid -P pattern (%s)\n", argv[argi]);
+				return EXIT_FAILURE;
+			}
+		}
+		else
+			break;
 	}
 
-	msense.pid = strtol(argv[argc == 3 ? 2 : 1], NULL, 10);
+	if (argi != argc - 1){
+		printf("usage: sense_mem [-w] [-d] [-c n] [-P x] "
+			"[-b x [-j] [-B n] [-D] [-t n]] process_id\n"
+			"\t-w enable writing to the process\n"
+			"\t-d only refresh pages that changed (linux, soft-dirty)\n"
+			"\t-c n capture a history of n snapshots per window\n"
+			"\t-P x look for x (hex bytes, e.g. 4d,5a), repeatable, seeds the\n"
+			"\t     find next index or is added to the batch report\n"
+			"batch mode, scan every readable mapping without connecting:\n"
+			"\t-b x write the report to x (- for stdout)\n"
+			"\t-j write JSON lines instead of a binary index\n"
+			"\t-B n bytes per entropy value (default: %d)\n"
+			"\t-D don't run the image / executable detectors\n"
+			"\t-t n number of workers (default: one per core)\n",
+			BATCH_DEFWINDOW);
+		return EXIT_FAILURE;
+	}
+
+	msense.pid = strtol(argv[argi], NULL, 10);
 	msense.mcache = memif_mapdescr(msense.pid, 0, FILTER_NONE, &msense.mcache_sz);
 	if (!msense.mcache){
 		fprintf(stderr, "Couldn't open/parse process (%d)\n", (int) msense.pid);
 		return EXIT_FAILURE;
 	}
 
+	if (batch)
+		return run_batch(&bopts, batch, batch_fmt);
+
+/* -P patterns seed the search index, it keeps its own copy. Without any,
+ * the index waits until the first pattern is added */
+	if (bopts.n_ptns)
+		search_setup(&bopts);
+	batch_opts_free(&bopts);
+
 	if (!senseye_connect(NULL, stderr, &cont, &aarr, connectfl))
 		return EXIT_FAILURE;
 
 /* dimension the control window to match the size of
- * the base-address and its width */
-	int desw = (fontw + 1) * (sizeof(void*) + 8 + 3);
+ * the base-address and its width, plus the hit density column */
+	int desw = (fontw + 1) * (sizeof(void*) + 8 + 4);
 	if (!arcan_shmif_resize(cont.context(&cont), desw, 512))
 		return EXIT_FAILURE;
 
@@ -435,7 +1350,26 @@ int main(int argc, char* argv[])
 	};
 	arcan_shmif_enqueue(msense.cont->context(msense.cont), &ev);
 
+/* clock to repaint the hit density as the search index fills in */
+	arcan_shmif_enqueue(msense.cont->context(msense.cont), &(struct arcan_event){
+		.category = EVENT_EXTERNAL,
+		.ext.kind = ARCAN_EVENT(CLOCKREQ),
+		.ext.clock.rate = 1,
+		.ext.clock.id = 0xabcdef00,
+	});
+
 	while (senseye_pump(&cont, true)){
+		struct search_index* idx = search_get(false);
+		if (!idx)
+			continue;
+
+		size_t done, total;
+		unsigned gen = search_progress(idx, &done, &total);
+		if (gen != msense.search_gen || done != msense.search_done){
+			msense.search_gen = gen;
+			msense.search_done = done;
+			update_preview(SHMIF_RGBA(0x00, 0xff, 0x00, 0xff));
+		}
 	}
 
 	return EXIT_SUCCESS;
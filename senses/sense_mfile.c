@@ -33,6 +33,13 @@
 #include <sys/resource.h>
 
 #include "font_8x8.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #define RGBA(r,g,b,a) SHMIF_RGBA(r,g,b,a)
 
 enum cmp_op {
@@ -70,6 +77,16 @@ struct ent {
 	bool locked;
 	int fd;
 	const char* arg;
+
+/* streaming mode, [map] is the view and starts at file offset [view_ofs] */
+	uint8_t* view;
+	size_t view_cap;
+	uint64_t view_ofs;
+	uint64_t* hash;
+	size_t n_hash;
+	uint64_t seq_blk;
+	bool seekable;
+	bool eof;
 };
 
 static struct {
@@ -95,6 +112,8 @@ static int usage()
 {
 	const char* const argp[] = {
 		"-d,--nodiff", "disable diff subwindow",
+		"-S,--stream", "read inputs in blocks instead of mapping them, "
+			"- for stdin",
 		"-sval,--border=val", "set border width (0..10), default: 1",
 		"-ca,b,op,--comp=a,b,op", "add comparison tile "
 			"(op: AND, OR, ADD, DEC, XOR)",
@@ -116,20 +135,361 @@ static const struct option longopts[] = {
 	{"help",   no_argument,       NULL, '?'},
 	{"border", required_argument, NULL, 's'},
 	{"comp",   required_argument, NULL, 'c'},
+	{"stream", no_argument,       NULL, 'S'},
 	{NULL, no_argument, NULL, 0}
 };
 
+/*
+ * Streaming mode, inputs are read in MF_BLKSZ blocks through a fixed pool
+ * rather than mapped in full, which covers inputs larger than the address
+ * space budget and sources that can't be mapped or seeked. Each entry gets a
+ * view that covers the bytes the tiles need at the current position, and a
+ * hash per block that is filled in the first time the block passes through
+ * the pool.
+ */
+#define MF_BLKSZ 65536
+#define MF_POOLBLK 256
+
+struct blk {
+	struct ent* ent;
+	uint64_t ind;
+	uint64_t tick;
+	size_t len;
+	uint8_t* buf;
+};
+
+static struct {
+	struct blk blk[MF_POOLBLK];
+	uint8_t* data;
+	uint64_t tick;
+
+/* per-run hash key, blocks are only aliased or matched by hash when set */
+	bool keyed;
+	uint64_t key[2];
+} blocks;
+
+#define SIP_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+
+static inline void sip_round(uint64_t v[4])
+{
+	v[0] += v[1]; v[1] = SIP_ROTL(v[1], 13); v[1] ^= v[0];
+	v[0] = SIP_ROTL(v[0], 32);
+	v[2] += v[3]; v[3] = SIP_ROTL(v[3], 16); v[3] ^= v[2];
+	v[0] += v[3]; v[3] = SIP_ROTL(v[3], 21); v[3] ^= v[0];
+	v[2] += v[1]; v[1] = SIP_ROTL(v[1], 17); v[1] ^= v[2];
+	v[2] = SIP_ROTL(v[2], 32);
+}
+
+/*
+ * SipHash-2-4 with a key from the kernel, the inputs are arbitrary files and
+ * a hash match is taken as the blocks being identical, so collisions must not
+ * be something that can be prepared in advance. 0 is reserved for 'not known
+ * yet'.
+ */
+static uint64_t blk_hash(const uint8_t* buf, size_t len)
+{
+	uint64_t v[4] = {
+		blocks.key[0] ^ 0x736f6d6570736575,
+		blocks.key[1] ^ 0x646f72616e646f6d,
+		blocks.key[0] ^ 0x6c7967656e657261,
+		blocks.key[1] ^ 0x7465646279746573
+	};
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8){
+		uint64_t m;
+		memcpy(&m, &buf[i], 8);
+		v[3] ^= m;
+		sip_round(v);
+		sip_round(v);
+		v[0] ^= m;
+	}
+
+	uint64_t m = (uint64_t) len << 56;
+	for (size_t j = 0; i + j < len; j++)
+		m |= (uint64_t) buf[i + j] << (8 * j);
+
+	v[3] ^= m;
+	sip_round(v);
+	sip_round(v);
+	v[0] ^= m;
+
+	v[2] ^= 0xff;
+	for (size_t j = 0; j < 4; j++)
+		sip_round(v);
+
+	uint64_t h = v[0] ^ v[1] ^ v[2] ^ v[3];
+	return h ? h : 1;
+}
+
+static bool blk_key()
+{
+	int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (-1 == fd)
+		return false;
+
+	size_t ofs = 0;
+	uint8_t* dst = (uint8_t*) blocks.key;
+	while (ofs < sizeof(blocks.key)){
+		ssize_t nr = read(fd, &dst[ofs], sizeof(blocks.key) - ofs);
+		if (-1 == nr && errno == EINTR)
+			continue;
+		if (nr <= 0)
+			break;
+		ofs += nr;
+	}
+
+	close(fd);
+	return ofs == sizeof(blocks.key);
+}
+
+static bool blk_sethash(struct ent* ent, uint64_t ind, uint64_t h)
+{
+	if (ind >= ent->n_hash){
+		size_t n = ent->n_hash ? ent->n_hash : 64;
+		while (n <= ind)
+			n <<= 1;
+
+		uint64_t* tmp = realloc(ent->hash, n * sizeof(uint64_t));
+		if (!tmp)
+			return false;
+
+		memset(&tmp[ent->n_hash], '\0', (n - ent->n_hash) * sizeof(uint64_t));
+		ent->hash = tmp;
+		ent->n_hash = n;
+	}
+
+	ent->hash[ind] = h;
+	return true;
+}
+
+static struct blk* blk_evict()
+{
+	struct blk* res = &blocks.blk[0];
+	for (size_t i = 1; i < MF_POOLBLK && res->ent; i++)
+		if (!blocks.blk[i].ent || blocks.blk[i].tick < res->tick)
+			res = &blocks.blk[i];
+
+	res->ent = NULL;
+	return res;
+}
+
+/* fill [dst] with block [ind] of [ent], false at EOF or on failure */
+static bool blk_read(struct ent* ent, uint64_t ind, struct blk* dst)
+{
+	size_t len = 0;
+
+	if (ent->seekable){
+		uint64_t ofs = ind * MF_BLKSZ;
+		while (len < MF_BLKSZ && ofs + len < ent->map_sz){
+			ssize_t nr = pread(ent->fd,
+				&dst->buf[len], MF_BLKSZ - len, ofs + len);
+			if (-1 == nr && (errno == EINTR || errno == EAGAIN))
+				continue;
+			if (nr <= 0)
+				break;
+			len += nr;
+		}
+	}
+	else {
+		while (len < MF_BLKSZ && !ent->eof){
+			ssize_t nr = read(ent->fd, &dst->buf[len], MF_BLKSZ - len);
+			if (-1 == nr && (errno == EINTR || errno == EAGAIN))
+				continue;
+			if (nr <= 0)
+				ent->eof = true;
+			else
+				len += nr;
+		}
+		ent->seq_blk++;
+		ent->map_sz += len;
+	}
+
+	if (!len)
+		return false;
+
+	*dst = (struct blk){
+		.ent = ent,
+		.ind = ind,
+		.tick = ++blocks.tick,
+		.len = len,
+		.buf = dst->buf
+	};
+
+/* without room for the hash the block is still usable, it is just never
+ * served to, or matched against, another input */
+	blk_sethash(ent, ind, blk_hash(dst->buf, len));
+	return true;
+}
+
+/*
+ * Resolve block [ind] of [ent]. A block that is no longer resident but whose
+ * hash is known can be served by the same block of another input if that one
+ * has the same hash, so identical regions are only read once. Sequential
+ * sources can only move forward, anything before that which has been evicted
+ * is lost.
+ */
+static struct blk* blk_get(struct ent* ent, uint64_t ind)
+{
+	uint64_t h = ind < ent->n_hash ? ent->hash[ind] : 0;
+	struct blk* alias = NULL;
+
+	for (size_t i = 0; i < MF_POOLBLK; i++){
+		struct blk* blk = &blocks.blk[i];
+		if (!blk->ent || blk->ind != ind)
+			continue;
+
+		if (blk->ent == ent){
+			blk->tick = ++blocks.tick;
+			return blk;
+		}
+
+		if (h && blocks.keyed &&
+			ind < blk->ent->n_hash && blk->ent->hash[ind] == h)
+			alias = blk;
+	}
+
+	if (alias){
+		alias->tick = ++blocks.tick;
+		return alias;
+	}
+
+	if (ent->seekable){
+		struct blk* blk = blk_evict();
+		return blk_read(ent, ind, blk) ? blk : NULL;
+	}
+
+	while (ind >= ent->seq_blk && !ent->eof){
+		struct blk* blk = blk_evict();
+		if (blk_read(ent, ent->seq_blk, blk) && blk->ind == ind)
+			return blk;
+	}
+
+	return NULL;
+}
+
+/*
+ * Rebuild the view of every streamed entry to cover what the tiles will
+ * sample at [pos]: the [base] * [base] pixels from pos + ofs onwards.
+ */
+static bool stream_prepare(struct ent* ents,
+	size_t n_ents, size_t base, enum pack_mode mode, size_t pos)
+{
+	size_t len = base * base * pack_szlut[mode];
+
+	for (size_t i = 0; i < n_ents; i++){
+		struct ent* ent = &ents[i];
+		if (ent->cmp_op != CMP_NORMAL)
+			continue;
+
+		if (len > ent->view_cap){
+			uint8_t* view = realloc(ent->view, len);
+			if (!view){
+				fprintf(stderr, "Couldn't allocate view for streamed input\n");
+				return false;
+			}
+			ent->view = ent->map = view;
+			ent->view_cap = len;
+		}
+
+/* negative offsets are clamped to the start of the source when the tiles
+ * are drawn, so always cover [len] bytes from there */
+		int64_t lo = (int64_t) pos + ent->ofs;
+		uint64_t ofs = lo < 0 ? 0 : lo;
+		uint64_t end = ofs + len;
+		ent->view_ofs = ofs;
+
+		for (uint64_t ind = ofs / MF_BLKSZ; ofs < end; ind++){
+			uint64_t blk_ofs = ind * MF_BLKSZ;
+			size_t step = MF_BLKSZ - (ofs - blk_ofs);
+			if (step > end - ofs)
+				step = end - ofs;
+
+			struct blk* blk = NULL;
+			if (ofs < ent->map_sz || (!ent->seekable && !ent->eof))
+				blk = blk_get(ent, ind);
+
+			size_t have = 0;
+			if (blk && blk->len > ofs - blk_ofs){
+				have = blk->len - (ofs - blk_ofs);
+				have = have > step ? step : have;
+				memcpy(&ent->view[ofs - ent->view_ofs],
+					&blk->buf[ofs - blk_ofs], have);
+			}
+
+			memset(&ent->view[ofs - ent->view_ofs + have], '\0', step - have);
+			ofs += step;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * True if [row_sz] bytes from [p] are known to be identical in all the
+ * sources, i.e. each block they touch has the same hash everywhere and
+ * the end-of-file padding falls in the same place.
+ */
+static bool blk_match(struct ent* ents,
+	size_t n_ents, int64_t p, size_t row_sz, size_t step)
+{
+	struct ent* ref = &ents[0];
+	if (!blocks.keyed || !ref->hash || p < 0)
+		return false;
+
+	uint64_t first = p / MF_BLKSZ;
+	uint64_t last = (p + row_sz - 1) / MF_BLKSZ;
+
+	for (size_t i = 1; i < n_ents; i++){
+		struct ent* ent = &ents[i];
+		if (ent->cmp_op != CMP_NORMAL)
+			continue;
+
+		if (!ent->hash || ent->ofs != ref->ofs)
+			return false;
+
+		uint64_t end = p + row_sz + step;
+		if (ent->map_sz != ref->map_sz &&
+			(end >= ent->map_sz || end >= ref->map_sz))
+			return false;
+
+		for (uint64_t ind = first; ind <= last; ind++)
+			if (ind >= ent->n_hash || ind >= ref->n_hash ||
+				!ref->hash[ind] || ent->hash[ind] != ref->hash[ind])
+				return false;
+	}
+
+	return true;
+}
+
 struct ent* load_context(char** files, size_t nfiles,
-	size_t lim, size_t* min, size_t* max)
+	size_t lim, size_t* min, size_t* max, bool stream)
 {
 	struct ent* res = malloc(sizeof(struct ent) * lim);
 	memset(res, '\0', sizeof(struct ent) * lim);
 	*max = 0;
 	*min = INT_MAX;
 
+	if (stream){
+		blocks.data = malloc(MF_POOLBLK * MF_BLKSZ);
+		if (!blocks.data){
+			fprintf(stderr, "Couldn't allocate the streaming block pool\n");
+			return NULL;
+		}
+		for (size_t i = 0; i < MF_POOLBLK; i++)
+			blocks.blk[i].buf = &blocks.data[i * MF_BLKSZ];
+
+		blocks.keyed = blk_key();
+		if (!blocks.keyed)
+			fprintf(stderr, "No hash key, identical blocks will be read twice\n");
+	}
+
 	for (size_t i=0; i < nfiles; i++){
 		struct ent* dent = &res[i];
-		dent->fd = open(files[i], O_RDONLY);
+		if (stream && strcmp(files[i], "-") == 0)
+			dent->fd = STDIN_FILENO;
+		else
+			dent->fd = open(files[i], O_RDONLY);
 		if (-1 == dent->fd){
 			fprintf(stderr, "Failed while trying to open %s\n", files[i]);
 			return NULL;
@@ -142,6 +502,13 @@ struct ent* load_context(char** files, size_t nfiles,
 			return NULL;
 		}
 
+		if (stream){
+			off_t end = lseek(dent->fd, 0, SEEK_END);
+			dent->seekable = end > 0 || (end == 0 && S_ISREG(buf.st_mode));
+			dent->map_sz = dent->seekable ? end : 0;
+			continue;
+		}
+
 		if (!S_ISREG(buf.st_mode)){
 			fprintf(stderr, "Invalid file mode for %s, expecting a normal file.\n",
 				files[i]);
@@ -165,6 +532,11 @@ struct ent* load_context(char** files, size_t nfiles,
 	return res;
 }
 
+static inline uint8_t* ent_at(struct ent* ent, uint64_t ofs)
+{
+	return ent->map + (ofs - ent->view_ofs);
+}
+
 static inline shmif_pixel pack_pixel(enum pack_mode mode, uint8_t* buf)
 {
 	switch(mode){
@@ -180,47 +552,214 @@ static inline shmif_pixel pack_pixel(enum pack_mode mode, uint8_t* buf)
 	return RGBA(0xde, 0xad, 0xbe, 0xef);
 }
 
-/* caller guarantees that buffer fits packing mode */
-static inline shmif_pixel mpack_pixel(enum pack_mode mode,
-	uint8_t* buf_a, uint8_t* buf_b, enum cmp_op op)
+/*
+ * Row kernels, pack [n] pixels from [buf] into [dst] with the mode switch
+ * taken once per row rather than once per pixel. The SIMD versions are
+ * swapped in by setup_kernels when the shmif pixel layout is one they know.
+ */
+typedef void (*pack_row_fn)(shmif_pixel* dst, const uint8_t* buf, size_t n);
+
+static void row_intens(shmif_pixel* dst, const uint8_t* buf, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		dst[i] = RGBA(buf[i], buf[i], buf[i], 0xff);
+}
+
+static void row_tight(shmif_pixel* dst, const uint8_t* buf, size_t n)
 {
-	uint8_t r, r2, g, g2, b, b2, a, a2;
-	r = g = b = buf_a[0];
-	r2 = g2 = b2 = buf_b[0];
-	a = a2 = 0xff;
+	for (size_t i = 0; i < n; i++, buf += 4)
+		dst[i] = RGBA(buf[0], buf[1], buf[2], buf[3]);
+}
 
-	if (mode != PACK_INTENS){
-		g = buf_a[1];
-		b = buf_a[2];
-		g2 = buf_b[1];
-		b2 = buf_b[2];
+static void row_tnoalpha(shmif_pixel* dst, const uint8_t* buf, size_t n)
+{
+	for (size_t i = 0; i < n; i++, buf += 3)
+		dst[i] = RGBA(buf[0], buf[1], buf[2], 0xff);
+}
 
-		if (mode == PACK_TIGHT){
-			a = buf_a[3];
-			a2 = buf_b[3];
-		}
+#if defined(__SSE2__) || defined(__ARM_NEON)
+#define ROW_SIMD
+
+static void row_intens_simd(shmif_pixel* dst, const uint8_t* buf, size_t n)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i a = _mm_set1_epi8((char) 0xff);
+
+	for (; i + 16 <= n; i += 16){
+		__m128i v = _mm_loadu_si128((const __m128i*) &buf[i]);
+		__m128i vv_lo = _mm_unpacklo_epi8(v, v);
+		__m128i vv_hi = _mm_unpackhi_epi8(v, v);
+		__m128i va_lo = _mm_unpacklo_epi8(v, a);
+		__m128i va_hi = _mm_unpackhi_epi8(v, a);
+		__m128i* out = (__m128i*) &dst[i];
+		_mm_storeu_si128(&out[0], _mm_unpacklo_epi16(vv_lo, va_lo));
+		_mm_storeu_si128(&out[1], _mm_unpackhi_epi16(vv_lo, va_lo));
+		_mm_storeu_si128(&out[2], _mm_unpacklo_epi16(vv_hi, va_hi));
+		_mm_storeu_si128(&out[3], _mm_unpackhi_epi16(vv_hi, va_hi));
+	}
+#else
+	for (; i + 16 <= n; i += 16){
+		uint8x16x4_t px;
+		px.val[0] = px.val[1] = px.val[2] = vld1q_u8(&buf[i]);
+		px.val[3] = vdupq_n_u8(0xff);
+		vst4q_u8((uint8_t*) &dst[i], px);
 	}
+#endif
+
+	row_intens(&dst[i], &buf[i], n - i);
+}
+
+static void row_tight_simd(shmif_pixel* dst, const uint8_t* buf, size_t n)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+/* R G B A -> B G R A, swap the low and high byte of each 16-bit half */
+	const __m128i m_ga = _mm_set1_epi32(0xff00ff00);
+	const __m128i m_b = _mm_set1_epi32(0x000000ff);
+	const __m128i m_r = _mm_set1_epi32(0x00ff0000);
+
+	for (; i + 4 <= n; i += 4){
+		__m128i v = _mm_loadu_si128((const __m128i*) &buf[i * 4]);
+		__m128i r = _mm_or_si128(_mm_and_si128(v, m_ga),
+			_mm_or_si128(
+				_mm_and_si128(_mm_srli_epi32(v, 16), m_b),
+				_mm_and_si128(_mm_slli_epi32(v, 16), m_r)
+			)
+		);
+		_mm_storeu_si128((__m128i*) &dst[i], r);
+	}
+#else
+	for (; i + 16 <= n; i += 16){
+		uint8x16x4_t v = vld4q_u8(&buf[i * 4]);
+		uint8x16_t t = v.val[0];
+		v.val[0] = v.val[2];
+		v.val[2] = t;
+		vst4q_u8((uint8_t*) &dst[i], v);
+	}
+#endif
+
+	row_tight(&dst[i], &buf[i * 4], n - i);
+}
+#endif
+
+/* indexed by enum pack_mode */
+static pack_row_fn row_pack[] = {
+	row_intens,
+	row_tight,
+	row_tnoalpha
+};
+
+static void setup_kernels()
+{
+#ifdef ROW_SIMD
+	shmif_pixel px = RGBA(0x01, 0x02, 0x03, 0x04);
+	uint8_t* pb = (uint8_t*) &px;
+
+	if (pb[0] == 0x03 && pb[1] == 0x02 && pb[2] == 0x01 && pb[3] == 0x04){
+		row_pack[PACK_INTENS] = row_intens_simd;
+		row_pack[PACK_TIGHT] = row_tight_simd;
+	}
+#endif
+}
+
+/*
+ * Byte-wise [op] over [n] bytes of [a] and [b] into [dst], the packing mode
+ * only decides how the result is turned into pixels afterwards so one kernel
+ * per operation covers all of them.
+ */
+#ifdef __SSE2__
+#define CMP_SIMD(OP)\
+	for (; i + 16 <= n; i += 16)\
+		_mm_storeu_si128((__m128i*) &dst[i], OP(\
+			_mm_loadu_si128((const __m128i*) &a[i]),\
+			_mm_loadu_si128((const __m128i*) &b[i])));
+#define V_AND _mm_and_si128
+#define V_ADD _mm_add_epi8
+#define V_DEC _mm_sub_epi8
+#define V_XOR _mm_xor_si128
+#elif defined(__ARM_NEON)
+#define CMP_SIMD(OP)\
+	for (; i + 16 <= n; i += 16)\
+		vst1q_u8(&dst[i], OP(vld1q_u8(&a[i]), vld1q_u8(&b[i])));
+#define V_AND vandq_u8
+#define V_ADD vaddq_u8
+#define V_DEC vsubq_u8
+#define V_XOR veorq_u8
+#else
+#define CMP_SIMD(OP)
+#endif
+
+static void cmp_row(uint8_t* dst,
+	const uint8_t* a, const uint8_t* b, size_t n, enum cmp_op op)
+{
+	size_t i = 0;
 
 	switch (op){
 	case CMP_AND:
-		r &= r2; g &= g2; b &= b2; a &= a2;
+		CMP_SIMD(V_AND);
+		for (; i < n; i++)
+			dst[i] = a[i] & b[i];
 	break;
 	case CMP_ADD:
-		r += r2; g += g2; b += b2; a += a2;
+		CMP_SIMD(V_ADD);
+		for (; i < n; i++)
+			dst[i] = a[i] + b[i];
 	break;
 	case CMP_DEC:
-		r -= r2; g -= g2; b -= b2; a -= a2;
+		CMP_SIMD(V_DEC);
+		for (; i < n; i++)
+			dst[i] = a[i] - b[i];
 	break;
 	case CMP_XOR:
-		r ^= r2; g ^= g2; b ^= b2; a ^= a2;
+		CMP_SIMD(V_XOR);
+		for (; i < n; i++)
+			dst[i] = a[i] ^ b[i];
 	break;
 	default:
+		memmove(dst, a, n);
 	break;
 	}
-	if (mode != PACK_TNOALPHA)
-		a = 0xff;
+}
+
+#undef CMP_SIMD
+
+/*
+ * Number of pixels, starting at byte [p] and at most [n], before the pad
+ * condition (p + step >= sz) kicks in.
+ */
+static size_t pad_from(int64_t p, size_t step, size_t sz, size_t n)
+{
+	int64_t lim = (int64_t) sz - p - (int64_t) step;
+	if (lim <= 0)
+		return 0;
+
+	size_t k = ((size_t) lim + step - 1) / step;
+	return k < n ? k : n;
+}
+
+/*
+ * Pointer to [n] bytes at [ofs] in the mapping of [ent], anything outside of
+ * the mapping reads as 0 and is staged in [tmp].
+ */
+static const uint8_t* src_bytes(struct ent* ent,
+	int64_t ofs, size_t n, uint8_t* tmp)
+{
+	if (ofs >= 0 && (uint64_t) ofs + n <= ent->map_sz)
+		return ent_at(ent, ofs);
+
+	memset(tmp, '\0', n);
+	int64_t lo = ofs < 0 ? 0 : ofs;
+	int64_t hi = ofs + (int64_t) n;
+	if (hi > (int64_t) ent->map_sz)
+		hi = ent->map_sz;
 
-	return RGBA(r, g, b, a);
+	if (hi > lo)
+		memcpy(&tmp[lo - ofs], ent_at(ent, lo), hi - lo);
+
+	return tmp;
 }
 
 static void base_cmp(struct arcan_shmif_cont* dst, struct ent* tile,
@@ -230,43 +769,105 @@ static void base_cmp(struct arcan_shmif_cont* dst, struct ent* tile,
 	size_t step = pack_szlut[mode];
 	struct ent* src_a = tile->set[0];
 	struct ent* src_b = tile->set[1];
-
-	for (size_t row = y; row < y+base; row++)
-		for (size_t col = x; col < x+base; col++, pos += step){
-			dst->vidp[row*dst->pitch+col] =
-				(pos+step+src_a->ofs >= src_a->map_sz) &&
-				(pos+step+src_b->ofs >= src_b->map_sz) ? color.pad :
-					mpack_pixel(mode, src_a->map + pos + src_a->ofs,
-						src_b->map + pos + src_b->ofs, tile->cmp_op);
+	uint8_t tmp_a[base * step], tmp_b[base * step], res[base * step];
+
+/* alpha of the mpack:ed pixel, only TNOALPHA keeps the result of the op */
+	uint8_t alpha = 0xff;
+	if (mode == PACK_TNOALPHA)
+		cmp_row(&alpha, &alpha, (uint8_t[]){0xff}, 1, tile->cmp_op);
+	shmif_pixel amask = RGBA(0x00, 0x00, 0x00, 0xff);
+	shmif_pixel aval = RGBA(0x00, 0x00, 0x00, alpha);
+
+	for (size_t row = y; row < y+base; row++, pos += base * step){
+		shmif_pixel* out = &dst->vidp[row*dst->pitch+x];
+		int64_t pa = (int64_t) pos + src_a->ofs;
+		int64_t pb = (int64_t) pos + src_b->ofs;
+
+/* a pixel is only padded when it is past the end in both sources */
+		size_t na = pad_from(pa, step, src_a->map_sz, base);
+		size_t nb = pad_from(pb, step, src_b->map_sz, base);
+		size_t np = na > nb ? na : nb;
+
+		cmp_row(res, src_bytes(src_a, pa, np * step, tmp_a),
+			src_bytes(src_b, pb, np * step, tmp_b), np * step, tile->cmp_op);
+		row_pack[mode](out, res, np);
+
+		if (mode != PACK_INTENS)
+			for (size_t i = 0; i < np; i++)
+				out[i] = (out[i] & ~amask) | aval;
+
+		for (size_t i = np; i < base; i++)
+			out[i] = color.pad;
 	}
 }
 
+/*
+ * One row of the source [ent] as the diff tile sees it, [p] is the byte
+ * offset of the first pixel and may be negative, such pixels sample the
+ * start of the mapping.
+ */
+static void dtile_row(shmif_pixel* dst, struct ent* ent,
+	int64_t p, size_t n, enum pack_mode mode)
+{
+	size_t step = pack_szlut[mode];
+	size_t i = 0;
+
+	for (; i < n && p < 0; i++, p += step)
+		dst[i] = p + (int64_t) step < 0 || ent->map_sz < step ||
+			p + (int64_t) step >= (int64_t) ent->map_sz ?
+			color.pad : pack_pixel(mode, ent_at(ent, 0));
+
+	size_t np = i + pad_from(p, step, ent->map_sz, n - i);
+	row_pack[mode](&dst[i], ent_at(ent, p), np - i);
+
+	for (i = np; i < n; i++)
+		dst[i] = color.pad;
+}
+
 /*
  * sweep all entries and generate a 1-bit tile that indicates if the input
- * files match or diff at each packing position
+ * files match or diff at each packing position, [nrows] lets the tile be
+ * split into bands.
  */
 static void draw_dtile(struct arcan_shmif_cont* dst,
 	struct ent* ents, size_t n_ents, size_t pos, size_t x, size_t y,
-	enum pack_mode mode, size_t base)
+	enum pack_mode mode, size_t base, size_t nrows)
 {
 	size_t step = pack_szlut[mode];
+	shmif_pixel ref[base], cur[base];
+	shmif_pixel lut[n_ents + 1];
+	uint16_t n_delta[base];
+
+	lut[0] = color.match;
+	for (size_t i = 1; i <= n_ents; i++)
+		lut[i] = RGBA(0x00, 255.0 * ((float)i / (float)n_ents), 0x00, 0xff);
+
+	for (size_t row = y; row < y+nrows; row++, pos += base * step){
+		shmif_pixel* out = &dst->vidp[row*dst->pitch+x];
+
+/* streamed inputs with identical blocks here, no need to look at the bytes */
+		if (blk_match(ents, n_ents,
+			(int64_t) pos + ents[0].ofs, base * step, step)){
+			for (size_t j = 0; j < base; j++)
+				out[j] = lut[0];
+			continue;
+		}
 
-	for (size_t row = y; row < y+base; row++)
-		for (size_t col = x; col < x+base; col++, pos += step){
-			shmif_pixel pxbuf[n_ents];
-			for (size_t i = 0; i < n_ents; i++)
-				if (ents[i].cmp_op == CMP_NORMAL){
-				off_t ofs = (ssize_t)pos + ents[i].ofs < 0 ? 0 : pos + ents[i].ofs;
-				pxbuf[i] = pos+step+ents[i].ofs >= ents[i].map_sz ? color.pad :
-					pack_pixel(mode, ents[i].map + ofs);
-			}
+		memset(n_delta, '\0', sizeof(n_delta));
+		dtile_row(ref, &ents[0], (int64_t) pos + ents[0].ofs, base, mode);
 
-			float n_delta = 0;
-			for (size_t i = 1; i < n_ents; i++)
-				n_delta += pxbuf[i] != pxbuf[0] ? 1 : 0;
+/* comparison tiles are derived, only the sources themselves count */
+		for (size_t i = 1; i < n_ents; i++){
+			if (ents[i].cmp_op != CMP_NORMAL)
+				continue;
 
-			dst->vidp[row*dst->pitch+col] = n_delta ?
-				RGBA(0x00, 255.0 * (n_delta / (float)n_ents), 0x00, 0xff) : color.match;
+			dtile_row(cur, &ents[i], (int64_t) pos + ents[i].ofs, base, mode);
+			for (size_t j = 0; j < base; j++)
+				n_delta[j] += cur[j] != ref[j];
+		}
+
+		for (size_t j = 0; j < base; j++)
+			out[j] = lut[n_delta[j]];
 	}
 }
 
@@ -276,7 +877,6 @@ static void draw_tile(struct arcan_shmif_cont* dst,
 {
 	size_t ntw = base*base;
 	size_t step = pack_szlut[mode];
-	ent->ofs = (ent->ofs < 0 && -1 * ent->ofs > pos) ? -pos : ent->ofs;
 	pos += ent->ofs;
 
 	size_t end = pos + ntw * step;
@@ -284,27 +884,175 @@ static void draw_tile(struct arcan_shmif_cont* dst,
 	if (end > ent->map_sz)
 		ntw = end > ent->map_sz + ntw * step ? 0 : (ent->map_sz - pos) / step;
 
-	size_t row = y;
-	size_t col = x;
-	size_t row_lim = base+y;
-	size_t col_lim = base+x;
+	uint8_t* buf = ent_at(ent, pos);
+
+	for (size_t row = y; row < base+y; row++){
+		shmif_pixel* out = &dst->vidp[row*dst->pitch+x];
+		size_t n = ntw > base ? base : ntw;
+		row_pack[mode](out, buf, n);
+		buf += n * step;
+		ntw -= n;
+
+		for (size_t i = n; i < base; i++)
+			out[i] = RGBA(0x00, 0x00, 0x00, 0xff);
+	}
+}
+
+/*
+ * Small persistent worker pool, pool_run hands [n] jobs out to the workers
+ * and to the calling thread, and returns when all of them are finished. Tiles
+ * (and bands of the diff tile) never overlap so the jobs themselves need no
+ * further synchronization.
+ */
+#define MF_MAXWORKERS 8
+
+typedef void (*pool_job)(void* tag, size_t ind);
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	pool_job job;
+	void* tag;
+	size_t n_jobs;
+	size_t next;
+	size_t active;
+	size_t n_workers;
+} pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER
+};
+
+/* pool.lock is held on entry and exit */
+static void pool_take()
+{
+	while (pool.next < pool.n_jobs){
+		size_t ind = pool.next++;
+		pool_job job = pool.job;
+		void* tag = pool.tag;
+		pool.active++;
+
+		pthread_mutex_unlock(&pool.lock);
+		job(tag, ind);
+		pthread_mutex_lock(&pool.lock);
+
+		pool.active--;
+	}
+}
+
+static void* pool_worker(void* arg)
+{
+	pthread_mutex_lock(&pool.lock);
+	for(;;){
+		while (pool.next >= pool.n_jobs)
+			pthread_cond_wait(&pool.wake, &pool.lock);
+
+		pool_take();
+		if (!pool.active)
+			pthread_cond_signal(&pool.done);
+	}
+
+	return NULL;
+}
+
+static void pool_setup()
+{
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t lim = ncpu > 1 ? ncpu - 1 : 0;
+	if (lim > MF_MAXWORKERS)
+		lim = MF_MAXWORKERS;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (; pool.n_workers < lim; pool.n_workers++){
+		pthread_t pth;
+		if (0 != pthread_create(&pth, &attr, pool_worker, NULL))
+			break;
+	}
+
+	pthread_attr_destroy(&attr);
+}
+
+static void pool_run(pool_job job, void* tag, size_t n)
+{
+	if (!pool.n_workers || n < 2){
+		for (size_t i = 0; i < n; i++)
+			job(tag, i);
+		return;
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.job = job;
+	pool.tag = tag;
+	pool.next = 0;
+	pool.n_jobs = n;
+	pthread_cond_broadcast(&pool.wake);
+
+	pool_take();
+	while (pool.active)
+		pthread_cond_wait(&pool.done, &pool.lock);
+
+	pool.n_jobs = pool.next = 0;
+	pthread_mutex_unlock(&pool.lock);
+}
 
-	uint8_t* buf = ent->map + pos;
+struct tile_job {
+	struct arcan_shmif_cont* dst;
+	struct ent* ents;
+	size_t n_ents;
+	size_t (*xy)[2];
+	size_t pos;
+	size_t base;
+	size_t band;
+	enum pack_mode mode;
+};
 
-	for (; row < row_lim && ntw; row++)
-		for (col = x; col < col_lim && ntw; col++, ntw--, buf += step)
-			dst->vidp[row*dst->pitch+col] = pack_pixel(mode, buf);
+static void diff_job(void* tag, size_t ind)
+{
+	struct tile_job* job = tag;
+	size_t row = ind * job->band;
+	size_t nrows = job->base - row < job->band ? job->base - row : job->band;
 
-	for (; row < row_lim; row++)
-		for (col = x; col < col_lim; col++)
-			dst->vidp[row*dst->pitch+col] = RGBA(0x00, 0x00, 0x00, 0xff);
+	draw_dtile(job->dst, job->ents, job->n_ents,
+		job->pos + row * job->base * pack_szlut[job->mode],
+		0, row, job->mode, job->base, nrows);
+}
+
+static void tile_job(void* tag, size_t ind)
+{
+	struct tile_job* job = tag;
+	struct ent* ent = &job->ents[ind];
+	size_t x = job->xy[ind][0];
+	size_t y = job->xy[ind][1];
+
+	if (ent->cmp_op == CMP_NORMAL)
+		draw_tile(job->dst, ent, job->pos, x, y, job->mode, job->base);
+	else
+		base_cmp(job->dst, ent, &job->ents,
+			job->n_ents, job->pos, x, y, job->mode, job->base);
 }
 
 static void refresh_diff(struct arcan_shmif_cont* dst,
 	struct ent* entries, size_t n_entries, size_t base,
 	enum pack_mode mode, size_t pos)
 {
-	draw_dtile(dst, entries, n_entries, pos, 0, 0, mode, base);
+/* split into bands so that the one tile still spreads over the pool */
+	size_t band = base / (2 * (pool.n_workers + 1));
+	band = band < 8 ? 8 : band;
+
+	struct tile_job job = {
+		.dst = dst,
+		.ents = entries,
+		.n_ents = n_entries,
+		.pos = pos,
+		.base = base,
+		.band = band,
+		.mode = mode
+	};
+	pool_run(diff_job, &job, (base + band - 1) / band);
 	arcan_shmif_signal(dst, SHMIF_SIGVID | SHMIF_SIGBLK_NONE);
 }
 
@@ -314,13 +1062,19 @@ static void refresh_data(struct arcan_shmif_cont* dst,
 )
 {
 	size_t y = 0, x = 0;
+	size_t xy[n_entries][2];
+	size_t n_tiles = 0;
 
-/* flood-fill "draw_tile", this could well be thread- split per tile */
-	for (size_t i = 0; i < n_entries && y <= dst->h - base; i++){
-		if (entries[i].cmp_op == CMP_NORMAL)
-			draw_tile(dst, &entries[i], pos, x, y, mode, base);
-		else
-			base_cmp(dst, &entries[i], &entries, n_entries, pos, x, y, mode, base);
+/* layout and borders first, then one job per tile. The offset clamp is done
+ * here rather than in draw_tile as comparison tiles read the offsets of the
+ * entries they are derived from */
+	for (size_t i = 0; i < n_entries && y <= dst->h - base; i++, n_tiles++){
+		struct ent* ent = &entries[i];
+		if (ent->cmp_op == CMP_NORMAL)
+			ent->ofs = (ent->ofs < 0 && -1 * ent->ofs > pos) ? -pos : ent->ofs;
+
+		xy[i][0] = x;
+		xy[i][1] = y;
 
 		if (border)
 			draw_box(dst, x + base, y, border, base, entries[i].locked ?
@@ -334,6 +1088,17 @@ static void refresh_data(struct arcan_shmif_cont* dst,
 		}
 	}
 
+	struct tile_job job = {
+		.dst = dst,
+		.ents = entries,
+		.n_ents = n_entries,
+		.xy = xy,
+		.pos = pos,
+		.base = base,
+		.mode = mode
+	};
+	pool_run(tile_job, &job, n_tiles);
+
 	arcan_event ev = {
 		.category = EVENT_EXTERNAL,
 		.ext.kind = EVENT_EXTERNAL_FRAMESTATUS,
@@ -423,12 +1188,13 @@ int main(int argc, char* argv[])
 	enum pack_mode pack_mode = PACK_INTENS;
 
 	bool difftile = true;
+	bool stream = false;
 	int ch;
 
 	char* ncarg[argc];
 	size_t ncargc = 0;
 
-	while((ch = getopt_long(argc, argv, "db:c:?", longopts, NULL)) >= 0)
+	while((ch = getopt_long(argc, argv, "db:c:S?", longopts, NULL)) >= 0)
 	switch(ch){
 	case '?' :
 		return usage();
@@ -443,6 +1209,9 @@ int main(int argc, char* argv[])
 	case 'd' :
 		difftile = true;
 	break;
+	case 'S' :
+		stream = true;
+	break;
 	}
 
 	if (optind >= argc - 1 || (argc - optind) > 256){
@@ -455,7 +1224,7 @@ int main(int argc, char* argv[])
 	size_t focus_count = 0;
 	size_t min_r, max_r, n_ent = argc - optind;
 	struct ent* entries = load_context(argv + optind,
-		n_ent, n_ent + ncargc, &min_r, &max_r);
+		n_ent, n_ent + ncargc, &min_r, &max_r, stream);
 
 	if (entries == NULL)
 		return EXIT_FAILURE;
@@ -468,6 +1237,9 @@ int main(int argc, char* argv[])
 	}
 	n_ent += ncargc;
 
+	setup_kernels();
+	pool_setup();
+
 	if (NULL == getenv("ARCAN_CONNPATH"))
 		setenv("ARCAN_CONNPATH", "senseye", 0);
 	cont = arcan_shmif_open(SEGID_APPLICATION, SHMIF_CONNECT_LOOP, &aarr);
@@ -490,7 +1262,8 @@ int main(int argc, char* argv[])
 		arcan_shmif_enqueue(&cont, &ev);
 	}
 
-#define REFRESH() {\
+#define REFRESH() if (!stream ||\
+	stream_prepare(entries, n_ent, base, pack_mode, ofs)) {\
 	if (difftile && diffcont.vidp) refresh_diff(\
 		&diffcont, entries, n_ent, base, pack_mode, ofs);\
 		refresh_data(&cont, entries, n_ent, base, pack_mode, ofs, border);\
@@ -6,6 +6,7 @@
  * signal around a transfer channel connected to STDIN, sampling and
  * forwarding on STDOUT.
  */
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -17,13 +18,39 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <sys/stat.h>
 
 #include <arcan_shmif.h>
 #include "libsenseye.h"
 
 static size_t inp_buf_sz = 1024 * 1;
+static size_t ring_sz = 1024 * 1024;
 static struct arcan_shmif_cont* shm;
 
+/*
+ * Unless running in lockstep, the channel only sees a sample of the stream
+ * through [ring], a pipe with a non-blocking write end. What doesn't fit
+ * when the UI falls behind is dropped rather than waited for.
+ */
+static bool lockstep = false;
+static int ring[2] = {-1, -1};
+
+/*
+ * Dropped bytes still count towards the stream offset of the channel. At
+ * most one gap is open at a time, at [gap_at] in the bytes written to the
+ * ring, and nothing more is written until the data_loop has read up to it.
+ * The gap then turns into [skip], which the data_loop seeks past before it
+ * passes on anything read after it.
+ */
+static struct {
+	pthread_mutex_t lock;
+	uint64_t in, out;
+	uint64_t gap_at, lost;
+	uint64_t skip;
+} ring_st = {
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
 bool control_refresh(shmif_pixel* vidp, size_t w, size_t h)
 {
 	return false;
@@ -34,9 +61,205 @@ void control_event(arcan_event* ev)
 
 }
 
+static bool write_all(int fd, const uint8_t* buf, size_t n)
+{
+	size_t ofs = 0;
+	while (n - ofs > 0){
+		ssize_t nw = write(fd, buf + ofs, n - ofs);
+		if (-1 == nw){
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			return false;
+		}
+		ofs += nw;
+	}
+	return true;
+}
+
+/* returns true if the ring can be written to or false if there's a gap */
+static bool ring_open()
+{
+	pthread_mutex_lock(&ring_st.lock);
+	if (ring_st.lost && ring_st.out >= ring_st.gap_at){
+		ring_st.skip += ring_st.lost;
+		ring_st.lost = 0;
+	}
+	bool res = !ring_st.lost;
+	pthread_mutex_unlock(&ring_st.lock);
+	return res;
+}
+
+static void ring_wrote(size_t n)
+{
+	pthread_mutex_lock(&ring_st.lock);
+	ring_st.in += n;
+	pthread_mutex_unlock(&ring_st.lock);
+}
+
+static void ring_lose(size_t n)
+{
+	pthread_mutex_lock(&ring_st.lock);
+	if (!ring_st.lost)
+		ring_st.gap_at = ring_st.in;
+	ring_st.lost += n;
+	pthread_mutex_unlock(&ring_st.lock);
+}
+
+/* account for [n] bytes read from the ring, returns the bytes to skip before
+ * them, at EOF ([n] = 0) that includes the gap still open */
+static uint64_t ring_read(size_t n)
+{
+	pthread_mutex_lock(&ring_st.lock);
+	uint64_t res = ring_st.skip + (n ? 0 : ring_st.lost);
+	ring_st.skip = 0;
+	ring_st.out += n;
+	pthread_mutex_unlock(&ring_st.lock);
+	return res;
+}
+
+static void ring_offer(const uint8_t* buf, size_t n)
+{
+	if (!ring_open()){
+		ring_lose(n);
+		return;
+	}
+
+	while (n > 0){
+		ssize_t nw = write(ring[1], buf, n);
+		if (-1 == nw && errno == EINTR)
+			continue;
+		if (nw <= 0){
+			ring_lose(n);
+			return;
+		}
+		ring_wrote(nw);
+		buf += nw;
+		n -= nw;
+	}
+}
+
+#ifdef __LINUX
+/*
+ * tee what is pending on STDIN into the ring and splice the same amount to
+ * STDOUT, neither copy passes through user space. Returns 1 if something was
+ * forwarded, 0 on EOF or a broken output and -1 if the descriptors turned out
+ * not to support it. In the last case, [teed] is set to the number of bytes
+ * at the head of STDIN that are already in the ring.
+ */
+#define SPLICE_CHUNK 65536
+
+static int forward_splice(size_t* teed)
+{
+	bool open = ring_open();
+	ssize_t nt = open ?
+		tee(STDIN_FILENO, ring[1], SPLICE_CHUNK, SPLICE_F_NONBLOCK) : -1;
+	bool sampled = nt > 0;
+
+	if (0 == nt)
+		return 0;
+
+	if (-1 == nt){
+		if (open && errno == EINVAL)
+			return -1;
+		if (open && errno != EAGAIN)
+			return 0;
+
+/* STDIN is known to be readable so the ring is full or has a gap, this part
+ * is dropped */
+		nt = SPLICE_CHUNK;
+	}
+	else
+		ring_wrote(nt);
+
+	size_t left = nt;
+	while (left){
+		ssize_t ns = splice(STDIN_FILENO, NULL,
+			STDOUT_FILENO, NULL, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+
+		if (-1 == ns){
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (errno != EINVAL || left != nt)
+				return 0;
+			*teed = sampled ? nt : 0;
+			return -1;
+		}
+		if (0 == ns)
+			return 0;
+
+/* the teed bytes must all be consumed or the next tee would repeat them */
+		if (!sampled){
+			ring_lose(ns);
+			break;
+		}
+		left -= ns;
+	}
+
+	return 1;
+}
+#endif
+
+/*
+ * Forward STDIN to STDOUT at whatever pace they allow, and feed the ring as
+ * a side effect. Closing the ring on EOF is what lets the data_loop know.
+ */
+static void* pass_loop(void* ptr)
+{
+	uint8_t buffer[inp_buf_sz];
+	size_t teed = 0;
+	struct pollfd pfd = {
+		.fd = STDIN_FILENO,
+		.events = POLLIN
+	};
+
+#ifdef __LINUX
+/* tee wants pipes on both ends, splice wants the output to accept it */
+	struct stat in, out;
+	bool zcopy = 0 == fstat(STDIN_FILENO, &in) &&
+		0 == fstat(STDOUT_FILENO, &out) && S_ISFIFO(in.st_mode) &&
+		(S_ISFIFO(out.st_mode) || S_ISSOCK(out.st_mode) ||
+		(S_ISREG(out.st_mode) && !(fcntl(STDOUT_FILENO, F_GETFL) & O_APPEND)));
+#endif
+
+	while (1){
+		if (-1 == poll(&pfd, 1, -1)){
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			break;
+		}
+
+#ifdef __LINUX
+		if (zcopy){
+			int rv = forward_splice(&teed);
+			if (rv > 0)
+				continue;
+			else if (rv == 0)
+				break;
+			zcopy = false;
+		}
+#endif
+
+		ssize_t nr = read(STDIN_FILENO, buffer, inp_buf_sz);
+		if (-1 == nr && (errno == EAGAIN || errno == EINTR))
+			continue;
+
+		if (nr <= 0 || !write_all(STDOUT_FILENO, buffer, nr))
+			break;
+
+/* the first bytes after falling back from splice can already be in the ring */
+		size_t skip = (size_t) nr < teed ? (size_t) nr : teed;
+		teed -= skip;
+		ring_offer(buffer + skip, nr - skip);
+	}
+
+	close(ring[1]);
+	return NULL;
+}
+
 void* data_loop(void* ptr)
 {
 	struct senseye_ch* ch = ptr;
+	int in_fd = lockstep ? STDIN_FILENO : ring[0];
 
 /* register type so UI gets mapped correctly */
 	arcan_event ev = {
@@ -50,7 +273,7 @@ void* data_loop(void* ptr)
 /* polling will happen in two layers, here and during pump/read */
 	short pollev = POLLIN | POLLERR | POLLHUP | POLLNVAL;
 	struct pollfd fds[2] = {
-		{	.fd = STDIN_FILENO, .events = pollev },
+		{	.fd = in_fd, .events = pollev },
 		{ .fd = ch->in_handle, .events = pollev }
 	};
 
@@ -66,29 +289,34 @@ void* data_loop(void* ptr)
 		if ( (fds[1].revents & POLLIN) > 0)
 			ch->pump(ch);
 
-		if ( (fds[0].revents | POLLIN) ){
-			size_t buffer[inp_buf_sz];
-			ssize_t nr = read(STDIN_FILENO, buffer, inp_buf_sz);
+		if ( (fds[0].revents & POLLIN) ){
+			uint8_t buffer[inp_buf_sz];
+			ssize_t nr = read(in_fd, buffer, inp_buf_sz);
 
-/* will block / wait until the user has stepped through and processed */
+/* will block / wait until the user has stepped through and processed,
+ * outside of lockstep that only holds back the ring */
 			if (nr > 0){
+				uint64_t skip = lockstep ? 0 : ring_read(nr);
+				if (skip)
+					ch->seek(ch, skip);
+
 				ch->data(ch, buffer, nr);
 
-/* flush to output */
-				off_t ofs = 0;
-				while (nr - ofs > 0){
-					ssize_t nw = write(STDOUT_FILENO, buffer + ofs, nr - ofs);
-					if (-1 == nw && errno != EAGAIN && errno != EINTR)
-						goto error;
-					ofs += nw;
-				}
+				if (lockstep && !write_all(STDOUT_FILENO, buffer, nr))
+					goto error;
 			}
+			else if (0 == nr)
+				goto error;
 		}
 
-/* any errors or dead? */
-		if ( ((fds[0].revents | fds[1].revents )
-			& ( POLLERR | POLLHUP | POLLNVAL ) ) > 0){
+/* any errors or dead? a hung up input is drained before giving up on it */
+		short dead = POLLERR | POLLHUP | POLLNVAL;
+		if ( ((fds[0].revents & dead) && !(fds[0].revents & POLLIN)) ||
+			(fds[1].revents & dead) ){
 error:
+		if (!lockstep)
+			ch->seek(ch, ring_read(0));
+
 		for (size_t i = 0; i < shm->addr->w * shm->addr->h; i++)
 			shm->vidp[i] = SHMIF_RGBA(0xff, 0x00, 0x00, 0xff);
 				arcan_shmif_signal(shm, SHMIF_SIGVID);
@@ -119,6 +347,8 @@ int main(int argc, char* argv[])
 	arcan_shmif_signal(shm, SHMIF_SIGVID);
 
 	size_t base = 256;
+	unsigned sample_nth = 0, sample_burst = 0;
+	float sample_fps = 0;
 
 /*
  * just use aarr to override possible defaults to permit
@@ -140,6 +370,38 @@ int main(int argc, char* argv[])
 			size_t bv = strtoul(val, NULL, 10);
 			inp_buf_sz = bv > 65536 || bv == 0 ? 64 * 1024 : bv;
 		}
+
+		if (arg_lookup(aarr, "ring_size", 0, &val)){
+			size_t bv = strtoul(val, NULL, 10);
+			if (bv > 0)
+				ring_sz = bv;
+		}
+
+		if (arg_lookup(aarr, "sync", 0, &val))
+			lockstep = true;
+
+/* sampling policy, see senseye_ch:sample */
+		if (arg_lookup(aarr, "sample_nth", 0, &val))
+			sample_nth = strtoul(val, NULL, 10);
+
+		if (arg_lookup(aarr, "sample_fps", 0, &val))
+			sample_fps = strtof(val, NULL);
+
+		if (arg_lookup(aarr, "sample_burst", 0, &val))
+			sample_burst = strtoul(val, NULL, 10);
+	}
+
+	if (!lockstep){
+		if (-1 == pipe(ring)){
+			fprintf(stderr, "couldn't create sample ring, running in lockstep.\n");
+			lockstep = true;
+		}
+		else {
+			fcntl(ring[1], F_SETFL, fcntl(ring[1], F_GETFL) | O_NONBLOCK);
+#ifdef F_SETPIPE_SZ
+			fcntl(ring[1], F_SETPIPE_SZ, ring_sz);
+#endif
+		}
 	}
 
 	struct senseye_ch* ch = senseye_open(&cont, "STDIN", base);
@@ -149,7 +411,10 @@ int main(int argc, char* argv[])
 	}
 	else {
 		pthread_t pth;
+		ch->sample(ch, sample_nth, sample_fps, sample_burst);
 		pthread_create(&pth, NULL, data_loop, ch);
+		if (!lockstep)
+			pthread_create(&pth, NULL, pass_loop, NULL);
 	}
 
 	while (senseye_pump(&cont, true)){
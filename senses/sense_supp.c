@@ -15,12 +15,19 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <time.h>
 
 #include <arcan_shmif.h>
 
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <sys/resource.h>
 
+#ifdef __LINUX
+#include <sys/epoll.h>
+#endif
+
 #include "libsenseye.h"
 #include "rwstat.h"
 
@@ -50,6 +57,21 @@ struct senseye_priv {
 	struct arcan_shmif_cont cont;
 	bool paused, running, noforward;
 	int framecount;
+
+/* stream offset of the next byte handed to data, forwarded or not */
+	uint64_t cnt;
+
+/* sampling policy and the state of the frame currently being passed,
+ * [stage] buffers a dropped frame in case a burst pattern hits in it */
+	unsigned nth, burst, armed;
+	float fps;
+	uint64_t frame_no;
+	size_t frame_left;
+	bool keep, staged, hit;
+	uint32_t ptn_state;
+	uint8_t* stage;
+	size_t stage_sz, stage_ofs;
+	struct timespec last;
 };
 
 static void dispatch_event(arcan_event* ev,
@@ -160,6 +182,151 @@ static void ch_pump(struct senseye_ch* ch)
 		dispatch_event(&ev, ch->in, priv);
 }
 
+/* tell the channel where the frame now being filled starts in the stream */
+static void wind_frame(struct senseye_ch* ch, uint64_t pos)
+{
+	size_t full = ch->in->base(ch->in) * ch->in->row_size(ch->in);
+	size_t have = full - ch->in->left(ch->in);
+	ch->in->wind_ofs(ch->in, pos > have ? pos - have : 0);
+}
+
+/*
+ * The UI releases frames by stepping and holds the source back by pausing,
+ * block in the latter case. Returns false if the UI wants no frame now.
+ */
+static bool ui_ready(struct senseye_ch* ch)
+{
+	struct senseye_priv* chp = ch->in_pr;
+
+	while (chp->running){
+		if (chp->framecount > 0)
+			return true;
+
+		if (!chp->paused)
+			return false;
+
+		arcan_event ev;
+		if (!arcan_shmif_wait(&chp->cont, &ev))
+			return false;
+		dispatch_event(&ev, ch->in, chp);
+	}
+
+	return false;
+}
+
+static void feed(struct senseye_ch* ch, const uint8_t* buf, size_t n)
+{
+	struct senseye_priv* chp = ch->in_pr;
+
+	while (n && chp->running){
+		int fc;
+		size_t nw = ch->in->data(ch->in, (uint8_t*) buf, n, &fc);
+		chp->framecount -= fc;
+		if (!nw)
+			break;
+		buf += nw;
+		n -= nw;
+	}
+}
+
+static double since(struct timespec* ts)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (double)(now.tv_sec - ts->tv_sec) +
+		(double)(now.tv_nsec - ts->tv_nsec) / 1000000000.0;
+}
+
+/* decide if the frame that starts now should be forwarded */
+static void sample_begin(struct senseye_ch* ch)
+{
+	struct senseye_priv* chp = ch->in_pr;
+	chp->frame_left = ch->in->left(ch->in);
+
+/* with only burst set nothing is forwarded until there is a match */
+	bool periodic = (!chp->burst || chp->nth > 1 || chp->fps > 0) &&
+		(chp->nth <= 1 || chp->frame_no % chp->nth == 0);
+	chp->frame_no++;
+
+	if (periodic && chp->fps > 0 && since(&chp->last) < 1.0 / chp->fps)
+		periodic = false;
+
+	chp->keep = periodic;
+	if (chp->armed){
+		chp->armed--;
+		chp->keep = true;
+	}
+
+	if (chp->keep && (chp->keep = ui_ready(ch))){
+		wind_frame(ch, chp->cnt);
+		clock_gettime(CLOCK_MONOTONIC, &chp->last);
+	}
+
+	chp->hit = false;
+	chp->stage_ofs = 0;
+	chp->staged = false;
+
+	if (chp->keep || !chp->burst)
+		return;
+
+	if (chp->stage_sz < chp->frame_left){
+		uint8_t* stage = realloc(chp->stage, chp->frame_left);
+		if (!stage)
+			return;
+		chp->stage = stage;
+		chp->stage_sz = chp->frame_left;
+	}
+	chp->staged = true;
+}
+
+static void sample_end(struct senseye_ch* ch)
+{
+	struct senseye_priv* chp = ch->in_pr;
+	if (!chp->hit)
+		return;
+
+/* every match extends the burst, a dropped frame is forwarded in full */
+	chp->armed = chp->burst - 1;
+	if (!chp->keep && chp->staged && ui_ready(ch)){
+		wind_frame(ch, chp->cnt - chp->stage_ofs);
+		feed(ch, chp->stage, chp->stage_ofs);
+		clock_gettime(CLOCK_MONOTONIC, &chp->last);
+	}
+}
+
+static ssize_t ch_sampled(struct senseye_ch* ch, const uint8_t* buf, size_t ntw)
+{
+	struct senseye_priv* chp = ch->in_pr;
+	size_t ofs = 0;
+
+	while (ofs < ntw && chp->running){
+		if (!chp->frame_left)
+			sample_begin(ch);
+
+		size_t n = ntw - ofs < chp->frame_left ? ntw - ofs : chp->frame_left;
+
+		if (chp->burst && ch->in->scan(ch->in, buf + ofs, n, &chp->ptn_state))
+			chp->hit = true;
+
+		if (chp->keep)
+			feed(ch, buf + ofs, n);
+		else if (chp->staged){
+			memcpy(&chp->stage[chp->stage_ofs], buf + ofs, n);
+			chp->stage_ofs += n;
+		}
+
+		chp->cnt += n;
+		chp->frame_left -= n;
+		ofs += n;
+
+		if (!chp->frame_left)
+			sample_end(ch);
+	}
+
+	ch_pump(ch);
+	return ntw;
+}
+
 static ssize_t ch_data(struct senseye_ch* ch, const void* buf, size_t ntw)
 {
 	if (!ch || !ch->in_pr)
@@ -168,40 +335,73 @@ static ssize_t ch_data(struct senseye_ch* ch, const void* buf, size_t ntw)
 	struct senseye_priv* chp = ch->in_pr;
 	size_t ofs = 0;
 
-retry:
 	if (!chp->running)
 		return -1;
 
-/* flush if the controlling UI has specified one or several framesteps */
-	if (!chp->paused || chp->framecount > 0){
+	if (chp->nth > 1 || chp->fps > 0 || chp->burst)
+		return ch_sampled(ch, buf, ntw);
+
+/* flush if the controlling UI has specified one or several framesteps,
+ * otherwise block thread, wait for user action and retry */
+	if (ui_ready(ch)){
 		int fc;
 
 		while (chp->framecount > 0 && ntw - ofs > 0){
-			ofs += ch->in->data(ch->in, (uint8_t*) buf + ofs, ntw, &fc);
+			if (ch->in->left(ch->in) ==
+				ch->in->base(ch->in) * ch->in->row_size(ch->in))
+				ch->in->wind_ofs(ch->in, chp->cnt + ofs);
+
+			size_t nw = ch->in->data(ch->in,
+				(uint8_t*) buf + ofs, ntw - ofs, &fc);
 			chp->framecount -= fc;
-		}
-	}
-/* otherwise, block thread, wait for user action and retry */
-	else{
-		arcan_event ev;
-		if (arcan_shmif_wait(&chp->cont, &ev)){
-			dispatch_event(&ev, ch->in, chp);
-			goto retry;
+			if (!nw)
+				break;
+			ofs += nw;
 		}
 	}
 
+	if (!chp->running)
+		return -1;
+
+/* what wasn't consumed is dropped by the caller, still part of the stream */
+	chp->cnt += ntw;
 	ch_pump(ch);
 	return ofs;
 }
 
-static off_t ch_seek(struct senseye_ch* ch, long long sv)
+static void ch_sample(struct senseye_ch* ch,
+	unsigned nth, float fps, unsigned burst)
 {
 	if (!ch || !ch->in_pr)
+		return;
+
+	struct senseye_priv* chp = ch->in_pr;
+	chp->nth = nth;
+	chp->fps = fps > 0 ? fps : 0;
+	chp->burst = burst;
+	chp->armed = 0;
+}
+
+static off_t ch_seek(struct senseye_ch* ch, long long sv)
+{
+	if (!ch || !ch->in_pr || sv < 0)
 		return -1;
 
-/* reset intermediate buffers, change file offset according to sv / whence */
+	struct senseye_priv* chp = ch->in_pr;
+
+/* the frame in progress is finished with cleared bytes so that the skipped
+ * part falls between frames, the next one is wound to the new offset */
+	size_t full = ch->in->base(ch->in) * ch->in->row_size(ch->in);
+	size_t left = ch->in->left(ch->in);
+	if (left < full)
+		feed(ch, NULL, left);
+
+	chp->frame_left = 0;
+	chp->hit = false;
+	chp->ptn_state = 0;
+	chp->cnt += sv;
 
-	return 0;
+	return chp->cnt;
 }
 
 static void ch_flush(struct senseye_ch* ch)
@@ -231,6 +431,10 @@ static void ch_close(struct senseye_ch* ch, const char* msg)
 	arcan_shmif_drop(&chp->cont);
 	ch->in->free(&ch->in);
 	chp->running = false;
+
+	free(chp->stage);
+	chp->stage = NULL;
+	chp->stage_sz = 0;
 }
 
 static void process_event(struct senseye_cont* cont, arcan_event* ev)
@@ -319,7 +523,8 @@ struct senseye_ch* senseye_open(
 		.flush = ch_flush,
 		.queue = ch_queue,
 		.close = ch_close,
-		.size  = ch_size
+		.size  = ch_size,
+		.sample = ch_sample
 	}, *rv = NULL;
 
 	int tag = random();
@@ -356,6 +561,7 @@ struct senseye_ch* senseye_open(
 				goto fail;
 
 			rv->in_pr = cp;
+			memset(cp, '\0', sizeof(struct senseye_priv));
 			cp->paused = false;
 			cp->running = true;
 			cp->framecount = 0;
@@ -397,3 +603,339 @@ fail:
 
 	return NULL;
 }
+
+/*
+ * Buffer pool: one free list per power-of-two class, the link is kept in
+ * the first bytes of the free buffer. Only a few buffers per class are kept
+ * around, and nothing above POOL_MAXCLASS is pooled at all.
+ */
+#define POOL_MINCLASS 12
+#define POOL_MAXCLASS 28
+#define POOL_KEEP 4
+
+static struct {
+	pthread_mutex_t lock;
+	void* free[POOL_MAXCLASS + 1];
+	size_t count[POOL_MAXCLASS + 1];
+} bufpool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER
+};
+
+static unsigned size_class(size_t sz)
+{
+	unsigned cls = POOL_MINCLASS;
+	while (cls <= POOL_MAXCLASS && ((size_t)1 << cls) < sz)
+		cls++;
+	return cls;
+}
+
+uint8_t* senseye_buffer(size_t* sz)
+{
+	unsigned cls = size_class(*sz);
+	if (cls > POOL_MAXCLASS)
+		return malloc(*sz);
+
+	*sz = (size_t)1 << cls;
+	pthread_mutex_lock(&bufpool.lock);
+	void* buf = bufpool.free[cls];
+	if (buf){
+		memcpy(&bufpool.free[cls], buf, sizeof(void*));
+		bufpool.count[cls]--;
+	}
+	pthread_mutex_unlock(&bufpool.lock);
+
+	return buf ? buf : malloc(*sz);
+}
+
+void senseye_buffer_release(uint8_t* buf, size_t sz)
+{
+	if (!buf)
+		return;
+
+	unsigned cls = size_class(sz);
+	if (cls > POOL_MAXCLASS || ((size_t)1 << cls) != sz){
+		free(buf);
+		return;
+	}
+
+	pthread_mutex_lock(&bufpool.lock);
+	if (bufpool.count[cls] < POOL_KEEP){
+		memcpy(buf, &bufpool.free[cls], sizeof(void*));
+		bufpool.free[cls] = buf;
+		bufpool.count[cls]++;
+		buf = NULL;
+	}
+	pthread_mutex_unlock(&bufpool.lock);
+
+	free(buf);
+}
+
+struct sched_ent {
+	struct senseye_ch* ch;
+	senseye_step step;
+	senseye_done done;
+	void* tag;
+	int fd[2];
+	size_t n_fd;
+
+	uint32_t slot, gen;
+	bool busy;
+	struct sched_ent* next;
+};
+
+static void sched_finish(struct sched_ent* ent)
+{
+	if (ent->done)
+		ent->done(ent->ch, ent->tag);
+	free(ent);
+}
+
+#ifdef __LINUX
+/*
+ * Channel scheduler: all channel handles go into one epoll set in one-shot
+ * mode and the workers take turns in epoll_wait. Whoever gets an event for
+ * a channel steps it and then re-arms its handles, if the other handle of a
+ * channel that is already being stepped fires it is just left disarmed for
+ * the running step to pick up. Events carry a slot + generation rather than
+ * a pointer so that one raced by the channel ending is simply dropped.
+ */
+#define SCHED_MAXWORKERS 4
+#define SCHED_KICK UINT64_MAX
+
+static struct {
+	pthread_mutex_t lock;
+	int epfd;
+	int kick[2];
+	size_t n_workers;
+
+	struct sched_ent** slots;
+	uint32_t* gens;
+	size_t n_slots;
+
+/* waiting for their first step */
+	struct sched_ent* pending;
+} sched = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.epfd = -1
+};
+
+static void sched_arm(struct sched_ent* ent, int op)
+{
+	for (size_t i = 0; i < ent->n_fd; i++){
+		struct epoll_event ev = {
+			.events = EPOLLIN | EPOLLONESHOT,
+			.data.u64 = (uint64_t) ent->slot << 32 | ent->gen
+		};
+		epoll_ctl(sched.epfd, op, ent->fd[i], &ev);
+	}
+}
+
+static void sched_run(struct sched_ent* ent)
+{
+	bool alive = ent->step(ent->ch, ent->tag);
+
+	pthread_mutex_lock(&sched.lock);
+	ent->busy = false;
+	if (alive){
+		sched_arm(ent, EPOLL_CTL_MOD);
+		pthread_mutex_unlock(&sched.lock);
+		return;
+	}
+
+	for (size_t i = 0; i < ent->n_fd; i++)
+		epoll_ctl(sched.epfd, EPOLL_CTL_DEL, ent->fd[i], NULL);
+	sched.slots[ent->slot] = NULL;
+	sched.gens[ent->slot]++;
+	pthread_mutex_unlock(&sched.lock);
+
+	sched_finish(ent);
+}
+
+static void* sched_worker(void* arg)
+{
+	for(;;){
+		struct epoll_event ev;
+		if (epoll_wait(sched.epfd, &ev, 1, -1) <= 0)
+			continue;
+
+		struct sched_ent* ent = NULL;
+		pthread_mutex_lock(&sched.lock);
+
+/* one byte on the kick pipe per channel waiting for its first step */
+		if (ev.data.u64 == SCHED_KICK){
+			uint8_t ch;
+			if (1 == read(sched.kick[0], &ch, 1) && sched.pending){
+				ent = sched.pending;
+				sched.pending = ent->next;
+				sched_arm(ent, EPOLL_CTL_ADD);
+			}
+		}
+		else {
+			uint32_t slot = ev.data.u64 >> 32;
+			uint32_t gen = ev.data.u64 & 0xffffffff;
+			if (slot < sched.n_slots && sched.gens[slot] == gen)
+				ent = sched.slots[slot];
+		}
+
+		if (ent && ent->busy)
+			ent = NULL;
+		if (ent)
+			ent->busy = true;
+		pthread_mutex_unlock(&sched.lock);
+
+		if (ent)
+			sched_run(ent);
+	}
+
+	return NULL;
+}
+
+/* sched.lock is held */
+static bool sched_setup()
+{
+	if (sched.epfd != -1)
+		return true;
+
+	sched.epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (-1 == sched.epfd)
+		return false;
+
+	if (-1 == pipe(sched.kick)){
+		close(sched.epfd);
+		sched.epfd = -1;
+		return false;
+	}
+
+	for (size_t i = 0; i < 2; i++){
+		fcntl(sched.kick[i], F_SETFD, FD_CLOEXEC);
+		fcntl(sched.kick[i], F_SETFL, O_NONBLOCK);
+	}
+
+	struct epoll_event ev = {.events = EPOLLIN, .data.u64 = SCHED_KICK};
+	epoll_ctl(sched.epfd, EPOLL_CTL_ADD, sched.kick[0], &ev);
+
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t lim = ncpu > 2 ? ncpu : 2;
+	if (lim > SCHED_MAXWORKERS)
+		lim = SCHED_MAXWORKERS;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	for (; sched.n_workers < lim; sched.n_workers++){
+		pthread_t pth;
+		if (0 != pthread_create(&pth, &attr, sched_worker, NULL))
+			break;
+	}
+
+	pthread_attr_destroy(&attr);
+	return sched.n_workers > 0;
+}
+
+/* sched.lock is held */
+static bool sched_slot(struct sched_ent* ent)
+{
+	size_t i = 0;
+	for (; i < sched.n_slots && sched.slots[i]; i++);
+
+	if (i == sched.n_slots){
+		size_t nn = sched.n_slots ? sched.n_slots * 2 : 64;
+		struct sched_ent** slots = realloc(sched.slots, nn * sizeof(void*));
+		if (!slots)
+			return false;
+		sched.slots = slots;
+
+		uint32_t* gens = realloc(sched.gens, nn * sizeof(uint32_t));
+		if (!gens)
+			return false;
+		sched.gens = gens;
+
+		for (size_t j = sched.n_slots; j < nn; j++){
+			sched.slots[j] = NULL;
+			sched.gens[j] = 0;
+		}
+		sched.n_slots = nn;
+	}
+
+	sched.slots[i] = ent;
+	ent->slot = i;
+	ent->gen = sched.gens[i];
+	return true;
+}
+
+static bool sched_add(struct sched_ent* ent)
+{
+	pthread_mutex_lock(&sched.lock);
+	if (!sched_setup() || !sched_slot(ent)){
+		pthread_mutex_unlock(&sched.lock);
+		return false;
+	}
+
+	struct sched_ent** cur = &sched.pending;
+	while (*cur)
+		cur = &(*cur)->next;
+	*cur = ent;
+	pthread_mutex_unlock(&sched.lock);
+
+	uint8_t ch = 1;
+	while (-1 == write(sched.kick[1], &ch, 1) && errno == EINTR);
+	return true;
+}
+
+#else
+/* no epoll, fall back to a thread per channel */
+static void* sched_thread(void* arg)
+{
+	struct sched_ent* ent = arg;
+	short pollev = POLLIN | POLLERR | POLLHUP | POLLNVAL;
+
+	while (ent->step(ent->ch, ent->tag)){
+		struct pollfd fds[2] = {
+			{.fd = ent->fd[0], .events = pollev},
+			{.fd = ent->n_fd > 1 ? ent->fd[1] : -1, .events = pollev}
+		};
+		poll(fds, 2, -1);
+	}
+
+	sched_finish(ent);
+	return NULL;
+}
+
+static bool sched_add(struct sched_ent* ent)
+{
+	pthread_t pth;
+	if (0 != pthread_create(&pth, NULL, sched_thread, ent))
+		return false;
+
+	pthread_detach(pth);
+	return true;
+}
+#endif
+
+bool senseye_schedule(struct senseye_ch* ch,
+	int fd, senseye_step step, senseye_done done, void* tag)
+{
+	if (!ch || !step)
+		return false;
+
+	struct sched_ent* ent = malloc(sizeof(struct sched_ent));
+	if (!ent)
+		return false;
+
+	*ent = (struct sched_ent){
+		.ch = ch,
+		.step = step,
+		.done = done,
+		.tag = tag,
+		.fd = {ch->in_handle, fd},
+		.n_fd = fd == -1 ? 1 : 2
+	};
+
+	if (!sched_add(ent)){
+		free(ent);
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Stage timer histograms and their export, see stagetime.h
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include <arcan_shmif.h>
+
+#include "stagetime.h"
+
+#ifdef SENSEYE_STAGETIME
+
+#define STAGE_DEFPERIOD 1000
+
+/* exported fields are clamped to this so the message always fits */
+#define STAGE_FIELDMAX 99999999
+
+static const char* stage_names[] = {
+	"copy",
+	"data",
+	"ptn",
+	"ent",
+	"pack",
+	"signal",
+	"populate"
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* [0..3] are exact, then four per power of two */
+static size_t bucket_ind(uint64_t ns)
+{
+	if (ns < 4)
+		return ns;
+
+	size_t pot = 2;
+	while (pot < 63 && (ns >> (pot + 1)))
+		pot++;
+
+	size_t ind = (pot - 1) * 4 + ((ns >> (pot - 2)) & 3);
+	return ind < STAGE_BUCKETS ? ind : STAGE_BUCKETS - 1;
+}
+
+/* middle of the bucket, percentiles are clamped to the max */
+static uint64_t bucket_ns(size_t ind)
+{
+	if (ind < 4)
+		return ind;
+
+	size_t pot = ind / 4 + 1;
+	uint64_t step = (uint64_t) 1 << (pot - 2);
+	return (4 + ind % 4) * step + step / 2;
+}
+
+/* last value that still falls in the bucket */
+static uint64_t bucket_top(size_t ind)
+{
+	if (ind < 4)
+		return ind;
+
+	size_t pot = ind / 4 + 1;
+	uint64_t step = (uint64_t) 1 << (pot - 2);
+	return (5 + ind % 4) * step - 1;
+}
+
+static unsigned field(uint64_t v)
+{
+	return v > STAGE_FIELDMAX ? STAGE_FIELDMAX : v;
+}
+
+static uint64_t hist_pct(struct stage_hist* h, double p)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < STAGE_BUCKETS; i++)
+		sum += h->bucket[i];
+
+	uint64_t lim = (uint64_t)(p * (double) sum + 0.5);
+	uint64_t acc = 0;
+
+	for (size_t i = 0; i < STAGE_BUCKETS; i++){
+		acc += h->bucket[i];
+		if (acc && acc >= lim){
+			uint64_t ns = bucket_ns(i);
+			return ns < h->max_ns ? ns : h->max_ns;
+		}
+	}
+
+	return h->max_ns;
+}
+
+static void hist_add(struct stage_hist* h, uint64_t ns)
+{
+	h->bucket[bucket_ind(ns)]++;
+	h->count++;
+	h->sum_ns += ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+}
+
+void stage_init(struct stage_timer* t)
+{
+	memset(t, '\0', sizeof(struct stage_timer));
+
+	const char* env = getenv("SENSEYE_STAGETIME");
+	if (!env || strcmp(env, "0") == 0)
+		return;
+
+	long period = strtol(env, NULL, 10);
+	t->period_ns = (uint64_t)(period < 100 ? STAGE_DEFPERIOD : period) * 1000000;
+	t->enabled = true;
+	t->last_export = now_ns();
+}
+
+uint64_t stage_begin(struct stage_timer* t)
+{
+	return t->enabled ? now_ns() : 0;
+}
+
+void stage_end(struct stage_timer* t, enum stage_id id, uint64_t start)
+{
+	if (!t->enabled || !start || id >= STAGE_COUNT)
+		return;
+
+	uint64_t ns = now_ns() - start;
+	hist_add(&t->window[id], ns);
+	hist_add(&t->total[id], ns);
+}
+
+void stage_export(struct stage_timer* t, struct arcan_shmif_cont* dst)
+{
+	if (!t->enabled)
+		return;
+
+	uint64_t now = now_ns();
+	if (now - t->last_export < t->period_ns)
+		return;
+	t->last_export = now;
+
+	for (size_t i = 0; i < STAGE_COUNT; i++){
+		struct stage_hist* h = &t->window[i];
+		if (!h->count)
+			continue;
+
+		arcan_event ev = {
+			.category = EVENT_EXTERNAL,
+			.ext.kind = ARCAN_EVENT(MESSAGE)
+		};
+		snprintf((char*)ev.ext.message.data, sizeof(ev.ext.message.data),
+			"senseye_stage:%s:%u:%u:%u:%u:%u",
+			stage_names[i], field(h->count), field(h->sum_ns / h->count / 1000),
+			field(hist_pct(h, 0.5) / 1000), field(hist_pct(h, 0.99) / 1000),
+			field(h->max_ns / 1000)
+		);
+		arcan_shmif_enqueue(dst, &ev);
+
+/* decay, so the window follows the cost of the last few periods, the max
+ * can't be known exactly afterwards so it is capped to the top bucket left */
+		uint64_t count = 0;
+		uint64_t top = 0;
+		for (size_t j = 0; j < STAGE_BUCKETS; j++){
+			h->bucket[j] >>= 1;
+			count += h->bucket[j];
+			if (h->bucket[j])
+				top = j == STAGE_BUCKETS - 1 ? UINT64_MAX : bucket_top(j);
+		}
+		h->sum_ns = h->count ? h->sum_ns / h->count * count : 0;
+		h->count = count;
+		h->max_ns = h->max_ns < top ? h->max_ns : top;
+	}
+}
+
+void stage_summary(struct stage_timer* t, FILE* out, const char* name)
+{
+	if (!t->enabled)
+		return;
+
+	bool header = false;
+	for (size_t i = 0; i < STAGE_COUNT; i++){
+		struct stage_hist* h = &t->total[i];
+		if (!h->count)
+			continue;
+
+		if (!header){
+			fprintf(out, "stage timing (%s), us: count avg p50 p90 p99 max\n",
+				name ? name : "");
+			header = true;
+		}
+
+		fprintf(out, "  %-9s %10"PRIu64" %8.1f %8.1f %8.1f %8.1f %8.1f\n",
+			stage_names[i], h->count,
+			(double) h->sum_ns / (double) h->count / 1000.0,
+			hist_pct(h, 0.5) / 1000.0, hist_pct(h, 0.9) / 1000.0,
+			hist_pct(h, 0.99) / 1000.0, h->max_ns / 1000.0
+		);
+	}
+}
+#endif
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Per-stage timing of the data paths (source copy, channel
+ * copy, alpha passes, packing, signalling and translator population). Built
+ * when SENSEYE_STAGETIME is defined and active when the SENSEYE_STAGETIME
+ * environment variable is set, otherwise every call is close to free.
+ * Each owner (rwstat channel, translator session) keeps one timer and
+ * periodically forwards it to the UI as senseye_stage: messages.
+ */
+
+#ifndef HAVE_STAGETIME
+#define HAVE_STAGETIME
+
+enum stage_id {
+	STAGE_COPY = 0, /* reading from the source, e.g. memif_copy         */
+	STAGE_DATA,     /* into the working buffer, ch_data or xlt unpack   */
+	STAGE_PTN,      /* update_ptnalpha                                  */
+	STAGE_ENT,      /* update_entalpha                                  */
+	STAGE_PACK,     /* packing the buffer into the output segment       */
+	STAGE_SIGNAL,   /* arcan_shmif_signal, waiting for the consumer     */
+	STAGE_POPULATE, /* translator populate                              */
+	STAGE_COUNT
+};
+
+#ifdef SENSEYE_STAGETIME
+
+/* four buckets per power of two nanoseconds, the last one catches
+ * everything above ~4s */
+#define STAGE_BUCKETS 128
+
+struct stage_hist {
+	uint32_t bucket[STAGE_BUCKETS];
+	uint64_t count;
+	uint64_t sum_ns;
+	uint64_t max_ns;
+};
+
+/*
+ * [window] is decayed (halved) on every export so it follows the recent
+ * cost, [total] covers the lifetime of the owner and is used for the
+ * summary.
+ */
+struct stage_timer {
+	bool enabled;
+	uint64_t period_ns;
+	uint64_t last_export;
+	struct stage_hist window[STAGE_COUNT];
+	struct stage_hist total[STAGE_COUNT];
+};
+
+/* reset and pick up the environment, SENSEYE_STAGETIME=ms sets the export
+ * period, anything below 100 (e.g. 1) gives the default of 1000 */
+void stage_init(struct stage_timer*);
+
+/* 0 if the timer is disabled, otherwise the current monotonic time in ns */
+uint64_t stage_begin(struct stage_timer*);
+
+/* add the time since [start] (from stage_begin) to [stage] */
+void stage_end(struct stage_timer*, enum stage_id, uint64_t start);
+
+/*
+ * If the export period has passed, enqueue one senseye_stage: message per
+ * stage that has samples in the window on [dst] and decay the window.
+ * The messages are:
+ * senseye_stage:name:count:avg_us:p50_us:p99_us:max_us
+ * where every field refers to the (decayed) window. Once the largest sample
+ * has decayed out, max_us drops to the top of the highest bucket that still
+ * has samples. Fields are capped at 99999999.
+ */
+void stage_export(struct stage_timer*, struct arcan_shmif_cont* dst);
+
+/* write the lifetime summary for the timer to [out], no-op if empty */
+void stage_summary(struct stage_timer*, FILE* out, const char* name);
+
+#else
+struct stage_timer {
+	bool enabled;
+};
+
+static inline void stage_init(struct stage_timer* t)
+{
+	t->enabled = false;
+}
+
+static inline uint64_t stage_begin(struct stage_timer* t)
+{
+	return 0;
+}
+
+static inline void stage_end(
+	struct stage_timer* t, enum stage_id id, uint64_t start){}
+
+static inline void stage_export(
+	struct stage_timer* t, struct arcan_shmif_cont* dst){}
+
+static inline void stage_summary(
+	struct stage_timer* t, FILE* out, const char* name){}
+#endif
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2026, agent
+ * License: 3-Clause BSD, see COPYING file in the senseye source repository.
+ * Reference: http://senseye.arcan-fe.com
+ * Description: Checks the compiled matcher against a naive scan, including
+ * a set where the patterns use every byte value (257 byte classes).
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "ptnmatch.h"
+
+struct hits {
+	size_t n;
+	size_t* ind;
+	size_t* end;
+};
+
+static void on_hit(void* tag, size_t ind, size_t end)
+{
+	struct hits* h = tag;
+	h->ind[h->n] = ind;
+	h->end[h->n++] = end;
+}
+
+/* every (pattern, end) pair a naive scan finds, in buffer order */
+static size_t naive(uint8_t* const* ptns, const size_t* sizes, size_t n,
+	const uint8_t* buf, size_t buf_sz, bool (*want)(void*, size_t, size_t),
+	void* tag)
+{
+	size_t rc = 0;
+	for (size_t end = 0; end < buf_sz; end++)
+		for (size_t i = 0; i < n; i++)
+			if (sizes[i] && sizes[i] <= end + 1 &&
+				memcmp(&buf[end + 1 - sizes[i]], ptns[i], sizes[i]) == 0){
+				if (!want(tag, i, end))
+					return (size_t) -1;
+				rc++;
+			}
+	return rc;
+}
+
+static bool has_hit(void* tag, size_t ind, size_t end)
+{
+	struct hits* h = tag;
+	for (size_t i = 0; i < h->n; i++)
+		if (h->ind[i] == ind && h->end[i] == end)
+			return true;
+	return false;
+}
+
+/* scan in [step] sized pieces to cover state carried between calls */
+static bool check(const char* name, uint8_t* const* ptns,
+	const size_t* sizes, size_t n, const uint8_t* buf, size_t buf_sz, size_t step)
+{
+	struct ptn_match* m = ptn_match_build(ptns, sizes, n);
+	if (!m){
+		printf("%s: build failed\n", name);
+		return false;
+	}
+
+	struct hits h = {
+		.ind = malloc(sizeof(size_t) * buf_sz * n),
+		.end = malloc(sizeof(size_t) * buf_sz * n)
+	};
+
+	uint32_t state = 0;
+	size_t rc = 0;
+	for (size_t ofs = 0; ofs < buf_sz; ofs += step){
+		size_t nb = buf_sz - ofs > step ? step : buf_sz - ofs;
+		size_t base = h.n;
+		rc += ptn_match_scan(m, &state, &buf[ofs], nb, on_hit, &h);
+		for (size_t i = base; i < h.n; i++)
+			h.end[i] += ofs;
+	}
+
+	size_t ref = naive(ptns, sizes, n, buf, buf_sz, has_hit, &h);
+	bool ok = ref == h.n && rc == h.n;
+	printf("%s: %zu matches, expected %zu, %s\n", name, h.n, ref, ok ? "ok" : "FAIL");
+
+	free(h.ind);
+	free(h.end);
+	ptn_match_free(&m);
+	return ok;
+}
+
+int main(int argc, char* argv[])
+{
+	bool ok = true;
+	uint8_t buf[4096];
+	srand(1);
+	for (size_t i = 0; i < sizeof(buf); i++)
+		buf[i] = i < 512 ? (uint8_t) i : (uint8_t) rand();
+
+/* one single byte pattern per value, and a few longer ones on top */
+	uint8_t single[256];
+	uint8_t* ptns[259];
+	size_t sizes[259];
+	for (size_t i = 0; i < 256; i++){
+		single[i] = i;
+		ptns[i] = &single[i];
+		sizes[i] = 1;
+	}
+	uint8_t ff[] = {0xfe, 0xff, 0x00};
+	uint8_t run[] = {0x01, 0x02, 0x03, 0x04};
+	uint8_t ovl[] = {0xff, 0xff};
+	ptns[256] = ff; sizes[256] = sizeof(ff);
+	ptns[257] = run; sizes[257] = sizeof(run);
+	ptns[258] = ovl; sizes[258] = sizeof(ovl);
+	buf[1000] = buf[1001] = buf[1002] = 0xff;
+
+	ok &= check("all byte values", ptns, sizes, 259, buf, sizeof(buf), sizeof(buf));
+	ok &= check("all byte values, chunked", ptns, sizes, 259, buf, sizeof(buf), 7);
+	ok &= check("multi-byte only", &ptns[256], &sizes[256], 3, buf, sizeof(buf), 13);
+
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
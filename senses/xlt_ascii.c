@@ -30,12 +30,27 @@ static const char* mode_lut[] = {
 	"Error"
 };
 
+/*
+ * Cells are drawn from a prerendered atlas, one per byte value, and the
+ * shadow holds the byte that is on screen for each cell so that only the
+ * ones that change (scrolling, new data) are redrawn.
+ */
+#define CELL_W (fontw + 2)
+#define CELL_H (fonth + 2)
+#define CELL_EMPTY 0x100
+#define CELL_UNKNOWN 0xffff
+
+static shmif_pixel* atlas;
+
 struct ascii_user {
 	int gc;
 	enum linefeed_mode lfm;
 
 	int col;
 	int row;
+
+	uint16_t* shadow;
+	size_t shadow_w, shadow_h, cols, rows;
 };
 
 enum linefeed_mode def_lfm = LF_WRAP;
@@ -60,18 +75,56 @@ static bool input(struct arcan_shmif_cont* out, arcan_event* ev)
 	return true;
 }
 
-static inline void draw_ch(struct arcan_shmif_cont* out,
-	uint8_t ch, ssize_t col, size_t row)
+static bool build_atlas()
 {
-	if (col < 0)
-		return;
+	size_t cell_sz = CELL_W * CELL_H;
+	atlas = malloc(sizeof(shmif_pixel) * cell_sz * 256);
+	if (!atlas)
+		return false;
 
-	draw_box(out, col, row, fontw+2, fonth+2, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
+	for (size_t ch = 0; ch < 256; ch++){
+		struct arcan_shmif_cont cell = {
+			.vidp = &atlas[ch * cell_sz],
+			.w = CELL_W,
+			.h = CELL_H,
+			.pitch = CELL_W
+		};
 
-	if (ch < 127)
-		draw_char(out, ch, col, row, SHMIF_RGBA(0xcc, 0xcc, 0xcc, 0xff));
-	else
-		draw_box(out, col, row, fontw, fonth, SHMIF_RGBA(0x55, 0x00, 0x00, 0xff));
+		draw_box(&cell, 0, 0, CELL_W, CELL_H, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
+
+		if (ch < 127)
+			draw_char(&cell, ch, 0, 0, SHMIF_RGBA(0xcc, 0xcc, 0xcc, 0xff));
+		else
+			draw_box(&cell, 0, 0, fontw, fonth, SHMIF_RGBA(0x55, 0x00, 0x00, 0xff));
+	}
+
+	return true;
+}
+
+/*
+ * set the cells of screen row [row] to [n] bytes from [buf] and clear the
+ * rest of it, only cells that differ from the shadow are drawn
+ */
+static void draw_row(struct arcan_shmif_cont* out,
+	struct ascii_user* actx, size_t row, const uint8_t* buf, size_t n)
+{
+	uint16_t* shadow = &actx->shadow[row * actx->cols];
+	size_t y = fonth+2 + row * CELL_H;
+
+	for (size_t col = 0; col < actx->cols; col++){
+		uint16_t key = col < n ? buf[col] : CELL_EMPTY;
+		if (shadow[col] == key)
+			continue;
+
+		size_t x = 2 + col * CELL_W;
+		if (key == CELL_EMPTY)
+			draw_box(out, x, y, CELL_W, CELL_H, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
+		else
+			draw_block(out, x, y, CELL_W, CELL_H, &atlas[key * CELL_W * CELL_H]);
+
+		dirty_box(out, x, y, CELL_W, CELL_H);
+		shadow[col] = key;
+	}
 }
 
 static size_t find_lf(enum linefeed_mode mode, size_t buf_sz, uint8_t* buf)
@@ -111,21 +164,50 @@ static void draw_header(struct arcan_shmif_cont* out,
 static bool populate(bool newdata, struct arcan_shmif_cont* in,
 	struct arcan_shmif_cont* out, uint64_t pos, size_t buf_sz, uint8_t* buf)
 {
+	struct ascii_user* actx = out->user;
 	if (!buf){
+		if (actx)
+			free(actx->shadow);
 		free(out->user);
+		out->user = NULL;
 		return false;
 	}
 
-	struct ascii_user* actx = out->user;
+/* partial updates are only useful if the server knows about them */
 	if (!actx){
 		actx = out->user = malloc(sizeof(struct ascii_user));
 		memset(actx, '\0', sizeof(struct ascii_user));
 		actx->lfm = def_lfm;
 		actx->gc = 0xdeadbeef;
+		out->hints |= SHMIF_RHINT_SUBREGION;
+		arcan_shmif_resize(out, out->w, out->h);
 	}
 
-	draw_box(out, 0, fonth+2,
-		out->w, out->h, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
+	out->dirty = (struct arcan_shmif_region){.x1 = out->w, .y1 = out->h};
+
+/* new dimensions, nothing on screen can be trusted */
+	if (!actx->shadow || actx->shadow_w != out->w || actx->shadow_h != out->h){
+		size_t cols = 0, rows = 0;
+		for (size_t col = 2; col < out->w - fontw; col += CELL_W)
+			cols++;
+		for (size_t row = fonth+2; row < out->h - fonth; row += CELL_H)
+			rows++;
+
+		free(actx->shadow);
+		actx->shadow = malloc(sizeof(uint16_t) * (cols * rows + 1));
+		if (!actx->shadow)
+			return false;
+
+		for (size_t i = 0; i < cols * rows; i++)
+			actx->shadow[i] = CELL_UNKNOWN;
+		actx->cols = cols;
+		actx->rows = rows;
+		actx->shadow_w = out->w;
+		actx->shadow_h = out->h;
+		draw_box(out, 0, fonth+2,
+			out->w, out->h, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
+		dirty_box(out, 0, fonth+2, out->w, out->h);
+	}
 
 /* based on CRLF mode and desired left row / column, forward buf */
 	if (newdata)
@@ -146,10 +228,11 @@ static bool populate(bool newdata, struct arcan_shmif_cont* in,
 		else
 			buf_sz = 0;
 
-		for (size_t row = fonth+2; row < out->h - fonth; row += fonth + 2)
-			for (size_t col = 2;
-				col < out->w - fontw && buf_ind < buf_sz; col += fontw + 2)
-					draw_ch(out, buf[buf_ind++], col, row);
+		for (size_t row = 0; row < actx->rows; row++){
+			size_t n = buf_sz - buf_ind > actx->cols ? actx->cols : buf_sz - buf_ind;
+			draw_row(out, actx, row, &buf[buf_ind], n);
+			buf_ind += n;
+		}
 	}
 	else if (actx->lfm == LF_ACCEPT_CRLF || actx->lfm == LF_ACCEPT_LF){
 /* skip first n rows */
@@ -159,12 +242,10 @@ static bool populate(bool newdata, struct arcan_shmif_cont* in,
 			buf += count;
 		}
 /* then draw / sample at offset */
-		for (size_t row = fonth+2; row < out->h - fonth; row += fonth + 2){
+		for (size_t row = 0; row < actx->rows; row++){
 			size_t nch = find_lf(actx->lfm, buf_sz, buf);
 			size_t ind = actx->col;
-				for (size_t col = 2;
-					col < out->w - fontw && ind < nch; col += fontw + 2)
-				draw_ch(out, buf[ind++], col, row);
+			draw_row(out, actx, row, &buf[ind], nch > ind ? nch - ind : 0);
 
 			buf += nch;
 			buf_sz -= nch;
@@ -173,12 +254,16 @@ static bool populate(bool newdata, struct arcan_shmif_cont* in,
 
 	draw_header(out, actx, pos,
 		(float)(orig_sz - buf_sz) / (float)orig_sz * 100.0);
+	dirty_box(out, 0, 0, out->w, fonth+2);
 	return true;
 }
 
 int main(int argc, char* argv[])
 {
 	enum ARCAN_FLAGS confl = SHMIF_CONNECT_LOOP;
-	return xlt_setup("ASCII", populate, input, XLT_DYNSIZE, confl) == true ?
-		EXIT_SUCCESS : EXIT_FAILURE;
+	if (!build_atlas())
+		return EXIT_FAILURE;
+
+	return xlt_setup("ASCII", populate, input,
+		XLT_DYNSIZE | XLT_INPLACE, confl) == true ? EXIT_SUCCESS : EXIT_FAILURE;
 }
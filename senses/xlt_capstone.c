@@ -13,6 +13,8 @@
 #include <inttypes.h>
 #include <getopt.h>
 #include <math.h>
+#include <pthread.h>
+#include <time.h>
 #include <capstone/capstone.h>
 #include "font_8x8.h"
 
@@ -93,6 +95,39 @@ static cs_opt_value syntax = CS_OPT_SYNTAX_DEFAULT;
 enum color_mode cmode = COLOR_SIMPLE;
 static bool detail = CS_OPT_OFF;
 
+/*
+ * sweeps that have less than this left to the end of the window are
+ * finished in populate, larger ones continue on the worker thread
+ */
+#define SWEEP_SYNC 65536
+
+/* instructions per cs_disasm call when extending a sweep */
+#define SWEEP_BATCH 4096
+
+/* at most this often (ms) will the worker ask for a redraw while filling */
+#define SWEEP_WAKE 100
+
+/*
+ * Linear sweep over the window, kept between updates so that redraws,
+ * cursor moves and window slides only need to decode what is new. Live
+ * instructions are [head, tail) in [insn] and are contiguous from [start]
+ * to [end], so the array doubles as the instruction boundary index. The
+ * raw bytes each instruction carries are used to check that its part of
+ * the buffer is unchanged. detail- blocks are owned by the sweep.
+ */
+struct sweep {
+	cs_insn* insn;
+	size_t head, tail, cap;
+	uint64_t start, end;
+
+/* no more instructions can be decoded before the window ends */
+	bool done;
+
+/* changes on every modification that isn't an append, so results from a
+ * worker that started on an older state can be discarded */
+	uint64_t gen;
+};
+
 /*
  * per-sesion options
  */
@@ -103,8 +138,29 @@ struct cs_ctx {
 	uint64_t pos;
 	bool active;
 
-	cs_insn* last;
-	size_t last_count;
+/* [lock] covers [sw] and the worker state */
+	struct sweep sw;
+	struct arcan_shmif_cont* out;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t worker;
+	bool worker_alive, shutdown, busy;
+	uint64_t busy_gen;
+
+/* private copy of the window for the worker, the real one can change
+ * as soon as populate returns */
+	struct {
+		uint8_t* buf;
+		size_t buf_sz;
+		uint64_t base, gen;
+	} job;
+	uint64_t win_start;
+	size_t win_sz;
+
+/* the window the sweep was last checked against */
+	uint8_t* seen;
+	size_t seen_sz;
+	uint64_t seen_start;
 
 	struct {
 		bool dirty;
@@ -179,6 +235,8 @@ static bool over_pop(bool newdata, struct arcan_shmif_cont* in,
 	size_t buf_sz, uint8_t* buf, struct xlt_session* sess)
 {
 	struct cs_ctx* ctx = out->user;
+	if (!ctx || !ctx->active)
+		return false;
 
 /* standard calculation for finding active region and scale factors */
 	float w = zoom_ofs[2] - zoom_ofs[0];
@@ -191,9 +249,10 @@ static bool over_pop(bool newdata, struct arcan_shmif_cont* in,
 
 	memset(over->vidp, '\0', sizeof(shmif_pixel) * over->h * over->pitch);
 
-	for (size_t i = 0; i < ctx->last_count; i++){
+	pthread_mutex_lock(&ctx->lock);
+	for (size_t i = ctx->sw.head; i < ctx->sw.tail; i++){
 		size_t x1, y1, x2, y2;
-		cs_insn* cur = &ctx->last[i];
+		cs_insn* cur = &ctx->sw.insn[i];
 		uint64_t addr = cur->address - pos;
 		shmif_pixel col = opcode_color(cur);
 		xlt_ofs_coord(sess, addr, &x1, &y1);
@@ -211,6 +270,7 @@ static bool over_pop(bool newdata, struct arcan_shmif_cont* in,
 			}
 		}
 	}
+	pthread_mutex_unlock(&ctx->lock);
 
 	return true;
 }
@@ -373,16 +433,480 @@ static void group_disass(struct arcan_shmif_cont* c, cs_insn* in, size_t cnt)
  */
 }
 
+static void drop_insn(cs_insn* insn, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		free(insn[i].detail);
+}
+
+/*
+ * Decode up to [lim] instructions from [buf] at [addr] into [dst], copied
+ * out of the capstone allocation so that they can live in a sweep.
+ * Returns the number of instructions, [*more] is set if there may be more
+ * to decode after them.
+ */
+static size_t decode_batch(csh handle, const uint8_t* buf, size_t buf_sz,
+	uint64_t addr, size_t lim, cs_insn* dst, bool* more)
+{
+	cs_insn* tmp;
+	size_t n = cs_disasm(handle, buf, buf_sz, addr, lim, &tmp);
+	size_t i = 0;
+
+	for (; i < n; i++){
+		dst[i] = tmp[i];
+		if (!tmp[i].detail)
+			continue;
+
+		dst[i].detail = malloc(sizeof(cs_detail));
+		if (!dst[i].detail)
+			break;
+		memcpy(dst[i].detail, tmp[i].detail, sizeof(cs_detail));
+	}
+
+	if (n)
+		cs_free(tmp, n);
+
+	*more = i == lim;
+	return i;
+}
+
+/*
+ * make room for [n] more live instructions at either end, when the array
+ * has to be rearranged the slack is split between both ends so that slides
+ * in either direction stay amortized
+ */
+static bool sweep_grow(struct sweep* sw, size_t n, bool front)
+{
+	size_t live = sw->tail - sw->head;
+
+	if (front ? sw->head >= n : sw->cap - sw->tail >= n)
+		return true;
+
+	if (2 * (live + n) > sw->cap){
+		size_t cap = sw->cap ? sw->cap : SWEEP_BATCH;
+		while (cap < 2 * (live + n))
+			cap *= 2;
+
+		cs_insn* insn = realloc(sw->insn, sizeof(cs_insn) * cap);
+		if (!insn)
+			return false;
+		sw->insn = insn;
+		sw->cap = cap;
+	}
+
+	size_t slack = (sw->cap - live - n) / 2;
+	size_t dst = front ? n + slack : slack;
+	memmove(&sw->insn[dst], &sw->insn[sw->head], sizeof(cs_insn) * live);
+	sw->head = dst;
+	sw->tail = dst + live;
+	return true;
+}
+
+/*
+ * drop live instructions outside of [first, last), only a cut at the end
+ * invalidates what a worker might be appending
+ */
+static void sweep_keep(struct sweep* sw, size_t first, size_t last)
+{
+	if (last != sw->tail){
+		drop_insn(&sw->insn[last], sw->tail - last);
+		sw->tail = last;
+		sw->done = false;
+		sw->gen++;
+	}
+
+	drop_insn(&sw->insn[sw->head], first - sw->head);
+	sw->head = first;
+
+	if (first < last){
+		sw->start = sw->insn[first].address;
+		sw->end = sw->insn[last-1].address + sw->insn[last-1].size;
+	}
+	else
+		sw->start = sw->end;
+}
+
+static void sweep_reset(struct sweep* sw, uint64_t start)
+{
+	sweep_keep(sw, sw->head, sw->head);
+	sw->start = sw->end = start;
+	sw->done = false;
+	sw->gen++;
+}
+
+/* index of the live instruction that starts at [addr] or [tail] */
+static size_t sweep_find(struct sweep* sw, uint64_t addr)
+{
+	size_t lo = sw->head, hi = sw->tail;
+
+	while (lo < hi){
+		size_t mid = lo + (hi - lo) / 2;
+		if (sw->insn[mid].address < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < sw->tail && sw->insn[lo].address == addr ? lo : sw->tail;
+}
+
+/* caller holds lock, add [n] decoded instructions to the end */
+static bool sweep_append(struct sweep* sw, cs_insn* insn, size_t n, bool more)
+{
+	if (!sweep_grow(sw, n, false)){
+		drop_insn(insn, n);
+		return false;
+	}
+
+	memcpy(&sw->insn[sw->tail], insn, sizeof(cs_insn) * n);
+	sw->tail += n;
+	if (n)
+		sw->end = insn[n-1].address + insn[n-1].size;
+	sw->done = !more;
+	return true;
+}
+
+/*
+ * Decode from [start] until a boundary in the existing sweep is reached, then
+ * splice the two. If there is no overlap within [lim] instructions, the sweep
+ * is restarted from [start].
+ */
+static void sweep_resync(struct cs_ctx* ctx,
+	uint64_t start, const uint8_t* buf, size_t buf_sz, size_t lim)
+{
+	struct sweep* sw = &ctx->sw;
+	cs_insn* pre = malloc(sizeof(cs_insn) * lim);
+	if (!pre){
+		sweep_reset(sw, start);
+		return;
+	}
+
+	bool more;
+	size_t n = decode_batch(ctx->handle, buf, buf_sz, start, lim, pre, &more);
+	size_t cut = n, join = sw->tail;
+
+	for (size_t i = 0; i < n; i++){
+		uint64_t next = pre[i].address + pre[i].size;
+		if (next < sw->start || next >= sw->end)
+			continue;
+
+		if ((join = sweep_find(sw, next)) != sw->tail){
+			cut = i + 1;
+			break;
+		}
+	}
+
+	if (join != sw->tail){
+		drop_insn(&pre[cut], n - cut);
+		sweep_keep(sw, join, sw->tail);
+
+		if (sweep_grow(sw, cut, true)){
+			sw->head -= cut;
+			memcpy(&sw->insn[sw->head], pre, sizeof(cs_insn) * cut);
+			sw->start = start;
+			free(pre);
+			return;
+		}
+
+/* no room to splice, start over from what was just decoded */
+		n = cut;
+		more = true;
+	}
+
+	sweep_reset(sw, start);
+	sweep_append(sw, pre, n, more);
+	free(pre);
+}
+
+/*
+ * caller holds lock, decode at most [lim] more instructions from [end],
+ * returns false if nothing more could be done
+ */
+static bool sweep_extend(struct cs_ctx* ctx,
+	uint64_t start, const uint8_t* buf, size_t buf_sz, size_t lim)
+{
+	struct sweep* sw = &ctx->sw;
+	size_t ofs = sw->end - start;
+
+	if (ofs >= buf_sz)
+		sw->done = true;
+
+	if (sw->done || !sweep_grow(sw, lim, false))
+		return false;
+
+	bool more;
+	size_t n = decode_batch(ctx->handle, &buf[ofs],
+		buf_sz - ofs, sw->end, lim, &sw->insn[sw->tail], &more);
+	sw->tail += n;
+	if (n)
+		sw->end = sw->insn[sw->tail-1].address + sw->insn[sw->tail-1].size;
+	sw->done = !more;
+	return true;
+}
+
+/* caller holds lock, drop instructions that don't end before [addr] */
+static void sweep_cut(struct sweep* sw, uint64_t addr)
+{
+	size_t lo = sw->head, hi = sw->tail;
+
+	while (lo < hi){
+		size_t mid = lo + (hi - lo) / 2;
+		if (sw->insn[mid].address + sw->insn[mid].size <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo != sw->tail)
+		sweep_keep(sw, sw->head, lo);
+}
+
+/*
+ * First address in the sweep where [buf] differs from the bytes it was
+ * decoded from. Comparing against a copy of the last window is a single
+ * pass over the data, rather than one over every cs_insn.
+ */
+static uint64_t first_change(struct cs_ctx* ctx,
+	uint64_t start, const uint8_t* buf, size_t buf_sz)
+{
+	struct sweep* sw = &ctx->sw;
+	if (!ctx->seen)
+		return sw->start;
+
+	uint64_t lo = sw->start > start ? sw->start : start;
+	uint64_t hi = sw->end < start + buf_sz ? sw->end : start + buf_sz;
+	const uint8_t* a = &buf[lo - start];
+	const uint8_t* b = &ctx->seen[lo - ctx->seen_start];
+
+	for (size_t ofs = 0, n = hi > lo ? hi - lo : 0; ofs < n; ofs += 4096){
+		size_t step = n - ofs > 4096 ? 4096 : n - ofs;
+		if (memcmp(&a[ofs], &b[ofs], step) == 0)
+			continue;
+
+		while (a[ofs] == b[ofs])
+			ofs++;
+		return lo + ofs;
+	}
+
+	return sw->end;
+}
+
+/* keep a copy of the window so the next update can find what changed */
+static void remember(struct cs_ctx* ctx,
+	uint64_t start, const uint8_t* buf, size_t buf_sz)
+{
+	if (ctx->seen_sz != buf_sz){
+		free(ctx->seen);
+		ctx->seen = malloc(buf_sz);
+		ctx->seen_sz = ctx->seen ? buf_sz : 0;
+	}
+
+	if (ctx->seen)
+		memcpy(ctx->seen, buf, buf_sz);
+	ctx->seen_start = start;
+}
+
+/*
+ * caller holds lock, bring the sweep in line with the window [start, buf_sz)
+ * so that at least [need] instructions (or all that the window has) are
+ * ready. Data is only compared against the sweep if it is [newdata],
+ * otherwise the same addresses still hold the same bytes.
+ */
+static void sweep_sync(struct cs_ctx* ctx, uint64_t start,
+	const uint8_t* buf, size_t buf_sz, bool newdata, size_t need)
+{
+	struct sweep* sw = &ctx->sw;
+	bool moved = start != ctx->win_start || buf_sz != ctx->win_sz;
+
+/* where the sweep stopped might not be where it stops in this window */
+	if (newdata || start + buf_sz != ctx->win_start + ctx->win_sz)
+		sw->done = false;
+
+/* content changed under the sweep, or the window no longer covers it */
+	if (newdata)
+		sweep_cut(sw, first_change(ctx, start, buf, buf_sz));
+	sweep_cut(sw, start + buf_sz);
+
+	if (newdata || moved)
+		remember(ctx, start, buf, buf_sz);
+
+	size_t at = sweep_find(sw, start);
+	if (at != sw->tail)
+		sweep_keep(sw, at, sw->tail);
+	else if (sw->head != sw->tail && start < sw->end)
+		sweep_resync(ctx, start, buf, buf_sz, need);
+	else
+		sweep_reset(sw, start);
+
+	size_t live = sw->tail - sw->head;
+	if (live < need)
+		sweep_extend(ctx, start, buf, buf_sz, need - live);
+
+	while (!sw->done && start + buf_sz - sw->end < SWEEP_SYNC &&
+		sweep_extend(ctx, start, buf, buf_sz, SWEEP_BATCH));
+}
+
+static uint64_t now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Extends the sweep to the end of the job window. Batches are decoded
+ * without the lock and only appended if the sweep hasn't been modified
+ * in some other way in the meanwhile.
+ */
+static void* sweep_worker(void* arg)
+{
+	struct cs_ctx* ctx = arg;
+	cs_insn* batch = malloc(sizeof(cs_insn) * SWEEP_BATCH);
+	csh handle;
+
+	if (!batch || cs_open(arch, mode, &handle) != CS_ERR_OK){
+		free(batch);
+		pthread_mutex_lock(&ctx->lock);
+		ctx->worker_alive = false;
+		pthread_detach(pthread_self());
+		pthread_mutex_unlock(&ctx->lock);
+		return NULL;
+	}
+	cs_option(handle, CS_OPT_DETAIL, detail ? CS_OPT_ON : CS_OPT_OFF);
+	cs_option(handle, CS_OPT_SYNTAX, syntax);
+
+	pthread_mutex_lock(&ctx->lock);
+	for(;;){
+		while (!ctx->job.buf && !ctx->shutdown)
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+
+		if (ctx->shutdown)
+			break;
+
+		uint8_t* buf = ctx->job.buf;
+		size_t buf_sz = ctx->job.buf_sz;
+		uint64_t base = ctx->job.base;
+		uint64_t gen = ctx->job.gen;
+		uint64_t last = now_ms();
+		ctx->job.buf = NULL;
+		ctx->busy = true;
+		ctx->busy_gen = gen;
+
+		while (!ctx->shutdown && !ctx->job.buf &&
+			ctx->sw.gen == gen && !ctx->sw.done){
+			uint64_t addr = ctx->sw.end;
+			pthread_mutex_unlock(&ctx->lock);
+
+			bool more = false;
+			size_t n = 0;
+			if (addr - base < buf_sz)
+				n = decode_batch(handle, &buf[addr - base],
+					buf_sz - (addr - base), addr, SWEEP_BATCH, batch, &more);
+
+			pthread_mutex_lock(&ctx->lock);
+			if (ctx->sw.gen != gen || ctx->sw.end != addr){
+				drop_insn(batch, n);
+				break;
+			}
+
+			sweep_append(&ctx->sw, batch, n, more);
+			uint64_t ts = now_ms();
+			if (ctx->sw.done || ts - last >= SWEEP_WAKE){
+				last = ts;
+				xlt_wake(ctx->out);
+			}
+		}
+
+		ctx->busy = false;
+		free(buf);
+	}
+	pthread_mutex_unlock(&ctx->lock);
+
+	cs_close(&handle);
+	free(batch);
+	return NULL;
+}
+
+/* caller holds lock, have the worker finish the sweep over [buf] */
+static void post_job(struct cs_ctx* ctx,
+	uint64_t start, const uint8_t* buf, size_t buf_sz, bool newdata)
+{
+	struct sweep* sw = &ctx->sw;
+	bool same = !newdata && start == ctx->win_start && buf_sz == ctx->win_sz;
+
+	ctx->win_start = start;
+	ctx->win_sz = buf_sz;
+
+	if (sw->done)
+		return;
+
+/* the worker copy no longer matches the window, invalidate what it does */
+	if (!same)
+		sw->gen++;
+	else if ((ctx->busy && ctx->busy_gen == sw->gen) ||
+		(ctx->job.buf && ctx->job.gen == sw->gen))
+		return;
+
+	if (!ctx->worker_alive){
+		if (0 != pthread_create(&ctx->worker, NULL, sweep_worker, ctx))
+			return;
+		ctx->worker_alive = true;
+	}
+
+	uint8_t* copy = malloc(buf_sz);
+	if (!copy)
+		return;
+	memcpy(copy, buf, buf_sz);
+
+	free(ctx->job.buf);
+	ctx->job.buf = copy;
+	ctx->job.buf_sz = buf_sz;
+	ctx->job.base = start;
+	ctx->job.gen = sw->gen;
+	pthread_cond_signal(&ctx->cond);
+}
+
+static void free_ctx(struct cs_ctx* ctx)
+{
+	pthread_mutex_lock(&ctx->lock);
+	bool alive = ctx->worker_alive;
+	ctx->shutdown = true;
+	pthread_cond_signal(&ctx->cond);
+	pthread_mutex_unlock(&ctx->lock);
+
+	if (alive)
+		pthread_join(ctx->worker, NULL);
+
+	free(ctx->job.buf);
+	free(ctx->seen);
+	sweep_keep(&ctx->sw, ctx->sw.head, ctx->sw.head);
+	free(ctx->sw.insn);
+
+	if (ctx->active)
+		cs_close(&ctx->handle);
+
+	pthread_mutex_destroy(&ctx->lock);
+	pthread_cond_destroy(&ctx->cond);
+	free(ctx);
+}
+
 static bool populate(bool newdata, struct arcan_shmif_cont* in,
 	struct arcan_shmif_cont* out, uint64_t pos, size_t buf_sz, uint8_t* buf)
 {
-	if (!buf)
+	if (!buf){
+		if (out->user)
+			free_ctx(out->user);
+		out->user = NULL;
 		return false;
+	}
 
 	if (!out->user){
 		out->user = malloc(sizeof(struct cs_ctx));
 		memset(out->user, '\0', sizeof(struct cs_ctx));
 		struct cs_ctx* inh = out->user;
+		inh->out = out;
+		pthread_mutex_init(&inh->lock, NULL);
+		pthread_cond_init(&inh->cond, NULL);
 		cs_err err = cs_open(arch, mode, &inh->handle);
 
 		inh->active = true;
@@ -413,32 +937,38 @@ static bool populate(bool newdata, struct arcan_shmif_cont* in,
 		buf += inh->disass_ofs;
 	}
 
-	draw_box(out, 0, 0, out->addr->w, out->addr->h, col_bg);
-	if (inh->last)
-		cs_free(inh->last, inh->last_count);
+/* only what fits on screen has to be ready now, the rest of the window is
+ * filled in by the worker and the overlay follows as it progresses */
+	uint64_t start = pos + inh->disass_ofs;
+	size_t need = out->addr->h / (fonth + 2) + 1;
 
-	inh->last_count = cs_disasm(inh->handle,
-		buf, buf_sz, pos + inh->disass_ofs, 0, &inh->last);
+	pthread_mutex_lock(&inh->lock);
+	sweep_sync(inh, start, buf, buf_sz, newdata, need);
+	post_job(inh, start, buf, buf_sz, newdata);
 
-	if (!inh->last_count){
+	cs_insn* insn = &inh->sw.insn[inh->sw.head];
+	size_t count = inh->sw.tail - inh->sw.head;
+
+	draw_box(out, 0, 0, out->addr->w, out->addr->h, col_bg);
+
+	if (!count){
 		char txtbuf[64];
 		snprintf(txtbuf, 64, "Failed disassembly @%"PRIx64, pos);
 		draw_text(out, txtbuf, 2, fonth + 4, col_err);
 		goto done;
 	}
 
-	draw_box(out, 0, 0, out->addr->w, out->addr->h, col_bg);
-
 	if (inh->mode == INTERP_NORMAL){
 		size_t row = 4 + fonth, xp = 0;
 		inh->pos = pos;
-		for (size_t i = 0; i < inh->last_count && row < out->addr->h - fonth; i++)
-			draw_mnemonic(out, inh, &inh->last[i], &xp, &row);
+		for (size_t i = 0; i < count && row < out->addr->h - fonth; i++)
+			draw_mnemonic(out, inh, &insn[i], &xp, &row);
 	}
 	else
-		group_disass(out, inh->last, inh->last_count);
+		group_disass(out, insn, count);
 
 done:
+	pthread_mutex_unlock(&inh->lock);
 	draw_header(out, inh, pos);
 	return true;
 }
@@ -633,7 +1163,8 @@ int main(int argc, char** argv)
 	arch = archs[aind].arch;
 	mode = archs[aind].mode;
 
-	struct xlt_context* ctx = xlt_open(archs[aind].name, XLT_DYNSIZE, confl);
+	struct xlt_context* ctx = xlt_open(archs[aind].name,
+		XLT_DYNSIZE | XLT_INPLACE, confl);
 	if (!ctx)
 		return EXIT_FAILURE;
 
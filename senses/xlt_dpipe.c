@@ -6,6 +6,17 @@
  * the command that is set as the chain opener (which should work on
  * a pipes and filters basis) in order to classify and output a string
  * that describes the format of the current buffer.
+ *
+ * With -c, the command is instead kept running as a coprocess that gets
+ * one request per step over the same pipes: the buffer length in decimal
+ * followed by '\n', then that many bytes of buffer. It should reply with
+ * a single '\n' terminated line. The pipes are driven from a thread of
+ * its own, the segment shows "(pending)" until the reply is in. A new
+ * frame cancels the request in flight by restarting the coprocess, and so
+ * does a reply that takes longer than -t milliseconds (default 1000).
+ * Example:
+ *  xlt_dpipe -c /bin/sh -c 'while read -r n; do
+ *   head -c $n > /tmp/dp; file -b /tmp/dp; done'
  */
 #include <stdlib.h>
 #include <stdio.h>
@@ -15,9 +26,11 @@
 #include <sys/wait.h>
 #include <signal.h>
 #include <poll.h>
-#include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <arcan_shmif.h>
 #include "libsenseye.h"
@@ -25,6 +38,43 @@
 
 static int glob_argc;
 static char** glob_argv;
+static bool glob_coproc;
+static int glob_timeout = 1000;
+
+/* per output segment, kept in out->user */
+struct dpipe_state {
+	char* msg;
+
+/* coprocess mode, [lock] covers [msg] and the request fields */
+	bool thr_alive;
+	pthread_t thr;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct arcan_shmif_cont* out;
+
+/* written to on cancel / shutdown, breaks the thread out of poll */
+	int ctl[2];
+	bool shutdown;
+
+/* next request, [req_new] until the thread has picked it up and
+ * [busy] while it is being worked on */
+	uint8_t* req;
+	size_t req_sz, req_cap, req_lim;
+	bool req_new, busy, posted;
+
+/* owned by the thread */
+	pid_t pid;
+	int rd, wr;
+	uint8_t* job;
+	size_t job_sz, job_cap;
+
+/* reply line, anything past [line_sz] is dropped, and what was read
+ * past the '\n' is kept in [carry] for the next reply */
+	char* line;
+	size_t line_ofs, line_sz;
+	char carry[256];
+	size_t carry_sz;
+};
 
 struct xlt_session {
 	struct arcan_shmif_cont in;
@@ -60,81 +110,427 @@ static bool poll_inp(int pfd, char* buf, size_t* ofs, size_t* sz)
 	return true;
 }
 
-static char* pipe_step(size_t inbuf_sz, size_t out_sz, uint8_t* buf)
+/*
+ * fork and exec the command, [rd] gets its stdout and [wr] its stdin
+ */
+static pid_t spawn(int* rd, int* wr)
 {
 	int in[2];
 	int out[2];
 
-	pipe(in);
-	pipe(out);
+	if (-1 == pipe(in))
+		return -1;
+
+	if (-1 == pipe(out)){
+		close(in[0]);
+		close(in[1]);
+		return -1;
+	}
 
 	pid_t pid;
 	if ( (pid = fork()) ){
 		close(in[1]);
 		close(out[0]);
 
-		size_t out_ofs = 0;
-		int rc;
+		if (-1 == pid){
+			fprintf(stderr, "fork failed, reason: %s\n", strerror(errno));
+			close(in[0]);
+			close(out[1]);
+			return -1;
+		}
+
+		*rd = in[0];
+		*wr = out[1];
+		return pid;
+	}
+
+/* skip first argument, copy rest and null terminate */
+	char* nargv[glob_argc+1];
+	for (size_t i = 0; i < glob_argc; i++)
+		nargv[i] = glob_argv[i];
+	nargv[glob_argc] = NULL;
+
+	close(in[0]);
+	close(out[1]);
+	close(STDIN_FILENO);
+	close(STDOUT_FILENO);
+	dup2(in[1], STDOUT_FILENO);
+	dup2(out[0], STDIN_FILENO);
+
+	execv(glob_argv[0], nargv);
+	exit(EXIT_FAILURE);
+}
+
+static char* pipe_step(size_t inbuf_sz, size_t out_sz, uint8_t* buf)
+{
+	int in, out;
+	pid_t pid = spawn(&in, &out);
+	if (-1 == pid)
+		return NULL;
+
+	size_t out_ofs = 0;
+	int rc;
 
 /* some minor buffering */
-		size_t inbuf_ofs = 0;
-		char inbuf[ inbuf_sz + 1 ];
-		memset(inbuf, '\0', inbuf_sz + 1);
+	size_t inbuf_ofs = 0;
+	char inbuf[ inbuf_sz + 1 ];
+	memset(inbuf, '\0', inbuf_sz + 1);
 
-		bool failed = false;
+	bool failed = false;
 /* naive flush */
-		while (out_sz - out_ofs > 0 && !failed){
-			ssize_t nw = write(out[1], &buf[out_ofs], out_sz-out_ofs);
-			if (-1 == nw)
-				break;
+	while (out_sz - out_ofs > 0 && !failed){
+		ssize_t nw = write(out, &buf[out_ofs], out_sz-out_ofs);
+		if (-1 == nw)
+			break;
 
-			out_ofs += nw;
-			failed = poll_inp(in[0], inbuf, &inbuf_ofs, &inbuf_sz);
-		}
+		out_ofs += nw;
+		failed = poll_inp(in, inbuf, &inbuf_ofs, &inbuf_sz);
+	}
 
-		close(out[1]);
-		while(!failed && poll_inp(in[0], inbuf, &inbuf_ofs, &inbuf_sz));
+	close(out);
+	while(!failed && poll_inp(in, inbuf, &inbuf_ofs, &inbuf_sz));
+	close(in);
 
 /* get rid of the child, we are done here */
-		kill(pid, SIGKILL);
-		waitpid(pid, &rc, WNOHANG);
+	kill(pid, SIGKILL);
+	waitpid(pid, &rc, WNOHANG);
 
 /* font rendering will filter possibly weird characters */
-		inbuf[inbuf_ofs] = '\0';
-		return strdup(inbuf);
+	inbuf[inbuf_ofs] = '\0';
+	return strdup(inbuf);
+}
+
+/* thread side, only called with the pipes no longer in use */
+static void coproc_kill(struct dpipe_state* st)
+{
+	if (-1 == st->pid)
+		return;
+
+	close(st->rd);
+	close(st->wr);
+	kill(st->pid, SIGKILL);
+	waitpid(st->pid, NULL, 0);
+	st->pid = -1;
+	st->carry_sz = 0;
+}
+
+static bool coproc_spawn(struct dpipe_state* st)
+{
+	st->pid = spawn(&st->rd, &st->wr);
+	if (-1 == st->pid)
+		return false;
+
+/* the deadline is enforced through poll, so never block on the pipes */
+	fcntl(st->rd, F_SETFL, fcntl(st->rd, F_GETFL) | O_NONBLOCK);
+	fcntl(st->wr, F_SETFL, fcntl(st->wr, F_GETFL) | O_NONBLOCK);
+	return true;
+}
+
+static long long ms_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool coproc_cancelled(struct dpipe_state* st)
+{
+	pthread_mutex_lock(&st->lock);
+	bool rv = st->req_new || st->shutdown;
+	pthread_mutex_unlock(&st->lock);
+	return rv;
+}
+
+/*
+ * append [n] bytes of reply to the line, returns true when it is complete,
+ * whatever follows the '\n' is kept as the start of the next reply
+ */
+static bool coproc_reply(struct dpipe_state* st, const char* buf, size_t n)
+{
+	for (size_t i = 0; i < n; i++){
+		if (buf[i] == '\n'){
+			st->line[st->line_ofs] = '\0';
+			size_t rest = n - i - 1;
+			if (rest > sizeof(st->carry))
+				rest = sizeof(st->carry);
+			memmove(st->carry, &buf[i+1], rest);
+			st->carry_sz = rest;
+			return true;
+		}
+		if (st->line_ofs < st->line_sz)
+			st->line[st->line_ofs++] = buf[i];
 	}
-/* skip first argument, copy rest and null terminate */
-	else if (-1 == pid)
-		fprintf(stderr, "fork failed, reason: %s\n", strerror(errno));
-	else {
-		char* nargv[glob_argc+1];
-		for (size_t i = 0; i < glob_argc; i++)
-			nargv[i] = glob_argv[i];
-		nargv[glob_argc] = NULL;
 
-		close(in[0]);
-		close(out[1]);
-		close(STDIN_FILENO);
-		close(STDOUT_FILENO);
-		dup2(in[1], STDOUT_FILENO);
-		dup2(out[0], STDIN_FILENO);
+	return false;
+}
+
+enum reply_state {
+	REPLY_OK = 0,
+	REPLY_CANCEL,
+	REPLY_TIMEOUT,
+	REPLY_FAIL
+};
+
+/*
+ * send [job] to the coprocess and collect the reply line, within
+ * [glob_timeout] and until populate queues a newer request.
+ */
+static enum reply_state coproc_run(struct dpipe_state* st)
+{
+	long long deadline = ms_now() + glob_timeout;
+	char hdr[24];
+	size_t hdr_sz = snprintf(hdr, sizeof(hdr), "%zu\n", st->job_sz);
+	size_t hdr_ofs = 0, out_ofs = 0;
+	bool got_line = false;
+	uint8_t ch[64];
+
+	while (read(st->ctl[0], ch, sizeof(ch)) > 0);
+
+	st->line_ofs = 0;
+	if (st->carry_sz){
+		char tmp[sizeof(st->carry)];
+		size_t n = st->carry_sz;
+		memcpy(tmp, st->carry, n);
+		st->carry_sz = 0;
+		got_line = coproc_reply(st, tmp, n);
+	}
+
+	for(;;){
+		bool sending = hdr_ofs < hdr_sz || out_ofs < st->job_sz;
+		if (!sending && got_line)
+			return REPLY_OK;
+
+		long long left = deadline - ms_now();
+		if (left <= 0)
+			return REPLY_TIMEOUT;
+
+		struct pollfd fds[3] = {
+			{.fd = st->ctl[0], .events = POLLIN},
+			{.fd = got_line ? -1 : st->rd, .events = POLLIN},
+			{.fd = st->wr, .events = POLLOUT}
+		};
+
+		int pc = poll(fds, sending ? 3 : 2, left);
+		if (-1 == pc && errno != EINTR)
+			return REPLY_FAIL;
+		if (pc <= 0)
+			continue;
+
+		if (fds[0].revents){
+			while (read(st->ctl[0], ch, sizeof(ch)) > 0);
+			if (coproc_cancelled(st))
+				return REPLY_CANCEL;
+		}
+
+		if (sending && (fds[2].revents & (POLLERR | POLLHUP | POLLNVAL)))
+			return REPLY_FAIL;
+
+		if (sending && (fds[2].revents & POLLOUT)){
+			ssize_t nw;
+			if (hdr_ofs < hdr_sz){
+				nw = write(st->wr, &hdr[hdr_ofs], hdr_sz - hdr_ofs);
+				if (nw > 0)
+					hdr_ofs += nw;
+			}
+			else {
+				nw = write(st->wr, &st->job[out_ofs], st->job_sz - out_ofs);
+				if (nw > 0)
+					out_ofs += nw;
+			}
+			if (-1 == nw && errno != EAGAIN && errno != EINTR)
+				return REPLY_FAIL;
+		}
+
+		if (!(fds[1].revents & (POLLIN | POLLHUP)))
+			continue;
+
+		char rbuf[256];
+		ssize_t nr = read(st->rd, rbuf, sizeof(rbuf));
+		if (0 == nr || (-1 == nr && errno != EAGAIN && errno != EINTR))
+			return REPLY_FAIL;
+
+		if (nr > 0)
+			got_line = coproc_reply(st, rbuf, nr);
+	}
+}
+
+/*
+ * takes one request at a time from populate, the outcome replaces [msg]
+ * and the segment is woken up to show it
+ */
+static void* coproc_thread(void* arg)
+{
+	struct dpipe_state* st = arg;
+
+	pthread_mutex_lock(&st->lock);
+	for(;;){
+		while (!st->req_new && !st->shutdown)
+			pthread_cond_wait(&st->cond, &st->lock);
+
+		if (st->shutdown)
+			break;
+
+/* swap buffers so that populate can queue the next request meanwhile */
+		uint8_t* buf = st->job;
+		size_t cap = st->job_cap;
+		st->job = st->req;
+		st->job_cap = st->req_cap;
+		st->job_sz = st->req_sz;
+		st->req = buf;
+		st->req_cap = cap;
+		st->req_sz = 0;
+
+		size_t lim = st->req_lim;
+		st->req_new = false;
+		st->busy = true;
+		pthread_mutex_unlock(&st->lock);
+
+		if (st->line_sz < lim){
+			free(st->line);
+			st->line = malloc(lim + 1);
+			st->line_sz = st->line ? lim : 0;
+		}
+
+		enum reply_state rs = REPLY_FAIL;
+		if (st->line && (-1 != st->pid || coproc_spawn(st)))
+			rs = coproc_run(st);
+
+		if (rs != REPLY_OK)
+			coproc_kill(st);
 
-		if (-1 == execv(glob_argv[0], nargv))
-			exit(EXIT_FAILURE);
+		pthread_mutex_lock(&st->lock);
+		st->busy = false;
+		if (rs == REPLY_CANCEL)
+			continue;
+
+		free(st->msg);
+		st->msg = rs == REPLY_OK ? strdup(st->line) :
+			(rs == REPLY_TIMEOUT ? strdup("(timeout)") : NULL);
+		pthread_mutex_unlock(&st->lock);
+
+		xlt_wake(st->out);
+		pthread_mutex_lock(&st->lock);
 	}
+	pthread_mutex_unlock(&st->lock);
 
 	return NULL;
 }
 
+static bool coproc_start(struct dpipe_state* st)
+{
+	if (-1 == pipe(st->ctl))
+		return false;
+
+	for (size_t i = 0; i < 2; i++){
+		fcntl(st->ctl[i], F_SETFD, FD_CLOEXEC);
+		fcntl(st->ctl[i], F_SETFL, O_NONBLOCK);
+	}
+
+	pthread_mutex_init(&st->lock, NULL);
+	pthread_cond_init(&st->cond, NULL);
+
+	if (0 != pthread_create(&st->thr, NULL, coproc_thread, st)){
+		pthread_mutex_destroy(&st->lock);
+		pthread_cond_destroy(&st->cond);
+		close(st->ctl[0]);
+		close(st->ctl[1]);
+		return false;
+	}
+
+	st->thr_alive = true;
+	return true;
+}
+
+static void coproc_stop(struct dpipe_state* st)
+{
+	if (!st->thr_alive)
+		return;
+
+	uint8_t ch = 1;
+	pthread_mutex_lock(&st->lock);
+	st->shutdown = true;
+	pthread_cond_signal(&st->cond);
+	pthread_mutex_unlock(&st->lock);
+	while (-1 == write(st->ctl[1], &ch, 1) && errno == EINTR);
+
+	pthread_join(st->thr, NULL);
+	pthread_mutex_destroy(&st->lock);
+	pthread_cond_destroy(&st->cond);
+	close(st->ctl[0]);
+	close(st->ctl[1]);
+	st->thr_alive = false;
+
+	coproc_kill(st);
+	free(st->req);
+	free(st->job);
+}
+
+static char* coproc_step(struct dpipe_state* st,
+	bool newdata, size_t inbuf_sz, size_t out_sz, uint8_t* buf)
+{
+	if (!st->thr_alive && !coproc_start(st))
+		return NULL;
+
+	pthread_mutex_lock(&st->lock);
+
+/* a new frame replaces whatever is still in flight */
+	if (newdata || !st->posted){
+		if (st->req_cap < out_sz){
+			uint8_t* nb = realloc(st->req, out_sz);
+			if (!nb){
+				pthread_mutex_unlock(&st->lock);
+				return NULL;
+			}
+			st->req = nb;
+			st->req_cap = out_sz;
+		}
+
+		memcpy(st->req, buf, out_sz);
+		st->req_sz = out_sz;
+		st->req_lim = inbuf_sz;
+		st->req_new = true;
+		st->posted = true;
+		pthread_cond_signal(&st->cond);
+
+		uint8_t ch = 1;
+		while (-1 == write(st->ctl[1], &ch, 1) && errno == EINTR);
+	}
+
+	char* msg = NULL;
+	if (st->req_new || st->busy)
+		msg = strdup("(pending)");
+	else if (st->msg)
+		msg = strdup(st->msg);
+
+	pthread_mutex_unlock(&st->lock);
+	return msg;
+}
+
 static bool populate(bool newdata, struct arcan_shmif_cont* in,
 	struct arcan_shmif_cont* out, uint64_t pos, size_t buf_sz, uint8_t* buf)
 {
+	struct dpipe_state* st = out->user;
+
 	if (!buf){
-		free(out->user);
+		if (st){
+			coproc_stop(st);
+			free(st->line);
+			free(st->msg);
+			free(st);
+			out->user = NULL;
+		}
 		return false;
 	}
 
-	if (!out->user){
+	if (!st){
+		st = malloc(sizeof(struct dpipe_state));
+		if (!st)
+			return false;
+		memset(st, '\0', sizeof(struct dpipe_state));
+		st->pid = -1;
+		st->out = out;
+		out->user = st;
+
 		arcan_shmif_resize(out, 512, 32);
 		draw_box(out, 0, 0, out->addr->w,
 			out->addr->h, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
@@ -142,7 +538,9 @@ static bool populate(bool newdata, struct arcan_shmif_cont* in,
 	}
 
 	size_t inbuf_sz = (out->addr->w / fontw) * (out->addr->h / fonth);
-	char* msg = pipe_step(inbuf_sz, buf_sz, buf);
+	char* msg = glob_coproc ?
+		coproc_step(st, newdata, inbuf_sz, buf_sz, buf) :
+		pipe_step(inbuf_sz, buf_sz, buf);
 	draw_box(out, 0, 0, out->addr->w,
 		out->addr->h, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
 
@@ -161,8 +559,27 @@ int main(int argc, char* argv[])
 	snprintf(name, 32, "DPIPE(%d)", (int) getpid());
 	enum ARCAN_FLAGS confl = SHMIF_CONNECT_LOOP;
 
-	glob_argc = argc - 1;
-	glob_argv = &argv[1];
+	int argi = 1;
+	for (; argi < argc && argv[argi][0] == '-'; argi++){
+		if (strcmp(argv[argi], "-c") == 0)
+			glob_coproc = true;
+		else if (strcmp(argv[argi], "-t") == 0 && argi < argc - 1)
+			glob_timeout = strtol(argv[++argi], NULL, 10);
+		else
+			break;
+	}
+
+	if (glob_timeout <= 0)
+		glob_timeout = 1;
+
+/* -c and -t without anything to run */
+	if (argi >= argc){
+		fprintf(stderr, "usage: xlt_dpipe [-c [-t ms]] /path/to/cmd [args]\n");
+		return EXIT_FAILURE;
+	}
+
+	glob_argc = argc - argi;
+	glob_argv = &argv[argi];
 
 	signal(SIGPIPE, SIG_IGN);
 
@@ -35,10 +35,46 @@ static const char* mode_lut[] = {
 	"Error"
 };
 
+/* cell highlights, in cursor distance order */
+enum cell_hl {
+	HL_NONE = 0,
+	HL_CURSOR,
+	HL_NEXT,
+	HL_WORD,
+	HL_QWORD
+};
+
+static const shmif_pixel hl_lut[] = {
+	SHMIF_RGBA(0x00, 0x00, 0x00, 0xff),
+	SHMIF_RGBA(0x00, 0xff, 0x00, 0xff),
+	SHMIF_RGBA(0xff, 0xff, 0x00, 0xff),
+	SHMIF_RGBA(0xff, 0x00, 0x00, 0xff),
+	SHMIF_RGBA(0xff, 0x00, 0xff, 0xff)
+};
+
+/*
+ * A cell covers one byte with the spacing to the next cell, glyphs are
+ * inset by one pixel so that a highlight shows up as a frame around them.
+ * The shadow keeps (byte | color << 8 | highlight << 9) for every cell on
+ * screen so that only those that differ from the last update are redrawn.
+ */
+#define CELL_W (3 * (fontw + 2))
+#define CELL_H (fonth + 2)
+#define CELL_KEY(ch, color, hl) ((ch) | ((color) << 8) | ((hl) << 9))
+#define CELL_EMPTY 0x1000
+#define CELL_UNKNOWN 0xffff
+
+/* prerendered cells, one per (byte, color mode), see build_atlas */
+static shmif_pixel* atlas;
+
 struct hex_user {
 	enum render_mode rm;
 	int last_w, last_h;
 	int col, row;
+
+	uint16_t* shadow;
+	size_t shadow_w, shadow_h, shadow_footer;
+	bool footer_drawn;
 };
 
 #define ROW_WIDTH(X) ( ((X) - 2 * (fontw+2)) / (3*(fontw+2)) + 1 )
@@ -85,22 +121,52 @@ static bool input(struct arcan_shmif_cont* out, arcan_event* ev)
 static char hlut[16] = {'0', '1', '2', '3', '4', '5',
 	'6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
 
-static inline void draw_ch(struct arcan_shmif_cont* out,
-	struct hex_user* actx, uint8_t ch, ssize_t col, size_t row)
+static bool build_atlas()
 {
-	if (col < 0)
-		return;
+	size_t cell_sz = CELL_W * CELL_H;
+	atlas = malloc(sizeof(shmif_pixel) * cell_sz * 512);
+	if (!atlas)
+		return false;
+
+	for (size_t i = 0; i < 512; i++){
+		uint8_t ch = i & 0xff;
+		struct arcan_shmif_cont cell = {
+			.vidp = &atlas[i * cell_sz],
+			.w = CELL_W,
+			.h = CELL_H,
+			.pitch = CELL_W
+		};
 
 /* box should indicate alignment */
-	draw_box(out, col,
-		row, 2*(fontw+2), fonth+1, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
+		shmif_pixel color = i >> 8 ? color_lut[ch] : SHMIF_RGBA(0xcc, 0xcc, 0xcc, 0xff);
+		draw_box(&cell, 0, 0, CELL_W, CELL_H, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
+		draw_char(&cell, hlut[ch >> 4 & 0xf], 1, 1, color);
+		draw_char(&cell, hlut[ch >> 0 & 0xf], 1+fontw+2, 1, color);
+	}
+
+	return true;
+}
+
+/* [x, y] is the top-left corner of the cell, not of the glyphs */
+static void draw_cell(struct arcan_shmif_cont* out,
+	uint16_t key, size_t x, size_t y)
+{
+	if (key == CELL_EMPTY){
+		draw_box(out, x, y, CELL_W, CELL_H, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
+		return;
+	}
 
-/* lookup color against bytevalue if needed */
-	shmif_pixel color = actx->rm == RM_SIMPLE || actx->rm == RM_DETAIL_SIMPLE ?
-		SHMIF_RGBA(0xcc, 0xcc, 0xcc, 0xff) : color_lut[ch];
+	draw_block(out, x, y, CELL_W, CELL_H, &atlas[(key & 0x1ff) * CELL_W * CELL_H]);
 
-	draw_char(out, hlut[ch >> 4 & 0xf], col, row, color);
-	draw_char(out, hlut[ch >> 0 & 0xf], col+fontw+2, row, color);
+/* frame outside of the glyph box */
+	enum cell_hl hl = key >> 9;
+	if (hl == HL_NONE)
+		return;
+
+	size_t box_w = 2 * (fontw + 2);
+	draw_box(out, x, y, CELL_W, 1, hl_lut[hl]);
+	draw_box(out, x, y + 1, 1, CELL_H - 1, hl_lut[hl]);
+	draw_box(out, x + 1 + box_w, y + 1, CELL_W - box_w - 1, CELL_H - 1, hl_lut[hl]);
 }
 
 static void draw_header(struct arcan_shmif_cont* out,
@@ -194,21 +260,24 @@ static void draw_footer(struct arcan_shmif_cont* out, struct hex_user* actx,
 static bool populate(bool newdata, struct arcan_shmif_cont* in,
 	struct arcan_shmif_cont* out, uint64_t pos, size_t buf_sz, uint8_t* buf)
 {
+	struct hex_user* actx = out->user;
 	if (!buf){
+		if (actx)
+			free(actx->shadow);
 		free(out->user);
+		out->user = NULL;
 		return false;
 	}
 
-	if (!out->user){
-		out->user = malloc(sizeof(struct hex_user));
+/* partial updates are only useful if the server knows about them */
+	if (!actx){
+		actx = out->user = malloc(sizeof(struct hex_user));
 		memset(out->user, '\0', sizeof(struct hex_user));
-		((struct hex_user*)out->user)->rm= def_rm;
+		actx->rm = def_rm;
+		out->hints |= SHMIF_RHINT_SUBREGION;
+		arcan_shmif_resize(out, out->w, out->h);
 	}
 
-	draw_box(out, 0, fonth+2,
-		out->addr->w, out->addr->h, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
-
-	struct hex_user* actx = out->user;
 	if (newdata || actx->last_w != out->addr->w || actx->last_h != out->addr->h){
 		actx->row = actx->col = 0;
 		actx->last_w = out->addr->w;
@@ -232,26 +301,77 @@ static bool populate(bool newdata, struct arcan_shmif_cont* in,
 	int cursor_ind = (ROW_WIDTH(out->addr->w) * actx->row + actx->col);
 	size_t ylim = out->addr->h - footer * (fonth+2);
 	size_t xlim = ROW_WIDTH(out->addr->w) * ch_w;
+	size_t cols = (xlim - 2 + ch_w - 1) / ch_w;
+	size_t rows = ylim > fonth+3 ? (ylim - (fonth+3) + fonth+1) / (fonth+2) : 0;
+	bool color = actx->rm == RM_COLOR || actx->rm == RM_DETAIL_COLOR;
+
+	out->dirty = (struct arcan_shmif_region){.x1 = out->w, .y1 = out->h};
+
+/* new layout, nothing on screen can be trusted */
+	if (!actx->shadow || actx->shadow_w != out->w ||
+		actx->shadow_h != out->h || actx->shadow_footer != footer){
+		free(actx->shadow);
+		actx->shadow = malloc(sizeof(uint16_t) * (cols * rows + 1));
+		if (!actx->shadow)
+			return false;
+
+		for (size_t i = 0; i < cols * rows; i++)
+			actx->shadow[i] = CELL_UNKNOWN;
+		actx->shadow_w = out->w;
+		actx->shadow_h = out->h;
+		actx->shadow_footer = footer;
+		actx->footer_drawn = false;
+		draw_box(out, 0, fonth+2,
+			out->addr->w, out->addr->h, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
+		dirty_box(out, 0, fonth+2, out->w, out->h);
+	}
 
-	for (size_t row = fonth+3; row < ylim; row += fonth + 2)
-		for (size_t col = 2; col < xlim && buf_ind < buf_sz; col += ch_w){
+	for (size_t row = 0; row < rows; row++)
+		for (size_t col = 0; col < cols; col++, buf_ind++){
+			uint16_t key = CELL_EMPTY;
 
 /* underline current position and mark related sizes, e.g. +2, 4, 8 */
-			if (buf_ind == cursor_ind)
-				draw_box(out, col-1, row-1, ch_w+2, fonth+3, SHMIF_RGBA(0x00, 0xff, 0x00, 0xff));
-			else if (buf_ind == cursor_ind+1)
-				draw_box(out, col-1, row-1, ch_w+2, fonth+3, SHMIF_RGBA(0xff, 0xff, 0x00, 0xff));
-			else if (buf_ind > cursor_ind && buf_ind <= cursor_ind+3)
-				draw_box(out, col-1, row-1, ch_w+2, fonth+3, SHMIF_RGBA(0xff, 0x00, 0x00, 0xff));
-			else if (buf_ind > cursor_ind+3 && buf_ind <= cursor_ind+7)
-				draw_box(out, col-1, row-1, ch_w+2, fonth+3, SHMIF_RGBA(0xff, 0x00, 0xff, 0xff));
-
-			draw_ch(out, actx, buf[buf_ind++], col, row);
+			if (buf_ind < buf_sz){
+				enum cell_hl hl = HL_NONE;
+				if (buf_ind == cursor_ind)
+					hl = HL_CURSOR;
+				else if (buf_ind == cursor_ind+1)
+					hl = HL_NEXT;
+				else if (buf_ind > cursor_ind && buf_ind <= cursor_ind+3)
+					hl = HL_WORD;
+				else if (buf_ind > cursor_ind+3 && buf_ind <= cursor_ind+7)
+					hl = HL_QWORD;
+				key = CELL_KEY(buf[buf_ind], color, hl);
+			}
+
+			uint16_t* cell = &actx->shadow[row * cols + col];
+			if (*cell == key)
+				continue;
+
+			size_t x = 1 + col * ch_w;
+			size_t y = fonth+2 + row * (fonth+2);
+			draw_cell(out, key, x, y);
+			dirty_box(out, x, y, ch_w, fonth+2);
+			*cell = key;
 		}
 
 	draw_header(out, actx, pos+cursor_ind);
-	if(actx->rm >= RM_DETAIL_SIMPLE && footer && cursor_ind < buf_sz)
+	dirty_box(out, 0, 0, out->w, fonth+2);
+
+	int y = (int)out->addr->h - (reserved_rows * fonth + 2);
+	if(actx->rm >= RM_DETAIL_SIMPLE && footer && cursor_ind < buf_sz){
 		draw_footer(out, actx, &buf[cursor_ind], buf_sz - cursor_ind);
+		actx->footer_drawn = true;
+	}
+	else if (actx->footer_drawn && y >= 0){
+		draw_box(out, 0, y, out->w, out->h - y, SHMIF_RGBA(0x00, 0x00, 0x00, 0xff));
+		actx->footer_drawn = false;
+	}
+	else
+		y = -1;
+
+	if (y >= 0)
+		dirty_box(out, 0, y, out->w, out->h - y);
 
 	return true;
 }
@@ -272,6 +392,9 @@ int main(int argc, char* argv[])
 		color_lut[i] = SHMIF_RGBA(pixel[0], pixel[1], pixel[2], 0xff);
 	}
 
-	return xlt_setup("hex", populate, input, XLT_DYNSIZE, confl) == true ?
-		EXIT_SUCCESS : EXIT_FAILURE;
+	if (!build_atlas())
+		return EXIT_FAILURE;
+
+	return xlt_setup("hex", populate, input,
+		XLT_DYNSIZE | XLT_INPLACE, confl) == true ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -11,7 +11,10 @@
 #include <arcan_shmif.h>
 #include "libsenseye.h"
 #include "font_8x8.h"
+#include "ptnmatch.h"
+#include "detect.h"
 #include <inttypes.h>
+#include <pthread.h>
 
 enum view_mode {
 	VIEW_LIST = 0,
@@ -43,6 +46,45 @@ struct scanres {
 	size_t ofs;
 };
 
+/* memory budget for the decoded images that are kept around per session */
+#define CACHE_BUDGET (64 * 1024 * 1024)
+
+/*
+ * A finished decode attempt, keyed on the absolute position of the signature
+ * and a hash over the [src_sz] bytes the decoder consumed, so that stepping
+ * back to an image that hasn't changed is a lookup rather than a decode.
+ */
+struct decoded {
+	uint64_t ipos, hash;
+	size_t src_sz;
+	uint8_t magic;
+
+/* NULL if decoding failed ([reason] is set) or the image is suspect */
+	uint8_t* raw;
+	size_t w, h;
+	bool suspect;
+	const char* reason;
+
+/* the encoded original, kept for saving */
+	uint8_t* orig;
+
+/* last rescale, reused until the output dimensions change */
+	uint8_t* scaled;
+	size_t scalew, scaleh;
+
+/* [cost] includes [scaled_cost], the size of the current rescale */
+	size_t cost, scaled_cost;
+	uint64_t used;
+	struct decoded* next;
+};
+
+struct decode_job {
+	uint64_t ipos;
+	uint8_t magic;
+	uint8_t* buf;
+	size_t buf_sz;
+};
+
 struct xlti_ctx {
 /* state management */
 	enum view_mode current, last;
@@ -52,75 +94,85 @@ struct xlti_ctx {
 	size_t count, found;
 	struct scanres* items;
 
-/* previous results for dumping / saving */
-	struct {
-		uint8_t* raw, (* orig);
-		size_t raw_sz, orig_sz, ctr;
-		uint64_t last_ipos, last_pos;
-		int last_state;
-		size_t scalew, scaleh, w, h;
-		int ind;
-	} decoded;
+/* currently presented result, never evicted, used for dumping / saving */
+	struct decoded* shown;
+	size_t dump_ctr;
 
 /* metadata- needed to hint what was decoded */
 	int over_state;
 	size_t over_pos, over_count;
+
+/* decoding runs in [worker] so the session thread never blocks on stbi,
+ * [lock] protects the job slot and the cache */
+	struct arcan_shmif_cont* out;
+	pthread_t worker;
+	bool worker_alive, shutdown;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+/* only the latest request is kept, [busy] is the one being decoded */
+	struct decode_job job;
+	bool busy;
+	uint64_t busy_ipos;
+
+	struct decoded* cache;
+	size_t cache_sz;
+	uint64_t clock;
+	const char* reason;
 };
 
+/*
+ * The signatures come from the image entries in detect_sigs so that the
+ * translator and the batch scanner always agree, they are compiled into one
+ * matcher on startup. [formats] adds how a hit is drawn and saved, an image
+ * signature without an entry there is still listed but never decoded.
+ */
 struct magic {
-	char ident[16];
-	char ext[4];
-	uint8_t buf[10];
+	const struct detect_sig* sig;
+	const char* ext;
 	shmif_pixel col;
-	size_t used;
 /* only useful for LIST mode to hint something was found but that
  * there's not currently any decoder available */
 	bool decodable;
 };
 
-struct magic magic[] = {
+/* the formats there is a decoder for, by detect_sig ident */
+static const struct {
+	const char* ident;
+	const char* ext;
+	shmif_pixel col;
+} formats[] = {
 	{
 		.ident = "GIF87",
 		.ext = "gif",
-		.buf = {0x47, 0x49, 0x46, 0x38, 0x37, 0x61},
-		.used = 6,
-		.col = SHMIF_RGBA(0xff, 0xff, 0x00, 0xff),
-		.decodable = true
+		.col = SHMIF_RGBA(0xff, 0xff, 0x00, 0xff)
 	},
 	{
 		.ident = "GIF89",
 		.ext = "gif",
-		.buf = {0x47, 0x49, 0x46, 0x38, 0x39, 0x61},
-		.used = 6,
-		.col = SHMIF_RGBA(0xaa, 0xaa, 0x00, 0xff),
-		.decodable = true
+		.col = SHMIF_RGBA(0xaa, 0xaa, 0x00, 0xff)
 	},
 	{
 		.ident = "PNG",
 		.ext = "png",
-		.buf = {0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a},
-		.used = 8,
-		.col = SHMIF_RGBA(0x00, 0xff, 0xff, 0xff),
-		.decodable = true
+		.col = SHMIF_RGBA(0x00, 0xff, 0xff, 0xff)
 	},
 	{
 		.ident = "JPEG",
 		.ext = "jpg",
-		.buf = {0xff, 0xd8},
-		.used = 2,
-		.col = SHMIF_RGBA(0xff, 0x00, 0xff, 0xff),
-		.decodable = true
+		.col = SHMIF_RGBA(0xff, 0x00, 0xff, 0xff)
 	},
 	{
 		.ident = "BMP",
 		.ext = "bmp",
-		.buf = {0x42, 0x4d},
-		.used = 2,
-		.col = SHMIF_RGBA(0xff, 0xaa, 0x66, 0xff),
-		.decodable = true
+		.col = SHMIF_RGBA(0xff, 0xaa, 0x66, 0xff)
 	}
 };
 
+#define MAGIC_MAX 16
+static struct magic magic[MAGIC_MAX];
+static size_t n_magic;
+
 static void dump(
 	const char* magic, uint8_t* buf, size_t buf_sz, size_t* ctr, bool raw)
 {
@@ -159,17 +211,20 @@ static bool input(struct arcan_shmif_cont* out, arcan_event* ev)
 		ctx->current = VIEW_LIST;
 	}
 	else if (strcmp(ev->io.label, "r") == 0){
-		if (ctx->current == VIEW_AUTO && ctx->decoded.raw)
-			dump("rgba",
-				ctx->decoded.raw, ctx->decoded.raw_sz, &ctx->decoded.ctr, true);
+		struct decoded* dec = ctx->shown;
+		if (ctx->current == VIEW_AUTO && dec && dec->raw){
+			dump("rgba", dec->raw, dec->w * dec->h * 4, &ctx->dump_ctr, true);
 			message(out, "dumped decoded raw");
+		}
 		return false;
 	}
 	else if (strcmp(ev->io.label, "d") == 0){
-		if (ctx->current == VIEW_AUTO && ctx->decoded.orig)
-			dump(magic[ctx->decoded.ind].ext,
-			ctx->decoded.orig, ctx->decoded.orig_sz, &ctx->decoded.ctr, false);
+		struct decoded* dec = ctx->shown;
+		if (ctx->current == VIEW_AUTO && dec && dec->orig){
+			dump(magic[dec->magic].ext,
+				dec->orig, dec->src_sz, &ctx->dump_ctr, false);
 			message(out, "dumped encoded original");
+		}
 		return false;
 	}
 	else
@@ -179,35 +234,96 @@ static bool input(struct arcan_shmif_cont* out, arcan_event* ev)
 	return true;
 }
 
+/* built from [magic] on startup, shared by every scan */
+static struct ptn_match* matcher;
+
+static bool build_matcher()
+{
+	uint8_t* bufs[MAGIC_MAX];
+	size_t sizes[MAGIC_MAX];
+	size_t n_formats = sizeof(formats) / sizeof(formats[0]);
+
+	for (size_t i = 0; i < detect_sigs_n && n_magic < MAGIC_MAX; i++){
+		const struct detect_sig* sig = &detect_sigs[i];
+		if (sig->kind != DETECT_IMAGE)
+			continue;
+
+		struct magic* m = &magic[n_magic];
+		*m = (struct magic){
+			.sig = sig,
+			.ext = "bin",
+			.col = SHMIF_RGBA(0x80, 0x80, 0x80, 0xff)
+		};
+
+		for (size_t j = 0; j < n_formats; j++)
+			if (strcmp(formats[j].ident, sig->ident) == 0){
+				m->ext = formats[j].ext;
+				m->col = formats[j].col;
+				m->decodable = true;
+			}
+
+		bufs[n_magic] = (uint8_t*) sig->buf;
+		sizes[n_magic] = sig->used;
+		n_magic++;
+	}
+
+	matcher = ptn_match_build(bufs, sizes, n_magic);
+	return matcher != NULL;
+}
+
+struct scan_state {
+	const uint8_t* buf;
+	size_t buf_sz;
+	size_t base;
+	struct scanres* out;
+	size_t rc, lim;
+};
+
+static void scan_hit(void* tag, size_t ind, size_t end)
+{
+	struct scan_state* st = tag;
+	const struct detect_sig* sig = magic[ind].sig;
+	size_t ofs = st->base + end + 1 - sig->used;
+
+	if (st->rc >= st->lim)
+		return;
+
+	if (sig->valid && !sig->valid(&st->buf[ofs], st->buf_sz - ofs))
+		return;
+
+	st->out[st->rc++] = (struct scanres){
+		.magic = ind,
+		.ofs = ofs
+	};
+}
+
+/* large enough to amortize the call, small enough to stop soon once full */
+#define SCAN_CHUNK 65536
+
 /*
  * Populate out with up to out_lim members where each member specify
  * what type was found and the offset in buf it was found. Returns the
- * number of elements that were set.
+ * number of elements that were set. Every signature is matched in one pass
+ * over [buf] and only candidates that pass validation are returned, in the
+ * order their signatures end.
  */
 static size_t scan(uint8_t* buf, size_t buf_sz,
 	struct scanres* out, size_t out_lim)
 {
-	size_t magic_count = sizeof(magic) / sizeof(magic[0]);
-	size_t oc[sizeof(magic)/sizeof(magic[0])] = {0};
-	size_t rc = 0;
-
-	for (size_t i = 0; i < buf_sz && rc < out_lim-1; i++)
-		for (size_t j = 0; j < magic_count && rc < out_lim-1; j++)
-			if (buf[i] == magic[j].buf[ oc[j] ]){
-				oc[j]++;
-				if (oc[j] >= magic[j].used){
-					out->magic = j;
-					out->ofs = i-(magic[j].used-1);
-					out++;
-					rc++;
-/* possibly validate / hint by decoding header as well */
-					oc[j] = 0;
-				}
-			}
-			else
-				oc[j] = 0;
+	struct scan_state st = {
+		.buf = buf,
+		.buf_sz = buf_sz,
+		.out = out,
+		.lim = out_lim ? out_lim - 1 : 0
+	};
+	uint32_t state = 0;
+
+	for (; st.base < buf_sz && st.rc < st.lim; st.base += SCAN_CHUNK){
+		size_t nb = buf_sz - st.base > SCAN_CHUNK ? SCAN_CHUNK : buf_sz - st.base;
+		ptn_match_scan(matcher, &state, &buf[st.base], nb, scan_hit, &st);
+	}
 
-	return rc;
+	return st.rc;
 }
 
 /*
@@ -227,7 +343,7 @@ static bool over_list(struct arcan_shmif_cont* over,
 		size_t x1, y1, x2, y2;
 		xlt_ofs_coord(sess, ctx->items[i].ofs, &x1, &y1);
 		xlt_ofs_coord(sess, ctx->items[i].ofs +
-			magic[ctx->items[i].magic].used, &x2, &y2);
+			magic[ctx->items[i].magic].sig->used, &x2, &y2);
 
 		shmif_pixel col = magic[ctx->items[i].magic].col;
 
@@ -358,77 +474,307 @@ static stbi_io_callbacks stbi_cb = {
 	.eof = stbi_cb_eof
 };
 
-static bool process_decode(struct xlti_ctx* ctx, struct arcan_shmif_cont* out,
-	bool newdata, size_t y, uint8_t* buf, size_t buf_sz, uint64_t pos,
-	struct scanres* item)
+static void free_decoded(struct decoded* dec)
 {
+	free(dec->raw);
+	free(dec->orig);
+	free(dec->scaled);
+	free(dec);
+}
+
+/* caller holds lock */
+static struct decoded* cache_lookup(struct xlti_ctx* ctx,
+	uint64_t ipos, const uint8_t* buf, size_t buf_sz)
+{
+	for (struct decoded* dec = ctx->cache; dec; dec = dec->next){
+		if (dec->ipos != ipos || dec->src_sz > buf_sz)
+			continue;
+
+		if (dec->hash == xlt_hash(buf, dec->src_sz)){
+			dec->used = ++ctx->clock;
+			return dec;
+		}
+	}
+
+	return NULL;
+}
+
+/* caller holds lock, drop least recently used until within budget */
+static void cache_trim(struct xlti_ctx* ctx, struct decoded* keep)
+{
+	while (ctx->cache_sz > CACHE_BUDGET){
+		struct decoded** victim = NULL;
+
+		for (struct decoded** cur = &ctx->cache; *cur; cur = &(*cur)->next){
+			if (*cur == keep || *cur == ctx->shown)
+				continue;
+			if (!victim || (*cur)->used < (*victim)->used)
+				victim = cur;
+		}
+
+		if (!victim)
+			return;
+
+		struct decoded* dec = *victim;
+		*victim = dec->next;
+		ctx->cache_sz -= dec->cost;
+		free_decoded(dec);
+	}
+}
+
+/* caller holds lock */
+static void cache_cost(struct xlti_ctx* ctx, struct decoded* dec, size_t cost)
+{
+	ctx->cache_sz = ctx->cache_sz - dec->cost + cost;
+	dec->cost = cost;
+	cache_trim(ctx, dec);
+}
+
+/* runs without the lock held, takes ownership of the job buffer */
+static struct decoded* decode(struct decode_job* job)
+{
+	struct decoded* dec = malloc(sizeof(struct decoded));
+	if (!dec){
+		free(job->buf);
+		return NULL;
+	}
+
+	memset(dec, '\0', sizeof(struct decoded));
+	dec->ipos = job->ipos;
+	dec->magic = job->magic;
+
 	int w, h, f;
 	struct stbi_inf inf = {
-		.buf = buf + item->ofs,
-		.buf_sz = buf_sz - item->ofs
+		.buf = job->buf,
+		.buf_sz = job->buf_sz
 	};
 
-/* don't decode unless necessary */
+	dec->raw = stbi_load_from_callbacks(&stbi_cb, &inf, &w, &h, &f, 4);
+	dec->src_sz = inf.fpos > magic[job->magic].sig->used ?
+		inf.fpos : magic[job->magic].sig->used;
+	dec->hash = xlt_hash(job->buf, dec->src_sz);
 
-	uint8_t* res;
-	res = stbi_load_from_callbacks(&stbi_cb, &inf, &w, &h, &f, 4);
-	ctx->over_pos = pos + item->ofs;
-	ctx->over_count = inf.fpos;
+	if (!dec->raw){
+		dec->reason = stbi_failure_reason();
+		free(job->buf);
+		return dec;
+	}
 
-	if (res){
-		ctx->over_state = 1;
-		ctx->decoded.last_ipos = pos + item->ofs;
-		ctx->decoded.last_pos = pos;
-		char scratch[64];
+	dec->w = w;
+	dec->h = h;
 
 /* sanity check size to prevent bomb etc. */
-		bool suspect = (w * h) > (8192 * 8192);
-		snprintf(scratch, 64, "@%"PRIu64": %s %s [%d * %d] @ factor: %.2f%%",
-			pos + item->ofs, suspect ? "suspicious" : "decoded",
-			magic[item->magic].ident, w, h, (float)(w*h*4)/(float)ctx->over_count
-		);
-		draw_text(out, scratch, (fontw+1)*2, y, SHMIF_RGBA(0x00,0xff,0x00,0xff));
-		y+=fonth+2;
-
-		if (suspect)
-			return true;
-
-		draw_text(out, "(d) save original (r) save raw (rgba)",
-			(fontw+1)*2, y, SHMIF_RGBA(0xff, 0xff, 0x00, 0xff));
-		y+=fonth+2;
-
-		if (ctx->decoded.raw){
-			free(ctx->decoded.raw);
-			free(ctx->decoded.orig);
-		}
+	if ((size_t)w * h > (8192 * 8192)){
+		dec->suspect = true;
+		free(dec->raw);
+		dec->raw = NULL;
+		free(job->buf);
+		return dec;
+	}
 
 /* maintain a copy if the user wants to save */
-		ctx->decoded.raw_sz = w * h * 4;
-		ctx->decoded.raw = res;
-		ctx->decoded.w = w;
-		ctx->decoded.h = h;
-		ctx->decoded.orig = malloc(ctx->over_count);
-		ctx->decoded.orig_sz = ctx->over_count;
-		memcpy(ctx->decoded.orig, buf + item->ofs, ctx->over_count);
-
-		ctx->decoded.scalew = out->w;
-		ctx->decoded.scaleh = out->h;
-		stbir_resize_uint8(res, w, h, 0,
-			(uint8_t*) &out->vidp[y * out->pitch], out->w, out->h-y, 0, 4);
+	dec->orig = realloc(job->buf, dec->src_sz);
+	if (!dec->orig)
+		dec->orig = job->buf;
+
+	return dec;
+}
+
+static void* decode_worker(void* arg)
+{
+	struct xlti_ctx* ctx = arg;
+
+	pthread_mutex_lock(&ctx->lock);
+	for(;;){
+		while (!ctx->job.buf && !ctx->shutdown)
+			pthread_cond_wait(&ctx->cond, &ctx->lock);
+
+		if (ctx->shutdown)
+			break;
+
+		struct decode_job job = ctx->job;
+		ctx->job.buf = NULL;
+		ctx->busy = true;
+		ctx->busy_ipos = job.ipos;
+		pthread_mutex_unlock(&ctx->lock);
+
+		struct decoded* dec = decode(&job);
+
+		pthread_mutex_lock(&ctx->lock);
+		ctx->busy = false;
+		if (!dec)
+			continue;
+
+		dec->next = ctx->cache;
+		ctx->cache = dec;
+		dec->used = ++ctx->clock;
+		if (dec->reason)
+			ctx->reason = dec->reason;
+		cache_cost(ctx, dec, sizeof(struct decoded) +
+			(dec->orig ? dec->src_sz : 0) + (dec->raw ? dec->w * dec->h * 4 : 0));
+
+		xlt_wake(ctx->out);
+	}
+	pthread_mutex_unlock(&ctx->lock);
 
+	return NULL;
+}
+
+/* caller holds lock, replaces any request that hasn't been picked up yet */
+static bool post_job(struct xlti_ctx* ctx,
+	uint64_t ipos, uint8_t mind, const uint8_t* buf, size_t buf_sz)
+{
+	if ((ctx->busy && ctx->busy_ipos == ipos) ||
+		(ctx->job.buf && ctx->job.ipos == ipos))
 		return true;
+
+	if (!ctx->worker_alive){
+		if (0 != pthread_create(&ctx->worker, NULL, decode_worker, ctx))
+			return false;
+		ctx->worker_alive = true;
+	}
+
+/* the window can change under us once populate returns, so the
+ * worker gets its own copy */
+	uint8_t* copy = malloc(buf_sz);
+	if (!copy)
+		return false;
+	memcpy(copy, buf, buf_sz);
+
+	free(ctx->job.buf);
+	ctx->job = (struct decode_job){
+		.ipos = ipos,
+		.magic = mind,
+		.buf = copy,
+		.buf_sz = buf_sz
+	};
+	pthread_cond_signal(&ctx->cond);
+
+	return true;
+}
+
+static void stop_worker(struct xlti_ctx* ctx)
+{
+	if (ctx->worker_alive){
+		pthread_mutex_lock(&ctx->lock);
+		ctx->shutdown = true;
+		pthread_cond_signal(&ctx->cond);
+		pthread_mutex_unlock(&ctx->lock);
+		pthread_join(ctx->worker, NULL);
+	}
+
+	free(ctx->job.buf);
+	while (ctx->cache){
+		struct decoded* dec = ctx->cache;
+		ctx->cache = dec->next;
+		free_decoded(dec);
+	}
+
+	pthread_mutex_destroy(&ctx->lock);
+	pthread_cond_destroy(&ctx->cond);
+}
+
+static void draw_decoded(struct xlti_ctx* ctx,
+	struct arcan_shmif_cont* out, size_t y, struct decoded* dec)
+{
+	size_t sh = out->h - y;
+	size_t stride = out->pitch * sizeof(shmif_pixel);
+	uint8_t* dst = (uint8_t*) &out->vidp[y * out->pitch];
+
+	if (!dec->scaled || dec->scalew != out->w || dec->scaleh != out->h){
+		free(dec->scaled);
+		dec->scaled = malloc(out->w * sh * 4);
+		size_t scaled_cost = dec->scaled ? out->w * sh * 4 : 0;
+
+		pthread_mutex_lock(&ctx->lock);
+		cache_cost(ctx, dec, dec->cost - dec->scaled_cost + scaled_cost);
+		dec->scaled_cost = scaled_cost;
+		pthread_mutex_unlock(&ctx->lock);
+
+		if (!dec->scaled){
+			stbir_resize_uint8(dec->raw,
+				dec->w, dec->h, 0, dst, out->w, sh, stride, 4);
+			return;
+		}
+		dec->scalew = out->w;
+		dec->scaleh = out->h;
+		stbir_resize_uint8(dec->raw, dec->w, dec->h, 0,
+			dec->scaled, out->w, sh, 0, 4);
 	}
 
-	else{
+	for (size_t row = 0; row < sh; row++)
+		memcpy(&dst[row * stride], &dec->scaled[row * out->w * 4], out->w * 4);
+}
+
+static bool process_decode(struct xlti_ctx* ctx, struct arcan_shmif_cont* out,
+	bool newdata, size_t y, uint8_t* buf, size_t buf_sz, uint64_t pos,
+	struct scanres* item)
+{
+	uint64_t ipos = pos + item->ofs;
+	char scratch[64];
+
+	if (!magic[item->magic].decodable){
+		snprintf(scratch, 64, "@%"PRIu64": %s, no decoder", ipos,
+			magic[item->magic].sig->ident);
+		draw_text(out, scratch, (fontw+1)*2, y, SHMIF_RGBA(0xff, 0x00, 0x00, 0xff));
+		return false;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	struct decoded* dec =
+		cache_lookup(ctx, ipos, buf + item->ofs, buf_sz - item->ofs);
+
+/* not seen before, hand it to the worker and come back when it's done */
+	if (!dec){
+		bool queued =
+			post_job(ctx, ipos, item->magic, buf + item->ofs, buf_sz - item->ofs);
+		ctx->shown = NULL;
+		pthread_mutex_unlock(&ctx->lock);
+
+		ctx->over_state = 0;
+		ctx->over_pos = ipos;
+		ctx->over_count = 0;
+		snprintf(scratch, 64, "@%"PRIu64": %s %s", ipos,
+			queued ? "decoding" : "couldn't queue", magic[item->magic].sig->ident);
+		draw_text(out, scratch, (fontw+1)*2, y, queued ?
+			SHMIF_RGBA(0xff, 0xff, 0x00, 0xff) : SHMIF_RGBA(0xff, 0x00, 0x00, 0xff));
+		return queued;
+	}
+
+	ctx->shown = dec;
+	pthread_mutex_unlock(&ctx->lock);
+
+	ctx->over_pos = ipos;
+	ctx->over_count = dec->src_sz;
+
+	if (!dec->raw && !dec->suspect){
 		ctx->over_state = -1;
 		draw_text(out, "Decoding failed",
 			(fontw+1)*2, y, SHMIF_RGBA(0xff, 0x00, 0x00, 0xff));
-		const char* msg = stbi_failure_reason();
-		if (msg)
-			draw_text(out, msg, (fontw+1)*2, y+fonth+2,
+		if (dec->reason)
+			draw_text(out, dec->reason, (fontw+1)*2, y+fonth+2,
 				SHMIF_RGBA(0xff, 0x00, 0x00, 0xff));
 		return false;
 	}
+
+	ctx->over_state = 1;
+	snprintf(scratch, 64, "@%"PRIu64": %s %s [%zu * %zu] @ factor: %.2f%%",
+		ipos, dec->suspect ? "suspicious" : "decoded",
+		magic[dec->magic].sig->ident, dec->w, dec->h,
+		(float)(dec->w*dec->h*4)/(float)ctx->over_count
+	);
+	draw_text(out, scratch, (fontw+1)*2, y, SHMIF_RGBA(0x00,0xff,0x00,0xff));
+	y+=fonth+2;
+
+	if (dec->suspect)
+		return true;
+
+	draw_text(out, "(d) save original (r) save raw (rgba)",
+		(fontw+1)*2, y, SHMIF_RGBA(0xff, 0xff, 0x00, 0xff));
+	y+=fonth+2;
+
+	draw_decoded(ctx, out, y, dec);
+	return true;
 }
 
 static bool populate(bool newdata, struct arcan_shmif_cont* in,
@@ -439,9 +785,8 @@ static bool populate(bool newdata, struct arcan_shmif_cont* in,
 
 	if (!buf){
 		if (ctx){
+			stop_worker(ctx);
 			free(ctx->items);
-			free(ctx->decoded.raw);
-			free(ctx->decoded.orig);
 			ctx->items = NULL;
 		}
 		free(out->user);
@@ -454,12 +799,15 @@ static bool populate(bool newdata, struct arcan_shmif_cont* in,
 		memset(ctx, '\0', sizeof(struct xlti_ctx));
 		ctx->current = VIEW_LIST;
 		ctx->found = -1;
+		ctx->out = out;
+		pthread_mutex_init(&ctx->lock, NULL);
+		pthread_cond_init(&ctx->cond, NULL);
 		goto alloc_nv;
 	}
 
 	if (!newdata && !ctx->invalidated && nr == 0){
-		if (!(ctx->decoded.scalew != out->w &&
-			ctx->decoded.scaleh != out->h && ctx->decoded.raw))
+		if (!(ctx->shown && ctx->shown->raw &&
+			ctx->shown->scalew != out->w && ctx->shown->scaleh != out->h))
 			return false;
 	}
 	ctx->invalidated = false;
@@ -485,8 +833,8 @@ alloc_nv:
 			for (size_t i = 0; i < ctx->found; i++){
 				char scratch[32];
 				struct magic* m = &magic[ctx->items[i].magic];
-				size_t chw = strlen(m->ident);
-				draw_text(out, m->ident, (fontw+1)*2, y+i*(fonth), m->col);
+				size_t chw = strlen(m->sig->ident);
+				draw_text(out, m->sig->ident, (fontw+1)*2, y+i*(fonth), m->col);
 				snprintf(scratch, 32, "@ %zu", ctx->items[i].ofs);
 				draw_text(out, scratch,
 					(chw+3)*(fontw+1), y + i * (fonth + 1), SHMIF_RGBA(0x00,0xff,0x00,0xff));
@@ -509,7 +857,9 @@ alloc_nv:
 		else{
 			draw_text(out, "No supported formats found",
 				(fontw+1)*2, y, SHMIF_RGBA(0xff, 0x00, 0x00, 0xff));
-			const char* reason = stbi_failure_reason();
+			pthread_mutex_lock(&ctx->lock);
+			const char* reason = ctx->reason;
+			pthread_mutex_unlock(&ctx->lock);
 			draw_text(out, reason ? reason : "Unknown Failure Reason",
 				(fontw+1)*2, y+fonth+2, SHMIF_RGBA(0xff, 0x00, 0x00, 0xff));
 		}
@@ -532,6 +882,12 @@ int main(int argc, char** argv)
 	if (!ctx)
 		return EXIT_FAILURE;
 
+	if (!build_matcher()){
+		fprintf(stderr, "couldn't build signature matcher\n");
+		xlt_free(&ctx);
+		return EXIT_FAILURE;
+	}
+
 	raw_prefix = strdup("imgraw_");
 	decode_prefix = strdup("imgdec_");
 
@@ -540,6 +896,7 @@ int main(int argc, char** argv)
 	xlt_free(&ctx);
 	free(raw_prefix);
 	free(decode_prefix);
+	ptn_match_free(&matcher);
 
 	return EXIT_SUCCESS;
 }
@@ -8,13 +8,25 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <stddef.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 
 #include <arcan_shmif.h>
 #include "libsenseye.h"
+#include "stagetime.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 /*
  * tracks basic/default setup that is copied to every new
- * session that is spawned off in its own thread or process.
+ * session that is handed to the scheduler (see sched_add).
  *
  * sess is 'pending' while waiting for the subsegments that
  * are planned to populate them
@@ -34,9 +46,21 @@ struct xlt_context {
 	xlt_input overlay_input;
 };
 
+enum sess_state {
+	SESS_IDLE = 0,
+	SESS_QUEUED,
+	SESS_RUNNING
+};
+
 struct xlt_session {
 	uint8_t* buf;
 
+/* what is handed to the translator, either [buf] or, for XLT_INPLACE with
+ * 4 byte packing, the pinned input frame itself until release_frame, and
+ * whether the input frame still has to be handed back */
+	uint8_t* view;
+	bool pinned, consumed, held;
+
 	uint64_t vpts;
 	size_t buf_sz;
 	size_t unpack_sz;
@@ -62,9 +86,28 @@ struct xlt_session {
 		size_t width, height;
 	} pending_update;
 
+/* requested populate pass, merged until it can be run (commit_update) */
+	struct {
+		bool dirty, newdata, deferred;
+		uint64_t retry_at;
+	} update;
+
+/* written to by xlt_wake from other threads, polled along with [in] */
+	int wake[2];
+	bool got_wake;
+
+/* owned by the scheduler, protected by sched.lock */
+	enum sess_state state;
+	bool dead, olay_lost;
+	struct xlt_session* next;
+	struct xlt_session* next_queued;
+
 	struct arcan_shmif_cont in;
 	struct arcan_shmif_cont olay;
 	struct arcan_shmif_cont out;
+
+/* unpack / populate / signal costs, exported on [out] */
+	struct stage_timer stages;
 };
 
 /*
@@ -78,6 +121,60 @@ static bool flush_output_events(struct xlt_session* sess)
 	return false;
 }
 
+/*
+ * unpack the low [pack_sz] (1 or 3) bytes of every pixel, matching the
+ * byte order of the other packing / unpacking stages
+ */
+static void unpack_pixels(
+	uint8_t* outb, const shmif_pixel* px, size_t n, size_t pack_sz)
+{
+	size_t i = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	if (pack_sz == 1){
+#ifdef __SSE2__
+/* mask out the low byte, then narrow 32 -> 16 -> 8 */
+		const __m128i mask = _mm_set1_epi32(0xff);
+		for (; i + 16 <= n; i += 16, outb += 16){
+			const __m128i* in = (const __m128i*) &px[i];
+			__m128i a = _mm_and_si128(_mm_loadu_si128(&in[0]), mask);
+			__m128i b = _mm_and_si128(_mm_loadu_si128(&in[1]), mask);
+			__m128i c = _mm_and_si128(_mm_loadu_si128(&in[2]), mask);
+			__m128i d = _mm_and_si128(_mm_loadu_si128(&in[3]), mask);
+			_mm_storeu_si128((__m128i*) outb, _mm_packus_epi16(
+				_mm_packs_epi32(a, b), _mm_packs_epi32(c, d)));
+		}
+#elif defined(__ARM_NEON)
+		for (; i + 16 <= n; i += 16, outb += 16)
+			vst1q_u8(outb, vld4q_u8((const uint8_t*) &px[i]).val[0]);
+#endif
+	}
+	else {
+#ifdef __ARM_NEON
+		for (; i + 16 <= n; i += 16, outb += 48){
+			uint8x16x4_t v = vld4q_u8((const uint8_t*) &px[i]);
+			uint8x16x3_t o = {{v.val[0], v.val[1], v.val[2]}};
+			vst3q_u8(outb, o);
+		}
+#else
+/* overlapping 4 byte stores, the next pixel overwrites the 4th byte */
+		for (; i + 1 < n; i++, outb += 3)
+			memcpy(outb, &px[i], 4);
+#endif
+	}
+#endif
+
+	for (; i < n; i++){
+		shmif_pixel cp = px[i];
+		*outb++ = (cp & 0x000000ff);
+		if (pack_sz == 1)
+			continue;
+
+		*outb++ = (cp & 0x0000ff00) >>  8;
+		*outb++ = (cp & 0x00ff0000) >> 16;
+	}
+}
+
 /*
  * recall that this does not compensate for mapping mode,
  * so data may appear to be "wrong" if the underlying mapping
@@ -94,22 +191,46 @@ static void populate(struct xlt_session* s)
 /* we reset this as the likely interested offset must have changed */
 	s->base_ofs = 0;
 
+	s->held = true;
+	s->consumed = false;
+
+/* read-only translators can work on the frame directly, it is kept until
+ * the current batch of events has been processed, see release_frame */
+	if ((s->flags & XLT_INPLACE) && s->pack_sz == 4){
+		s->view = (uint8_t*) s->in.vidp;
+		s->pinned = true;
+		return;
+	}
+
+	s->view = s->buf;
+
 /* maintain a copy to be able to release vidp quicker, making room
  * for a new frame */
+	uint64_t ts = stage_begin(&s->stages);
 	if (s->pack_sz == 4)
 		memcpy(s->buf, s->in.vidp, s->unpack_sz);
-	else{
-		uint8_t* outb = s->buf;
+	else
+		unpack_pixels(s->buf, s->in.vidp,
+			s->in.addr->w * s->in.addr->h, s->pack_sz);
+	stage_end(&s->stages, STAGE_DATA, ts);
+}
 
-		for (size_t i = 0; i < s->in.addr->w * s->in.addr->h; i++){
-			shmif_pixel cp = s->in.vidp[i];
-			*outb++ = (cp & 0x000000ff);
-			if (s->pack_sz == 1)
-				continue;
+/*
+ * keep the pinned frame for later redraws (input, offset changes) and
+ * hand it back, this is done after the translator has already produced
+ * its output so the copy is no longer on the path to a new frame.
+ */
+static void release_frame(struct xlt_session* s)
+{
+	if (s->pinned){
+		memcpy(s->buf, s->in.vidp, s->unpack_sz);
+		s->view = s->buf;
+		s->pinned = false;
+	}
 
-			*outb++ = (cp & 0x0000ff00) >>  8;
-			*outb++ = (cp & 0x00ff0000) >> 16;
-		}
+	if (s->held && s->consumed){
+		s->in.addr->vready = false;
+		s->held = false;
 	}
 }
 
@@ -117,7 +238,7 @@ static inline void update_overlay(struct xlt_session* sess, bool nd)
 {
 	if (sess->overlay && sess->olay.addr && sess->overlay(nd, &sess->in,
 		sess->zoom_range, &sess->olay, &sess->out,
-		sess->vpts, sess->unpack_sz, sess->buf, sess))
+		sess->vpts, sess->unpack_sz, sess->view, sess))
 		arcan_shmif_signal(&sess->olay, SHMIF_SIGVID);
 }
 
@@ -137,18 +258,66 @@ void xlt_ofs_coord(struct xlt_session* sess,
 	}
 }
 
+static uint64_t now_ms()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * only marks the output as outdated, several requests while processing one
+ * batch of events (or while the last frame is still with the server) turn
+ * into a single populate pass in commit_update
+ */
 static inline void update_buffers(
 	struct xlt_session* sess, bool newdata)
 {
-	if (sess->populate(newdata, &sess->in, &sess->out,
+	sess->update.dirty = true;
+	sess->update.newdata |= newdata;
+}
+
+#define XLT_RETRY_MS 4
+
+static void commit_update(struct xlt_session* sess)
+{
+	if (!sess->update.dirty)
+		return;
+
+	if (!sess->view){
+		sess->update.dirty = sess->update.newdata = false;
+		return;
+	}
+
+/* server hasn't picked up the last frame, drawing now would tear and
+ * blocking would hold up a worker, so come back later (see sched_dispatch)
+ * and let the input go in the meantime, the copy in [buf] is what counts */
+	if (sess->out.addr->vready){
+		sess->update.deferred = true;
+		sess->update.retry_at = now_ms() + XLT_RETRY_MS;
+		sess->consumed = true;
+		return;
+	}
+
+	bool newdata = sess->update.newdata;
+	sess->update.dirty = sess->update.newdata = sess->update.deferred = false;
+
+	uint64_t ts = stage_begin(&sess->stages);
+	bool drawn = sess->populate(newdata, &sess->in, &sess->out,
 		sess->vpts + sess->base_ofs, sess->unpack_sz - sess->base_ofs,
-		sess->buf + sess->base_ofs)){
+		sess->view + sess->base_ofs);
+	stage_end(&sess->stages, STAGE_POPULATE, ts);
 
+	if (drawn){
 		update_overlay(sess, newdata);
 
-		arcan_shmif_signal(&sess->out, SHMIF_SIGVID);
-		sess->in.addr->vready = false;
+		ts = stage_begin(&sess->stages);
+		arcan_shmif_signal(&sess->out, SHMIF_SIGVID | SHMIF_SIGBLK_NONE);
+		stage_end(&sess->stages, STAGE_SIGNAL, ts);
+		sess->consumed = true;
 	}
+
+	stage_export(&sess->stages, &sess->out);
 }
 
 /*
@@ -170,9 +339,18 @@ static void event_commit(struct xlt_session* s)
 		else{
 			s->base_ofs = s->pending_input.ofs;
 			update_buffers(s, false);
+			s->got_wake = false;
 		}
 		s->pending_input.got_input = false;
 	}
+
+	if (s->got_wake){
+		s->got_wake = false;
+		if (s->view)
+			update_buffers(s, false);
+	}
+
+	commit_update(s);
 }
 
 static void overlay_event(struct xlt_session* sess)
@@ -245,7 +423,7 @@ static bool dispatch_event(struct xlt_session* sess, arcan_event* ev)
 /* use to set local window offset, or hint of global position? */
 		}
 		else if (ev->tgt.kind == TARGET_COMMAND_STEPFRAME){
-			if (ev->tgt.ioevs[0].iv > 0 || sess->buf == NULL){
+			if (ev->tgt.ioevs[0].iv > 0 || sess->view == NULL){
 				sess->vpts = sess->in.addr->vpts;
 				populate(sess);
 				update_buffers(sess, true);
@@ -277,10 +455,98 @@ static bool dispatch_event(struct xlt_session* sess, arcan_event* ev)
 	return true;
 }
 
-static void* process(void* inarg)
+void xlt_wake(struct arcan_shmif_cont* out)
+{
+	struct xlt_session* sess = (struct xlt_session*)
+		((uint8_t*) out - offsetof(struct xlt_session, out));
+
+/* non-blocking, a full pipe means there is already a wakeup pending */
+	if (sess->wake[1] != -1){
+		uint8_t ch = 1;
+		while (-1 == write(sess->wake[1], &ch, 1) && errno == EINTR);
+	}
+}
+
+uint64_t xlt_hash(const uint8_t* buf, size_t sz)
+{
+	uint64_t h = 0xcbf29ce484222325ULL ^ sz;
+	size_t i = 0;
+
+	for (; i + 8 <= sz; i += 8){
+		uint64_t v;
+		memcpy(&v, &buf[i], 8);
+		h = (h ^ v) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+
+	for (; i < sz; i++)
+		h = (h ^ buf[i]) * 0x100000001b3ULL;
+
+	h ^= h >> 32;
+	return h * 0x9e3779b97f4a7c15ULL;
+}
+
+static int open_wake(struct xlt_session* sess)
+{
+	if (-1 == pipe(sess->wake)){
+		sess->wake[0] = sess->wake[1] = -1;
+		return -1;
+	}
+
+	for (size_t i = 0; i < 2; i++){
+		fcntl(sess->wake[i], F_SETFD, FD_CLOEXEC);
+		fcntl(sess->wake[i], F_SETFL, O_NONBLOCK);
+	}
+
+	return 0;
+}
+
+/*
+ * One pass over everything that is pending for a session, run on one of
+ * the scheduler workers. Returns false when the session should end.
+ */
+static bool session_step(struct xlt_session* sess)
 {
-	struct xlt_session* sess = inarg;
 	arcan_event ev;
+	int rc;
+
+	if (sess->dead)
+		return false;
+
+	if (sess->wake[0] != -1){
+		uint8_t buf[64];
+		while (read(sess->wake[0], buf, sizeof(buf)) > 0)
+			sess->got_wake = true;
+	}
+
+/* two phase flush so that some events that can come in piles,
+ * (input / displayhint / frames) only apply the latest one */
+	flush_output_events(sess);
+	while ((rc = arcan_shmif_poll(&sess->in, &ev)) > 0)
+		if (!dispatch_event(sess, &ev))
+			return false;
+
+	if (rc < 0)
+		return false;
+
+	if (sess->olay_lost){
+		arcan_shmif_drop(&sess->olay);
+		sess->olay_lost = false;
+	}
+
+	if (sess->olay.addr)
+		overlay_event(sess);
+
+	event_commit(sess);
+	release_frame(sess);
+	return true;
+}
+
+static void session_start(struct xlt_session* sess)
+{
+	arcan_event ev;
+
+	open_wake(sess);
 
 	if (sess->overlay){
 		ev.category = EVENT_EXTERNAL,
@@ -289,32 +555,268 @@ static void* process(void* inarg)
 		sprintf((char*)ev.ext.message.data, "OVERLAY");
 		arcan_shmif_enqueue(&sess->out, &ev);
 	}
+}
 
-/* two phase flush so that some events that can come in piles,
- * (input / displayhint) only apply the latest one */
-	while (arcan_shmif_wait(&sess->in, &ev)){
-		flush_output_events(sess);
-		if (!dispatch_event(sess, &ev))
-			goto end;
-
-		while(arcan_shmif_poll(&sess->in, &ev) != 0)
-			if (!dispatch_event(sess, &ev))
-				goto end;
-
-		if (sess->olay.addr)
-			overlay_event(sess);
-
-		event_commit(sess);
+static void session_end(struct xlt_session* sess)
+{
+/* let the translator release its state (and stop any threads that
+ * could still xlt_wake) before the session goes away */
+	sess->populate(false, &sess->in, &sess->out, 0, 0, NULL);
+	stage_summary(&sess->stages, stderr, "translator");
+
+	if (sess->wake[0] != -1){
+		close(sess->wake[0]);
+		close(sess->wake[1]);
 	}
 
-end:
 	arcan_shmif_drop(&sess->in);
 	arcan_shmif_drop(&sess->olay);
 	arcan_shmif_drop(&sess->out);
+	free(sess->buf);
+}
+
+/*
+ * Sessions don't get a thread each; one dispatcher thread polls the
+ * segments of all idle sessions and queues those with something to do,
+ * and a fixed pool of workers (one per core, at most XLT_MAXWORKERS) runs
+ * session_step on them. A session is only ever on one worker at a time,
+ * anything that arrives while it is queued or running is handled in the
+ * same pass.
+ */
+#define XLT_MAXWORKERS 8
+
+/* how long the dispatcher waits before trying again when it can't poll */
+#define XLT_BACKOFF_MS 10
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	bool running;
+	int ctl[2];
+
+	struct xlt_session* sessions;
+	size_t n_sessions;
+
+	struct xlt_session* queue_head;
+	struct xlt_session* queue_tail;
+	size_t n_workers;
+} sched = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.ctl = {-1, -1}
+};
+
+/* sched.lock is held */
+static void sched_queue(struct xlt_session* sess)
+{
+	sess->state = SESS_QUEUED;
+	sess->next_queued = NULL;
+
+	if (sched.queue_tail)
+		sched.queue_tail->next_queued = sess;
+	else
+		sched.queue_head = sess;
+
+	sched.queue_tail = sess;
+	pthread_cond_signal(&sched.wake);
+}
+
+/* have the dispatcher rebuild its set of descriptors */
+static void sched_notify()
+{
+	uint8_t ch = 1;
+	while (-1 == write(sched.ctl[1], &ch, 1) && errno == EINTR);
+}
+
+static void* sched_worker(void* arg)
+{
+	pthread_mutex_lock(&sched.lock);
+	for(;;){
+		while (!sched.queue_head)
+			pthread_cond_wait(&sched.wake, &sched.lock);
+
+		struct xlt_session* sess = sched.queue_head;
+		sched.queue_head = sess->next_queued;
+		if (!sched.queue_head)
+			sched.queue_tail = NULL;
+		sess->state = SESS_RUNNING;
+		pthread_mutex_unlock(&sched.lock);
+
+		bool alive = session_step(sess);
+		if (!alive)
+			session_end(sess);
+
+		pthread_mutex_lock(&sched.lock);
+		if (alive)
+			sess->state = SESS_IDLE;
+		else{
+			struct xlt_session** cur = &sched.sessions;
+			while (*cur != sess)
+				cur = &(*cur)->next;
+			*cur = sess->next;
+			sched.n_sessions--;
+			free(sess);
+		}
+		sched_notify();
+	}
+
+	return NULL;
+}
+
+static void* sched_dispatch(void* arg)
+{
+	struct pollfd* fds = NULL;
+	struct xlt_session** owner = NULL;
+	size_t cap = 0;
+	short pollev = POLLIN | POLLERR | POLLHUP | POLLNVAL;
+
+	for(;;){
+		pthread_mutex_lock(&sched.lock);
+		if (cap < 1 + 3 * sched.n_sessions){
+			size_t ncap = 1 + 3 * sched.n_sessions + 16;
+			struct pollfd* nfds = realloc(fds, sizeof(struct pollfd) * ncap);
+			if (nfds)
+				fds = nfds;
+			struct xlt_session** nown = realloc(owner, sizeof(void*) * ncap);
+			if (nown)
+				owner = nown;
+			if (nfds && nown)
+				cap = ncap;
+		}
+
+/* nothing to poll with yet, the sessions will be picked up on a retry */
+		if (!cap){
+			pthread_mutex_unlock(&sched.lock);
+			poll(NULL, 0, XLT_BACKOFF_MS);
+			continue;
+		}
+
+		size_t n = 0;
+		int timeout = -1;
+		uint64_t now = now_ms();
+		fds[n++] = (struct pollfd){.fd = sched.ctl[0], .events = POLLIN};
+
+		for (struct xlt_session* s = sched.sessions; s; s = s->next){
+			if (s->state != SESS_IDLE)
+				continue;
+
+			if (s->update.deferred){
+				if (now >= s->update.retry_at){
+					sched_queue(s);
+					continue;
+				}
+				int left = s->update.retry_at - now;
+				timeout = timeout == -1 || left < timeout ? left : timeout;
+			}
+
+			if (n + 3 > cap)
+				break;
+
+			owner[n] = s;
+			fds[n++] = (struct pollfd){.fd = s->in.epipe, .events = pollev};
+
+			if (s->wake[0] != -1){
+				owner[n] = s;
+				fds[n++] = (struct pollfd){.fd = s->wake[0], .events = POLLIN};
+			}
+
+			if (s->olay.addr){
+				owner[n] = s;
+				fds[n++] = (struct pollfd){.fd = s->olay.epipe, .events = pollev};
+			}
+		}
+		pthread_mutex_unlock(&sched.lock);
+
+		if (-1 == poll(fds, n, timeout)){
+			if (errno != EINTR)
+				poll(NULL, 0, XLT_BACKOFF_MS);
+			continue;
+		}
+
+		if (fds[0].revents & POLLIN){
+			uint8_t buf[64];
+			while (read(sched.ctl[0], buf, sizeof(buf)) > 0);
+		}
+
+/* only the dispatcher moves sessions out of idle, so [owner] is still
+ * valid here even though the lock was released */
+		pthread_mutex_lock(&sched.lock);
+		for (size_t i = 1; i < n; i++){
+			struct xlt_session* s = owner[i];
+			if (!fds[i].revents || s->state != SESS_IDLE)
+				continue;
+
+			if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)){
+				if (fds[i].fd == s->in.epipe)
+					s->dead = true;
+				else if (s->olay.addr && fds[i].fd == s->olay.epipe)
+					s->olay_lost = true;
+			}
+
+			sched_queue(s);
+		}
+		pthread_mutex_unlock(&sched.lock);
+	}
 
 	return NULL;
 }
 
+static bool sched_setup()
+{
+	if (sched.running)
+		return true;
+
+	if (-1 == pipe(sched.ctl))
+		return false;
+
+	for (size_t i = 0; i < 2; i++){
+		fcntl(sched.ctl[i], F_SETFD, FD_CLOEXEC);
+		fcntl(sched.ctl[i], F_SETFL, O_NONBLOCK);
+	}
+
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t lim = ncpu > 1 ? ncpu : 1;
+	if (lim > XLT_MAXWORKERS)
+		lim = XLT_MAXWORKERS;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+
+	pthread_t pth;
+	for (; sched.n_workers < lim; sched.n_workers++)
+		if (0 != pthread_create(&pth, &attr, sched_worker, NULL))
+			break;
+
+	if (!sched.n_workers || 0 != pthread_create(&pth, &attr, sched_dispatch, NULL)){
+		pthread_attr_destroy(&attr);
+		return false;
+	}
+
+	pthread_attr_destroy(&attr);
+	sched.running = true;
+	return true;
+}
+
+/* the first pass is queued right away, there may already be events */
+static bool sched_add(struct xlt_session* sess)
+{
+	if (!sched_setup())
+		return false;
+
+	session_start(sess);
+
+	pthread_mutex_lock(&sched.lock);
+	sess->next = sched.sessions;
+	sched.sessions = sess;
+	sched.n_sessions++;
+	sched_queue(sess);
+	pthread_mutex_unlock(&sched.lock);
+
+	sched_notify();
+	return true;
+}
+
 static void setup_session(struct xlt_context* ctx, struct xlt_session* sess)
 {
 	memset(sess, '\0', sizeof(struct xlt_session));
@@ -324,6 +826,8 @@ static void setup_session(struct xlt_context* ctx, struct xlt_session* sess)
 	sess->overlay = ctx->overlay;
 	sess->overlay_input = ctx->overlay_input;
 	sess->flags = ctx->flags;
+	sess->wake[0] = sess->wake[1] = -1;
+	stage_init(&sess->stages);
 }
 
 struct xlt_context* xlt_open(const char* ident,
@@ -391,11 +895,9 @@ static bool process_event(struct xlt_context* ctx, arcan_event* ev)
 
 /* sweet spot for attempting fork + seccmp-bpf */
 	if (pending->in.addr && pending->out.addr){
-		pthread_t pth;
-
 		pending->unpack_sz = pending->pack_sz * pending->in.w * pending->in.h;
-		if (-1 == pthread_create(&pth, NULL, process, pending)){
-			fprintf(stderr, "couldn't spawn translation thread, giving up.\n");
+		if (!sched_add(pending)){
+			fprintf(stderr, "couldn't spawn translation threads, giving up.\n");
 			return false;
 		}
 
@@ -13,14 +13,15 @@ end
 
 -- NOTE: probably better to just glob the folder..
 local tools = {
-	"histogram.lua"
+	"histogram.lua",
+	"stagetime.lua"
 };
 
 -- each tool returns its own menu entr(ies, y)
 local tools_list = {};
 local function scan()
 	for _,v in ipairs(tools) do
-		local fun = system_load(prefix .. "senseye/histogram.lua", false);
+		local fun = system_load(prefix .. "senseye/" .. v, false);
 		if not fun then
 			error_function("failed to open/parse " .. v);
 		else
@@ -43,84 +43,113 @@ local histwnd_menu = {
 }
 };
 
+-- the sensor sends its statistics as a header message followed by hex
+-- encoded multipart messages (see send_stats in rwstat.c), reassemble
+-- them into header and payload
+local function stats_message(ctx, tbl)
+	if (not ctx.hdr) then
+		if (type(tbl.message) ~= "string" or
+			string.sub(tbl.message, 1, 6) ~= "stats_") then
+			return;
+		end
+		ctx.hdr = tbl.message;
+		ctx.parts = {};
+	else
+		table.insert(ctx.parts, tbl.message);
+	end
+
+	if (tbl.multipart) then
+		return;
+	end
+
+	local hdr = ctx.hdr;
+	ctx.hdr = nil;
+	return hdr, table.concat(ctx.parts, "");
+end
+
+local function hex_bytes(str)
+	local res = {};
+	for i=1,#str-1,2 do
+		table.insert(res, tonumber(string.sub(str, i, i+1), 16) or 0);
+	end
+	return res;
+end
+
+-- the sensor keeps the histogram itself, so instead of reading back and
+-- processing the window contents, ask for the statistics stream and
+-- update the histogram surface from that
 local
 function build_histogram(wnd)
-	print("build new histogram");
-	if (valid_vid(wnd.external, TYPE_FRAMESERVER)) then
-		target_verbose(wnd.external, true);
+	if (not valid_vid(wnd.external, TYPE_FRAMESERVER)) then
+		return;
 	end
 
-	local vid = null_surface(1, 1);
-	image_sharestorage(wnd.canvas, vid);
-	local props = image_storage_properties(vid);
-	local ibuf = alloc_surface(props.width, props.height);
+	target_verbose(wnd.external, true);
+	local set_stats = function(on)
+		if (valid_vid(wnd.external, TYPE_FRAMESERVER)) then
+			target_input(wnd.external, {
+				kind = "digital", label = on and "STATS_ON" or "STATS_OFF",
+				active = true, devid = 0, subid = 0
+			});
+		end
+	end
 
 -- hgram will be used for the data-store where we impose the histogram
 	local hgram = fill_surface(256, 1, 0, 0, 0, 256, 1);
+	local ctx = {};
+
+-- the sensor sends one set of statistics per request, stats_ptn is the
+-- last message of a set so ask for the next one from there
+	local update = function(wnd, source, tbl)
+		local hdr, payload = stats_message(ctx, tbl);
+		if (hdr and string.sub(hdr, 1, 10) == "stats_ptn:") then
+			set_stats(true);
+			return;
+		end
 
--- 1. resize handler that synchs storage and texture coordinates
-	local synch = function()
-		local nprops = image_storage_properties(vid);
-		local rprops = image_surface_resolve(wnd.canvas);
-		local csz = image_storage_properties(ibuf);
-
-		local dw = math.min(nprops.width, rprops.width);
-		local dh = math.min(nprops.height, rprops.height);
-
--- optimization, since there are many possible scalemodes and other options,
--- pick whatever is smallest, the size of the window or the size of the storage
-		if (dw ~= csz.width or dh ~= csz.height) then
-			image_resize_storage(ibuf, dw, dh);
-			resize_image(vid, dw, dh);
-			active_display():message(string.format("resized to %d %d", dw, dh));
+		if (not hdr or string.sub(hdr, 1, 12) ~= "stats_hgram:") then
+			return;
+		end
+
+		local bins = hex_bytes(payload);
+		if (#bins ~= 256) then
+			return;
 		end
-		local txcos = image_get_txcos(wnd.canvas);
-		image_set_txcos(vid, txcos);
-		rendertarget_forceupdate(ibuf);
-		stepframe_target(ibuf);
-	end
 
--- 2. synch updates to when the provider receives a frame
-	local update = function()
-		rendertarget_forceupdate(ibuf);
-		stepframe_target(ibuf);
+		local px = {};
+		for i=1,256 do
+			local v = bins[i];
+			px[#px+1] = v;
+			px[#px+1] = v;
+			px[#px+1] = v;
+		end
+
+		local vid = raw_surface(256, 1, 3, px);
+		if (valid_vid(vid)) then
+			image_sharestorage(vid, hgram);
+			delete_image(vid);
+		end
 	end
 
--- bind that histogram to a new window and make sure the source calctarget
--- is destroyed when the window is tied to the life of the window
--- also make sure to drop any resize handler on the main window as they
+-- bind that histogram to a new window and make sure to stop the stream
+-- and drop the handler on the main window when it goes away, as they
 -- can be deleted independently
 	local hwnd = active_display():add_window(hgram, {scalemode = "stretch"});
 	hwnd:add_handler("destroy", function()
-		if (wnd.drop_handler) then
-			wnd:drop_handler("resize", synch);
-			wnd:drop_dispatch("frame", update);
+		if (wnd.drop_dispatch) then
+			wnd:drop_dispatch("message", update);
 		end
+		set_stats(false);
 	end);
 	hwnd.hgram = {
-		limit_w = MAX_SURFACEW,
-		limit_h = MAX_SURFACEH,
-		method = HISTOGRAM_MERGE_NOALPHA,
-		synch = synch,
 		update = update
 	};
 	hwnd.clipboard_block = true;
 	hwnd.menu_state_disabled = true;
 	hwnd.actions = histwnd_menu;
 
-	wnd:add_handler("resize", synch);
-	wnd:add_dispatch("frame", update);
-
--- finally set up the offscreen readback process that also calculates the hgram
-	define_calctarget(ibuf, {vid},
-		RENDERTARGET_DETACH, RENDERTARGET_NOSCALE, 0,
-		function(tbl, w, h)
-			tbl:histogram_impose(hgram, hwnd.hgram.method, true);
--- FIXME: it is here we can match against reference histograms and notify
--- which distributions that actually match
-		end
-	);
-	show_image({vid});
+	wnd:add_dispatch("message", update);
+	set_stats(true);
 end
 
 return {
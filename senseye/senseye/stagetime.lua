@@ -0,0 +1,124 @@
+-- live per-stage cost overlay, fed by the senseye_stage: messages that the
+-- senses send when built with SENSEYE_STAGETIME and started with the
+-- SENSEYE_STAGETIME environment variable set.
+--
+-- message format (all times in microseconds):
+-- senseye_stage:name:count:avg:p50:p99:max
+
+local function parse_stage(msg)
+	if (type(msg) ~= "string" or string.sub(msg, 1, 14) ~= "senseye_stage:") then
+		return;
+	end
+
+	local fields = string.split(string.sub(msg, 15), ":");
+	if (#fields ~= 6) then
+		return;
+	end
+
+	local res = {name = fields[1]};
+	for i,k in ipairs({"count", "avg", "p50", "p99", "max"}) do
+		res[k] = tonumber(fields[i+1]);
+		if (not res[k]) then
+			return;
+		end
+	end
+	return res;
+end
+
+local function overlay_text(stages)
+	local lst = {};
+	for k,_ in pairs(stages) do
+		table.insert(lst, k);
+	end
+	table.sort(lst);
+
+	local res = {"\\f,0\\#ffffff"};
+	for _,k in ipairs(lst) do
+		local v = stages[k];
+		table.insert(res, string.format(
+			"%-8s %6d avg %8.1f p50 %8.1f p99 %8.1f max %8.1f\\n\\r",
+			k, v.count, v.avg, v.p50, v.p99, v.max)
+		);
+	end
+	return table.concat(res, "");
+end
+
+local function update_overlay(wnd)
+	local st = wnd.senseye_stagetime;
+	if (valid_vid(st.vid)) then
+		delete_image(st.vid);
+		st.vid = nil;
+	end
+
+	local vid = render_text(overlay_text(st.stages));
+	if (not valid_vid(vid)) then
+		return;
+	end
+
+	link_image(vid, wnd.canvas);
+	image_inherit_order(vid, true);
+	order_image(vid, 1);
+	image_mask_set(vid, MASK_UNPICKABLE);
+	show_image(vid);
+	st.vid = vid;
+end
+
+local function drop_overlay(wnd)
+	local st = wnd.senseye_stagetime;
+	if (not st) then
+		return;
+	end
+
+	if (valid_vid(st.vid)) then
+		delete_image(st.vid);
+	end
+	if (wnd.drop_dispatch) then
+		wnd:drop_dispatch("message", st.message);
+	end
+	wnd.senseye_stagetime = nil;
+end
+
+local function build_overlay(wnd)
+	if (valid_vid(wnd.external, TYPE_FRAMESERVER)) then
+		target_verbose(wnd.external, true);
+	end
+
+	local st = {
+		stages = {}
+	};
+
+-- only redraw when the set of messages has been refreshed, the senses send
+-- all stages back to back once every export period
+	st.message = function(wnd, source, tbl)
+		local ent = parse_stage(tbl.message);
+		if (not ent) then
+			return;
+		end
+		if (st.stages[ent.name]) then
+			update_overlay(wnd);
+			st.stages = {};
+		end
+		st.stages[ent.name] = ent;
+	end
+
+	wnd.senseye_stagetime = st;
+	wnd:add_dispatch("message", st.message);
+	wnd:add_handler("destroy", function()
+		drop_overlay(wnd);
+	end);
+end
+
+return {
+	name = "stagetime",
+	label = "Stage Timing",
+	description = "Toggle an overlay with the per-stage processing cost",
+	kind = "action",
+	handler = function()
+		local wnd = active_display().selected;
+		if (wnd.senseye_stagetime) then
+			drop_overlay(wnd);
+		else
+			build_overlay(wnd);
+		end
+	end
+};